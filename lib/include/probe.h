@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: LGPL-2.1+ */
+/* Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org> */
+#ifndef __PROBE_H
+#define __PROBE_H
+
+/*
+ * Static probe points, USDT probes when the systemtap sdt header is
+ * available, otherwise nothing. A disabled USDT probe is a nop
+ * instruction but its arguments are still computed: pass the values
+ * at hand, eg. a pointer to a netlink attribute rather than its
+ * decoded content, and let the probe consumer dereference them.
+ *
+ * PROBE2(thermal, event, cmd, tz_id);
+ *
+ * The probes are listed with 'readelf -n <binary>' and used with
+ * 'bpftrace -p <pid> -e "usdt:*:thermal:event { ... }"' or 'perf probe
+ * sdt_thermal:event' once the binary is added to the perf buildid
+ * cache. Define PROBE_DISABLE to build without the probes.
+ */
+#if !defined(PROBE_DISABLE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_SDT
+#endif
+#endif
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define PROBE0(provider, name)					\
+	STAP_PROBE(provider, name)
+#define PROBE1(provider, name, a1)				\
+	STAP_PROBE1(provider, name, a1)
+#define PROBE2(provider, name, a1, a2)				\
+	STAP_PROBE2(provider, name, a1, a2)
+#define PROBE3(provider, name, a1, a2, a3)			\
+	STAP_PROBE3(provider, name, a1, a2, a3)
+#define PROBE4(provider, name, a1, a2, a3, a4)			\
+	STAP_PROBE4(provider, name, a1, a2, a3, a4)
+#else
+/*
+ * The arguments are not evaluated, they are only referenced to not
+ * leave unused variables
+ */
+#define PROBE0(provider, name)					\
+	do { } while (0)
+#define PROBE1(provider, name, a1)				\
+	do { if (0) { (void)(a1); } } while (0)
+#define PROBE2(provider, name, a1, a2)				\
+	do { if (0) { (void)(a1); (void)(a2); } } while (0)
+#define PROBE3(provider, name, a1, a2, a3)			\
+	do { if (0) { (void)(a1); (void)(a2); (void)(a3); } } while (0)
+#define PROBE4(provider, name, a1, a2, a3, a4)			\
+	do { if (0) { (void)(a1); (void)(a2); (void)(a3); (void)(a4); } } while (0)
+#endif
+
+#endif
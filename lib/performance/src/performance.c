@@ -11,8 +11,10 @@
 #include <sys/sysinfo.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "performance.h"
+#include "probe.h"
 
 #define SYS_CLASS_DEVFREQ		"/sys/class/devfreq"
 #define SYS_DEVICE_SYSTEM_CPU		"/sys/devices/system/cpu"
@@ -34,7 +36,14 @@
 
 #define CPU_DMA_LATENCY_DEV		"/dev/cpu_dma_latency"
 
+/*
+ * The devices table is not modified once the handler is created and
+ * the device attributes are accessed with a single pread / pwrite, so
+ * the handler can be used from several threads. The global latency
+ * file descriptor is shared by all of them and protected by a lock.
+ */
 static int cpu_dma_latency_fd = -1;
+static pthread_mutex_t cpu_dma_latency_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*
  * The opening of a file is the most costly operation with files. So
@@ -81,17 +90,19 @@ struct performance_handler {
 static int set_device_perf(struct performance_handler *handler,
 			   int id, perf_type_t perf_type, int value)
 {
-	int len = 128;
+	int len = 128, ret;
 	char value_str[len];
 
 	len = snprintf(value_str, len - 1, "%d\n", value);
 	if (len < 0)
 		return -1;
 
-	if (pwrite(handler->dev_sysfs_perfs[id].fds[perf_type], value_str, len, 0) < 0)
-		return -1;
+	ret = pwrite(handler->dev_sysfs_perfs[id].fds[perf_type],
+		     value_str, len, 0) < 0 ? -1 : 0;
 
-	return 0;
+	PROBE4(performance, set_perf, id, perf_type, value, ret);
+
+	return ret;
 }
 
 static int get_device_perf(struct performance_handler *handler,
@@ -163,40 +174,45 @@ int performance_get_device_frequency(struct performance_handler *handler, int id
 
 int performance_set_global_latency(int latency_us)
 {
-	int ret;
+	int ret = 0;
+
+	pthread_mutex_lock(&cpu_dma_latency_lock);
 
 	if (latency_us == INT_MAX) {
 		close(cpu_dma_latency_fd);
 		cpu_dma_latency_fd = -1;
-		return 0;
+		goto out;
 	}
 
 	if (cpu_dma_latency_fd == -1) {
 		cpu_dma_latency_fd = open(CPU_DMA_LATENCY_DEV, O_CLOEXEC | O_RDWR);
-		if (cpu_dma_latency_fd < 0)
-			return -1;
+		if (cpu_dma_latency_fd < 0) {
+			ret = -1;
+			goto out;
+		}
 	}
 
-	ret = pwrite(cpu_dma_latency_fd, &latency_us, sizeof(latency_us), 0);
-	if (ret < 0) {
+	if (pwrite(cpu_dma_latency_fd, &latency_us, sizeof(latency_us), 0) < 0) {
 		close(cpu_dma_latency_fd);
 		cpu_dma_latency_fd = -1;
 	}
+out:
+	pthread_mutex_unlock(&cpu_dma_latency_lock);
 
-	return 0;
+	return ret;
 }
 
 int performance_get_global_latency(void)
 {
-	int latency_us;
-	int ret;
+	int latency_us = INT_MAX;
+
+	pthread_mutex_lock(&cpu_dma_latency_lock);
 
-	if (cpu_dma_latency_fd == -1)
-		return INT_MAX;
+	if (cpu_dma_latency_fd != -1 &&
+	    pread(cpu_dma_latency_fd, &latency_us, sizeof(latency_us), 0) < 0)
+		latency_us = -1;
 
-	ret = pread(cpu_dma_latency_fd, &latency_us, sizeof(latency_us), 0);
-	if (ret < 0)
-		return ret;
+	pthread_mutex_unlock(&cpu_dma_latency_lock);
 
 	return latency_us;
 }
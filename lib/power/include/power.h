@@ -12,6 +12,15 @@ extern "C" {
 #endif
 	struct power_handler;
 
+	/*
+	 * A zero power restores the limit the dtpm had when the
+	 * handler was created
+	 */
+	struct power_limit_request {
+		int id;
+		unsigned int power_mw;
+	};
+
 	int power_limit_set(struct power_handler *handler, const char *name,
 			    unsigned int constraint, unsigned int power_mw);
 
@@ -24,6 +33,17 @@ extern "C" {
 	int power_usage_get(struct power_handler *handler, const char *name,
 			    unsigned int constraint);
 
+	/*
+	 * The dtpm id is resolved once and used in the requests, the
+	 * limits already set are not written again
+	 */
+	int power_dtpm_id(struct power_handler *handler, const char *name);
+
+	int power_dtpm_max(struct power_handler *handler, int id);
+
+	int power_limits_set(struct power_handler *handler,
+			     struct power_limit_request *req, int nr);
+
 	int power_for_each(struct power_handler *handler,
 			   int (*cb)(const char *name, void *data), void *data);
 	
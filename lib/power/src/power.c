@@ -2,27 +2,46 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <regex.h>
 
 #include "power.h"
+#include "probe.h"
 
 #define DTPM_PATH "/sys/class/powercap"
 
+/*
+ * 'limit_uw' is the last limit written, a request for the same limit
+ * is not written again. 'initial_uw' is the limit found when the
+ * handler was created, it is restored by a zero power request.
+ */
 struct dtpm {
 	struct dtpm *next;
 	unsigned int hash;
 	char *name;
+	int id;
 	int set_power_fd;
 	int get_power_fd;
+	unsigned long limit_uw;
+	unsigned long initial_uw;
+	unsigned long max_uw;
 };
 
+/*
+ * The dtpm are also indexed by their id, the lock serializes the
+ * limit updates and the cached limits
+ */
 struct power_handler {
 	struct dtpm *dtpm;
+	struct dtpm **dtpms;
+	int nr_dtpms;
+	pthread_mutex_t lock;
 };
 
 #define for_each_dtpm(__dtpm__, __iter__) \
@@ -46,13 +65,66 @@ static struct dtpm *power_dtpm_find(struct power_handler *handler,
 	struct dtpm *dtpm;
 
 	for_each_dtpm(handler->dtpm, dtpm) {
-		if (dtpm->hash == hash)
+		if (dtpm->hash == hash && !strcmp(dtpm->name, name))
 			return dtpm;
 	}
 
 	return NULL;
 }
 
+/*
+ * The powercap sysfs files contain the values in micro watts as text
+ */
+static int power_read_uw(int fd, unsigned long *power_uw)
+{
+	char buffer[32], *end;
+	ssize_t len;
+
+	len = pread(fd, buffer, sizeof(buffer) - 1, 0);
+	if (len <= 0)
+		return -1;
+
+	buffer[len] = '\0';
+
+	*power_uw = strtoul(buffer, &end, 10);
+
+	return end == buffer ? -1 : 0;
+}
+
+static int power_write_uw(int fd, unsigned long power_uw)
+{
+	char buffer[32];
+	int len;
+
+	len = snprintf(buffer, sizeof(buffer), "%lu\n", power_uw);
+
+	return pwrite(fd, buffer, len, 0) != len ? -1 : 0;
+}
+
+/*
+ * Returns 1 if the limit was written, 0 if the dtpm already has this
+ * limit and the write was skipped, -1 on error
+ */
+static int __power_limit_set(struct dtpm *dtpm, unsigned int power_mw)
+{
+	unsigned long power_uw = power_mw ? power_mw * 1000UL : dtpm->initial_uw;
+	int ret;
+
+	if (power_uw == dtpm->limit_uw)
+		return 0;
+
+	ret = power_write_uw(dtpm->set_power_fd, power_uw);
+
+	PROBE3(power, limit_set, dtpm->name, power_mw, ret);
+
+	if (ret)
+		return -1;
+
+	dtpm->limit_uw = power_uw;
+
+	return 1;
+}
+
 int power_limit_get(struct power_handler *handler, const char *name,
 		    unsigned int constraint)
 {
@@ -63,31 +135,37 @@ int power_limit_get(struct power_handler *handler, const char *name,
 	if (!dtpm)
 		return -1;
 
-	if (pread(dtpm->get_power_fd, &power_uw,
-		  sizeof(power_uw), 0) != sizeof(power_uw))
+	if (power_read_uw(dtpm->set_power_fd, &power_uw))
 		return -1;
-	
+
 	return power_uw / 1000;
 }
-	
+
+/*
+ * Returns the limit read back, the kernel clamps it to the power range
+ * of the dtpm. A zero power restores the initial limit.
+ */
 int power_limit_set(struct power_handler *handler, const char *name,
 		    unsigned int constraint, unsigned int power_mw)
 {
 	struct dtpm *dtpm;
-	unsigned long power_uw = power_mw * 1000;
+	unsigned long power_uw;
+	int ret;
 
 	dtpm = power_dtpm_find(handler, name);
 	if (!dtpm)
 		return -1;
 
-	if (pwrite(dtpm->set_power_fd, &power_uw,
-		   sizeof(power_uw), 0) != sizeof(power_uw))
+	pthread_mutex_lock(&handler->lock);
+	ret = __power_limit_set(dtpm, power_mw);
+	pthread_mutex_unlock(&handler->lock);
+
+	if (ret < 0)
 		return -1;
 
-	if (pread(dtpm->get_power_fd, &power_uw,
-		  sizeof(power_uw), 0) != sizeof(power_uw))
+	if (power_read_uw(dtpm->set_power_fd, &power_uw))
 		return -1;
-	
+
 	return power_uw / 1000;
 }
 
@@ -97,6 +175,40 @@ int power_limit_reset(struct power_handler *handler, const char *name,
 	return power_limit_set(handler, name, constraint, 0);
 }
 
+/*
+ * Set the limits of several dtpm. All the requests are processed even
+ * if one fails. Returns the number of writes issued or -1 if one of
+ * the requests failed.
+ */
+int power_limits_set(struct power_handler *handler,
+		     struct power_limit_request *req, int nr)
+{
+	int i, ret, writes = 0, error = 0;
+
+	if (!handler || !req)
+		return -1;
+
+	pthread_mutex_lock(&handler->lock);
+
+	for (i = 0; i < nr; i++) {
+
+		if (req[i].id < 0 || req[i].id >= handler->nr_dtpms) {
+			error = -1;
+			continue;
+		}
+
+		ret = __power_limit_set(handler->dtpms[req[i].id], req[i].power_mw);
+		if (ret < 0)
+			error = -1;
+		else
+			writes += ret;
+	}
+
+	pthread_mutex_unlock(&handler->lock);
+
+	return error ? error : writes;
+}
+
 int power_usage_get(struct power_handler *handler, const char *name,
 		    unsigned int constraint)
 {
@@ -107,19 +219,35 @@ int power_usage_get(struct power_handler *handler, const char *name,
 	if (!dtpm)
 		return -1;
 
-	if (pread(dtpm->get_power_fd, &power_uw,
-		  sizeof(power_uw), 0) != sizeof(power_uw))
+	if (power_read_uw(dtpm->get_power_fd, &power_uw))
 		return -1;
 
 	return power_uw / 1000;
 }
 
+int power_dtpm_id(struct power_handler *handler, const char *name)
+{
+	struct dtpm *dtpm;
+
+	dtpm = power_dtpm_find(handler, name);
+
+	return dtpm ? dtpm->id : -1;
+}
+
+int power_dtpm_max(struct power_handler *handler, int id)
+{
+	if (id < 0 || id >= handler->nr_dtpms || !handler->dtpms[id]->max_uw)
+		return -1;
+
+	return handler->dtpms[id]->max_uw / 1000;
+}
+
 static int power_dtpm_init(struct dtpm *dtpm, int dirfd, const char *dirname)
 {
 	struct stat s;
 	FILE *file;
 	char *buffer;
-	int fd, ret = -1;
+	int fd, fd_max, ret = -1;
 
 	buffer = malloc(PATH_MAX);
 	if (!buffer)
@@ -147,11 +275,30 @@ static int power_dtpm_init(struct dtpm *dtpm, int dirfd, const char *dirname)
 
 	dtpm->hash = hash_string(dtpm->name);
 
+	/*
+	 * Without the permission to change the limit, the dtpm can
+	 * still be monitored
+	 */
 	snprintf(buffer, PATH_MAX, "%s/constraint_0_power_limit_uw", dirname);
-	dtpm->set_power_fd = openat(dirfd, buffer, 0);
+	dtpm->set_power_fd = openat(dirfd, buffer, O_RDWR | O_CLOEXEC);
+	if (dtpm->set_power_fd < 0)
+		dtpm->set_power_fd = openat(dirfd, buffer, O_RDONLY | O_CLOEXEC);
 	if (dtpm->set_power_fd < 0)
 		goto out_fclose;
 
+	if (power_read_uw(dtpm->set_power_fd, &dtpm->initial_uw))
+		dtpm->initial_uw = 0;
+
+	dtpm->limit_uw = dtpm->initial_uw;
+
+	snprintf(buffer, PATH_MAX, "%s/constraint_0_max_power_uw", dirname);
+	fd_max = openat(dirfd, buffer, O_RDONLY | O_CLOEXEC);
+	if (fd_max < 0 || power_read_uw(fd_max, &dtpm->max_uw))
+		dtpm->max_uw = 0;
+
+	if (fd_max >= 0)
+		close(fd_max);
+
 	snprintf(buffer, PATH_MAX, "%s/power_uw", dirname);
 	dtpm->get_power_fd = openat(dirfd, buffer, 0);
 	if (dtpm->get_power_fd < 0) {
@@ -191,11 +338,18 @@ static int power_dtpm_initialize(struct power_handler *handler)
 	 */
 	while ((dirent = readdir(dir))) {
 
+		struct dtpm **dtpms;
 		struct dtpm *dtpm;
 		
 		if (regexec(&regex, dirent->d_name, 0, NULL, 0) == REG_NOMATCH)
 			continue;
 
+		dtpms = realloc(handler->dtpms, sizeof(*dtpms) * (handler->nr_dtpms + 1));
+		if (!dtpms)
+			return -1;
+
+		handler->dtpms = dtpms;
+
 		dtpm = malloc(sizeof(*dtpm));
 		if (!dtpm)
 			return -1;
@@ -203,6 +357,9 @@ static int power_dtpm_initialize(struct power_handler *handler)
 		if (power_dtpm_init(dtpm, dirfd(dir), dirent->d_name))
 			return -1;
 
+		dtpm->id = handler->nr_dtpms;
+		dtpms[handler->nr_dtpms++] = dtpm;
+
 		dtpm->next = handler->dtpm;
 		handler->dtpm = dtpm;
 	}
@@ -234,17 +391,34 @@ struct power_handler *power_create(void)
 	if (!handler)
 		return NULL;
 
+	pthread_mutex_init(&handler->lock, NULL);
+
 	if (power_dtpm_initialize(handler))
 		goto out_free;
 
 	return handler;
 
 out_free:
-	free(handler);
+	power_destroy(handler);
 	return NULL;
 }
 
 void power_destroy(struct power_handler *power)
 {
+	struct dtpm *dtpm, *next;
+
+	if (!power)
+		return;
+
+	for (dtpm = power->dtpm; dtpm; dtpm = next) {
+		next = dtpm->next;
+		close(dtpm->set_power_fd);
+		close(dtpm->get_power_fd);
+		free(dtpm->name);
+		free(dtpm);
+	}
+
+	pthread_mutex_destroy(&power->lock);
+	free(power->dtpms);
 	free(power);
 }
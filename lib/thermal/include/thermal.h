@@ -5,6 +5,37 @@
 
 #include <linux/thermal.h>
 
+/*
+ * The userspace thresholds were added in Linux 6.13, define the
+ * netlink values when the kernel headers are older
+ */
+#ifndef THERMAL_THRESHOLD_WAY_UP
+#define THERMAL_THRESHOLD_WAY_UP			0x1
+#define THERMAL_THRESHOLD_WAY_DOWN			0x2
+
+#define THERMAL_GENL_ATTR_THRESHOLD			(THERMAL_GENL_ATTR_CPU_CAPABILITY_EFFICIENCY + 1)
+#define THERMAL_GENL_ATTR_THRESHOLD_TEMP		(THERMAL_GENL_ATTR_CPU_CAPABILITY_EFFICIENCY + 2)
+#define THERMAL_GENL_ATTR_THRESHOLD_DIRECTION		(THERMAL_GENL_ATTR_CPU_CAPABILITY_EFFICIENCY + 3)
+#define THERMAL_GENL_ATTR_TZ_PREV_TEMP			(THERMAL_GENL_ATTR_CPU_CAPABILITY_EFFICIENCY + 4)
+#undef THERMAL_GENL_ATTR_MAX
+#define THERMAL_GENL_ATTR_MAX				THERMAL_GENL_ATTR_TZ_PREV_TEMP
+
+#define THERMAL_GENL_EVENT_THRESHOLD_ADD		(THERMAL_GENL_EVENT_CPU_CAPABILITY_CHANGE + 1)
+#define THERMAL_GENL_EVENT_THRESHOLD_DELETE		(THERMAL_GENL_EVENT_CPU_CAPABILITY_CHANGE + 2)
+#define THERMAL_GENL_EVENT_THRESHOLD_FLUSH		(THERMAL_GENL_EVENT_CPU_CAPABILITY_CHANGE + 3)
+#define THERMAL_GENL_EVENT_THRESHOLD_UP			(THERMAL_GENL_EVENT_CPU_CAPABILITY_CHANGE + 4)
+#define THERMAL_GENL_EVENT_THRESHOLD_DOWN		(THERMAL_GENL_EVENT_CPU_CAPABILITY_CHANGE + 5)
+#undef THERMAL_GENL_EVENT_MAX
+#define THERMAL_GENL_EVENT_MAX				THERMAL_GENL_EVENT_THRESHOLD_DOWN
+
+#define THERMAL_GENL_CMD_THRESHOLD_GET			(THERMAL_GENL_CMD_CDEV_GET + 1)
+#define THERMAL_GENL_CMD_THRESHOLD_ADD			(THERMAL_GENL_CMD_CDEV_GET + 2)
+#define THERMAL_GENL_CMD_THRESHOLD_DELETE		(THERMAL_GENL_CMD_CDEV_GET + 3)
+#define THERMAL_GENL_CMD_THRESHOLD_FLUSH		(THERMAL_GENL_CMD_CDEV_GET + 4)
+#undef THERMAL_GENL_CMD_MAX
+#define THERMAL_GENL_CMD_MAX				THERMAL_GENL_CMD_THRESHOLD_FLUSH
+#endif
+
 #ifndef LIBTHERMAL_API
 #define LIBTHERMAL_API __attribute__((visibility("default")))
 #endif
@@ -17,6 +48,16 @@ struct thermal_sampling_ops {
 	int (*tz_temp)(int tz_id, int temp, void *arg);
 };
 
+/*
+ * The performance and efficiency capabilities of a CPU, from 0 to
+ * 1023, as reported by the hardware feedback interface
+ */
+struct thermal_cpu_capability {
+	int cpu;
+	int performance;
+	int efficiency;
+};
+
 struct thermal_events_ops {
 	int (*tz_create)(const char *name, int tz_id, void *arg);
 	int (*tz_delete)(int tz_id, void *arg);
@@ -31,6 +72,12 @@ struct thermal_events_ops {
 	int (*cdev_delete)(int cdev_id, void *arg);
 	int (*cdev_update)(int cdev_id, int cur_state, void *arg);
 	int (*gov_change)(int tz_id, const char *gov_name, void *arg);
+	int (*threshold_add)(int tz_id, int temperature, int direction, void *arg);
+	int (*threshold_delete)(int tz_id, int temperature, int direction, void *arg);
+	int (*threshold_flush)(int tz_id, void *arg);
+	int (*threshold_up)(int tz_id, int temp, int prev_temp, void *arg);
+	int (*threshold_down)(int tz_id, int temp, int prev_temp, void *arg);
+	int (*cpu_capability_change)(struct thermal_cpu_capability *cap, int nr, void *arg);
 };
 
 struct thermal_ops {
@@ -45,12 +92,37 @@ struct thermal_trip {
 	int hyst;
 };
 
+/*
+ * Temperature trend estimator: an exponentially weighted moving
+ * average of the temperature slope, fed with the temperature samples
+ * and their timestamp in milliseconds. 'slope' is the rounded value
+ * of the average kept in fixed point in 'average'.
+ */
+struct thermal_trend {
+	long long timestamp;
+	long long average;
+	int temp;
+	int slope;
+	int samples;
+};
+
+/*
+ * A userspace threshold, the direction is a mask of
+ * THERMAL_THRESHOLD_WAY_UP and THERMAL_THRESHOLD_WAY_DOWN
+ */
+struct thermal_threshold {
+	int temperature;
+	int direction;
+};
+
 struct thermal_zone {
 	int id;
 	int temp;
 	char name[THERMAL_NAME_LENGTH];
 	char governor[THERMAL_NAME_LENGTH];
 	struct thermal_trip *trip;
+	struct thermal_threshold *thresholds;
+	struct thermal_trend trend;
 };
 
 struct thermal_cdev {
@@ -61,6 +133,23 @@ struct thermal_cdev {
 	int cur_state;
 };
 
+/*
+ * Cooling device state statistics, the time in state is in
+ * milliseconds and the array has max_state + 1 entries.
+ */
+struct thermal_cdev_stats {
+	int cur_state;
+	int max_state;
+	long long timestamp;
+	unsigned long total_trans;
+	unsigned long long *time_in_state;
+};
+
+struct thermal_cdev_request {
+	int id;
+	int state;
+};
+
 typedef enum {
 	THERMAL_ERROR = -1,
 	THERMAL_SUCCESS = 0,
@@ -74,19 +163,77 @@ typedef int (*cb_tt_t)(struct thermal_trip *, void *);
 
 typedef int (*cb_tc_t)(struct thermal_cdev *, void *);
 
+typedef int (*cb_th_t)(struct thermal_threshold *, void *);
+
+typedef int (*cb_async_t)(thermal_error_t, void *, void *);
+
 LIBTHERMAL_API int for_each_thermal_zone(struct thermal_zone *tz, cb_tz_t cb, void *arg);
 
 LIBTHERMAL_API int for_each_thermal_trip(struct thermal_trip *tt, cb_tt_t cb, void *arg);
 
 LIBTHERMAL_API int for_each_thermal_cdev(struct thermal_cdev *cdev, cb_tc_t cb, void *arg);
 
+LIBTHERMAL_API int for_each_thermal_threshold(struct thermal_threshold *th, cb_th_t cb, void *arg);
+
 LIBTHERMAL_API struct thermal_zone *thermal_zone_find_by_name(struct thermal_zone *tz,
 							      const char *name);
 
 LIBTHERMAL_API struct thermal_zone *thermal_zone_find_by_id(struct thermal_zone *tz, int id);
 
+LIBTHERMAL_API struct thermal_cdev *thermal_cdev_find_by_id(struct thermal_cdev *cdev, int id);
+
+LIBTHERMAL_API struct thermal_cdev *thermal_cdev_find_by_name(struct thermal_cdev *cdev,
+							      const char *name);
+
 LIBTHERMAL_API struct thermal_zone *thermal_zone_discover(struct thermal_handler *th);
 
+/*
+ * Cooling device state tracking
+ */
+LIBTHERMAL_API thermal_error_t thermal_cdev_stats_init(struct thermal_handler *th,
+						       struct thermal_cdev *cdev);
+
+LIBTHERMAL_API void thermal_cdev_stats_exit(struct thermal_handler *th);
+
+LIBTHERMAL_API thermal_error_t thermal_cdev_stats_get(struct thermal_handler *th, int cdev_id,
+						      struct thermal_cdev_stats *stats);
+
+LIBTHERMAL_API thermal_error_t thermal_cdev_stats_sysfs(int cdev_id,
+							struct thermal_cdev_stats *stats);
+
+/*
+ * Cooling device control, the state tracking must be initialized
+ */
+LIBTHERMAL_API thermal_error_t thermal_cdev_set_state(struct thermal_handler *th,
+						      int cdev_id, int state);
+
+LIBTHERMAL_API int thermal_cdev_set_states(struct thermal_handler *th,
+					   struct thermal_cdev_request *req, int nr);
+
+/*
+ * Writable trip points
+ */
+LIBTHERMAL_API thermal_error_t thermal_trip_set_temp(struct thermal_handler *th,
+						     int tz_id, int trip_id, int temp);
+
+LIBTHERMAL_API thermal_error_t thermal_trip_set_hyst(struct thermal_handler *th,
+						     int tz_id, int trip_id, int hyst);
+
+/*
+ * Temperature trend
+ */
+LIBTHERMAL_API void thermal_trend_init(struct thermal_trend *trend);
+
+LIBTHERMAL_API void thermal_trend_update(struct thermal_trend *trend, int temp,
+					 long long timestamp);
+
+LIBTHERMAL_API int thermal_trend_predict(struct thermal_trend *trend, int delta);
+
+LIBTHERMAL_API int thermal_trend_time_to_temp(struct thermal_trend *trend, int temp);
+
+LIBTHERMAL_API int thermal_zone_time_to_trip(struct thermal_zone *tz,
+					     struct thermal_trip **trip);
+
 LIBTHERMAL_API struct thermal_handler *thermal_init(struct thermal_ops *ops);
 
 LIBTHERMAL_API void thermal_exit(struct thermal_handler *th);
@@ -102,6 +249,15 @@ LIBTHERMAL_API thermal_error_t thermal_events_handle(struct thermal_handler *th,
 
 LIBTHERMAL_API int thermal_events_fd(struct thermal_handler *th);
 
+/*
+ * Number of messages received on the events and sampling sockets and
+ * number of times the socket buffer overflowed, the messages which
+ * did not fit in the buffer are lost
+ */
+LIBTHERMAL_API thermal_error_t thermal_nl_stats(struct thermal_handler *th,
+						unsigned long *received,
+						unsigned long *overruns);
+
 /*
  * Netlink thermal commands
  */
@@ -124,6 +280,54 @@ LIBTHERMAL_API thermal_error_t thermal_cmd_get_governor(struct thermal_handler *
 LIBTHERMAL_API thermal_error_t thermal_cmd_get_temp(struct thermal_handler *th,
 						    struct thermal_zone *tz);
 
+/*
+ * Userspace thresholds, they need a kernel with the thresholds
+ * support and the CAP_SYS_ADMIN capability to be changed
+ */
+LIBTHERMAL_API thermal_error_t thermal_cmd_threshold_get(struct thermal_handler *th,
+							 struct thermal_zone *tz);
+
+LIBTHERMAL_API thermal_error_t thermal_cmd_threshold_add(struct thermal_handler *th,
+							 struct thermal_zone *tz,
+							 int temperature, int direction);
+
+LIBTHERMAL_API thermal_error_t thermal_cmd_threshold_delete(struct thermal_handler *th,
+							    struct thermal_zone *tz,
+							    int temperature, int direction);
+
+LIBTHERMAL_API thermal_error_t thermal_cmd_threshold_flush(struct thermal_handler *th,
+							   struct thermal_zone *tz);
+
+/*
+ * Asynchronous netlink thermal commands: the request is sent and the
+ * function returns immediately. The reply is parsed when the fd
+ * returned by thermal_cmd_async_fd() is readable and
+ * thermal_cmd_async_handle() is called. The callback receives the
+ * parsed object: the thermal zone array, the cooling device array or
+ * the thermal zone passed as parameter.
+ */
+LIBTHERMAL_API thermal_error_t thermal_cmd_async_get_tz(struct thermal_handler *th,
+							cb_async_t cb, void *arg);
+
+LIBTHERMAL_API thermal_error_t thermal_cmd_async_get_cdev(struct thermal_handler *th,
+							  cb_async_t cb, void *arg);
+
+LIBTHERMAL_API thermal_error_t thermal_cmd_async_get_trip(struct thermal_handler *th,
+							  struct thermal_zone *tz,
+							  cb_async_t cb, void *arg);
+
+LIBTHERMAL_API thermal_error_t thermal_cmd_async_get_governor(struct thermal_handler *th,
+							      struct thermal_zone *tz,
+							      cb_async_t cb, void *arg);
+
+LIBTHERMAL_API thermal_error_t thermal_cmd_async_get_temp(struct thermal_handler *th,
+							  struct thermal_zone *tz,
+							  cb_async_t cb, void *arg);
+
+LIBTHERMAL_API thermal_error_t thermal_cmd_async_handle(struct thermal_handler *th);
+
+LIBTHERMAL_API int thermal_cmd_async_fd(struct thermal_handler *th);
+
 /*
  * Netlink thermal samples
  */
@@ -0,0 +1,439 @@
+// SPDX-License-Identifier: LGPL-2.1+
+// Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <thermal.h>
+#include <probe.h>
+#include "thermal_nl.h"
+
+#define SYS_CLASS_THERMAL	"/sys/class/thermal"
+
+/*
+ * The cooling devices are indexed by their id in a table which grows
+ * when a cooling device with a higher id shows up. An entry without
+ * time in state array is not tracked.
+ *
+ * The cur_state file is opened the first time the state is set and
+ * kept opened, it is the most costly operation with sysfs.
+ *
+ * The states can be set from other threads than the one handling the
+ * events, the table is protected by the cdev_lock of the handler.
+ */
+struct thermal_cdev_state {
+	struct thermal_cdev_stats stats;
+	int fd;
+};
+
+static long long thermal_cdev_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static struct thermal_cdev_state *thermal_cdev_state_find(struct thermal_handler *th,
+							  int cdev_id)
+{
+	if (cdev_id < 0 || cdev_id >= th->nr_cdev_state)
+		return NULL;
+
+	if (!th->cdev_state[cdev_id].stats.time_in_state)
+		return NULL;
+
+	return &th->cdev_state[cdev_id];
+}
+
+static int thermal_cdev_state_resize(struct thermal_cdev_stats *stats, int max_state)
+{
+	unsigned long long *time_in_state;
+
+	if (max_state <= stats->max_state && stats->time_in_state)
+		return 0;
+
+	time_in_state = realloc(stats->time_in_state,
+				sizeof(*time_in_state) * (max_state + 1));
+	if (!time_in_state)
+		return -1;
+
+	memset(&time_in_state[stats->max_state + 1], 0,
+	       sizeof(*time_in_state) * (max_state - stats->max_state));
+
+	stats->time_in_state = time_in_state;
+	stats->max_state = max_state;
+
+	return 0;
+}
+
+static void thermal_cdev_stats_account(struct thermal_cdev_stats *stats, long long now)
+{
+	stats->time_in_state[stats->cur_state] += now - stats->timestamp;
+	stats->timestamp = now;
+}
+
+static void __thermal_cdev_stats_add(struct thermal_handler *th, int cdev_id, int max_state)
+{
+	struct thermal_cdev_state *cdev_state;
+	int nr = th->nr_cdev_state;
+
+	if (cdev_id < 0 || max_state < 0)
+		return;
+
+	if (cdev_id >= nr) {
+
+		cdev_state = realloc(th->cdev_state, sizeof(*cdev_state) * (cdev_id + 1));
+		if (!cdev_state)
+			return;
+
+		memset(&cdev_state[nr], 0, sizeof(*cdev_state) * (cdev_id + 1 - nr));
+
+		th->cdev_state = cdev_state;
+		th->nr_cdev_state = cdev_id + 1;
+	}
+
+	cdev_state = &th->cdev_state[cdev_id];
+
+	if (cdev_state->stats.time_in_state && cdev_state->fd >= 0)
+		close(cdev_state->fd);
+
+	free(cdev_state->stats.time_in_state);
+	memset(cdev_state, 0, sizeof(*cdev_state));
+
+	cdev_state->fd = -1;
+
+	/*
+	 * Start with state zero, max_state = -1 makes the resize
+	 * function clear the whole array
+	 */
+	cdev_state->stats.max_state = -1;
+
+	if (thermal_cdev_state_resize(&cdev_state->stats, max_state))
+		return;
+
+	cdev_state->stats.timestamp = thermal_cdev_now();
+}
+
+static void __thermal_cdev_stats_delete(struct thermal_handler *th, int cdev_id)
+{
+	struct thermal_cdev_state *cdev_state;
+
+	cdev_state = thermal_cdev_state_find(th, cdev_id);
+	if (!cdev_state)
+		return;
+
+	if (cdev_state->fd >= 0)
+		close(cdev_state->fd);
+
+	free(cdev_state->stats.time_in_state);
+	memset(cdev_state, 0, sizeof(*cdev_state));
+}
+
+static void __thermal_cdev_stats_update(struct thermal_handler *th, int cdev_id, int cur_state)
+{
+	struct thermal_cdev_state *cdev_state;
+	struct thermal_cdev_stats *stats;
+
+	cdev_state = thermal_cdev_state_find(th, cdev_id);
+	if (!cdev_state || cur_state < 0)
+		return;
+
+	stats = &cdev_state->stats;
+
+	if (stats->cur_state == cur_state)
+		return;
+
+	/*
+	 * The maximum state of a cooling device can change at
+	 * runtime, for instance when a cpufreq policy is updated
+	 */
+	if (thermal_cdev_state_resize(stats, cur_state))
+		return;
+
+	thermal_cdev_stats_account(stats, thermal_cdev_now());
+
+	stats->cur_state = cur_state;
+	stats->total_trans++;
+}
+
+void thermal_cdev_stats_add(struct thermal_handler *th, int cdev_id, int max_state)
+{
+	pthread_mutex_lock(&th->cdev_lock);
+	__thermal_cdev_stats_add(th, cdev_id, max_state);
+	pthread_mutex_unlock(&th->cdev_lock);
+}
+
+void thermal_cdev_stats_delete(struct thermal_handler *th, int cdev_id)
+{
+	pthread_mutex_lock(&th->cdev_lock);
+	__thermal_cdev_stats_delete(th, cdev_id);
+	pthread_mutex_unlock(&th->cdev_lock);
+}
+
+void thermal_cdev_stats_update(struct thermal_handler *th, int cdev_id, int cur_state)
+{
+	pthread_mutex_lock(&th->cdev_lock);
+	__thermal_cdev_stats_update(th, cdev_id, cur_state);
+	pthread_mutex_unlock(&th->cdev_lock);
+}
+
+/*
+ * The statistics are copied in the caller's time in state array of
+ * stats->max_state + 1 entries, the table can be resized by the other
+ * threads once the lock is released.
+ */
+thermal_error_t thermal_cdev_stats_get(struct thermal_handler *th, int cdev_id,
+				       struct thermal_cdev_stats *stats)
+{
+	struct thermal_cdev_state *cdev_state;
+	unsigned long long *time_in_state;
+	int max_state, nr;
+
+	if (!th || !stats || !stats->time_in_state || stats->max_state < 0)
+		return THERMAL_ERROR;
+
+	pthread_mutex_lock(&th->cdev_lock);
+
+	cdev_state = thermal_cdev_state_find(th, cdev_id);
+	if (!cdev_state) {
+		pthread_mutex_unlock(&th->cdev_lock);
+		return THERMAL_ERROR;
+	}
+
+	/*
+	 * Account the time spent in the current state up to now
+	 */
+	thermal_cdev_stats_account(&cdev_state->stats, thermal_cdev_now());
+
+	max_state = stats->max_state;
+	time_in_state = stats->time_in_state;
+
+	/*
+	 * The states above the caller's maximum are not copied, the
+	 * ones above the tracked maximum were never entered
+	 */
+	nr = cdev_state->stats.max_state < max_state ? cdev_state->stats.max_state : max_state;
+
+	memset(time_in_state, 0, sizeof(*time_in_state) * (max_state + 1));
+	memcpy(time_in_state, cdev_state->stats.time_in_state, sizeof(*time_in_state) * (nr + 1));
+
+	*stats = cdev_state->stats;
+	stats->max_state = max_state;
+	stats->time_in_state = time_in_state;
+
+	pthread_mutex_unlock(&th->cdev_lock);
+
+	return THERMAL_SUCCESS;
+}
+
+static int thermal_cdev_write_state(struct thermal_cdev_state *cdev_state,
+				    int cdev_id, int state)
+{
+	char path[PATH_MAX];
+	char buffer[16];
+	int len, ret;
+
+	if (cdev_state->fd < 0) {
+
+		snprintf(path, sizeof(path), SYS_CLASS_THERMAL "/cooling_device%d/cur_state",
+			 cdev_id);
+
+		cdev_state->fd = open(path, O_RDWR | O_CLOEXEC);
+		if (cdev_state->fd < 0)
+			return -1;
+	}
+
+	len = snprintf(buffer, sizeof(buffer), "%d\n", state);
+
+	ret = pwrite(cdev_state->fd, buffer, len, 0) != len ? -1 : 0;
+
+	PROBE3(thermal, cdev_set_state, cdev_id, state, ret);
+
+	return ret;
+}
+
+/*
+ * Returns 1 if the state was written, 0 if the cooling device is
+ * already in the requested state and the write was skipped, -1 on
+ * error.
+ */
+static int __thermal_cdev_set_state(struct thermal_handler *th, int cdev_id, int state)
+{
+	struct thermal_cdev_state *cdev_state;
+
+	cdev_state = thermal_cdev_state_find(th, cdev_id);
+	if (!cdev_state || state < 0)
+		return -1;
+
+	if (cdev_state->stats.cur_state == state)
+		return 0;
+
+	if (thermal_cdev_write_state(cdev_state, cdev_id, state))
+		return -1;
+
+	/*
+	 * Update the state right away, the state update event coming
+	 * later will be ignored as the state did not change
+	 */
+	__thermal_cdev_stats_update(th, cdev_id, state);
+
+	return 1;
+}
+
+thermal_error_t thermal_cdev_set_state(struct thermal_handler *th, int cdev_id, int state)
+{
+	int ret;
+
+	if (!th)
+		return THERMAL_ERROR;
+
+	pthread_mutex_lock(&th->cdev_lock);
+	ret = __thermal_cdev_set_state(th, cdev_id, state);
+	pthread_mutex_unlock(&th->cdev_lock);
+
+	return ret < 0 ? THERMAL_ERROR : THERMAL_SUCCESS;
+}
+
+/*
+ * Set the states of several cooling devices. All the requests are
+ * processed even if one fails. Returns the number of writes issued or
+ * -1 if one of the requests failed.
+ */
+int thermal_cdev_set_states(struct thermal_handler *th,
+			    struct thermal_cdev_request *req, int nr)
+{
+	int i, ret, writes = 0, error = 0;
+
+	if (!th || !req)
+		return THERMAL_ERROR;
+
+	pthread_mutex_lock(&th->cdev_lock);
+
+	for (i = 0; i < nr; i++) {
+
+		ret = __thermal_cdev_set_state(th, req[i].id, req[i].state);
+		if (ret < 0)
+			error = THERMAL_ERROR;
+		else
+			writes += ret;
+	}
+
+	pthread_mutex_unlock(&th->cdev_lock);
+
+	return error ? error : writes;
+}
+
+static int __thermal_cdev_stats_init(struct thermal_cdev *cdev, void *arg)
+{
+	struct thermal_handler *th = arg;
+
+	struct thermal_cdev_state *cdev_state;
+
+	pthread_mutex_lock(&th->cdev_lock);
+
+	__thermal_cdev_stats_add(th, cdev->id, cdev->max_state);
+
+	cdev_state = thermal_cdev_state_find(th, cdev->id);
+	if (cdev_state) {
+		__thermal_cdev_stats_update(th, cdev->id, cdev->cur_state);
+
+		/*
+		 * The initial state is not a transition
+		 */
+		cdev_state->stats.total_trans = 0;
+	}
+
+	pthread_mutex_unlock(&th->cdev_lock);
+
+	return cdev_state ? 0 : -1;
+}
+
+thermal_error_t thermal_cdev_stats_init(struct thermal_handler *th, struct thermal_cdev *cdev)
+{
+	if (!th)
+		return THERMAL_ERROR;
+
+	if (for_each_thermal_cdev(cdev, __thermal_cdev_stats_init, th))
+		return THERMAL_ERROR;
+
+	return THERMAL_SUCCESS;
+}
+
+void thermal_cdev_stats_exit(struct thermal_handler *th)
+{
+	int i;
+
+	for (i = 0; i < th->nr_cdev_state; i++) {
+
+		if (!th->cdev_state[i].stats.time_in_state)
+			continue;
+
+		if (th->cdev_state[i].fd >= 0)
+			close(th->cdev_state[i].fd);
+
+		free(th->cdev_state[i].stats.time_in_state);
+	}
+
+	free(th->cdev_state);
+
+	th->cdev_state = NULL;
+	th->nr_cdev_state = 0;
+}
+
+/*
+ * Read the statistics maintained by the kernel when it is compiled
+ * with CONFIG_THERMAL_STATISTICS. The caller provides a time in state
+ * array of stats->max_state + 1 entries.
+ */
+thermal_error_t thermal_cdev_stats_sysfs(int cdev_id, struct thermal_cdev_stats *stats)
+{
+	char path[PATH_MAX];
+	unsigned long long time;
+	int state;
+	FILE *f;
+
+	if (!stats || !stats->time_in_state)
+		return THERMAL_ERROR;
+
+	snprintf(path, sizeof(path), SYS_CLASS_THERMAL "/cooling_device%d/stats/total_trans",
+		 cdev_id);
+
+	f = fopen(path, "re");
+	if (!f)
+		return THERMAL_ERROR;
+
+	if (fscanf(f, "%lu", &stats->total_trans) != 1) {
+		fclose(f);
+		return THERMAL_ERROR;
+	}
+
+	fclose(f);
+
+	snprintf(path, sizeof(path), SYS_CLASS_THERMAL "/cooling_device%d/stats/time_in_state_ms",
+		 cdev_id);
+
+	f = fopen(path, "re");
+	if (!f)
+		return THERMAL_ERROR;
+
+	while (fscanf(f, " state%d %llu", &state, &time) == 2) {
+
+		if (state < 0 || state > stats->max_state)
+			continue;
+
+		stats->time_in_state[state] = time;
+	}
+
+	fclose(f);
+
+	return THERMAL_SUCCESS;
+}
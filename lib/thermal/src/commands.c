@@ -2,6 +2,7 @@
 // Copyright (C) 2022, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
 #define _GNU_SOURCE
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -37,6 +38,12 @@ static struct nla_policy thermal_genl_policy[THERMAL_GENL_ATTR_MAX + 1] = {
 	[THERMAL_GENL_ATTR_CDEV_CUR_STATE]      = { .type = NLA_U32 },
 	[THERMAL_GENL_ATTR_CDEV_MAX_STATE]      = { .type = NLA_U32 },
 	[THERMAL_GENL_ATTR_CDEV_NAME]           = { .type = NLA_STRING },
+
+	/* Thresholds */
+	[THERMAL_GENL_ATTR_THRESHOLD]		= { .type = NLA_NESTED },
+	[THERMAL_GENL_ATTR_THRESHOLD_TEMP]	= { .type = NLA_U32 },
+	[THERMAL_GENL_ATTR_THRESHOLD_DIRECTION]	= { .type = NLA_U32 },
+	[THERMAL_GENL_ATTR_TZ_PREV_TEMP]	= { .type = NLA_U32 },
 };
 
 static int parse_tz_get(struct genl_info *info, struct thermal_zone **tz)
@@ -57,6 +64,8 @@ static int parse_tz_get(struct genl_info *info, struct thermal_zone **tz)
 				return THERMAL_ERROR;
 
 			__tz[size - 1].id = nla_get_u32(attr);
+			__tz[size - 1].trip = NULL;
+			__tz[size - 1].thresholds = NULL;
 		}
 
 		if (nla_type(attr) == THERMAL_GENL_ATTR_TZ_NAME)
@@ -145,11 +154,57 @@ static int parse_tz_get_trip(struct genl_info *info, struct thermal_zone *tz)
 	if (__tt)
 		__tt[size].id = -1;
 
+	/*
+	 * The trip points can be refreshed at runtime, release the
+	 * previous array
+	 */
+	free(tz->trip);
+
 	tz->trip = __tt;
 
 	return THERMAL_SUCCESS;
 }
 
+static int parse_threshold_get(struct genl_info *info, struct thermal_zone *tz)
+{
+	struct nlattr *attr;
+	struct thermal_threshold *__tt = NULL;
+	size_t size = 0;
+	int rem;
+
+	/*
+	 * The kernel sends an empty reply when there is no threshold
+	 */
+	if (info->attrs[THERMAL_GENL_ATTR_THRESHOLD]) {
+
+		nla_for_each_nested(attr, info->attrs[THERMAL_GENL_ATTR_THRESHOLD], rem) {
+
+			if (nla_type(attr) == THERMAL_GENL_ATTR_THRESHOLD_TEMP) {
+
+				size++;
+
+				__tt = realloc(__tt, sizeof(*__tt) * (size + 2));
+				if (!__tt)
+					return THERMAL_ERROR;
+
+				__tt[size - 1].temperature = nla_get_u32(attr);
+			}
+
+			if (nla_type(attr) == THERMAL_GENL_ATTR_THRESHOLD_DIRECTION)
+				__tt[size - 1].direction = nla_get_u32(attr);
+		}
+	}
+
+	if (__tt)
+		__tt[size].temperature = INT_MAX;
+
+	free(tz->thresholds);
+
+	tz->thresholds = __tt;
+
+	return THERMAL_SUCCESS;
+}
+
 static int parse_tz_get_temp(struct genl_info *info, struct thermal_zone *tz)
 {
 	int id = -1;
@@ -213,6 +268,10 @@ static int handle_netlink(struct nl_cache_ops *unused,
 		ret = parse_tz_get_gov(info, arg);
 		break;
 
+	case THERMAL_GENL_CMD_THRESHOLD_GET:
+		ret = parse_threshold_get(info, arg);
+		break;
+
 	default:
 		return THERMAL_ERROR;
 	}
@@ -256,6 +315,34 @@ static struct genl_cmd thermal_cmds[] = {
 		.c_maxattr	= THERMAL_GENL_ATTR_MAX,
 		.c_attr_policy	= thermal_genl_policy,
 	},
+	{
+		.c_id		= THERMAL_GENL_CMD_THRESHOLD_GET,
+		.c_name		= (char *)"Get thresholds list",
+		.c_msg_parser	= handle_netlink,
+		.c_maxattr	= THERMAL_GENL_ATTR_MAX,
+		.c_attr_policy	= thermal_genl_policy,
+	},
+	{
+		.c_id		= THERMAL_GENL_CMD_THRESHOLD_ADD,
+		.c_name		= (char *)"Add a threshold",
+		.c_msg_parser	= handle_netlink,
+		.c_maxattr	= THERMAL_GENL_ATTR_MAX,
+		.c_attr_policy	= thermal_genl_policy,
+	},
+	{
+		.c_id		= THERMAL_GENL_CMD_THRESHOLD_DELETE,
+		.c_name		= (char *)"Delete a threshold",
+		.c_msg_parser	= handle_netlink,
+		.c_maxattr	= THERMAL_GENL_ATTR_MAX,
+		.c_attr_policy	= thermal_genl_policy,
+	},
+	{
+		.c_id		= THERMAL_GENL_CMD_THRESHOLD_FLUSH,
+		.c_name		= (char *)"Flush the thresholds",
+		.c_msg_parser	= handle_netlink,
+		.c_maxattr	= THERMAL_GENL_ATTR_MAX,
+		.c_attr_policy	= thermal_genl_policy,
+	},
 };
 
 static struct genl_ops thermal_cmd_ops = {
@@ -264,9 +351,45 @@ static struct genl_ops thermal_cmd_ops = {
 	.o_ncmds	= ARRAY_SIZE(thermal_cmds),
 };
 
-static thermal_error_t thermal_genl_auto(struct thermal_handler *th, int id, int cmd,
+/*
+ * The attributes of a command, the thermal zone id is not sent when
+ * it is negative and the threshold only with the threshold commands
+ */
+struct cmd_param {
+	int tz_id;
+	int temp;
+	int direction;
+};
+
+typedef int (*cmd_cb_t)(struct nl_msg *, struct cmd_param *);
+
+static int thermal_genl_tz_id_encode(struct nl_msg *msg, struct cmd_param *p)
+{
+	if (p->tz_id >= 0 && nla_put_u32(msg, THERMAL_GENL_ATTR_TZ_ID, p->tz_id))
+		return -1;
+
+	return 0;
+}
+
+static int thermal_genl_threshold_encode(struct nl_msg *msg, struct cmd_param *p)
+{
+	if (thermal_genl_tz_id_encode(msg, p))
+		return -1;
+
+	if (nla_put_u32(msg, THERMAL_GENL_ATTR_THRESHOLD_TEMP, p->temp))
+		return -1;
+
+	if (nla_put_u32(msg, THERMAL_GENL_ATTR_THRESHOLD_DIRECTION, p->direction))
+		return -1;
+
+	return 0;
+}
+
+static thermal_error_t thermal_genl_auto(struct thermal_handler *th, cmd_cb_t cmd_cb,
+					 struct cmd_param *param, int cmd,
 					 int flags, void *arg)
 {
+	thermal_error_t ret = THERMAL_ERROR;
 	struct nl_msg *msg;
 	void *hdr;
 
@@ -277,45 +400,366 @@ static thermal_error_t thermal_genl_auto(struct thermal_handler *th, int id, int
 	hdr = genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, thermal_cmd_ops.o_id,
 			  0, flags, cmd, THERMAL_GENL_VERSION);
 	if (!hdr)
-		return THERMAL_ERROR;
+		goto out;
 
-	if (id >= 0 && nla_put_u32(msg, THERMAL_GENL_ATTR_TZ_ID, id))
-		return THERMAL_ERROR;
+	if (cmd_cb && cmd_cb(msg, param))
+		goto out;
 
 	if (nl_send_msg(th->sk_cmd, th->cb_cmd, msg, genl_handle_msg, arg))
-		return THERMAL_ERROR;
+		goto out;
 
+	ret = THERMAL_SUCCESS;
+out:
 	nlmsg_free(msg);
 
-	return THERMAL_SUCCESS;
+	return ret;
 }
 
 thermal_error_t thermal_cmd_get_tz(struct thermal_handler *th, struct thermal_zone **tz)
 {
-	return thermal_genl_auto(th, -1, THERMAL_GENL_CMD_TZ_GET_ID,
+	return thermal_genl_auto(th, NULL, NULL, THERMAL_GENL_CMD_TZ_GET_ID,
 				 NLM_F_DUMP | NLM_F_ACK, tz);
 }
 
 thermal_error_t thermal_cmd_get_cdev(struct thermal_handler *th, struct thermal_cdev **tc)
 {
-	return thermal_genl_auto(th, -1, THERMAL_GENL_CMD_CDEV_GET,
+	return thermal_genl_auto(th, NULL, NULL, THERMAL_GENL_CMD_CDEV_GET,
 				 NLM_F_DUMP | NLM_F_ACK, tc);
 }
 
 thermal_error_t thermal_cmd_get_trip(struct thermal_handler *th, struct thermal_zone *tz)
 {
-	return thermal_genl_auto(th, tz->id, THERMAL_GENL_CMD_TZ_GET_TRIP,
-				 0, tz);
+	struct cmd_param p = { .tz_id = tz->id };
+
+	return thermal_genl_auto(th, thermal_genl_tz_id_encode, &p,
+				 THERMAL_GENL_CMD_TZ_GET_TRIP, 0, tz);
 }
 
 thermal_error_t thermal_cmd_get_governor(struct thermal_handler *th, struct thermal_zone *tz)
 {
-	return thermal_genl_auto(th, tz->id, THERMAL_GENL_CMD_TZ_GET_GOV, 0, tz);
+	struct cmd_param p = { .tz_id = tz->id };
+
+	return thermal_genl_auto(th, thermal_genl_tz_id_encode, &p,
+				 THERMAL_GENL_CMD_TZ_GET_GOV, 0, tz);
 }
 
 thermal_error_t thermal_cmd_get_temp(struct thermal_handler *th, struct thermal_zone *tz)
 {
-	return thermal_genl_auto(th, tz->id, THERMAL_GENL_CMD_TZ_GET_TEMP, 0, tz);
+	struct cmd_param p = { .tz_id = tz->id };
+
+	return thermal_genl_auto(th, thermal_genl_tz_id_encode, &p,
+				 THERMAL_GENL_CMD_TZ_GET_TEMP, 0, tz);
+}
+
+thermal_error_t thermal_cmd_threshold_get(struct thermal_handler *th, struct thermal_zone *tz)
+{
+	struct cmd_param p = { .tz_id = tz->id };
+
+	return thermal_genl_auto(th, thermal_genl_tz_id_encode, &p,
+				 THERMAL_GENL_CMD_THRESHOLD_GET, 0, tz);
+}
+
+thermal_error_t thermal_cmd_threshold_add(struct thermal_handler *th, struct thermal_zone *tz,
+					  int temperature, int direction)
+{
+	struct cmd_param p = { .tz_id = tz->id, .temp = temperature, .direction = direction };
+
+	return thermal_genl_auto(th, thermal_genl_threshold_encode, &p,
+				 THERMAL_GENL_CMD_THRESHOLD_ADD, 0, tz);
+}
+
+thermal_error_t thermal_cmd_threshold_delete(struct thermal_handler *th, struct thermal_zone *tz,
+					     int temperature, int direction)
+{
+	struct cmd_param p = { .tz_id = tz->id, .temp = temperature, .direction = direction };
+
+	return thermal_genl_auto(th, thermal_genl_threshold_encode, &p,
+				 THERMAL_GENL_CMD_THRESHOLD_DELETE, 0, tz);
+}
+
+thermal_error_t thermal_cmd_threshold_flush(struct thermal_handler *th, struct thermal_zone *tz)
+{
+	struct cmd_param p = { .tz_id = tz->id };
+
+	return thermal_genl_auto(th, thermal_genl_tz_id_encode, &p,
+				 THERMAL_GENL_CMD_THRESHOLD_FLUSH, 0, tz);
+}
+
+/*
+ * A pending asynchronous command. The sequence number is used to
+ * match the kernel reply with the request, the parser fills
+ * 'parse_arg' and the callback is invoked with 'result' when the
+ * final ack or the end of the dump is received.
+ */
+struct thermal_cmd_async {
+	struct thermal_cmd_async *next;
+	unsigned int seq;
+	thermal_error_t error;
+	cb_async_t cb;
+	void *arg;
+	void *parse_arg;
+	void *result;
+};
+
+static struct thermal_cmd_async *thermal_cmd_async_find(struct thermal_handler *th,
+							 unsigned int seq)
+{
+	struct thermal_cmd_async *req;
+
+	for (req = th->async; req; req = req->next) {
+		if (req->seq == seq)
+			return req;
+	}
+
+	return NULL;
+}
+
+static void thermal_cmd_async_complete(struct thermal_handler *th, unsigned int seq)
+{
+	struct thermal_cmd_async **prev, *req;
+
+	for (prev = &th->async; *prev; prev = &(*prev)->next) {
+
+		req = *prev;
+
+		if (req->seq != seq)
+			continue;
+
+		*prev = req->next;
+
+		req->cb(req->error, req->result, req->arg);
+
+		free(req);
+
+		return;
+	}
+}
+
+static int nl_async_valid_handler(struct nl_msg *msg, void *arg)
+{
+	struct thermal_handler *th = arg;
+	struct thermal_cmd_async *req;
+
+	req = thermal_cmd_async_find(th, nlmsg_hdr(msg)->nlmsg_seq);
+	if (!req)
+		return NL_SKIP;
+
+	if (genl_handle_msg(msg, req->parse_arg))
+		req->error = THERMAL_ERROR;
+
+	return NL_OK;
+}
+
+static int nl_async_done_handler(struct nl_msg *msg, void *arg)
+{
+	thermal_cmd_async_complete(arg, nlmsg_hdr(msg)->nlmsg_seq);
+
+	return NL_OK;
+}
+
+static int nl_async_error_handler(struct sockaddr_nl *nla, struct nlmsgerr *nl_err,
+				  void *arg)
+{
+	struct thermal_handler *th = arg;
+	struct thermal_cmd_async *req;
+
+	req = thermal_cmd_async_find(th, nl_err->msg.nlmsg_seq);
+	if (req)
+		req->error = THERMAL_ERROR;
+
+	thermal_cmd_async_complete(th, nl_err->msg.nlmsg_seq);
+
+	return NL_SKIP;
+}
+
+static thermal_error_t thermal_genl_async(struct thermal_handler *th, int id, int cmd,
+					  int flags, struct thermal_cmd_async *req)
+{
+	struct nl_msg *msg;
+	void *hdr;
+
+	msg = nlmsg_alloc();
+	if (!msg)
+		goto out_free_req;
+
+	hdr = genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, thermal_cmd_ops.o_id,
+			  0, flags, cmd, THERMAL_GENL_VERSION);
+	if (!hdr)
+		goto out_free_msg;
+
+	if (id >= 0 && nla_put_u32(msg, THERMAL_GENL_ATTR_TZ_ID, id))
+		goto out_free_msg;
+
+	if (nl_send_auto_complete(th->sk_async, msg) < 0)
+		goto out_free_msg;
+
+	/*
+	 * The sequence number is assigned when the message is sent,
+	 * the kernel will reuse it in all the replies
+	 */
+	req->seq = nlmsg_hdr(msg)->nlmsg_seq;
+	req->next = th->async;
+	th->async = req;
+
+	nlmsg_free(msg);
+
+	return THERMAL_SUCCESS;
+
+out_free_msg:
+	nlmsg_free(msg);
+out_free_req:
+	free(req);
+
+	return THERMAL_ERROR;
+}
+
+static struct thermal_cmd_async *thermal_cmd_async_alloc(cb_async_t cb, void *arg,
+							 void *result)
+{
+	struct thermal_cmd_async *req;
+
+	if (!cb)
+		return NULL;
+
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		return NULL;
+
+	req->cb = cb;
+	req->arg = arg;
+	req->result = result;
+	req->parse_arg = result;
+
+	return req;
+}
+
+static thermal_error_t thermal_cmd_async_dump(struct thermal_handler *th, int cmd,
+					      cb_async_t cb, void *arg)
+{
+	struct thermal_cmd_async *req;
+
+	req = thermal_cmd_async_alloc(cb, arg, NULL);
+	if (!req)
+		return THERMAL_ERROR;
+
+	/*
+	 * The dump parsers allocate the resulting array and store its
+	 * address in the location they are given
+	 */
+	req->parse_arg = &req->result;
+
+	return thermal_genl_async(th, -1, cmd, NLM_F_DUMP | NLM_F_ACK, req);
+}
+
+static thermal_error_t thermal_cmd_async_tz(struct thermal_handler *th, int cmd,
+					    struct thermal_zone *tz,
+					    cb_async_t cb, void *arg)
+{
+	struct thermal_cmd_async *req;
+
+	req = thermal_cmd_async_alloc(cb, arg, tz);
+	if (!req)
+		return THERMAL_ERROR;
+
+	return thermal_genl_async(th, tz->id, cmd, 0, req);
+}
+
+thermal_error_t thermal_cmd_async_get_tz(struct thermal_handler *th,
+					 cb_async_t cb, void *arg)
+{
+	return thermal_cmd_async_dump(th, THERMAL_GENL_CMD_TZ_GET_ID, cb, arg);
+}
+
+thermal_error_t thermal_cmd_async_get_cdev(struct thermal_handler *th,
+					   cb_async_t cb, void *arg)
+{
+	return thermal_cmd_async_dump(th, THERMAL_GENL_CMD_CDEV_GET, cb, arg);
+}
+
+thermal_error_t thermal_cmd_async_get_trip(struct thermal_handler *th,
+					   struct thermal_zone *tz,
+					   cb_async_t cb, void *arg)
+{
+	return thermal_cmd_async_tz(th, THERMAL_GENL_CMD_TZ_GET_TRIP, tz, cb, arg);
+}
+
+thermal_error_t thermal_cmd_async_get_governor(struct thermal_handler *th,
+					       struct thermal_zone *tz,
+					       cb_async_t cb, void *arg)
+{
+	return thermal_cmd_async_tz(th, THERMAL_GENL_CMD_TZ_GET_GOV, tz, cb, arg);
+}
+
+thermal_error_t thermal_cmd_async_get_temp(struct thermal_handler *th,
+					   struct thermal_zone *tz,
+					   cb_async_t cb, void *arg)
+{
+	return thermal_cmd_async_tz(th, THERMAL_GENL_CMD_TZ_GET_TEMP, tz, cb, arg);
+}
+
+thermal_error_t thermal_cmd_async_handle(struct thermal_handler *th)
+{
+	int ret;
+
+	if (!th)
+		return THERMAL_ERROR;
+
+	/*
+	 * The socket is non blocking, a dump split across several
+	 * datagrams is resumed at the next call
+	 */
+	ret = nl_recvmsgs(th->sk_async, th->cb_async);
+	if (ret < 0 && ret != -NLE_AGAIN)
+		return THERMAL_ERROR;
+
+	return THERMAL_SUCCESS;
+}
+
+int thermal_cmd_async_fd(struct thermal_handler *th)
+{
+	if (!th)
+		return -1;
+
+	return nl_socket_get_fd(th->sk_async);
+}
+
+static void thermal_cmd_async_exit(struct thermal_handler *th)
+{
+	struct thermal_cmd_async *req;
+
+	while (th->async) {
+		req = th->async;
+		th->async = req->next;
+		free(req);
+	}
+
+	nl_thermal_disconnect(th->sk_async, th->cb_async);
+}
+
+static thermal_error_t thermal_cmd_async_init(struct thermal_handler *th)
+{
+	th->async = NULL;
+
+	if (nl_thermal_connect(&th->sk_async, &th->cb_async))
+		return THERMAL_ERROR;
+
+	if (nl_socket_set_nonblocking(th->sk_async))
+		goto out_disconnect;
+
+	if (nl_cb_err(th->cb_async, NL_CB_CUSTOM, nl_async_error_handler, th) ||
+	    nl_cb_set(th->cb_async, NL_CB_VALID, NL_CB_CUSTOM, nl_async_valid_handler, th) ||
+	    nl_cb_set(th->cb_async, NL_CB_FINISH, NL_CB_CUSTOM, nl_async_done_handler, th) ||
+	    nl_cb_set(th->cb_async, NL_CB_ACK, NL_CB_CUSTOM, nl_async_done_handler, th))
+		goto out_disconnect;
+
+	return THERMAL_SUCCESS;
+
+out_disconnect:
+	nl_thermal_disconnect(th->sk_async, th->cb_async);
+	th->sk_async = NULL;
+	th->cb_async = NULL;
+
+	return THERMAL_ERROR;
 }
 
 thermal_error_t thermal_cmd_exit(struct thermal_handler *th)
@@ -323,6 +767,8 @@ thermal_error_t thermal_cmd_exit(struct thermal_handler *th)
 	if (genl_unregister_family(&thermal_cmd_ops))
 		return THERMAL_ERROR;
 
+	thermal_cmd_async_exit(th);
+
 	nl_thermal_disconnect(th->sk_cmd, th->cb_cmd);
 
 	return THERMAL_SUCCESS;
@@ -348,5 +794,14 @@ thermal_error_t thermal_cmd_init(struct thermal_handler *th)
 	if (family != GENL_ID_CTRL)
 		return THERMAL_ERROR;
 
+	if (thermal_cmd_async_init(th))
+		goto out_unregister;
+
 	return THERMAL_SUCCESS;
+
+out_unregister:
+	genl_unregister_family(&thermal_cmd_ops);
+	nl_thermal_disconnect(th->sk_cmd, th->cb_cmd);
+
+	return THERMAL_ERROR;
 }
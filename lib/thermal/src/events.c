@@ -3,10 +3,12 @@
 #include <linux/netlink.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 
 #include <thermal.h>
+#include <probe.h>
 #include "thermal_nl.h"
 
 /*
@@ -16,7 +18,58 @@
  * will be able to discard the event if there is not ops associated
  * with it.
  */
-static int enabled_ops[__THERMAL_GENL_EVENT_MAX];
+static int enabled_ops[THERMAL_GENL_EVENT_MAX + 1];
+
+/*
+ * The capability array is allocated at init time for all the
+ * configured CPUs and reused for every event, the callback receives
+ * the CPUs contained in the event only.
+ */
+static int handle_cpu_capability(struct thermal_handler *th, struct nlattr *cap_attr,
+				 struct thermal_events_ops *ops, void *arg)
+{
+	struct thermal_cpu_capability *cap;
+	struct nlattr *attr;
+	int rem, nr = 0;
+
+	if (!cap_attr)
+		return THERMAL_ERROR;
+
+	nla_for_each_nested(attr, cap_attr, rem) {
+
+		if (nla_type(attr) == THERMAL_GENL_ATTR_CPU_CAPABILITY_ID) {
+
+			/*
+			 * Should not happen unless a CPU is hotplugged
+			 * beyond the configured ones
+			 */
+			if (nr == th->nr_cpu_cap) {
+				cap = realloc(th->cpu_cap, sizeof(*cap) * (nr + 1));
+				if (!cap)
+					return THERMAL_ERROR;
+
+				th->cpu_cap = cap;
+				th->nr_cpu_cap = nr + 1;
+			}
+
+			nr++;
+
+			memset(&th->cpu_cap[nr - 1], 0, sizeof(*th->cpu_cap));
+			th->cpu_cap[nr - 1].cpu = nla_get_u32(attr);
+		}
+
+		if (!nr)
+			continue;
+
+		if (nla_type(attr) == THERMAL_GENL_ATTR_CPU_CAPABILITY_PERFORMANCE)
+			th->cpu_cap[nr - 1].performance = nla_get_u32(attr);
+
+		if (nla_type(attr) == THERMAL_GENL_ATTR_CPU_CAPABILITY_EFFICIENCY)
+			th->cpu_cap[nr - 1].efficiency = nla_get_u32(attr);
+	}
+
+	return ops->cpu_capability_change(th->cpu_cap, nr, arg);
+}
 
 static int handle_thermal_event(struct nl_msg *n, void *arg)
 {
@@ -28,12 +81,44 @@ static int handle_thermal_event(struct nl_msg *n, void *arg)
 
 	genlmsg_parse(nlh, 0, attrs, THERMAL_GENL_ATTR_MAX, NULL);
 
+	thp->th->nl_received++;
+
+	/*
+	 * The thermal zone id attribute is passed as is, the probe
+	 * decodes it only when it is enabled
+	 */
+	PROBE2(thermal, event, genlhdr->cmd, attrs[THERMAL_GENL_ATTR_TZ_ID]);
+
 	arg = thp->arg;
 
+	/*
+	 * The cooling device states are tracked by the library
+	 * whatever the ops registered by the caller
+	 */
+	switch (genlhdr->cmd) {
+
+	case THERMAL_GENL_EVENT_CDEV_ADD:
+		thermal_cdev_stats_add(thp->th,
+				       nla_get_u32(attrs[THERMAL_GENL_ATTR_CDEV_ID]),
+				       nla_get_u32(attrs[THERMAL_GENL_ATTR_CDEV_MAX_STATE]));
+		break;
+
+	case THERMAL_GENL_EVENT_CDEV_DELETE:
+		thermal_cdev_stats_delete(thp->th,
+					  nla_get_u32(attrs[THERMAL_GENL_ATTR_CDEV_ID]));
+		break;
+
+	case THERMAL_GENL_EVENT_CDEV_STATE_UPDATE:
+		thermal_cdev_stats_update(thp->th,
+					  nla_get_u32(attrs[THERMAL_GENL_ATTR_CDEV_ID]),
+					  nla_get_u32(attrs[THERMAL_GENL_ATTR_CDEV_CUR_STATE]));
+		break;
+	}
+
 	/*
 	 * This is an event we don't care of, bail out.
 	 */
-	if (!enabled_ops[genlhdr->cmd])
+	if (genlhdr->cmd > THERMAL_GENL_EVENT_MAX || !enabled_ops[genlhdr->cmd])
 		return THERMAL_SUCCESS;
 
 	switch (genlhdr->cmd) {
@@ -94,6 +179,33 @@ static int handle_thermal_event(struct nl_msg *n, void *arg)
 	case THERMAL_GENL_EVENT_TZ_GOV_CHANGE:
 		return ops->gov_change(nla_get_u32(attrs[THERMAL_GENL_ATTR_TZ_ID]),
 				       nla_get_string(attrs[THERMAL_GENL_ATTR_GOV_NAME]), arg);
+
+	case THERMAL_GENL_EVENT_CPU_CAPABILITY_CHANGE:
+		return handle_cpu_capability(thp->th, attrs[THERMAL_GENL_ATTR_CPU_CAPABILITY],
+					     ops, arg);
+
+	case THERMAL_GENL_EVENT_THRESHOLD_ADD:
+		return ops->threshold_add(nla_get_u32(attrs[THERMAL_GENL_ATTR_TZ_ID]),
+					  nla_get_u32(attrs[THERMAL_GENL_ATTR_THRESHOLD_TEMP]),
+					  nla_get_u32(attrs[THERMAL_GENL_ATTR_THRESHOLD_DIRECTION]), arg);
+
+	case THERMAL_GENL_EVENT_THRESHOLD_DELETE:
+		return ops->threshold_delete(nla_get_u32(attrs[THERMAL_GENL_ATTR_TZ_ID]),
+					     nla_get_u32(attrs[THERMAL_GENL_ATTR_THRESHOLD_TEMP]),
+					     nla_get_u32(attrs[THERMAL_GENL_ATTR_THRESHOLD_DIRECTION]), arg);
+
+	case THERMAL_GENL_EVENT_THRESHOLD_FLUSH:
+		return ops->threshold_flush(nla_get_u32(attrs[THERMAL_GENL_ATTR_TZ_ID]), arg);
+
+	case THERMAL_GENL_EVENT_THRESHOLD_UP:
+		return ops->threshold_up(nla_get_u32(attrs[THERMAL_GENL_ATTR_TZ_ID]),
+					 nla_get_u32(attrs[THERMAL_GENL_ATTR_TZ_TEMP]),
+					 nla_get_u32(attrs[THERMAL_GENL_ATTR_TZ_PREV_TEMP]), arg);
+
+	case THERMAL_GENL_EVENT_THRESHOLD_DOWN:
+		return ops->threshold_down(nla_get_u32(attrs[THERMAL_GENL_ATTR_TZ_ID]),
+					   nla_get_u32(attrs[THERMAL_GENL_ATTR_TZ_TEMP]),
+					   nla_get_u32(attrs[THERMAL_GENL_ATTR_TZ_PREV_TEMP]), arg);
 	default:
 		return -1;
 	}
@@ -114,6 +226,12 @@ static void thermal_events_ops_init(struct thermal_events_ops *ops)
 	enabled_ops[THERMAL_GENL_EVENT_CDEV_DELETE]	= !!ops->cdev_delete;
 	enabled_ops[THERMAL_GENL_EVENT_CDEV_STATE_UPDATE] = !!ops->cdev_update;
 	enabled_ops[THERMAL_GENL_EVENT_TZ_GOV_CHANGE]	= !!ops->gov_change;
+	enabled_ops[THERMAL_GENL_EVENT_CPU_CAPABILITY_CHANGE] = !!ops->cpu_capability_change;
+	enabled_ops[THERMAL_GENL_EVENT_THRESHOLD_ADD]	= !!ops->threshold_add;
+	enabled_ops[THERMAL_GENL_EVENT_THRESHOLD_DELETE] = !!ops->threshold_delete;
+	enabled_ops[THERMAL_GENL_EVENT_THRESHOLD_FLUSH]	= !!ops->threshold_flush;
+	enabled_ops[THERMAL_GENL_EVENT_THRESHOLD_UP]	= !!ops->threshold_up;
+	enabled_ops[THERMAL_GENL_EVENT_THRESHOLD_DOWN]	= !!ops->threshold_down;
 }
 
 thermal_error_t thermal_events_handle(struct thermal_handler *th, void *arg)
@@ -127,7 +245,7 @@ thermal_error_t thermal_events_handle(struct thermal_handler *th, void *arg)
 		      handle_thermal_event, &thp))
 		return THERMAL_ERROR;
 
-	return nl_recvmsgs(th->sk_event, th->cb_event);
+	return nl_thermal_recv(th, th->sk_event, th->cb_event);
 }
 
 int thermal_events_fd(struct thermal_handler *th)
@@ -146,13 +264,32 @@ thermal_error_t thermal_events_exit(struct thermal_handler *th)
 
 	nl_thermal_disconnect(th->sk_event, th->cb_event);
 
+	free(th->cpu_cap);
+	th->cpu_cap = NULL;
+	th->nr_cpu_cap = 0;
+
 	return THERMAL_SUCCESS;
 }
 
 thermal_error_t thermal_events_init(struct thermal_handler *th)
 {
+	long nr_cpus;
+
 	thermal_events_ops_init(&th->ops->events);
 
+	if (th->ops->events.cpu_capability_change) {
+
+		nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+		if (nr_cpus <= 0)
+			nr_cpus = 1;
+
+		th->cpu_cap = calloc(nr_cpus, sizeof(*th->cpu_cap));
+		if (!th->cpu_cap)
+			return THERMAL_ERROR;
+
+		th->nr_cpu_cap = nr_cpus;
+	}
+
 	if (nl_thermal_connect(&th->sk_event, &th->cb_event))
 		return THERMAL_ERROR;
 
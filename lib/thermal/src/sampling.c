@@ -18,6 +18,10 @@ static int handle_thermal_sample(struct nl_msg *n, void *arg)
 
 	genlmsg_parse(nlh, 0, attrs, THERMAL_GENL_ATTR_MAX, NULL);
 
+	thp->th->nl_received++;
+
+	arg = thp->arg;
+
 	switch (genlhdr->cmd) {
 
 	case THERMAL_GENL_SAMPLING_TEMP:
@@ -40,7 +44,7 @@ thermal_error_t thermal_sampling_handle(struct thermal_handler *th, void *arg)
 		      handle_thermal_sample, &thp))
 		return THERMAL_ERROR;
 
-	return nl_recvmsgs(th->sk_sampling, th->cb_sampling);
+	return nl_thermal_recv(th, th->sk_sampling, th->cb_sampling);
 }
 
 int thermal_sampling_fd(struct thermal_handler *th)
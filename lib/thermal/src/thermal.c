@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: LGPL-2.1+
 // Copyright (C) 2022, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#include <limits.h>
 #include <stdio.h>
 #include <thermal.h>
 
@@ -18,6 +19,19 @@ int for_each_thermal_cdev(struct thermal_cdev *cdev, cb_tc_t cb, void *arg)
 	return ret;
 }
 
+int for_each_thermal_threshold(struct thermal_threshold *th, cb_th_t cb, void *arg)
+{
+	int i, ret = 0;
+
+	if (!th)
+		return 0;
+
+	for (i = 0; th[i].temperature != INT_MAX; i++)
+		ret |= cb(&th[i], arg);
+
+	return ret;
+}
+
 int for_each_thermal_trip(struct thermal_trip *tt, cb_tt_t cb, void *arg)
 {
 	int i, ret = 0;
@@ -60,6 +74,37 @@ struct thermal_zone *thermal_zone_find_by_name(struct thermal_zone *tz,
 	return NULL;
 }
 
+struct thermal_cdev *thermal_cdev_find_by_name(struct thermal_cdev *cdev,
+					       const char *name)
+{
+	int i;
+
+	if (!cdev || !name)
+		return NULL;
+
+	for (i = 0; cdev[i].id != -1; i++) {
+		if (!strcmp(cdev[i].name, name))
+			return &cdev[i];
+	}
+
+	return NULL;
+}
+
+struct thermal_cdev *thermal_cdev_find_by_id(struct thermal_cdev *cdev, int id)
+{
+	int i;
+
+	if (!cdev || id < 0)
+		return NULL;
+
+	for (i = 0; cdev[i].id != -1; i++) {
+		if (cdev[i].id == id)
+			return &cdev[i];
+	}
+
+	return NULL;
+}
+
 struct thermal_zone *thermal_zone_find_by_id(struct thermal_zone *tz, int id)
 {
 	int i;
@@ -77,6 +122,8 @@ struct thermal_zone *thermal_zone_find_by_id(struct thermal_zone *tz, int id)
 
 static int __thermal_zone_discover(struct thermal_zone *tz, void *th)
 {
+	thermal_trend_init(&tz->trend);
+
 	if (thermal_cmd_get_trip(th, tz) < 0)
 		return -1;
 
@@ -104,19 +151,36 @@ void thermal_exit(struct thermal_handler *th)
 	thermal_cmd_exit(th);
 	thermal_events_exit(th);
 	thermal_sampling_exit(th);
+	thermal_cdev_stats_exit(th);
+	thermal_trip_fd_exit(th);
 
+	pthread_mutex_destroy(&th->cdev_lock);
 	free(th);
 }
 
+thermal_error_t thermal_nl_stats(struct thermal_handler *th, unsigned long *received,
+				 unsigned long *overruns)
+{
+	if (!th)
+		return THERMAL_ERROR;
+
+	*received = th->nl_received;
+	*overruns = th->nl_overruns;
+
+	return THERMAL_SUCCESS;
+}
+
 struct thermal_handler *thermal_init(struct thermal_ops *ops)
 {
 	struct thermal_handler *th;
 
-	th = malloc(sizeof(*th));
+	th = calloc(1, sizeof(*th));
 	if (!th)
 		return NULL;
 	th->ops = ops;
 
+	pthread_mutex_init(&th->cdev_lock, NULL);
+
 	if (thermal_events_init(th))
 		goto out_free;
 
@@ -182,6 +182,23 @@ void nl_thermal_disconnect(struct nl_sock *nl_sock, struct nl_cb *nl_cb)
 	nl_cb_put(nl_cb);
 }
 
+/*
+ * The kernel reports with ENOBUFS that multicast messages were lost
+ * because the socket buffer was full, the reception goes on with the
+ * next messages
+ */
+int nl_thermal_recv(struct thermal_handler *th, struct nl_sock *nl_sock,
+		    struct nl_cb *nl_cb)
+{
+	int ret;
+
+	ret = nl_recvmsgs(nl_sock, nl_cb);
+	if (ret == -NLE_NOMEM)
+		th->nl_overruns++;
+
+	return ret;
+}
+
 int nl_unsubscribe_thermal(struct nl_sock *nl_sock, struct nl_cb *nl_cb,
 			   const char *group)
 {
@@ -3,6 +3,8 @@
 #ifndef __THERMAL_H
 #define __THERMAL_H
 
+#include <pthread.h>
+
 #include <netlink/netlink.h>
 #include <netlink/genl/genl.h>
 #include <netlink/genl/mngt.h>
@@ -16,9 +18,20 @@ struct thermal_handler {
 	struct nl_sock *sk_event;
 	struct nl_sock *sk_sampling;
 	struct nl_sock *sk_cmd;
+	struct nl_sock *sk_async;
 	struct nl_cb *cb_cmd;
 	struct nl_cb *cb_event;
 	struct nl_cb *cb_sampling;
+	struct nl_cb *cb_async;
+	struct thermal_cmd_async *async;
+	struct thermal_cdev_state *cdev_state;
+	int nr_cdev_state;
+	pthread_mutex_t cdev_lock;
+	struct thermal_trip_fd *trip_fd;
+	struct thermal_cpu_capability *cpu_cap;
+	int nr_cpu_cap;
+	unsigned long nl_received;
+	unsigned long nl_overruns;
 };
 
 struct thermal_handler_param {
@@ -39,8 +52,24 @@ extern int nl_thermal_connect(struct nl_sock **nl_sock, struct nl_cb **nl_cb);
 
 extern void nl_thermal_disconnect(struct nl_sock *nl_sock, struct nl_cb *nl_cb);
 
+extern int nl_thermal_recv(struct thermal_handler *th, struct nl_sock *nl_sock,
+			   struct nl_cb *nl_cb);
+
 extern int nl_send_msg(struct nl_sock *sock, struct nl_cb *nl_cb, struct nl_msg *msg,
 		       int (*rx_handler)(struct nl_msg *, void *),
 		       void *data);
 
+/*
+ * Cooling device state tracking
+ */
+extern void thermal_cdev_stats_add(struct thermal_handler *th, int cdev_id,
+				   int max_state);
+
+extern void thermal_cdev_stats_delete(struct thermal_handler *th, int cdev_id);
+
+extern void thermal_cdev_stats_update(struct thermal_handler *th, int cdev_id,
+				      int cur_state);
+
+extern void thermal_trip_fd_exit(struct thermal_handler *th);
+
 #endif /* __THERMAL_H */
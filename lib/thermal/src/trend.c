@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: LGPL-2.1+
+// Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <thermal.h>
+
+/*
+ * Weight of the new slope in the moving average, expressed as a
+ * power of two: 1 / (1 << THERMAL_TREND_SHIFT). A small weight smooths
+ * the sensor noise, a large one reacts faster to a change of the load.
+ */
+#define THERMAL_TREND_SHIFT	2
+
+/*
+ * Fractional bits of the average, an integer average truncated at
+ * each update drifts toward zero and never reaches a steady slope
+ */
+#define THERMAL_TREND_FRAC	8
+
+void thermal_trend_init(struct thermal_trend *trend)
+{
+	memset(trend, 0, sizeof(*trend));
+}
+
+void thermal_trend_update(struct thermal_trend *trend, int temp, long long timestamp)
+{
+	long long delta = timestamp - trend->timestamp;
+	int slope;
+
+	/*
+	 * The slope is in m°C per second, the timestamps are in
+	 * milliseconds. Two samples are needed to compute the first
+	 * slope which is then used as the initial average.
+	 */
+	if (trend->samples && delta > 0) {
+
+		slope = ((long long)temp - trend->temp) * 1000 / delta;
+
+		if (trend->samples == 1)
+			trend->average = (long long)slope << THERMAL_TREND_FRAC;
+		else
+			trend->average += (((long long)slope << THERMAL_TREND_FRAC) -
+					   trend->average) / (1 << THERMAL_TREND_SHIFT);
+
+		/*
+		 * Rounded to the nearest, away from zero for the halves
+		 */
+		if (trend->average >= 0)
+			trend->slope = (trend->average + (1 << (THERMAL_TREND_FRAC - 1))) /
+				(1 << THERMAL_TREND_FRAC);
+		else
+			trend->slope = (trend->average - (1 << (THERMAL_TREND_FRAC - 1))) /
+				(1 << THERMAL_TREND_FRAC);
+	}
+
+	if (trend->samples < INT_MAX)
+		trend->samples++;
+
+	trend->temp = temp;
+	trend->timestamp = timestamp;
+}
+
+int thermal_trend_predict(struct thermal_trend *trend, int delta)
+{
+	return trend->temp + (long long)trend->slope * delta / 1000;
+}
+
+int thermal_trend_time_to_temp(struct thermal_trend *trend, int temp)
+{
+	long long delta = (long long)temp - trend->temp;
+
+	if (!delta)
+		return 0;
+
+	/*
+	 * The temperature is stable or goes in the opposite
+	 * direction, it will never reach the target
+	 */
+	if (!trend->slope || (delta > 0) != (trend->slope > 0))
+		return -1;
+
+	delta = delta * 1000 / trend->slope;
+
+	return delta > INT_MAX ? INT_MAX : delta;
+}
+
+int thermal_zone_time_to_trip(struct thermal_zone *tz, struct thermal_trip **trip)
+{
+	struct thermal_trip *next = NULL;
+	int i;
+
+	if (!tz->trip || tz->trend.slope <= 0)
+		return -1;
+
+	for (i = 0; tz->trip[i].id != -1; i++) {
+
+		if (tz->trip[i].temp <= tz->trend.temp)
+			continue;
+
+		if (!next || tz->trip[i].temp < next->temp)
+			next = &tz->trip[i];
+	}
+
+	if (!next)
+		return -1;
+
+	if (trip)
+		*trip = next;
+
+	return thermal_trend_time_to_temp(&tz->trend, next->temp);
+}
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: LGPL-2.1+
+// Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <thermal.h>
+#include "thermal_nl.h"
+
+#define SYS_CLASS_THERMAL	"/sys/class/thermal"
+
+typedef enum {
+	TRIP_TEMP,
+	TRIP_HYST,
+	TRIP_MAX_ATTRS,
+} trip_attr_t;
+
+static const char * const trip_attrs[] = {
+	[TRIP_TEMP] = "temp",
+	[TRIP_HYST] = "hyst",
+};
+
+/*
+ * The trip point files are opened the first time they are written
+ * and kept opened, the trip points being reprogrammed at each
+ * crossing when they are used as a sliding window.
+ */
+struct thermal_trip_fd {
+	struct thermal_trip_fd *next;
+	int tz_id;
+	int trip_id;
+	int fds[TRIP_MAX_ATTRS];
+};
+
+static struct thermal_trip_fd *thermal_trip_fd_get(struct thermal_handler *th,
+						    int tz_id, int trip_id)
+{
+	struct thermal_trip_fd *trip_fd;
+	int i;
+
+	for (trip_fd = th->trip_fd; trip_fd; trip_fd = trip_fd->next) {
+		if (trip_fd->tz_id == tz_id && trip_fd->trip_id == trip_id)
+			return trip_fd;
+	}
+
+	trip_fd = malloc(sizeof(*trip_fd));
+	if (!trip_fd)
+		return NULL;
+
+	trip_fd->tz_id = tz_id;
+	trip_fd->trip_id = trip_id;
+
+	for (i = 0; i < TRIP_MAX_ATTRS; i++)
+		trip_fd->fds[i] = -1;
+
+	trip_fd->next = th->trip_fd;
+	th->trip_fd = trip_fd;
+
+	return trip_fd;
+}
+
+static thermal_error_t thermal_trip_write(struct thermal_handler *th, int tz_id,
+					  int trip_id, trip_attr_t attr, int value)
+{
+	struct thermal_trip_fd *trip_fd;
+	char path[PATH_MAX];
+	char buffer[16];
+	int len;
+
+	if (!th || tz_id < 0 || trip_id < 0)
+		return THERMAL_ERROR;
+
+	trip_fd = thermal_trip_fd_get(th, tz_id, trip_id);
+	if (!trip_fd)
+		return THERMAL_ERROR;
+
+	if (trip_fd->fds[attr] < 0) {
+
+		snprintf(path, sizeof(path),
+			 SYS_CLASS_THERMAL "/thermal_zone%d/trip_point_%d_%s",
+			 tz_id, trip_id, trip_attrs[attr]);
+
+		trip_fd->fds[attr] = open(path, O_WRONLY | O_CLOEXEC);
+		if (trip_fd->fds[attr] < 0)
+			return THERMAL_ERROR;
+	}
+
+	len = snprintf(buffer, sizeof(buffer), "%d\n", value);
+
+	if (pwrite(trip_fd->fds[attr], buffer, len, 0) != len)
+		return THERMAL_ERROR;
+
+	return THERMAL_SUCCESS;
+}
+
+thermal_error_t thermal_trip_set_temp(struct thermal_handler *th, int tz_id,
+				      int trip_id, int temp)
+{
+	return thermal_trip_write(th, tz_id, trip_id, TRIP_TEMP, temp);
+}
+
+thermal_error_t thermal_trip_set_hyst(struct thermal_handler *th, int tz_id,
+				      int trip_id, int hyst)
+{
+	return thermal_trip_write(th, tz_id, trip_id, TRIP_HYST, hyst);
+}
+
+void thermal_trip_fd_exit(struct thermal_handler *th)
+{
+	struct thermal_trip_fd *trip_fd;
+	int i;
+
+	while (th->trip_fd) {
+
+		trip_fd = th->trip_fd;
+		th->trip_fd = trip_fd->next;
+
+		for (i = 0; i < TRIP_MAX_ATTRS; i++) {
+			if (trip_fd->fds[i] >= 0)
+				close(trip_fd->fds[i]);
+		}
+
+		free(trip_fd);
+	}
+}
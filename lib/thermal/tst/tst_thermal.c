@@ -54,6 +54,25 @@ static int show_tz(struct thermal_zone *tz, void *arg)
 	return 0;
 }
 
+static int show_async_temp(thermal_error_t error, void *data, void *arg)
+{
+	struct thermal_zone *tz = data;
+
+	if (error) {
+		fprintf(stderr, "Failed to get temperature for '%s'\n", tz->name);
+		return -1;
+	}
+
+	printf("thermal zone '%s' async temperature: %d\n", tz->name, tz->temp);
+
+	return 0;
+}
+
+static int async_temp(struct thermal_zone *tz, void *arg)
+{
+	return thermal_cmd_async_get_temp(arg, tz, show_async_temp, NULL);
+}
+
 static int tz_create(const char *name, int tz_id, void *arg)
 {
 	printf("Thermal zone '%s'/%d created\n", name, tz_id);
@@ -286,7 +305,16 @@ int main(void)
 	
 	if (epoll_ctl(epollfd, EPOLL_CTL_ADD, thermal_sampling_fd(th), &ev) == -1)
 		return -1;
-	
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = thermal_cmd_async_handle;
+
+	if (epoll_ctl(epollfd, EPOLL_CTL_ADD, thermal_cmd_async_fd(th), &ev) == -1)
+		return -1;
+
+	if (for_each_thermal_zone(tz, async_temp, th))
+		return -1;
+
 	while (1) {
 
 		static int counter = 0;
@@ -298,6 +326,8 @@ int main(void)
 			} else if (events[i].data.ptr == thermal_sampling_handle) {
 				counter++;
 				thermal_sampling_handle(th, NULL);
+			} else if (events[i].data.ptr == thermal_cmd_async_handle) {
+				thermal_cmd_async_handle(th);
 			}
 		}
 
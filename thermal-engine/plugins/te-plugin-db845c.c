@@ -6,11 +6,7 @@
 #include "threshold.h"
 #include "plugin.h"
 
-struct plugin_descriptor plugin_descriptor = {
-	.version	= "0.0.1",
-	.profile	= "browsing",
-	.compatibles	= { "te-plugin-db845c", NULL },
-};
+PLUGIN_DESCRIPTOR("0.0.1", "browsing", "te-plugin-db845c");
 
 static void *init_db845c(void)
 {
@@ -52,10 +48,12 @@ static int reset_db845c(int tz_id, int temperature, void *data)
 	return 0;
 }
 
-struct plugin_ops plugin_ops = {
+PLUGIN_EXPORT struct plugin_ops plugin_ops = {
 	.init = init_db845c,
 	.exit = exit_db845c,
 	.trip_low = trip_low_db845c,
 	.trip_high = trip_high_db845c,
 	.reset = reset_db845c,
 };
+
+PLUGIN_REGISTER(&plugin_ops);
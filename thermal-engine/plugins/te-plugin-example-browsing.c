@@ -6,11 +6,7 @@
 #include "threshold.h"
 #include "plugin.h"
 
-struct plugin_descriptor plugin_descriptor = {
-	.version	= "0.0.1",
-	.profile	= "browsing",
-	.compatibles	= { "te-plugin-compat1" , "te-plugin-compat2", NULL },
-};
+PLUGIN_DESCRIPTOR("0.0.1", "browsing", "te-plugin-compat1", "te-plugin-compat2");
 
 static void *init_example(void)
 {
@@ -52,10 +48,33 @@ static int reset_example(int tz_id, int temperature, void *data)
 	return 0;
 }
 
-struct plugin_ops plugin_ops = {
+static int trip_batch_example(struct plugin_batch *batch, void *data)
+{
+	int i;
+
+	for (i = 0; i < batch->nr_events; i++)
+		DEBUG("Plugin batch callback, tz_id=%d, temperature=%d, way %s\n",
+		      batch->events[i].tz_id, batch->events[i].temperature,
+		      batch->events[i].way_up ? "up" : "down");
+
+	for (i = 0; i < batch->nr_levels; i++)
+		DEBUG("Plugin batch level, tz_id=%d, level=%d\n",
+		      batch->levels[i].tz_id, batch->levels[i].level);
+
+	return 0;
+}
+
+PLUGIN_EXPORT struct plugin_ops plugin_ops = {
 	.init = init_example,
 	.exit = exit_example,
 	.trip_low = trip_low_example,
 	.trip_high = trip_high_example,
 	.reset = reset_example,
 };
+
+PLUGIN_EXPORT struct plugin_ops_v2 plugin_ops_v2 = {
+	.version = PLUGIN_OPS_VERSION,
+	.trip_batch = trip_batch_example,
+};
+
+PLUGIN_REGISTER(&plugin_ops, &plugin_ops_v2);
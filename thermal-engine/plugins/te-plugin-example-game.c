@@ -6,11 +6,7 @@
 #include "threshold.h"
 #include "plugin.h"
 
-struct plugin_descriptor plugin_descriptor = {
-	.version	= "0.0.1",
-	.profile	= "game",
-	.compatibles	= { "te-plugin-compat1" , "te-plugin-compat2", NULL },
-};
+PLUGIN_DESCRIPTOR("0.0.1", "game", "te-plugin-compat1", "te-plugin-compat2");
 
 static void *init_example(void)
 {
@@ -52,10 +48,12 @@ static int reset_example(int tz_id, int temperature, void *data)
 	return 0;
 }
 
-struct plugin_ops plugin_ops = {
+PLUGIN_EXPORT struct plugin_ops plugin_ops = {
 	.init = init_example,
 	.exit = exit_example,
 	.trip_low = trip_low_example,
 	.trip_high = trip_high_example,
 	.reset = reset_example,
 };
+
+PLUGIN_REGISTER(&plugin_ops);
@@ -6,11 +6,7 @@
 #include "threshold.h"
 #include "plugin.h"
 
-struct plugin_descriptor plugin_descriptor = {
-	.version	= "0.0.1",
-	.profile	= "balanced",
-	.compatibles	= { "te-plugin-x13s", NULL },
-};
+PLUGIN_DESCRIPTOR("0.0.1", "balanced", "te-plugin-x13s");
 
 static void *init_x13s(void)
 {
@@ -52,10 +48,12 @@ static int reset_x13s(int tz_id, int temperature, void *data)
 	return 0;
 }
 
-struct plugin_ops plugin_ops = {
+PLUGIN_EXPORT struct plugin_ops plugin_ops = {
 	.init = init_x13s,
 	.exit = exit_x13s,
 	.trip_low = trip_low_x13s,
 	.trip_high = trip_high_x13s,
 	.reset = reset_x13s,
 };
+
+PLUGIN_REGISTER(&plugin_ops);
@@ -0,0 +1,162 @@
+// Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <thermal.h>
+
+#include "thermal-engine.h"
+#include "capability.h"
+#include "log.h"
+
+/*
+ * The last capabilities reported by the kernel, indexed by CPU
+ * id. The best CPU is computed when the capabilities change, so the
+ * plugins can query it at no cost. A CPU without capability reported
+ * yet has an id of -1.
+ *
+ * The capabilities are updated from the mainloop and read by the
+ * plugin actions running on the executor workers, hence the lock.
+ */
+struct capabilities {
+	pthread_mutex_t lock;
+	struct thermal_cpu_capability *cap;
+	int nr;
+	int best;
+};
+
+static int capability_cmp(struct thermal_cpu_capability *a,
+			  struct thermal_cpu_capability *b)
+{
+	if (a->performance != b->performance)
+		return a->performance - b->performance;
+
+	return a->efficiency - b->efficiency;
+}
+
+static void capability_best_update(struct capabilities *caps)
+{
+	int i, best = -1;
+
+	for (i = 0; i < caps->nr; i++) {
+
+		if (caps->cap[i].cpu < 0)
+			continue;
+
+		if (best < 0 || capability_cmp(&caps->cap[i], &caps->cap[best]) > 0)
+			best = i;
+	}
+
+	__atomic_store_n(&caps->best, best, __ATOMIC_RELAXED);
+}
+
+int capability_update(struct capabilities *caps, struct thermal_cpu_capability *cap, int nr)
+{
+	int i;
+
+	pthread_mutex_lock(&caps->lock);
+
+	for (i = 0; i < nr; i++) {
+
+		if (cap[i].cpu < 0 || cap[i].cpu >= caps->nr) {
+			WARN("Capability for unknown cpu%d\n", cap[i].cpu);
+			continue;
+		}
+
+		DEBUG("cpu%d: performance=%d, efficiency=%d\n",
+		      cap[i].cpu, cap[i].performance, cap[i].efficiency);
+
+		caps->cap[cap[i].cpu] = cap[i];
+	}
+
+	capability_best_update(caps);
+
+	pthread_mutex_unlock(&caps->lock);
+
+	return 0;
+}
+
+int capability_get(struct capabilities *caps, int cpu, struct thermal_cpu_capability *cap)
+{
+	int ret = -1;
+
+	if (cpu < 0 || cpu >= caps->nr)
+		return -1;
+
+	pthread_mutex_lock(&caps->lock);
+
+	if (caps->cap[cpu].cpu >= 0) {
+		*cap = caps->cap[cpu];
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&caps->lock);
+
+	return ret;
+}
+
+int capability_best(struct capabilities *caps)
+{
+	return __atomic_load_n(&caps->best, __ATOMIC_RELAXED);
+}
+
+struct capabilities *capability_alloc(int nr_cpus)
+{
+	struct capabilities *caps;
+	int i;
+
+	caps = malloc(sizeof(*caps));
+	if (!caps)
+		return NULL;
+
+	caps->cap = malloc(sizeof(*caps->cap) * nr_cpus);
+	if (!caps->cap) {
+		free(caps);
+		return NULL;
+	}
+
+	for (i = 0; i < nr_cpus; i++)
+		caps->cap[i].cpu = -1;
+
+	caps->nr = nr_cpus;
+	caps->best = -1;
+
+	pthread_mutex_init(&caps->lock, NULL);
+
+	return caps;
+}
+
+void capability_free(struct capabilities *caps)
+{
+	if (!caps)
+		return;
+
+	pthread_mutex_destroy(&caps->lock);
+	free(caps->cap);
+	free(caps);
+}
+
+int thermal_engine_capability_init(struct thermal_engine_data *ted)
+{
+	long nr_cpus;
+
+	nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (nr_cpus <= 0) {
+		ERROR("Failed to get the number of cpus\n");
+		return -1;
+	}
+
+	ted->capabilities = capability_alloc(nr_cpus);
+	if (!ted->capabilities)
+		return -1;
+
+	return 0;
+}
+
+void thermal_engine_capability_exit(struct thermal_engine_data *ted)
+{
+	capability_free(ted->capabilities);
+	ted->capabilities = NULL;
+}
@@ -0,0 +1,12 @@
+#ifndef __CAPABILITY_H__
+#define __CAPABILITY_H__
+
+struct thermal_cpu_capability;
+struct capabilities;
+
+int capability_update(struct capabilities *caps, struct thermal_cpu_capability *cap, int nr);
+int capability_get(struct capabilities *caps, int cpu, struct thermal_cpu_capability *cap);
+int capability_best(struct capabilities *caps);
+struct capabilities *capability_alloc(int nr_cpus);
+void capability_free(struct capabilities *caps);
+#endif
@@ -1,23 +1,54 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <libconfig.h>
 #include <thermal.h>
 
 #include "thermal-engine.h"
 #include "config.h"
+#include "config_cache.h"
 #include "options.h"
 #include "plugin.h"
 #include "profile.h"
 #include "threshold.h"
+#include "window.h"
 #include "log.h"
 #include "fsm.h"
 
 void thermal_engine_config_exit(struct thermal_engine_data *ted)
 {
+	config_cache_close(ted->cache);
+	ted->cache = NULL;
+
+	if (!ted->config)
+		return;
+
 	config_destroy(ted->config);
 	free(ted->config);
 }
 
+static int config_plugins_budget(config_setting_t *plugins)
+{
+	const char *overrun = NULL;
+	int budget = 0, quarantine = PLUGIN_QUARANTINE_DEFAULT;
+
+	if (!config_setting_lookup_int(plugins, "budget", &budget))
+		return plugin_budget_set(0, NULL, 0);
+
+	config_setting_lookup_string(plugins, "overrun", &overrun);
+	config_setting_lookup_int(plugins, "quarantine", &quarantine);
+
+	if (budget < 0 || quarantine < 0) {
+		ERROR("Invalid plugin budget=%d, quarantine=%d\n", budget, quarantine);
+		return -1;
+	}
+
+	DEBUG("Plugin latency budget=%d us, overrun=%s, quarantine=%d\n",
+	      budget, overrun ? overrun : "log", quarantine);
+
+	return plugin_budget_set(budget, overrun, quarantine);
+}
+
 int config_plugins(struct thermal_engine_data *ted,
 		   int (*cb)(struct list *list,
 			     const char *path,
@@ -32,12 +63,18 @@ int config_plugins(struct thermal_engine_data *ted,
 	const char *path;
 	int i;
 
+	if (ted->cache)
+		return config_cache_plugins(ted, cb);
+
 	plugins = config_lookup(config, "plugins");
 	if (!plugins) {
-		WARN("No plugin defined in configuration");
+		WARN("No plugin defined in configuration\n");
 		return 0;
 	}
 
+	if (config_plugins_budget(plugins))
+		return -1;
+
 	if (!config_setting_lookup_string(plugins, "path", &path)) {
 		WARN("No plugins path, using default: %s\n", PLUGIN_PATH);
 		path = PLUGIN_PATH;
@@ -137,7 +174,7 @@ static int config_threshold(struct thermal_engine_data *ted, int tz_id,
 	DEBUG("Found threshold with temperature=%d, hysteresis=%d\n",
 	      temperature, hysteresis);
 
-	if (threshold_add(ted->thresholds, tz_id, temperature)) {
+	if (threshold_add(ted->thresholds, tz_id, temperature, hysteresis)) {
 		ERROR("Failed to add threshold temp=%d, hyst=%d\n",
 		      temperature, hysteresis);
 		return -1;
@@ -170,7 +207,7 @@ static int config_thresholds(struct thermal_engine_data *ted, int tz_id,
 	config_setting_t *threshold;
 	int i;
 
-	if (threshold_add(ted->thresholds, tz_id, THRESHOLD_DEFAULT_TEMP)) {
+	if (threshold_add(ted->thresholds, tz_id, THRESHOLD_DEFAULT_TEMP, 0)) {
 		ERROR("Failed to add initial state to fsm\n");
 		return -1;
 	}
@@ -190,12 +227,68 @@ static int config_thresholds(struct thermal_engine_data *ted, int tz_id,
 	return 0;
 }
 
+static int config_window(struct thermal_engine_data *ted, int tz_id,
+			 config_setting_t *window)
+{
+	int trip_low, trip_high;
+
+	if (config_setting_length(window) != 2) {
+		ERROR("A window is defined by two trip point ids\n");
+		return -1;
+	}
+
+	trip_low = config_setting_get_int_elem(window, 0);
+	trip_high = config_setting_get_int_elem(window, 1);
+
+	DEBUG("Found window with trip points low=%d, high=%d\n", trip_low, trip_high);
+
+	return window_add(ted, tz_id, trip_low, trip_high);
+}
+
+static int config_thermal_zone_setup(struct thermal_engine_data *ted,
+				     struct thermal_zone *tz,
+				     config_setting_t *thermal_zone)
+{
+	config_setting_t *thresholds;
+	config_setting_t *window;
+
+	thresholds = config_setting_lookup(thermal_zone, "thresholds");
+	if (!thresholds) {
+		ERROR("No thresholds defined for thermal zone '%s'\n", tz->name);
+		return -1;
+	}
+
+	if (config_thresholds(ted, tz->id, thresholds)) {
+		ERROR("Failed to configure the thresholds\n");
+		return -1;
+	}
+
+	/*
+	 * The thresholds are registered in the kernel when it is
+	 * supported, otherwise the trip points crossing events are
+	 * used, optionally with a sliding window
+	 */
+	window = config_setting_lookup(thermal_zone, "window");
+	if (window) {
+		if (config_window(ted, tz->id, window)) {
+			ERROR("Failed to configure the window\n");
+			return -1;
+		}
+	} else {
+		threshold_kernel_register(ted, tz->id);
+	}
+
+	return 0;
+}
+
 int config_thermal_zone(struct thermal_engine_data *ted)
 {
 	config_setting_t *thermal_zones;
-	config_setting_t *thresholds;
 	int i;
 
+	if (ted->cache)
+		return config_cache_thermal_zone(ted);
+
 	thermal_zones = config_lookup(ted->config, "thermal-zones");
 	if (!thermal_zones) {
 		ERROR("No thermal zones defined in configuration\n");
@@ -220,17 +313,9 @@ int config_thermal_zone(struct thermal_engine_data *ted)
 			continue;
 		}
 
-		thresholds = config_setting_lookup(thermal_zone, "thresholds");
-		if (!thresholds) {
-			ERROR("No thresholds defined for thermal zone '%s'\n", name);
+		if (config_thermal_zone_setup(ted, tz, thermal_zone))
 			return -1;
-		}
 
-		if (config_thresholds(ted, tz->id, thresholds)) {
-			ERROR("Failed to configure the thresholds\n");
-			return -1;
-		}
-		
 		DEBUG("Found thermal zone name=%s, type=%s\n", name, type);
 	}
 
@@ -242,6 +327,9 @@ int config_profile(struct thermal_engine_data *ted)
 	config_setting_t *profile;
 	const char *name;
 
+	if (ted->cache)
+		return config_cache_profile(ted);
+
 	profile = config_lookup(ted->config, "profile");
 	if (!profile) {
 		WARN("No default profile specified specified in configuration\n");
@@ -263,6 +351,14 @@ int config_profile(struct thermal_engine_data *ted)
 
 int thermal_engine_config_init(struct thermal_engine_data *ted)
 {
+	if (ted->options->cache) {
+		ted->cache = config_cache_open(ted);
+		if (ted->cache) {
+			INFO("Using configuration cache '%s'\n", ted->options->cache);
+			return 0;
+		}
+	}
+
 	ted->config = calloc(1, sizeof(*ted->config));
 	if (!ted->config)
 		return -1;
@@ -281,3 +377,451 @@ int thermal_engine_config_init(struct thermal_engine_data *ted)
 
 	return 0;
 }
+
+/*
+ * Two settings are equal when they have the same name, type and
+ * value, the aggregates are compared element by element
+ */
+static int config_setting_equal(config_setting_t *a, config_setting_t *b)
+{
+	const char *name_a, *name_b;
+	int i;
+
+	if (!a || !b)
+		return a == b;
+
+	if (config_setting_type(a) != config_setting_type(b))
+		return 0;
+
+	name_a = config_setting_name(a);
+	name_b = config_setting_name(b);
+
+	if ((name_a || name_b) && (!name_a || !name_b || strcmp(name_a, name_b)))
+		return 0;
+
+	switch (config_setting_type(a)) {
+	case CONFIG_TYPE_INT:
+		return config_setting_get_int(a) == config_setting_get_int(b);
+	case CONFIG_TYPE_INT64:
+		return config_setting_get_int64(a) == config_setting_get_int64(b);
+	case CONFIG_TYPE_FLOAT:
+		return config_setting_get_float(a) == config_setting_get_float(b);
+	case CONFIG_TYPE_BOOL:
+		return config_setting_get_bool(a) == config_setting_get_bool(b);
+	case CONFIG_TYPE_STRING:
+		return !strcmp(config_setting_get_string(a), config_setting_get_string(b));
+	case CONFIG_TYPE_GROUP:
+	case CONFIG_TYPE_ARRAY:
+	case CONFIG_TYPE_LIST:
+		if (config_setting_length(a) != config_setting_length(b))
+			return 0;
+
+		for (i = 0; i < config_setting_length(a); i++)
+			if (!config_setting_equal(config_setting_get_elem(a, i),
+						  config_setting_get_elem(b, i)))
+				return 0;
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static int config_setting_contains(config_setting_t *list, config_setting_t *setting)
+{
+	int i;
+
+	for (i = 0; list && i < config_setting_length(list); i++)
+		if (config_setting_equal(config_setting_get_elem(list, i), setting))
+			return 1;
+
+	return 0;
+}
+
+static config_setting_t *config_thermal_zone_lookup(config_setting_t *thermal_zones,
+						    const char *name)
+{
+	config_setting_t *thermal_zone;
+	const char *n;
+	int i;
+
+	for (i = 0; thermal_zones && i < config_setting_length(thermal_zones); i++) {
+
+		thermal_zone = config_setting_get_elem(thermal_zones, i);
+
+		n = NULL;
+		config_setting_lookup_string(thermal_zone, "name", &n);
+
+		if (n && name && !strcmp(n, name))
+			return thermal_zone;
+	}
+
+	return NULL;
+}
+
+/*
+ * The plugins loaded by a configuration reload, they are attached to
+ * the thresholds of the thermal zones which are not reconfigured
+ */
+struct config_reload {
+	struct plugin **added;
+	int nr_added;
+};
+
+static const char *config_plugins_path(config_setting_t *plugins)
+{
+	const char *path;
+
+	if (!plugins || !config_setting_lookup_string(plugins, "path", &path))
+		return PLUGIN_PATH;
+
+	return path;
+}
+
+static void config_plugin_remove(struct thermal_engine_data *ted,
+				 config_setting_t *descr)
+{
+	const char *compatible, *profile, *version;
+	struct plugin *plugin;
+
+	compatible = profile = version = NULL;
+
+	config_setting_lookup_string(descr, "compatible", &compatible);
+	config_setting_lookup_string(descr, "profile", &profile);
+	config_setting_lookup_string(descr, "version", &version);
+
+	if (!compatible)
+		return;
+
+	plugin = plugin_find(ted->plugins, compatible, profile, version);
+	if (!plugin)
+		return;
+
+	threshold_plugin_remove(ted->thresholds, plugin);
+
+	list_del(ted->plugins, &plugin->list);
+
+	INFO("Removed plugin compatible='%s', profile='%s'\n",
+	     compatible, plugin->descriptor->profile);
+
+	plugin_retire(ted->executor, plugin);
+}
+
+static int config_plugin_add(struct thermal_engine_data *ted, const char *path,
+			     config_setting_t *descr, struct config_reload *reload)
+{
+	const char *compatible, *profile, *version;
+	struct plugin **added;
+	struct plugin *plugin;
+
+	compatible = profile = version = NULL;
+
+	config_setting_lookup_string(descr, "compatible", &compatible);
+	config_setting_lookup_string(descr, "profile", &profile);
+	config_setting_lookup_string(descr, "version", &version);
+
+	added = realloc(reload->added, sizeof(*added) * (reload->nr_added + 1));
+	if (!added)
+		return -1;
+
+	reload->added = added;
+
+	plugin = plugin_open(path, compatible, profile, version);
+	if (!plugin) {
+		ERROR("Failed to load plugin compatible='%s'\n", compatible);
+		return -1;
+	}
+
+	list_add_tail(ted->plugins, &plugin->list);
+
+	reload->added[reload->nr_added++] = plugin;
+
+	return 0;
+}
+
+/*
+ * The plugins are identified by their descriptor, only the removed
+ * descriptors are closed and only the new ones are loaded
+ */
+static int config_plugins_reload(struct thermal_engine_data *ted, struct config_t *old,
+				 struct config_reload *reload)
+{
+	config_setting_t *plugins, *old_plugins;
+	config_setting_t *descriptors, *old_descriptors;
+	config_setting_t *descr;
+	const char *path;
+	int i, same_path, ret = 0;
+
+	plugins = config_lookup(ted->config, "plugins");
+	old_plugins = config_lookup(old, "plugins");
+
+	if (config_setting_equal(plugins, old_plugins))
+		return 0;
+
+	if (plugins)
+		ret |= config_plugins_budget(plugins);
+	else
+		ret |= plugin_budget_set(0, NULL, 0);
+
+	path = config_plugins_path(plugins);
+	same_path = !strcmp(path, config_plugins_path(old_plugins));
+
+	descriptors = plugins ? config_setting_lookup(plugins, "descriptors") : NULL;
+	old_descriptors = old_plugins ? config_setting_lookup(old_plugins, "descriptors") : NULL;
+
+	if (same_path && config_setting_equal(descriptors, old_descriptors))
+		return ret;
+
+	for (i = 0; old_descriptors && i < config_setting_length(old_descriptors); i++) {
+
+		descr = config_setting_get_elem(old_descriptors, i);
+
+		if (same_path && config_setting_contains(descriptors, descr))
+			continue;
+
+		config_plugin_remove(ted, descr);
+	}
+
+	/*
+	 * New shared objects may have been installed since the
+	 * directory was indexed
+	 */
+	plugin_rescan();
+
+	for (i = 0; descriptors && i < config_setting_length(descriptors); i++) {
+
+		descr = config_setting_get_elem(descriptors, i);
+
+		if (same_path && config_setting_contains(old_descriptors, descr))
+			continue;
+
+		ret |= config_plugin_add(ted, path, descr, reload);
+	}
+
+	/*
+	 * The plugins may come from another directory
+	 */
+	if (ted->watch) {
+		thermal_engine_plugin_watch_exit(ted);
+		ret |= thermal_engine_plugin_watch_init(ted);
+	}
+
+	return ret;
+}
+
+static int config_plugins_attach(struct thermal_engine_data *ted, int tz_id,
+				 config_setting_t *thermal_zone,
+				 struct config_reload *reload)
+{
+	config_setting_t *thresholds, *threshold, *profiles;
+	const char *profile;
+	int i, j, k, temperature, ret = 0;
+
+	thresholds = config_setting_lookup(thermal_zone, "thresholds");
+
+	for (i = 0; thresholds && i < config_setting_length(thresholds); i++) {
+
+		threshold = config_setting_get_elem(thresholds, i);
+		if (config_setting_length(threshold) < 3)
+			continue;
+
+		temperature = config_setting_get_int_elem(threshold, 0);
+		profiles = config_setting_get_elem(threshold, 2);
+
+		for (j = 0; j < config_setting_length(profiles); j++) {
+
+			profile = config_setting_get_string_elem(
+				config_setting_get_elem(profiles, j), 0);
+
+			for (k = 0; k < reload->nr_added; k++) {
+
+				struct plugin *plugin = reload->added[k];
+
+				if (!profile || strcmp(plugin->descriptor->profile, profile))
+					continue;
+
+				ret |= threshold_add_plugin(ted->thresholds, plugin,
+							    tz_id, temperature);
+			}
+		}
+	}
+
+	return ret;
+}
+
+static void config_thermal_zone_remove(struct thermal_engine_data *ted, int tz_id)
+{
+	window_del(ted, tz_id);
+	threshold_kernel_unregister(ted, tz_id);
+	threshold_zone_reset(ted->thresholds, tz_id);
+}
+
+/*
+ * Only the thermal zones whose configuration changed get their
+ * thresholds, their window or their kernel thresholds set again
+ */
+static int config_thermal_zones_reload(struct thermal_engine_data *ted,
+				       struct config_t *old,
+				       struct config_reload *reload)
+{
+	config_setting_t *thermal_zones, *old_thermal_zones;
+	config_setting_t *thermal_zone, *old_thermal_zone;
+	struct thermal_zone *tz;
+	const char *name;
+	int i, ret = 0;
+
+	thermal_zones = config_lookup(ted->config, "thermal-zones");
+	old_thermal_zones = config_lookup(old, "thermal-zones");
+
+	for (i = 0; i < config_setting_length(thermal_zones); i++) {
+
+		thermal_zone = config_setting_get_elem(thermal_zones, i);
+
+		name = NULL;
+		config_setting_lookup_string(thermal_zone, "name", &name);
+
+		tz = thermal_zone_find_by_name(ted->tz, name);
+		if (!tz)
+			continue;
+
+		old_thermal_zone = config_thermal_zone_lookup(old_thermal_zones, name);
+
+		if (config_setting_equal(thermal_zone, old_thermal_zone)) {
+			ret |= config_plugins_attach(ted, tz->id, thermal_zone, reload);
+			continue;
+		}
+
+		if (old_thermal_zone)
+			config_thermal_zone_remove(ted, tz->id);
+
+		if (config_thermal_zone_setup(ted, tz, thermal_zone)) {
+			ERROR("Failed to reconfigure thermal zone '%s'\n", name);
+			ret = -1;
+			continue;
+		}
+
+		INFO("Reconfigured thermal zone '%s'\n", name);
+	}
+
+	for (i = 0; i < config_setting_length(old_thermal_zones); i++) {
+
+		thermal_zone = config_setting_get_elem(old_thermal_zones, i);
+
+		name = NULL;
+		config_setting_lookup_string(thermal_zone, "name", &name);
+
+		if (config_thermal_zone_lookup(thermal_zones, name))
+			continue;
+
+		tz = thermal_zone_find_by_name(ted->tz, name);
+		if (!tz)
+			continue;
+
+		config_thermal_zone_remove(ted, tz->id);
+
+		INFO("Removed the configuration of thermal zone '%s'\n", name);
+	}
+
+	return ret;
+}
+
+/*
+ * The thresholds have the actions of all the profiles, the new
+ * profile only has to be switched to
+ */
+static int config_profile_reload(struct thermal_engine_data *ted, struct config_t *old)
+{
+	config_setting_t *profile;
+	const char *name;
+
+	profile = config_lookup(ted->config, "profile");
+
+	if (!profile || config_setting_equal(profile, config_lookup(old, "profile")))
+		return 0;
+
+	if (!config_setting_lookup_string(profile, "name", &name)) {
+		ERROR("Failed to get profile name\n");
+		return -1;
+	}
+
+	if (threshold_profile_add(ted->thresholds, name))
+		return -1;
+
+	return profile_switch(ted, name);
+}
+
+/*
+ * Read the configuration file again and apply the differences with
+ * the running configuration. The running configuration is kept if the
+ * new one can not be read, otherwise the new one becomes the reference
+ * even if some changes failed to apply.
+ */
+int thermal_engine_config_reload(struct thermal_engine_data *ted)
+{
+	struct config_reload reload = { .added = NULL, .nr_added = 0 };
+	struct config_t *config, *old;
+	int ret = 0;
+
+	/*
+	 * Started from the cache, the running configuration is the one
+	 * the cache was compiled from
+	 */
+	if (ted->cache) {
+		ted->config = config_cache_config(ted->cache);
+		if (!ted->config)
+			return -1;
+
+		config_cache_close(ted->cache);
+		ted->cache = NULL;
+	}
+
+	old = ted->config;
+
+	config = calloc(1, sizeof(*config));
+	if (!config)
+		return -1;
+
+	config_init(config);
+
+	INFO("Reloading configuration file '%s'\n", ted->options->config);
+
+	if (!config_read_file(config, ted->options->config)) {
+		ERROR("Failed to read configuration file: %s - line %d, "
+		      "keeping the running configuration\n",
+		      config_error_text(config), config_error_line(config));
+		goto out_destroy;
+	}
+
+	if (!config_lookup(config, "thermal-zones")) {
+		ERROR("No thermal zones defined in configuration, "
+		      "keeping the running configuration\n");
+		goto out_destroy;
+	}
+
+	ted->config = config;
+
+	ret |= config_plugins_reload(ted, old, &reload);
+	ret |= config_thermal_zones_reload(ted, old, &reload);
+	ret |= config_profile_reload(ted, old);
+
+	free(reload.added);
+
+	config_destroy(old);
+	free(old);
+
+	if (ret) {
+		WARN("Some configuration changes failed to apply\n");
+		return ret;
+	}
+
+	if (ted->options->cache && config_cache_save(ted))
+		WARN("Failed to update the configuration cache\n");
+
+	return 0;
+
+out_destroy:
+	config_destroy(config);
+	free(config);
+
+	return -1;
+}
@@ -0,0 +1,884 @@
+// Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libconfig.h>
+#include <thermal.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "thermal-engine.h"
+#include "config_cache.h"
+#include "options.h"
+#include "plugin.h"
+#include "profile.h"
+#include "threshold.h"
+#include "window.h"
+#include "log.h"
+
+#define CONFIG_CACHE_MAGIC	0x43434554 /* "TECC" */
+#define CONFIG_CACHE_VERSION	1
+
+/*
+ * Offset of a NULL string
+ */
+#define CONFIG_CACHE_NONE	UINT32_MAX
+
+#define CONFIG_CACHE_PLUGINS	0x1
+
+/*
+ * The image does not contain any pointer, the sections are referenced
+ * by their offset from the beginning of the image and the strings by
+ * their offset in the string table. The elements of a section refer
+ * to a range of elements of the next section.
+ */
+struct config_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t flags;
+	uint64_t hardware;
+	uint32_t source;
+	uint32_t source_len;
+	uint32_t zones;
+	uint32_t nr_zones;
+	uint32_t thresholds;
+	uint32_t nr_thresholds;
+	uint32_t actions;
+	uint32_t nr_actions;
+	uint32_t devices;
+	uint32_t nr_devices;
+	uint32_t plugins;
+	uint32_t nr_plugins;
+	uint32_t strings;
+	uint32_t strings_len;
+	uint32_t plugin_path;
+	uint32_t budget;
+	uint32_t overrun;
+	uint32_t quarantine;
+	uint32_t profile;
+	uint32_t pad;
+};
+
+/*
+ * The thermal zone id is resolved from the name when the cache is
+ * compiled, trip_low is -1 when there is no window
+ */
+struct config_cache_zone {
+	uint32_t name;
+	int32_t tz_id;
+	int32_t trip_low;
+	int32_t trip_high;
+	uint32_t threshold;
+	uint32_t nr_thresholds;
+};
+
+struct config_cache_threshold {
+	int32_t temperature;
+	int32_t hysteresis;
+	uint32_t action;
+	uint32_t nr_actions;
+};
+
+struct config_cache_action {
+	uint32_t profile;
+	int32_t power;
+	uint32_t device;
+	uint32_t nr_devices;
+};
+
+struct config_cache_plugin {
+	uint32_t compatible;
+	uint32_t profile;
+	uint32_t version;
+};
+
+struct config_cache {
+	const char *image;
+	size_t size;
+	const struct config_cache_header *header;
+	const struct config_cache_zone *zones;
+	const struct config_cache_threshold *thresholds;
+	const struct config_cache_action *actions;
+	const uint32_t *devices;
+	const struct config_cache_plugin *plugins;
+};
+
+/*
+ * A growing section while the cache is compiled
+ */
+struct config_cache_blob {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+struct config_cache_builder {
+	struct config_cache_blob zones;
+	struct config_cache_blob thresholds;
+	struct config_cache_blob actions;
+	struct config_cache_blob devices;
+	struct config_cache_blob plugins;
+	struct config_cache_blob strings;
+	struct config_cache_header header;
+};
+
+static uint64_t config_cache_hash(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static int __config_cache_hardware(struct thermal_zone *tz, void *arg)
+{
+	uint64_t *hash = arg;
+	int i;
+
+	*hash = config_cache_hash(*hash, &tz->id, sizeof(tz->id));
+	*hash = config_cache_hash(*hash, tz->name, strlen(tz->name) + 1);
+
+	for (i = 0; tz->trip && tz->trip[i].id != -1; i++) {
+		*hash = config_cache_hash(*hash, &tz->trip[i].id, sizeof(tz->trip[i].id));
+		*hash = config_cache_hash(*hash, &tz->trip[i].type, sizeof(tz->trip[i].type));
+	}
+
+	return 0;
+}
+
+/*
+ * The thermal zone ids and their trip points the configuration was
+ * resolved against
+ */
+static uint64_t config_cache_hardware(struct thermal_zone *tz)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for_each_thermal_zone(tz, __config_cache_hardware, &hash);
+
+	return hash;
+}
+
+static char *config_cache_read(const char *path, size_t *len)
+{
+	struct stat st;
+	char *buffer;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st))
+		goto out_close;
+
+	buffer = malloc(st.st_size + 1);
+	if (!buffer)
+		goto out_close;
+
+	if (read(fd, buffer, st.st_size) != st.st_size) {
+		free(buffer);
+		goto out_close;
+	}
+
+	buffer[st.st_size] = '\0';
+	*len = st.st_size;
+
+	close(fd);
+
+	return buffer;
+
+out_close:
+	close(fd);
+
+	return NULL;
+}
+
+static const char *config_cache_string(struct config_cache *cache, uint32_t offset)
+{
+	if (offset >= cache->header->strings_len)
+		return NULL;
+
+	return cache->image + cache->header->strings + offset;
+}
+
+static int config_cache_section(struct config_cache *cache, uint32_t offset,
+				uint32_t nr, size_t size, const void **section)
+{
+	if (offset % sizeof(uint64_t) || offset > cache->size ||
+	    nr > (cache->size - offset) / size)
+		return -1;
+
+	*section = cache->image + offset;
+
+	return 0;
+}
+
+static int config_cache_check(struct config_cache *cache)
+{
+	const struct config_cache_header *header = cache->header;
+
+	if (header->magic != CONFIG_CACHE_MAGIC ||
+	    header->version != CONFIG_CACHE_VERSION ||
+	    header->size != cache->size)
+		return -1;
+
+	if (config_cache_section(cache, header->zones, header->nr_zones,
+				 sizeof(*cache->zones), (const void **)&cache->zones) ||
+	    config_cache_section(cache, header->thresholds, header->nr_thresholds,
+				 sizeof(*cache->thresholds), (const void **)&cache->thresholds) ||
+	    config_cache_section(cache, header->actions, header->nr_actions,
+				 sizeof(*cache->actions), (const void **)&cache->actions) ||
+	    config_cache_section(cache, header->devices, header->nr_devices,
+				 sizeof(*cache->devices), (const void **)&cache->devices) ||
+	    config_cache_section(cache, header->plugins, header->nr_plugins,
+				 sizeof(*cache->plugins), (const void **)&cache->plugins))
+		return -1;
+
+	if (header->source > cache->size ||
+	    header->source_len > cache->size - header->source)
+		return -1;
+
+	/*
+	 * The strings are nul terminated by the last byte of the table
+	 */
+	if (!header->strings_len || header->strings > cache->size ||
+	    header->strings_len > cache->size - header->strings ||
+	    cache->image[header->strings + header->strings_len - 1])
+		return -1;
+
+	return 0;
+}
+
+struct config_cache *config_cache_open(struct thermal_engine_data *ted)
+{
+	struct config_cache *cache;
+	struct stat st;
+	char *source;
+	size_t len;
+	void *image;
+	int fd;
+
+	fd = open(ted->options->cache, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		DEBUG("No configuration cache '%s'\n", ted->options->cache);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct config_cache_header)) {
+		close(fd);
+		return NULL;
+	}
+
+	image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED)
+		return NULL;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		goto out_unmap;
+
+	cache->image = image;
+	cache->size = st.st_size;
+	cache->header = image;
+
+	if (config_cache_check(cache)) {
+		WARN("Invalid configuration cache '%s'\n", ted->options->cache);
+		goto out_free;
+	}
+
+	if (cache->header->hardware != config_cache_hardware(ted->tz)) {
+		INFO("The thermal zones changed, the configuration cache is stale\n");
+		goto out_free;
+	}
+
+	source = config_cache_read(ted->options->config, &len);
+	if (!source)
+		goto out_free;
+
+	if (len != cache->header->source_len ||
+	    memcmp(source, cache->image + cache->header->source, len)) {
+		INFO("The configuration changed, the configuration cache is stale\n");
+		free(source);
+		goto out_free;
+	}
+
+	free(source);
+
+	return cache;
+
+out_free:
+	free(cache);
+out_unmap:
+	munmap(image, st.st_size);
+
+	return NULL;
+}
+
+void config_cache_close(struct config_cache *cache)
+{
+	if (!cache)
+		return;
+
+	munmap((void *)cache->image, cache->size);
+	free(cache);
+}
+
+struct config_t *config_cache_config(struct config_cache *cache)
+{
+	struct config_t *config;
+	char *source;
+
+	config = calloc(1, sizeof(*config));
+	if (!config)
+		return NULL;
+
+	source = strndup(cache->image + cache->header->source, cache->header->source_len);
+	if (!source)
+		goto out_free;
+
+	config_init(config);
+
+	if (!config_read_string(config, source)) {
+		ERROR("Failed to parse the cached configuration\n");
+		config_destroy(config);
+		free(source);
+		goto out_free;
+	}
+
+	free(source);
+
+	return config;
+
+out_free:
+	free(config);
+
+	return NULL;
+}
+
+int config_cache_plugins(struct thermal_engine_data *ted,
+			 int (*cb)(struct list *list,
+				   const char *path,
+				   const char *compatible,
+				   const char *profile,
+				   const char *version))
+{
+	struct config_cache *cache = ted->cache;
+	const struct config_cache_header *header = cache->header;
+	const struct config_cache_plugin *plugin;
+	const char *path;
+	uint32_t i;
+
+	if (!(header->flags & CONFIG_CACHE_PLUGINS)) {
+		WARN("No plugin defined in configuration\n");
+		return 0;
+	}
+
+	if (plugin_budget_set(header->budget,
+			      config_cache_string(cache, header->overrun),
+			      header->quarantine))
+		return -1;
+
+	path = config_cache_string(cache, header->plugin_path);
+	if (!path)
+		return -1;
+
+	for (i = 0; i < header->nr_plugins; i++) {
+
+		plugin = &cache->plugins[i];
+
+		cb(ted->plugins, path,
+		   config_cache_string(cache, plugin->compatible),
+		   config_cache_string(cache, plugin->profile),
+		   config_cache_string(cache, plugin->version));
+	}
+
+	return 0;
+}
+
+int config_cache_profile(struct thermal_engine_data *ted)
+{
+	const char *name;
+
+	name = config_cache_string(ted->cache, ted->cache->header->profile);
+	if (!name) {
+		WARN("No default profile specified specified in configuration\n");
+		return 0;
+	}
+
+	return profile_set_name(ted->profile, name);
+}
+
+static int config_cache_action(struct thermal_engine_data *ted, int tz_id, int temperature,
+			       const struct config_cache_action *action)
+{
+	struct config_cache *cache = ted->cache;
+	struct plugin_power *pwr;
+	const char *profile, *device;
+	uint32_t i;
+
+	profile = config_cache_string(cache, action->profile);
+
+	if (!profile || action->device > cache->header->nr_devices ||
+	    action->nr_devices > cache->header->nr_devices - action->device)
+		return -1;
+
+	pwr = plugin_power_alloc(action->power);
+	if (!pwr)
+		return -1;
+
+	for (i = 0; i < action->nr_devices; i++) {
+
+		device = config_cache_string(cache, cache->devices[action->device + i]);
+
+		if (!device || plugin_power_add_device(pwr, device)) {
+			plugin_power_free(pwr);
+			return -1;
+		}
+	}
+
+	return threshold_add_action(ted->thresholds, ted->plugins, pwr, profile,
+				    tz_id, temperature);
+}
+
+static int config_cache_zone(struct thermal_engine_data *ted,
+			     const struct config_cache_zone *zone)
+{
+	const struct config_cache_header *header = ted->cache->header;
+	const struct config_cache_threshold *threshold;
+	uint32_t i, j;
+
+	if (zone->threshold > header->nr_thresholds ||
+	    zone->nr_thresholds > header->nr_thresholds - zone->threshold)
+		return -1;
+
+	if (threshold_add(ted->thresholds, zone->tz_id, THRESHOLD_DEFAULT_TEMP, 0))
+		return -1;
+
+	for (i = 0; i < zone->nr_thresholds; i++) {
+
+		threshold = &ted->cache->thresholds[zone->threshold + i];
+
+		if (threshold->action > header->nr_actions ||
+		    threshold->nr_actions > header->nr_actions - threshold->action)
+			return -1;
+
+		if (threshold_add(ted->thresholds, zone->tz_id, threshold->temperature,
+				  threshold->hysteresis))
+			return -1;
+
+		for (j = 0; j < threshold->nr_actions; j++)
+			if (config_cache_action(ted, zone->tz_id, threshold->temperature,
+						&ted->cache->actions[threshold->action + j]))
+				return -1;
+	}
+
+	if (zone->trip_low < 0) {
+		threshold_kernel_register(ted, zone->tz_id);
+		return 0;
+	}
+
+	return window_add(ted, zone->tz_id, zone->trip_low, zone->trip_high);
+}
+
+int config_cache_thermal_zone(struct thermal_engine_data *ted)
+{
+	struct config_cache *cache = ted->cache;
+	uint32_t i;
+
+	for (i = 0; i < cache->header->nr_zones; i++) {
+
+		if (config_cache_zone(ted, &cache->zones[i])) {
+			ERROR("Failed to configure thermal zone '%s' from the cache\n",
+			      config_cache_string(cache, cache->zones[i].name));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int config_cache_blob_add(struct config_cache_blob *blob, const void *data,
+				 size_t len, uint32_t *offset)
+{
+	char *p;
+
+	if (blob->len + len > blob->size) {
+
+		size_t size = blob->size ? blob->size * 2 : 256;
+
+		while (size < blob->len + len)
+			size *= 2;
+
+		p = realloc(blob->data, size);
+		if (!p)
+			return -1;
+
+		blob->data = p;
+		blob->size = size;
+	}
+
+	memcpy(blob->data + blob->len, data, len);
+
+	*offset = blob->len;
+	blob->len += len;
+
+	return 0;
+}
+
+static uint32_t config_cache_add_string(struct config_cache_builder *builder,
+					const char *string)
+{
+	uint32_t offset;
+
+	if (!string)
+		return CONFIG_CACHE_NONE;
+
+	if (config_cache_blob_add(&builder->strings, string, strlen(string) + 1, &offset))
+		return CONFIG_CACHE_NONE;
+
+	return offset;
+}
+
+static int config_cache_build_plugins(struct config_cache_builder *builder,
+				      config_setting_t *plugins)
+{
+	struct config_cache_header *header = &builder->header;
+	config_setting_t *descriptors, *descr;
+	const char *path, *overrun = NULL;
+	int i, budget = 0, quarantine = PLUGIN_QUARANTINE_DEFAULT;
+	uint32_t offset;
+
+	if (!plugins)
+		return 0;
+
+	header->flags |= CONFIG_CACHE_PLUGINS;
+
+	config_setting_lookup_int(plugins, "budget", &budget);
+	config_setting_lookup_string(plugins, "overrun", &overrun);
+	config_setting_lookup_int(plugins, "quarantine", &quarantine);
+
+	if (!config_setting_lookup_string(plugins, "path", &path))
+		path = PLUGIN_PATH;
+
+	header->budget = budget;
+	header->quarantine = quarantine;
+	header->overrun = config_cache_add_string(builder, overrun);
+	header->plugin_path = config_cache_add_string(builder, path);
+
+	descriptors = config_setting_lookup(plugins, "descriptors");
+
+	for (i = 0; descriptors && i < config_setting_length(descriptors); i++) {
+
+		struct config_cache_plugin plugin;
+		const char *compatible, *profile, *version;
+
+		compatible = profile = version = NULL;
+
+		descr = config_setting_get_elem(descriptors, i);
+		config_setting_lookup_string(descr, "compatible", &compatible);
+		config_setting_lookup_string(descr, "profile", &profile);
+		config_setting_lookup_string(descr, "version", &version);
+
+		plugin.compatible = config_cache_add_string(builder, compatible);
+		plugin.profile = config_cache_add_string(builder, profile);
+		plugin.version = config_cache_add_string(builder, version);
+
+		if (config_cache_blob_add(&builder->plugins, &plugin, sizeof(plugin), &offset))
+			return -1;
+
+		header->nr_plugins++;
+	}
+
+	return 0;
+}
+
+static int config_cache_build_action(struct config_cache_builder *builder,
+				     config_setting_t *profile)
+{
+	struct config_cache_header *header = &builder->header;
+	struct config_cache_action action;
+	config_setting_t *devices;
+	uint32_t offset, device;
+	int i;
+
+	action.profile = config_cache_add_string(builder,
+						 config_setting_get_string_elem(profile, 0));
+	action.power = config_setting_get_int_elem(profile, 1);
+	action.device = header->nr_devices;
+	action.nr_devices = 0;
+
+	devices = config_setting_get_elem(profile, 2);
+
+	for (i = 0; devices && i < config_setting_length(devices); i++) {
+
+		device = config_cache_add_string(builder,
+						 config_setting_get_string_elem(devices, i));
+
+		if (config_cache_blob_add(&builder->devices, &device, sizeof(device), &offset))
+			return -1;
+
+		action.nr_devices++;
+		header->nr_devices++;
+	}
+
+	if (config_cache_blob_add(&builder->actions, &action, sizeof(action), &offset))
+		return -1;
+
+	header->nr_actions++;
+
+	return 0;
+}
+
+/*
+ * The actions of a threshold are contiguous, they are compiled before
+ * the threshold refers to them
+ */
+static int config_cache_build_threshold(struct config_cache_builder *builder,
+					config_setting_t *setting)
+{
+	struct config_cache_header *header = &builder->header;
+	struct config_cache_threshold threshold;
+	config_setting_t *profiles = NULL;
+	uint32_t offset;
+	int i;
+
+	threshold.temperature = config_setting_get_int_elem(setting, 0);
+	threshold.hysteresis = config_setting_get_int_elem(setting, 1);
+	threshold.action = header->nr_actions;
+	threshold.nr_actions = 0;
+
+	if (config_setting_length(setting) > 2)
+		profiles = config_setting_get_elem(setting, 2);
+
+	for (i = 0; profiles && i < config_setting_length(profiles); i++) {
+
+		if (config_cache_build_action(builder, config_setting_get_elem(profiles, i)))
+			return -1;
+
+		threshold.nr_actions++;
+	}
+
+	if (config_cache_blob_add(&builder->thresholds, &threshold, sizeof(threshold), &offset))
+		return -1;
+
+	header->nr_thresholds++;
+
+	return 0;
+}
+
+static int config_cache_build_zones(struct thermal_engine_data *ted,
+				    struct config_cache_builder *builder,
+				    config_setting_t *thermal_zones)
+{
+	struct config_cache_header *header = &builder->header;
+	config_setting_t *thermal_zone, *thresholds, *window;
+	struct config_cache_zone zone;
+	struct thermal_zone *tz;
+	const char *name;
+	uint32_t offset;
+	int i, j;
+
+	for (i = 0; thermal_zones && i < config_setting_length(thermal_zones); i++) {
+
+		thermal_zone = config_setting_get_elem(thermal_zones, i);
+
+		name = NULL;
+		config_setting_lookup_string(thermal_zone, "name", &name);
+
+		tz = thermal_zone_find_by_name(ted->tz, name);
+		if (!tz)
+			continue;
+
+		zone.name = config_cache_add_string(builder, name);
+		zone.tz_id = tz->id;
+		zone.trip_low = zone.trip_high = -1;
+		zone.threshold = header->nr_thresholds;
+		zone.nr_thresholds = 0;
+
+		thresholds = config_setting_lookup(thermal_zone, "thresholds");
+
+		for (j = 0; thresholds && j < config_setting_length(thresholds); j++) {
+
+			if (config_cache_build_threshold(builder,
+							 config_setting_get_elem(thresholds, j)))
+				return -1;
+
+			zone.nr_thresholds++;
+		}
+
+		window = config_setting_lookup(thermal_zone, "window");
+		if (window) {
+			zone.trip_low = config_setting_get_int_elem(window, 0);
+			zone.trip_high = config_setting_get_int_elem(window, 1);
+		}
+
+		if (config_cache_blob_add(&builder->zones, &zone, sizeof(zone), &offset))
+			return -1;
+
+		header->nr_zones++;
+	}
+
+	return 0;
+}
+
+static int config_cache_write(int fd, const void *data, size_t len, uint32_t *offset)
+{
+	static const char pad[sizeof(uint64_t)];
+	off_t pos;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos < 0)
+		return -1;
+
+	/*
+	 * The sections are aligned for a direct access in the mapping
+	 */
+	if (pos % sizeof(uint64_t)) {
+		size_t n = sizeof(uint64_t) - pos % sizeof(uint64_t);
+
+		if (write(fd, pad, n) != (ssize_t)n)
+			return -1;
+
+		pos += n;
+	}
+
+	if (len && write(fd, data, len) != (ssize_t)len)
+		return -1;
+
+	*offset = pos;
+
+	return 0;
+}
+
+static int config_cache_write_image(struct config_cache_builder *builder, int fd,
+				    const char *source, size_t source_len)
+{
+	struct config_cache_header *header = &builder->header;
+	uint32_t offset;
+	off_t size;
+
+	if (config_cache_write(fd, header, sizeof(*header), &offset) ||
+	    config_cache_write(fd, source, source_len, &header->source) ||
+	    config_cache_write(fd, builder->zones.data, builder->zones.len, &header->zones) ||
+	    config_cache_write(fd, builder->thresholds.data, builder->thresholds.len,
+			       &header->thresholds) ||
+	    config_cache_write(fd, builder->actions.data, builder->actions.len,
+			       &header->actions) ||
+	    config_cache_write(fd, builder->devices.data, builder->devices.len,
+			       &header->devices) ||
+	    config_cache_write(fd, builder->plugins.data, builder->plugins.len,
+			       &header->plugins) ||
+	    config_cache_write(fd, builder->strings.data, builder->strings.len,
+			       &header->strings))
+		return -1;
+
+	size = lseek(fd, 0, SEEK_CUR);
+	if (size < 0 || size > UINT32_MAX)
+		return -1;
+
+	header->source_len = source_len;
+	header->strings_len = builder->strings.len;
+	header->size = size;
+
+	/*
+	 * The header is written last with the offsets of the sections
+	 */
+	if (pwrite(fd, header, sizeof(*header), 0) != sizeof(*header))
+		return -1;
+
+	return fsync(fd);
+}
+
+int config_cache_save(struct thermal_engine_data *ted)
+{
+	struct config_cache_builder builder;
+	const char *profile = NULL;
+	char *source, *tmp;
+	size_t source_len;
+	int fd, ret = -1;
+
+	if (!ted->config)
+		return -1;
+
+	memset(&builder, 0, sizeof(builder));
+
+	builder.header.magic = CONFIG_CACHE_MAGIC;
+	builder.header.version = CONFIG_CACHE_VERSION;
+	builder.header.hardware = config_cache_hardware(ted->tz);
+
+	source = config_cache_read(ted->options->config, &source_len);
+	if (!source)
+		return -1;
+
+	/*
+	 * The string table is never empty, its last byte is the
+	 * terminator checked when the cache is opened
+	 */
+	config_lookup_string(ted->config, "profile.name", &profile);
+	builder.header.profile = config_cache_add_string(&builder, profile);
+	builder.header.overrun = builder.header.plugin_path = CONFIG_CACHE_NONE;
+
+	if (builder.header.profile == CONFIG_CACHE_NONE &&
+	    config_cache_add_string(&builder, "") == CONFIG_CACHE_NONE)
+		goto out_free;
+
+	if (config_cache_build_plugins(&builder, config_lookup(ted->config, "plugins")) ||
+	    config_cache_build_zones(ted, &builder, config_lookup(ted->config, "thermal-zones")))
+		goto out_free;
+
+	/*
+	 * The image is written to a new file in the directory of the
+	 * cache, never to an existing one, and renamed over the cache
+	 */
+	if (asprintf(&tmp, "%s.XXXXXX", ted->options->cache) == -1)
+		goto out_free;
+
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0) {
+		ERROR("Failed to create the configuration cache '%s': %s\n",
+		      tmp, strerror(errno));
+		goto out_free_tmp;
+	}
+
+	ret = fchmod(fd, 0644);
+	if (!ret)
+		ret = config_cache_write_image(&builder, fd, source, source_len);
+
+	close(fd);
+
+	if (!ret)
+		ret = rename(tmp, ted->options->cache);
+
+	if (ret)
+		unlink(tmp);
+	else
+		INFO("Configuration compiled to '%s'\n", ted->options->cache);
+
+out_free_tmp:
+	free(tmp);
+out_free:
+	free(builder.zones.data);
+	free(builder.thresholds.data);
+	free(builder.actions.data);
+	free(builder.devices.data);
+	free(builder.plugins.data);
+	free(builder.strings.data);
+	free(source);
+
+	return ret;
+}
@@ -0,0 +1,38 @@
+/* Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org> */
+#ifndef __THERMAL_ENGINE_CONFIG_CACHE_H
+#define __THERMAL_ENGINE_CONFIG_CACHE_H
+
+struct thermal_engine_data;
+struct config_cache;
+struct config_t;
+struct list;
+
+/*
+ * The configuration compiled with the thermal zones it was resolved
+ * against. The image is mapped and replayed without parsing the
+ * configuration file, it is rejected when the configuration file or
+ * the thermal zones changed.
+ */
+extern struct config_cache *config_cache_open(struct thermal_engine_data *ted);
+extern void config_cache_close(struct config_cache *cache);
+
+/*
+ * Compile the parsed configuration to the cache file, the file is
+ * replaced atomically
+ */
+extern int config_cache_save(struct thermal_engine_data *ted);
+
+/*
+ * Parse the configuration the cache was compiled from
+ */
+extern struct config_t *config_cache_config(struct config_cache *cache);
+
+extern int config_cache_plugins(struct thermal_engine_data *ted,
+				int (*cb)(struct list *list,
+					  const char *path,
+					  const char *compatible,
+					  const char *profile,
+					  const char *version));
+extern int config_cache_profile(struct thermal_engine_data *ted);
+extern int config_cache_thermal_zone(struct thermal_engine_data *ted);
+#endif
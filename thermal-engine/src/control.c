@@ -0,0 +1,189 @@
+// Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "thermal-engine.h"
+#include "options.h"
+#include "mainloop.h"
+#include "profile.h"
+#include "log.h"
+
+/*
+ * The engine is controlled through a unix socket: the client sends
+ * one command, gets the answer and the connection is closed, eg.
+ * 'echo "profile game" | socat - UNIX-CONNECT:<path>'
+ *
+ * profile		the name of the active profile
+ * profile <name>	switch to the profile, answers its name
+ *
+ * A failed command is answered with 'error: <reason>'.
+ */
+#define CONTROL_CMD_MAX		256
+
+struct control {
+	int fd;
+	const char *path;
+};
+
+static int control_profile(struct thermal_engine_data *ted, const char *arg,
+			   char *answer, size_t len)
+{
+	if (*arg && profile_switch(ted, arg)) {
+		snprintf(answer, len, "error: unknown profile '%s'\n", arg);
+		return -1;
+	}
+
+	snprintf(answer, len, "%s\n", profile_get_name(ted->profile));
+
+	return 0;
+}
+
+static int control_cmd(struct thermal_engine_data *ted, char *cmd,
+		       char *answer, size_t len)
+{
+	char *arg;
+
+	cmd[strcspn(cmd, "\r\n")] = '\0';
+
+	arg = cmd + strcspn(cmd, " ");
+	if (*arg)
+		*arg++ = '\0';
+
+	arg += strspn(arg, " ");
+
+	DEBUG("Control command '%s', argument '%s'\n", cmd, arg);
+
+	if (!strcmp(cmd, "profile"))
+		return control_profile(ted, arg, answer, len);
+
+	snprintf(answer, len, "error: unknown command '%s'\n", cmd);
+
+	return -1;
+}
+
+/*
+ * The command is small enough to be read at once, the client is
+ * dropped if it sends nothing before closing
+ */
+static int control_client_handler(int fd, void *data)
+{
+	struct thermal_engine_data *ted = data;
+	char cmd[CONTROL_CMD_MAX], answer[CONTROL_CMD_MAX + 32];
+	ssize_t ret;
+
+	ret = recv(fd, cmd, sizeof(cmd) - 1, MSG_DONTWAIT);
+	if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+
+	if (ret > 0) {
+		cmd[ret] = '\0';
+
+		if (control_cmd(ted, cmd, answer, sizeof(answer)))
+			WARN("Control command failed: %s", answer);
+
+		if (send(fd, answer, strlen(answer), MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+			WARN("Failed to answer the control command: %s\n",
+			     strerror(errno));
+	}
+
+	mainloop_del(ted->ml, fd);
+	close(fd);
+
+	return 0;
+}
+
+static int control_handler(int fd, void *data)
+{
+	struct thermal_engine_data *ted = data;
+	int client;
+
+	client = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client < 0)
+		return 0;
+
+	if (mainloop_add(ted->ml, client, control_client_handler, ted))
+		close(client);
+
+	return 0;
+}
+
+int thermal_engine_control_init(struct thermal_engine_data *ted)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct control *control;
+	const char *path = ted->options->control;
+
+	if (!path)
+		return 0;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		ERROR("Control socket path too long '%s'\n", path);
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	control = malloc(sizeof(*control));
+	if (!control)
+		return -1;
+
+	control->path = path;
+
+	control->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (control->fd < 0)
+		goto out_free;
+
+	/*
+	 * A stale socket left by a previous instance
+	 */
+	unlink(path);
+
+	if (bind(control->fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		ERROR("Failed to bind the control socket '%s': %s\n", path,
+		      strerror(errno));
+		goto out_close;
+	}
+
+	if (listen(control->fd, SOMAXCONN))
+		goto out_unlink;
+
+	if (mainloop_add(ted->ml, control->fd, control_handler, ted))
+		goto out_unlink;
+
+	ted->control = control;
+
+	INFO("Control available on '%s'\n", path);
+
+	return 0;
+
+out_unlink:
+	unlink(path);
+out_close:
+	close(control->fd);
+out_free:
+	free(control);
+
+	return -1;
+}
+
+void thermal_engine_control_exit(struct thermal_engine_data *ted)
+{
+	struct control *control = ted->control;
+
+	if (!control)
+		return;
+
+	mainloop_del(ted->ml, control->fd);
+	close(control->fd);
+	unlink(control->path);
+	free(control);
+
+	ted->control = NULL;
+}
@@ -0,0 +1,362 @@
+// Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+#include "thermal-engine.h"
+#include "executor.h"
+#include "mainloop.h"
+#include "options.h"
+#include "log.h"
+
+#define EXECUTOR_MAX_WORKERS	4
+
+/*
+ * The jobs of a key are chained behind the one being run, only this
+ * one is in the 'busy' list of the mainloop. When it completes, the
+ * next job of the key is made ready, so the jobs of a key run one at
+ * a time in the submission order and a key never waits for another.
+ *
+ * The ready jobs are taken by any idle worker and the completed ones
+ * are given back to the mainloop, both queues are protected by the
+ * lock. The queues are lists of the jobs themselves, a job is never
+ * refused nor dropped.
+ */
+struct executor_queue {
+	struct executor_job *head;
+	struct executor_job *tail;
+};
+
+struct executor {
+	struct mainloop *mainloop;
+	pthread_t *workers;
+	int nr_workers;
+	int efd;
+	int pending;
+	int stop;
+	struct executor_job *busy;
+	struct executor_queue ready;
+	struct executor_queue complete;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_cond_t done;
+};
+
+static void executor_queue_push(struct executor_queue *queue, struct executor_job *job)
+{
+	job->next = NULL;
+
+	if (queue->tail)
+		queue->tail->next = job;
+	else
+		queue->head = job;
+
+	queue->tail = job;
+}
+
+static struct executor_job *executor_queue_pop(struct executor_queue *queue)
+{
+	struct executor_job *job = queue->head;
+
+	if (!job)
+		return NULL;
+
+	queue->head = job->next;
+	if (!queue->head)
+		queue->tail = NULL;
+
+	return job;
+}
+
+static void *executor_worker(void *arg)
+{
+	struct executor *executor = arg;
+	struct executor_job *job;
+	sigset_t mask;
+
+	/*
+	 * The signals are handled by the mainloop thread
+	 */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	pthread_mutex_lock(&executor->lock);
+
+	for (;;) {
+
+		job = executor_queue_pop(&executor->ready);
+		if (!job) {
+			if (executor->stop)
+				break;
+
+			pthread_cond_wait(&executor->cond, &executor->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&executor->lock);
+
+		job->ret = job->run(job);
+
+		pthread_mutex_lock(&executor->lock);
+
+		executor_queue_push(&executor->complete, job);
+		pthread_cond_signal(&executor->done);
+
+		eventfd_write(executor->efd, 1);
+	}
+
+	pthread_mutex_unlock(&executor->lock);
+
+	return NULL;
+}
+
+/*
+ * Called with the lock held
+ */
+static void executor_ready(struct executor *executor, struct executor_job *job)
+{
+	executor_queue_push(&executor->ready, job);
+	pthread_cond_signal(&executor->cond);
+}
+
+/*
+ * The job completed is replaced in the busy list by the next one of
+ * its key, if any, which becomes ready
+ */
+static void executor_next(struct executor *executor, struct executor_job *job)
+{
+	struct executor_job **busy, *next = job->queued;
+
+	for (busy = &executor->busy; *busy != job; busy = &(*busy)->busy)
+		;
+
+	if (!next) {
+		*busy = job->busy;
+		return;
+	}
+
+	next->last = job->last;
+	next->busy = job->busy;
+	*busy = next;
+
+	executor_ready(executor, next);
+}
+
+static int executor_complete(struct executor *executor)
+{
+	struct executor_queue complete;
+	struct executor_job *job;
+	int nr = 0;
+
+	pthread_mutex_lock(&executor->lock);
+
+	complete = executor->complete;
+	executor->complete.head = executor->complete.tail = NULL;
+
+	for (job = complete.head; job; job = job->next)
+		executor_next(executor, job);
+
+	pthread_mutex_unlock(&executor->lock);
+
+	/*
+	 * The jobs are released by their done callback, the next one
+	 * is read before
+	 */
+	while ((job = executor_queue_pop(&complete))) {
+		executor->pending--;
+		job->done(job, job->ret);
+		nr++;
+	}
+
+	return nr;
+}
+
+static int executor_handler(int fd, void *data)
+{
+	struct executor *executor = data;
+	eventfd_t value;
+
+	if (eventfd_read(fd, &value) < 0)
+		return -1;
+
+	executor_complete(executor);
+
+	return 0;
+}
+
+void executor_submit(struct executor *executor, unsigned long key,
+		     struct executor_job *job,
+		     executor_run_t run, executor_done_t done)
+{
+	struct executor_job *busy;
+
+	job->run = run;
+	job->done = done;
+
+	if (!executor->nr_workers) {
+		job->ret = job->run(job);
+		job->done(job, job->ret);
+		return;
+	}
+
+	job->key = key;
+	job->queued = NULL;
+	job->last = job;
+
+	executor->pending++;
+
+	pthread_mutex_lock(&executor->lock);
+
+	for (busy = executor->busy; busy; busy = busy->busy)
+		if (busy->key == key)
+			break;
+
+	if (busy) {
+		busy->last->queued = job;
+		busy->last = job;
+	} else {
+		job->busy = executor->busy;
+		executor->busy = job;
+		executor_ready(executor, job);
+	}
+
+	pthread_mutex_unlock(&executor->lock);
+}
+
+int executor_pending(struct executor *executor)
+{
+	return executor->pending;
+}
+
+static void executor_workers_stop(struct executor *executor, int nr_workers)
+{
+	int i;
+
+	pthread_mutex_lock(&executor->lock);
+	executor->stop = 1;
+	pthread_cond_broadcast(&executor->cond);
+	pthread_mutex_unlock(&executor->lock);
+
+	for (i = 0; i < nr_workers; i++)
+		pthread_join(executor->workers[i], NULL);
+}
+
+/*
+ * Wait for all the jobs submitted, including the ones queued behind
+ * another job of their key, to complete
+ */
+static void executor_drain(struct executor *executor)
+{
+	while (executor->pending) {
+
+		pthread_mutex_lock(&executor->lock);
+
+		while (!executor->complete.head)
+			pthread_cond_wait(&executor->done, &executor->lock);
+
+		pthread_mutex_unlock(&executor->lock);
+
+		executor_complete(executor);
+	}
+}
+
+void executor_fini(struct executor *executor)
+{
+	if (!executor)
+		return;
+
+	if (executor->nr_workers) {
+		executor_drain(executor);
+		executor_workers_stop(executor, executor->nr_workers);
+		mainloop_del(executor->mainloop, executor->efd);
+		close(executor->efd);
+	}
+
+	pthread_cond_destroy(&executor->done);
+	pthread_cond_destroy(&executor->cond);
+	pthread_mutex_destroy(&executor->lock);
+	free(executor->workers);
+	free(executor);
+}
+
+struct executor *executor_init(struct mainloop *mainloop, int nr_workers)
+{
+	struct executor *executor;
+	int i;
+
+	executor = calloc(1, sizeof(*executor));
+	if (!executor)
+		return NULL;
+
+	executor->mainloop = mainloop;
+	executor->efd = -1;
+
+	pthread_mutex_init(&executor->lock, NULL);
+	pthread_cond_init(&executor->cond, NULL);
+	pthread_cond_init(&executor->done, NULL);
+
+	if (!nr_workers)
+		return executor;
+
+	executor->workers = calloc(nr_workers, sizeof(*executor->workers));
+	if (!executor->workers)
+		goto out_free;
+
+	executor->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (executor->efd < 0)
+		goto out_free;
+
+	if (mainloop_add(mainloop, executor->efd, executor_handler, executor))
+		goto out_close;
+
+	for (i = 0; i < nr_workers; i++)
+		if (pthread_create(&executor->workers[i], NULL, executor_worker, executor))
+			goto out_stop;
+
+	executor->nr_workers = nr_workers;
+
+	return executor;
+
+out_stop:
+	executor_workers_stop(executor, i);
+	mainloop_del(mainloop, executor->efd);
+out_close:
+	close(executor->efd);
+out_free:
+	executor->nr_workers = 0;
+	executor_fini(executor);
+
+	return NULL;
+}
+
+int thermal_engine_executor_init(struct thermal_engine_data *ted)
+{
+	int nr_workers = ted->options->workers;
+
+	if (nr_workers < 0) {
+		nr_workers = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nr_workers > EXECUTOR_MAX_WORKERS)
+			nr_workers = EXECUTOR_MAX_WORKERS;
+		if (nr_workers < 1)
+			nr_workers = 1;
+	}
+
+	ted->executor = executor_init(ted->ml, nr_workers);
+	if (!ted->executor)
+		return -1;
+
+	INFO("Plugin actions run on %d worker(s)\n", nr_workers);
+
+	return 0;
+}
+
+void thermal_engine_executor_exit(struct thermal_engine_data *ted)
+{
+	executor_fini(ted->executor);
+	ted->executor = NULL;
+}
@@ -0,0 +1,50 @@
+/* Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org> */
+#ifndef __THERMAL_ENGINE_EXECUTOR_H
+#define __THERMAL_ENGINE_EXECUTOR_H
+
+struct mainloop;
+struct executor;
+struct executor_job;
+
+/*
+ * 'run' is called from a worker thread, 'done' is called from the
+ * mainloop with the value returned by 'run'. The job belongs to the
+ * executor until 'done' is called, it can be released from there.
+ */
+typedef int (*executor_run_t)(struct executor_job *job);
+typedef void (*executor_done_t)(struct executor_job *job, int ret);
+
+struct executor_job {
+	executor_run_t run;
+	executor_done_t done;
+	int ret;
+	/* Private to the executor */
+	unsigned long key;
+	struct executor_job *next;
+	struct executor_job *busy;
+	struct executor_job *queued;
+	struct executor_job *last;
+};
+
+/*
+ * Jobs submitted with the same key run in the submission order, one
+ * at a time. Jobs with different keys run in parallel on any idle
+ * worker, a busy key does not delay the others. The jobs are never
+ * dropped.
+ */
+extern void executor_submit(struct executor *executor, unsigned long key,
+			    struct executor_job *job,
+			    executor_run_t run, executor_done_t done);
+
+/*
+ * Number of jobs submitted but not completed yet
+ */
+extern int executor_pending(struct executor *executor);
+
+/*
+ * Without workers, the jobs run synchronously in executor_submit()
+ */
+extern struct executor *executor_init(struct mainloop *mainloop, int nr_workers);
+extern void executor_fini(struct executor *executor);
+
+#endif
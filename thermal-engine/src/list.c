@@ -45,3 +45,26 @@ void list_remove(struct list *list)
 	if (list->next)
 		list->next->prev = list->prev;
 }
+
+void list_replace(struct list *head, struct list *old, struct list *new)
+{
+	new->prev = old->prev;
+	new->next = old->next;
+
+	if (new->prev)
+		new->prev->next = new;
+
+	if (new->next)
+		new->next->prev = new;
+
+	if (head->tail == old)
+		head->tail = new;
+}
+
+void list_del(struct list *head, struct list *list)
+{
+	if (head->tail == list)
+		head->tail = list->prev;
+
+	list_remove(list);
+}
@@ -20,4 +20,6 @@ struct list *list_prev(struct list *list);
 void list_add_head(struct list *head, struct list *new);
 void list_add_tail(struct list *head, struct list *new);
 void list_remove(struct list *list);
+void list_del(struct list *head, struct list *list);
+void list_replace(struct list *head, struct list *old, struct list *new);
 #endif /* __LIST_H__ */
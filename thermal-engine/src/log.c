@@ -1,14 +1,43 @@
 // Copyright (C) 2022, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#define _GNU_SOURCE
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
 
 #include "log.h"
 #include "timestamp.h"
 
 #define BUFFER_LOG_SIZE	4096
 
+/*
+ * A record holds the raw arguments of a message, the strings are
+ * copied as they can be released when logit() returns. A message
+ * with more arguments or longer strings than a record can hold is
+ * truncated and ends with LOG_TRUNCATED.
+ */
+#define LOG_RING_SIZE		128
+#define LOG_MAX_ARGS		8
+#define LOG_STRINGS_SIZE	128
+#define LOG_SPEC_SIZE		32
+#define LOG_TRUNCATED		"..."
+
+/*
+ * The writer sleeps at most this duration in ms, the rings of the
+ * exited threads are released when it wakes up
+ */
+#define LOG_WRITER_TIMEOUT	1000
+
 static const char *__ident = "unknown";
 static int __options;
 static unsigned int __level;
@@ -24,80 +53,814 @@ static const char * const loglvl[] = {
 	[LOG_EMERG]	= "EMERG",
 };
 
+#define LOG_LEVELS	(sizeof(loglvl) / sizeof(loglvl[0]))
+
+enum log_arg_type {
+	LOG_ARG_NONE,
+	LOG_ARG_INT,
+	LOG_ARG_LONG,
+	LOG_ARG_LLONG,
+	LOG_ARG_SIZE,
+	LOG_ARG_INTMAX,
+	LOG_ARG_PTRDIFF,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_LDOUBLE,
+	LOG_ARG_PTR,
+	LOG_ARG_STRING,
+};
+
+union log_arg {
+	long long i;
+	double d;
+	const void *p;
+	unsigned int s; /* offset of the copy in the strings */
+};
+
+/*
+ * The format and the prefix are string literals, they are formatted
+ * by the writer with the arguments
+ */
+struct log_record {
+	unsigned long timestamp;
+	const char *format;
+	const char *prefix;
+	unsigned int level;
+	unsigned int suppressed;
+	unsigned int nr_args;
+	unsigned int strings_len;
+	unsigned int truncated;
+	union log_arg args[LOG_MAX_ARGS];
+	char strings[LOG_STRINGS_SIZE];
+};
+
+/*
+ * The messages not terminated by a '\n' are concatenated with the
+ * next ones of the same thread
+ */
+struct log_line {
+	char buffer[BUFFER_LOG_SIZE];
+	size_t len;
+};
+
+/*
+ * One ring per thread, written by the thread and read by the writer
+ * without lock. The ring is released by the writer once the thread
+ * exited and the ring is empty.
+ */
+struct log_ring {
+	struct log_record records[LOG_RING_SIZE];
+	atomic_uint head;
+	atomic_uint tail;
+	atomic_uint dropped;
+	atomic_int dead;
+	struct log_line line;
+	struct log_ring *next;
+};
+
+struct log_spec {
+	const char *start;
+	size_t len;
+	int stars;
+	enum log_arg_type type;
+};
+
+static _Atomic(struct log_ring *) log_rings;
+static __thread struct log_ring *log_ring;
+
+/*
+ * The rate limiting applies to whole lines, the continuation of a
+ * suppressed line is suppressed too
+ */
+static __thread int log_partial;
+static __thread int log_suppress_line;
+
+static pthread_key_t log_key;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+
+static pthread_t log_writer_thread;
+static atomic_int log_async;
+static atomic_int log_stop;
+static atomic_int log_waiting;
+static int log_efd = -1;
+
+static pthread_mutex_t log_flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_flush_cond = PTHREAD_COND_INITIALIZER;
+static atomic_ulong log_flush_request;
+static unsigned long log_flush_done;
+
+/*
+ * Used when the writer is not running
+ */
+static pthread_mutex_t log_sync_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct log_line log_sync_line;
+
 int log_str2level(const char *lvl)
 {
 	unsigned int i;
 
-	for (i = 0; i < sizeof(loglvl) / sizeof(loglvl[LOG_DEBUG]); i++)
+	for (i = 0; i < LOG_LEVELS; i++)
 		if (!strcmp(lvl, loglvl[i]))
 			return i;
 
 	return LOG_DEBUG;
 }
 
-extern void logit(unsigned int level, const char *log_prefix, const char *format, ...)
+/*
+ * Parse the conversion specification starting at the '%' pointed by
+ * 'p', returns the character following it
+ */
+static const char *log_spec_parse(const char *p, struct log_spec *spec)
 {
-	static char buffer[BUFFER_LOG_SIZE] = { '\0' };
-	size_t idx;
-	va_list args;
+	int length = 0;
 
-	if (level >= sizeof(loglvl))
-		return;
-	
-	if (level > __level)
-		return;
+	spec->start = p++;
+	spec->stars = 0;
+	spec->type = LOG_ARG_NONE;
 
-	if (!format || !strlen(format))
+	while (*p && strchr("-+ #0'", *p))
+		p++;
+
+	if (*p == '*') {
+		spec->stars++;
+		p++;
+	}
+
+	while (*p >= '0' && *p <= '9')
+		p++;
+
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec->stars++;
+			p++;
+		}
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+
+	while (*p && strchr("hlLqjzt", *p))
+		length = length * 256 + *p++;
+
+	switch (*p) {
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+		switch (length) {
+		case 'l':
+			spec->type = LOG_ARG_LONG;
+			break;
+		case 'l' * 256 + 'l':
+		case 'q':
+			spec->type = LOG_ARG_LLONG;
+			break;
+		case 'z':
+			spec->type = LOG_ARG_SIZE;
+			break;
+		case 'j':
+			spec->type = LOG_ARG_INTMAX;
+			break;
+		case 't':
+			spec->type = LOG_ARG_PTRDIFF;
+			break;
+		default:
+			spec->type = LOG_ARG_INT;
+			break;
+		}
+		break;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		spec->type = length == 'L' ? LOG_ARG_LDOUBLE : LOG_ARG_DOUBLE;
+		break;
+	case 's':
+		spec->type = LOG_ARG_STRING;
+		break;
+	case 'p':
+		spec->type = LOG_ARG_PTR;
+		break;
+	}
+
+	if (*p)
+		p++;
+
+	spec->len = p - spec->start;
+
+	return p;
+}
+
+static void log_record_string(struct log_record *record, union log_arg *arg,
+			      const char *string)
+{
+	size_t len, room = LOG_STRINGS_SIZE - record->strings_len;
+
+	if (!string)
+		string = "(null)";
+
+	arg->s = record->strings_len;
+
+	if (!room) {
+		arg->s = LOG_STRINGS_SIZE - 1;
+		record->truncated = 1;
 		return;
+	}
+
+	len = strnlen(string, room - 1);
+	if (string[len])
+		record->truncated = 1;
+
+	memcpy(&record->strings[record->strings_len], string, len);
+	record->strings[record->strings_len + len] = '\0';
+	record->strings_len += len + 1;
+}
+
+/*
+ * Only the arguments are copied, nothing is formatted
+ */
+static void log_record_args(struct log_record *record, va_list args)
+{
+	struct log_spec spec;
+	const char *p = record->format;
+	union log_arg *arg;
+	int i;
+
+	record->nr_args = 0;
+	record->strings_len = 0;
+	record->truncated = 0;
+	record->strings[LOG_STRINGS_SIZE - 1] = '\0';
+
+	while ((p = strchr(p, '%'))) {
 
-	idx = strlen(buffer);
+		p = log_spec_parse(p, &spec);
 
+		if (spec.type == LOG_ARG_NONE)
+			continue;
+
+		if (record->nr_args + spec.stars + 1 > LOG_MAX_ARGS) {
+			record->truncated = 1;
+			return;
+		}
+
+		for (i = 0; i < spec.stars; i++)
+			record->args[record->nr_args++].i = va_arg(args, int);
+
+		arg = &record->args[record->nr_args++];
+
+		switch (spec.type) {
+		case LOG_ARG_INT:
+			arg->i = va_arg(args, int);
+			break;
+		case LOG_ARG_LONG:
+			arg->i = va_arg(args, long);
+			break;
+		case LOG_ARG_LLONG:
+			arg->i = va_arg(args, long long);
+			break;
+		case LOG_ARG_SIZE:
+			arg->i = va_arg(args, size_t);
+			break;
+		case LOG_ARG_INTMAX:
+			arg->i = va_arg(args, intmax_t);
+			break;
+		case LOG_ARG_PTRDIFF:
+			arg->i = va_arg(args, ptrdiff_t);
+			break;
+		case LOG_ARG_DOUBLE:
+			arg->d = va_arg(args, double);
+			break;
+		case LOG_ARG_LDOUBLE:
+			arg->d = va_arg(args, long double);
+			break;
+		case LOG_ARG_PTR:
+			arg->p = va_arg(args, void *);
+			break;
+		case LOG_ARG_STRING:
+			log_record_string(record, arg, va_arg(args, const char *));
+			break;
+		case LOG_ARG_NONE:
+			break;
+		}
+	}
+}
+
+#define LOG_SNPRINTF(__buf, __size, __spec, __stars, __args, __value)		\
+	((__stars) == 0 ? snprintf(__buf, __size, __spec, __value) :		\
+	 (__stars) == 1 ? snprintf(__buf, __size, __spec, (int)(__args)[0].i,	\
+				   __value) :					\
+	 snprintf(__buf, __size, __spec, (int)(__args)[0].i, (int)(__args)[1].i, \
+		  __value))
+
+static int log_spec_format(struct log_record *record, struct log_spec *spec,
+			   union log_arg *args, char *buffer, size_t size)
+{
+	union log_arg *arg = &args[spec->stars];
+	char fmt[LOG_SPEC_SIZE];
+
+	if (spec->len >= LOG_SPEC_SIZE)
+		return 0;
+
+	memcpy(fmt, spec->start, spec->len);
+	fmt[spec->len] = '\0';
+
+	switch (spec->type) {
+	case LOG_ARG_INT:
+		return LOG_SNPRINTF(buffer, size, fmt, spec->stars, args, (int)arg->i);
+	case LOG_ARG_LONG:
+		return LOG_SNPRINTF(buffer, size, fmt, spec->stars, args, (long)arg->i);
+	case LOG_ARG_LLONG:
+		return LOG_SNPRINTF(buffer, size, fmt, spec->stars, args, arg->i);
+	case LOG_ARG_SIZE:
+		return LOG_SNPRINTF(buffer, size, fmt, spec->stars, args, (size_t)arg->i);
+	case LOG_ARG_INTMAX:
+		return LOG_SNPRINTF(buffer, size, fmt, spec->stars, args, (intmax_t)arg->i);
+	case LOG_ARG_PTRDIFF:
+		return LOG_SNPRINTF(buffer, size, fmt, spec->stars, args, (ptrdiff_t)arg->i);
+	case LOG_ARG_DOUBLE:
+		return LOG_SNPRINTF(buffer, size, fmt, spec->stars, args, arg->d);
+	case LOG_ARG_LDOUBLE:
+		return LOG_SNPRINTF(buffer, size, fmt, spec->stars, args, (long double)arg->d);
+	case LOG_ARG_PTR:
+		return LOG_SNPRINTF(buffer, size, fmt, spec->stars, args, arg->p);
+	case LOG_ARG_STRING:
+		return LOG_SNPRINTF(buffer, size, fmt, spec->stars, args,
+				    &record->strings[arg->s]);
+	case LOG_ARG_NONE:
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Mark the message as truncated, before the end of line
+ */
+static void log_record_truncated(struct log_record *record, struct log_line *line)
+{
+	size_t len = strlen(record->format);
+	int eol = len && record->format[len - 1] == '\n';
+
+	if (line->len && line->buffer[line->len - 1] == '\n')
+		line->len--;
+
+	if (line->len > BUFFER_LOG_SIZE - sizeof(LOG_TRUNCATED) - 1)
+		line->len = BUFFER_LOG_SIZE - sizeof(LOG_TRUNCATED) - 1;
+
+	line->len += snprintf(&line->buffer[line->len], BUFFER_LOG_SIZE - line->len,
+			      "%s%s", LOG_TRUNCATED, eol ? "\n" : "");
+}
+
+/*
+ * Format the record at the end of the line, the output is truncated
+ * to the size of the line
+ */
+static void log_record_format(struct log_record *record, struct log_line *line)
+{
+	const char *p = record->format, *next;
+	unsigned int nr_args = 0;
+	struct log_spec spec;
+	size_t len;
+	int ret;
+
+	while (*p && line->len < BUFFER_LOG_SIZE - 1) {
+
+		size_t room = BUFFER_LOG_SIZE - line->len;
+
+		next = strchr(p, '%');
+		len = next ? (size_t)(next - p) : strlen(p);
+		if (len >= room)
+			len = room - 1;
+
+		memcpy(&line->buffer[line->len], p, len);
+		line->len += len;
+		line->buffer[line->len] = '\0';
+
+		if (!next)
+			break;
+
+		p = log_spec_parse(next, &spec);
+
+		if (spec.type == LOG_ARG_NONE) {
+			if (spec.len == 2 && spec.start[1] == '%' &&
+			    line->len < BUFFER_LOG_SIZE - 1) {
+				line->buffer[line->len++] = '%';
+				line->buffer[line->len] = '\0';
+			}
+			continue;
+		}
+
+		/*
+		 * The arguments which did not fit in the record
+		 */
+		if (nr_args + spec.stars + 1 > record->nr_args)
+			break;
+
+		ret = log_spec_format(record, &spec, &record->args[nr_args],
+				      &line->buffer[line->len], BUFFER_LOG_SIZE - line->len);
+		if (ret > 0)
+			line->len += ret;
+
+		if (line->len > BUFFER_LOG_SIZE - 1)
+			line->len = BUFFER_LOG_SIZE - 1;
+
+		nr_args += spec.stars + 1;
+	}
+
+	if (record->truncated)
+		log_record_truncated(record, line);
+}
+
+static void log_output(unsigned int level, const char *buffer)
+{
+	if (__options & TO_SYSLOG)
+		syslog(level, "%s", buffer);
+
+	if (__options & TO_STDERR)
+		fprintf(stderr, "%s", buffer);
+
+	if (__options & TO_STDOUT)
+		fprintf(stdout, "%s", buffer);
+}
+
+static void log_header(struct log_line *line, unsigned long ts, unsigned int level,
+		       const char *prefix)
+{
+	line->len = snprintf(line->buffer, BUFFER_LOG_SIZE, "[ %lu.%03lu ] (%s%s%s): ",
+			     ts / 1000, ts % 1000, loglvl[level],
+			     prefix[0] != '\0' ? "@" : "", prefix);
+}
+
+static void log_notify(unsigned long ts, const char *what, unsigned int nr)
+{
+	struct log_line line;
+
+	log_header(&line, ts, LOG_WARNING, "");
+
+	snprintf(&line.buffer[line.len], BUFFER_LOG_SIZE - line.len,
+		 "%u messages %s\n", nr, what);
+
+	log_output(LOG_WARNING, line.buffer);
+}
+
+static void log_write(struct log_line *line, struct log_record *record)
+{
 	/*
-	 * There is nothing in the buffer, it is a new trace. Let's
-	 * add the timestamp.
+	 * There is nothing in the line, it is a new trace. Let's add
+	 * the timestamp.
 	 */
-	if (!idx) {
-		unsigned long ts = timestamp();
-		idx = sprintf(buffer, "[ %lu.%03lu ] (%s%s%s): ",
-			      ts / 1000, ts % 1000, loglvl[level],
-			      log_prefix[0] != '\0' ? "@" : "", log_prefix);
+	if (!line->len) {
+
+		if (record->suppressed)
+			log_notify(record->timestamp, "suppressed", record->suppressed);
+
+		log_header(line, record->timestamp, record->level, record->prefix);
 	}
 
+	log_record_format(record, line);
+
 	/*
 	 * If the logger did not added a '\n', then it wants the log
 	 * to be concatenate with the next one. This is useful when we
 	 * are logging multiple information without wanting to do that
 	 * in multiline.
 	 */
-	if (format[strlen(format) - 1] != '\n') {
-		va_start(args, format);
-		vsnprintf(&buffer[idx], BUFFER_LOG_SIZE - idx, format, args);
-		va_end(args);
+	if (record->format[strlen(record->format) - 1] != '\n')
 		return;
-	}
+
+	log_output(record->level, line->buffer);
+
+	line->len = 0;
+}
+
+static void log_ring_exit(void *data)
+{
+	struct log_ring *ring = data;
 
 	/*
-	 * We have a previous message in the buffer, we should
-	 * concatenate the current one with the buffer.
+	 * A message logged later by this thread gets a new ring
 	 */
+	log_ring = NULL;
+
+	atomic_store(&ring->dead, 1);
+}
+
+static void log_key_init(void)
+{
+	pthread_key_create(&log_key, log_ring_exit);
+}
+
+static struct log_ring *log_ring_get(void)
+{
+	struct log_ring *ring = log_ring;
+
+	if (ring)
+		return ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	pthread_once(&log_once, log_key_init);
+	pthread_setspecific(log_key, ring);
+
+	ring->next = atomic_load(&log_rings);
+	while (!atomic_compare_exchange_weak(&log_rings, &ring->next, ring))
+		;
+
+	log_ring = ring;
+
+	return ring;
+}
+
+static void log_ring_release(struct log_ring *ring)
+{
+	struct log_ring *head = ring, *prev;
+
+	/*
+	 * The threads only add rings at the head of the list
+	 */
+	if (atomic_compare_exchange_strong(&log_rings, &head, ring->next)) {
+		free(ring);
+		return;
+	}
+
+	for (prev = head; prev && prev->next != ring; prev = prev->next)
+		;
+
+	if (prev)
+		prev->next = ring->next;
+
+	free(ring);
+}
+
+/*
+ * Write the records of all the rings in the timestamp order, returns
+ * the number of records written
+ */
+static int log_drain(void)
+{
+	struct log_ring *ring, *oldest, *next;
+	struct log_record *record;
+	unsigned int head, dropped;
+	int nr = 0;
+
+	for (;;) {
+
+		oldest = NULL;
+		record = NULL;
+
+		for (ring = atomic_load(&log_rings); ring; ring = ring->next) {
+
+			head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+			if (head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+				continue;
+
+			if (!oldest || ring->records[head % LOG_RING_SIZE].timestamp <
+			    record->timestamp) {
+				oldest = ring;
+				record = &ring->records[head % LOG_RING_SIZE];
+			}
+		}
+
+		if (!oldest)
+			break;
+
+		log_write(&oldest->line, record);
+
+		atomic_store_explicit(&oldest->head,
+				      atomic_load_explicit(&oldest->head, memory_order_relaxed) + 1,
+				      memory_order_release);
+		nr++;
+	}
+
+	for (ring = atomic_load(&log_rings); ring; ring = next) {
+
+		next = ring->next;
+
+		dropped = atomic_exchange(&ring->dropped, 0);
+		if (dropped)
+			log_notify(timestamp(), "dropped", dropped);
+
+		if (atomic_load(&ring->dead) && !ring->line.len &&
+		    atomic_load(&ring->head) == atomic_load(&ring->tail))
+			log_ring_release(ring);
+	}
+
+	return nr;
+}
+
+static int log_pending(void)
+{
+	struct log_ring *ring;
+
+	for (ring = atomic_load(&log_rings); ring; ring = ring->next)
+		if (atomic_load(&ring->head) != atomic_load(&ring->tail))
+			return 1;
+
+	return 0;
+}
+
+static void *log_writer(__maybe_unused void *data)
+{
+	struct pollfd pfd = { .fd = log_efd, .events = POLLIN };
+	unsigned long request;
+	eventfd_t value;
+	sigset_t set;
+	int nr;
+
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	for (;;) {
+
+		request = atomic_load(&log_flush_request);
+
+		nr = log_drain();
+
+		if (nr && (__options & (TO_STDOUT | TO_STDERR))) {
+			fflush(stdout);
+			fflush(stderr);
+		}
+
+		if (request != log_flush_done) {
+			pthread_mutex_lock(&log_flush_lock);
+			log_flush_done = request;
+			pthread_cond_broadcast(&log_flush_cond);
+			pthread_mutex_unlock(&log_flush_lock);
+		}
+
+		if (nr)
+			continue;
+
+		if (atomic_load(&log_stop))
+			break;
+
+		/*
+		 * The threads wake up the writer only when it sleeps,
+		 * the rings are checked again after telling them
+		 */
+		atomic_store(&log_waiting, 1);
+
+		if (log_pending() || atomic_load(&log_flush_request) != log_flush_done) {
+			atomic_store(&log_waiting, 0);
+			continue;
+		}
+
+		if (poll(&pfd, 1, LOG_WRITER_TIMEOUT) > 0)
+			eventfd_read(log_efd, &value);
+
+		atomic_store(&log_waiting, 0);
+	}
+
+	return NULL;
+}
+
+static void log_wakeup(void)
+{
+	if (atomic_load(&log_waiting) && atomic_exchange(&log_waiting, 0))
+		eventfd_write(log_efd, 1);
+}
+
+static int log_ratelimit(struct log_site *site, unsigned long now, unsigned int *suppressed)
+{
+	unsigned long begin;
+
+	*suppressed = 0;
+
+	if (!site || !LOG_RATELIMIT_BURST)
+		return 0;
+
+	begin = __atomic_load_n(&site->begin, __ATOMIC_RELAXED);
+
+	if (now - begin >= LOG_RATELIMIT_INTERVAL &&
+	    __atomic_compare_exchange_n(&site->begin, &begin, now, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+		*suppressed = __atomic_exchange_n(&site->missed, 0, __ATOMIC_RELAXED);
+	}
+
+	if (__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED) < LOG_RATELIMIT_BURST)
+		return 0;
+
+	__atomic_fetch_add(&site->missed, 1, __ATOMIC_RELAXED);
+
+	return -1;
+}
+
+static void log_sync(struct log_record *record)
+{
+	pthread_mutex_lock(&log_sync_lock);
+	log_write(&log_sync_line, record);
+	pthread_mutex_unlock(&log_sync_lock);
+}
+
+extern void logit(struct log_site *site, unsigned int level, const char *log_prefix,
+		  const char *format, ...)
+{
+	struct log_record stack, *record = &stack;
+	struct log_ring *ring = NULL;
+	unsigned int tail, suppressed = 0;
+	unsigned long ts;
+	va_list args;
+	size_t len;
+
+	if (level >= LOG_LEVELS)
+		return;
+
+	if (level > __level)
+		return;
+
+	if (!format || !format[0])
+		return;
+
+	ts = timestamp();
+	len = strlen(format);
+
+	if (!log_partial)
+		log_suppress_line = log_ratelimit(site, ts, &suppressed);
+
+	log_partial = format[len - 1] != '\n';
+
+	if (log_suppress_line)
+		return;
+
+	if (atomic_load(&log_async))
+		ring = log_ring_get();
+
+	if (ring) {
+		tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+		/*
+		 * The thread does not wait for the writer
+		 */
+		if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) ==
+		    LOG_RING_SIZE) {
+			atomic_fetch_add(&ring->dropped, 1);
+			return;
+		}
+
+		record = &ring->records[tail % LOG_RING_SIZE];
+	}
+
+	record->timestamp = ts;
+	record->level = level;
+	record->prefix = log_prefix;
+	record->format = format;
+	record->suppressed = suppressed;
+
 	va_start(args, format);
-	vsnprintf(&buffer[idx], BUFFER_LOG_SIZE - idx, format, args);		
+	log_record_args(record, args);
 	va_end(args);
 
- 	if (__options & TO_SYSLOG)
-		syslog(level, "%s", buffer);
+	if (!ring) {
+		log_sync(record);
+		return;
+	}
 
-	if (__options & TO_STDERR)
-		fprintf(stderr, "%s", buffer);
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
 
-	if (__options & TO_STDOUT)
-		fprintf(stdout, "%s", buffer);
+	log_wakeup();
+}
+
+void log_flush(void)
+{
+	unsigned long request;
+
+	if (!atomic_load(&log_async))
+		return;
+
+	pthread_mutex_lock(&log_flush_lock);
+
+	request = atomic_fetch_add(&log_flush_request, 1) + 1;
+
+	atomic_store(&log_waiting, 0);
+	eventfd_write(log_efd, 1);
+
+	while ((long)(log_flush_done - request) < 0)
+		pthread_cond_wait(&log_flush_cond, &log_flush_lock);
 
-	buffer[0] = '\0';
+	pthread_mutex_unlock(&log_flush_lock);
+}
+
+static int log_writer_start(void)
+{
+	log_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (log_efd < 0)
+		return -1;
+
+	atomic_store(&log_stop, 0);
+
+	if (pthread_create(&log_writer_thread, NULL, log_writer, NULL)) {
+		close(log_efd);
+		log_efd = -1;
+		return -1;
+	}
+
+	atomic_store(&log_async, 1);
+
+	return 0;
 }
 
 int log_init(int level, const char *ident, int options)
 {
+	static int registered;
+
 	if (!options)
 		return -1;
 
@@ -119,10 +882,37 @@ int log_init(int level, const char *ident, int options)
 		setlogmask(LOG_UPTO(level));
 	}
 
+	/*
+	 * The messages are written synchronously if the writer can not
+	 * be started
+	 */
+	if (!atomic_load(&log_async) && log_writer_start())
+		fprintf(stderr, "Failed to start the log writer\n");
+
+	/*
+	 * The pending messages are written when exiting on an error
+	 */
+	if (!registered && !atexit(log_exit))
+		registered = 1;
+
 	return 0;
 }
 
 void log_exit(void)
 {
+	if (atomic_exchange(&log_async, 0)) {
+
+		atomic_store(&log_stop, 1);
+		eventfd_write(log_efd, 1);
+
+		pthread_join(log_writer_thread, NULL);
+
+		close(log_efd);
+		log_efd = -1;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
 	closelog();
 }
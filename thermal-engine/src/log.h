@@ -15,19 +15,76 @@
 #define LOG_PREFIX ""
 #endif
 
-extern void logit(unsigned int level, const char *log_prefix, const char *format, ...);
+/*
+ * The messages with a level above LOG_BUILD_LEVEL are removed at
+ * compile time, eg. -DLOG_BUILD_LEVEL=LOG_INFO drops the DEBUG ones
+ */
+#ifndef LOG_BUILD_LEVEL
+#define LOG_BUILD_LEVEL LOG_DEBUG
+#endif
+
+/*
+ * Each call site can emit LOG_RATELIMIT_BURST messages per
+ * LOG_RATELIMIT_INTERVAL milliseconds, the number of suppressed
+ * messages is reported when the call site logs again. A zero burst
+ * disables the rate limiting.
+ */
+#ifndef LOG_RATELIMIT_INTERVAL
+#define LOG_RATELIMIT_INTERVAL	1000
+#endif
+
+#ifndef LOG_RATELIMIT_BURST
+#define LOG_RATELIMIT_BURST	50
+#endif
 
-#define DEBUG(fmt, ...)		logit(LOG_DEBUG, LOG_PREFIX, fmt, ##__VA_ARGS__)
-#define INFO(fmt, ...)		logit(LOG_INFO, LOG_PREFIX, fmt, ##__VA_ARGS__)
-#define NOTICE(fmt, ...)	logit(LOG_NOTICE, LOG_PREFIX, fmt, ##__VA_ARGS__)
-#define WARN(fmt, ...)		logit(LOG_WARNING, LOG_PREFIX, fmt, ##__VA_ARGS__)
-#define ERROR(fmt, ...)		logit(LOG_ERR, LOG_PREFIX, fmt, ##__VA_ARGS__)
-#define CRITICAL(fmt, ...)	logit(LOG_CRIT, LOG_PREFIX, fmt, ##__VA_ARGS__)
-#define ALERT(fmt, ...)		logit(LOG_ALERT, LOG_PREFIX, fmt, ##__VA_ARGS__)
-#define EMERG(fmt, ...)		logit(LOG_EMERG, LOG_PREFIX, fmt, ##__VA_ARGS__)
+struct log_site {
+	unsigned long begin;
+	unsigned int count;
+	unsigned int missed;
+};
 
+/*
+ * The messages are formatted later by a background thread from a copy
+ * of their arguments, with these limits:
+ *  - at most 8 arguments, a '*' width or precision counts for one
+ *  - the '%s' strings of a message share 128 bytes
+ *  - a long double is copied as a double and loses its precision
+ * A message exceeding them is printed truncated, ending with "...".
+ */
+extern void logit(struct log_site *site, unsigned int level, const char *log_prefix,
+		  const char *format, ...);
+
+#define LOG(level, fmt, ...)						\
+	do {								\
+		if ((level) <= LOG_BUILD_LEVEL) {			\
+			static struct log_site __log_site;		\
+			logit(&__log_site, level, LOG_PREFIX, fmt,	\
+			      ##__VA_ARGS__);				\
+		}							\
+	} while (0)
+
+#define DEBUG(fmt, ...)		LOG(LOG_DEBUG, fmt, ##__VA_ARGS__)
+#define INFO(fmt, ...)		LOG(LOG_INFO, fmt, ##__VA_ARGS__)
+#define NOTICE(fmt, ...)	LOG(LOG_NOTICE, fmt, ##__VA_ARGS__)
+#define WARN(fmt, ...)		LOG(LOG_WARNING, fmt, ##__VA_ARGS__)
+#define ERROR(fmt, ...)		LOG(LOG_ERR, fmt, ##__VA_ARGS__)
+#define CRITICAL(fmt, ...)	LOG(LOG_CRIT, fmt, ##__VA_ARGS__)
+#define ALERT(fmt, ...)		LOG(LOG_ALERT, fmt, ##__VA_ARGS__)
+#define EMERG(fmt, ...)		LOG(LOG_EMERG, fmt, ##__VA_ARGS__)
+
+/*
+ * The messages are written by a background thread once log_init() is
+ * called, log_exit() writes the pending ones. It is also called at
+ * exit.
+ */
 int log_init(int level, const char *ident, int options);
 int log_str2level(const char *lvl);
 void log_exit(void);
 
+/*
+ * Wait for the messages already logged to be written, the formats of
+ * a plugin must not be unloaded before
+ */
+void log_flush(void);
+
 #endif
@@ -1,32 +1,114 @@
 // Copyright (C) 2022, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#include <stdint.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <signal.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
 
-#include "pair.h"
 #include "log.h"
+#include "cb_chain.h"
 #include "mainloop.h"
 
+/*
+ * The sources are stored in a table indexed by their fd, which grows
+ * when a higher fd is added. An entry without callback is unused.
+ *
+ * A callback may remove a source and add another one reusing the same
+ * fd while the events of the old one are still pending in the batch.
+ * Each source gets a generation number, passed with the fd in the
+ * epoll data, so these stale events are dropped.
+ */
 struct mainloop_data {
 	mainloop_callback_t cb;
 	void *data;
+	unsigned int events;
+	unsigned int generation;
+	unsigned long dispatched;
+};
+
+/*
+ * The timers are kept in a min-heap ordered by their deadline, the
+ * expiration plus the slack, and a single timerfd is armed with the
+ * deadline of the heap top. When it fires, all the timers already
+ * expired are run, even if their deadline is later, so the timers
+ * with some slack are coalesced with the others.
+ *
+ * Deleting a timer only marks it as cancelled, it is released when it
+ * reaches the top of the heap or when the cancelled timers take more
+ * than half of the heap.
+ */
+struct mainloop_timer {
+	long long expire;
+	long long deadline;
+	unsigned int period;
+	unsigned int slack;
+	int cancelled;
+	mainloop_timer_callback_t cb;
+	void *data;
+};
+
+struct mainloop_timers {
+	struct mainloop_timer **heap;
+	struct mainloop_timer *running;
+	int nr_timers;
+	int max_timers;
+	int nr_cancelled;
 	int fd;
 };
 
 struct mainloop {
 	int epfd;
 	int exit_mainloop;
-	struct pair events;
+	struct mainloop_data *sources;
+	int max_sources;
+	int nr_sources;
+	struct epoll_event *events;
+	int max_events;
+	struct mainloop_timers timers;
+	struct cb_chain flush;
+	unsigned long wakeups;
+	unsigned int generation;
 };
 
-#define MAX_EVENTS 10
+static inline uint64_t mainloop_event_data(int fd, unsigned int generation)
+{
+	return ((uint64_t)generation << 32) | (unsigned int)fd;
+}
+
+/*
+ * The events array starts small and doubles each time epoll fills it
+ * completely, up to the number of registered sources
+ */
+#define MIN_EVENTS 16
+#define MIN_SOURCES 16
+
+static void mainloop_events_grow(struct mainloop *mainloop)
+{
+	struct epoll_event *events;
+	int max = mainloop->max_events * 2;
+
+	if (mainloop->max_events >= mainloop->nr_sources)
+		return;
+
+	if (max > mainloop->nr_sources)
+		max = mainloop->nr_sources;
+
+	events = realloc(mainloop->events, sizeof(*events) * max);
+	if (!events)
+		return;
+
+	mainloop->events = events;
+	mainloop->max_events = max;
+}
 
 int mainloop(struct mainloop *mainloop, unsigned int timeout)
 {
-	int i, nfds;
-	struct epoll_event events[MAX_EVENTS];
+	int i, fd, nfds, stop;
+	unsigned int generation;
 	struct mainloop_data *md;
 
 	if (mainloop->epfd < 0)
@@ -34,64 +116,486 @@ int mainloop(struct mainloop *mainloop, unsigned int timeout)
 
 	for (;;) {
 
-		nfds = epoll_wait(mainloop->epfd, events, MAX_EVENTS, timeout);
+		nfds = epoll_wait(mainloop->epfd, mainloop->events,
+				  mainloop->max_events, timeout);
 		if (nfds < 0) {
 			if (errno == EINTR)
 				continue;
 			return -1;
 		}
 
-		for (i = 0; i < nfds; i++) {
-			md = events[i].data.ptr;
+		mainloop->wakeups++;
+
+		for (i = 0, stop = 0; i < nfds && !stop; i++) {
+			fd = (int)(mainloop->events[i].data.u64 & 0xffffffff);
+			generation = mainloop->events[i].data.u64 >> 32;
+
+			/*
+			 * A previous callback of the batch may have
+			 * removed this source or replaced it with
+			 * another one on the same fd
+			 */
+			if (fd >= mainloop->max_sources || !mainloop->sources[fd].cb)
+				continue;
+
+			md = &mainloop->sources[fd];
+			if (md->generation != generation)
+				continue;
+
+			md->dispatched++;
 
-			if (md->cb(md->fd, md->data) > 0)
-				return 0;
+			if (md->cb(fd, md->data) > 0)
+				stop = 1;
 		}
 
+		/*
+		 * The work deferred by the callbacks of this batch
+		 */
+		if (nfds)
+			cb_chain_run(nfds, &mainloop->flush);
+
+		if (stop)
+			return 0;
+
+		if (nfds == mainloop->max_events)
+			mainloop_events_grow(mainloop);
+
 		if (mainloop->exit_mainloop || !nfds)
 			return 0;
 	}
 }
 
-int mainloop_add(struct mainloop *mainloop, int fd,
-		 mainloop_callback_t cb, void *data)
+static int mainloop_sources_grow(struct mainloop *mainloop, int fd)
 {
-	struct epoll_event ev = {
-		.events = EPOLLIN,
-	};
+	struct mainloop_data *sources;
+	int max = mainloop->max_sources ? mainloop->max_sources : MIN_SOURCES;
 
+	while (max <= fd)
+		max *= 2;
+
+	sources = realloc(mainloop->sources, sizeof(*sources) * max);
+	if (!sources)
+		return -1;
+
+	memset(&sources[mainloop->max_sources], 0,
+	       sizeof(*sources) * (max - mainloop->max_sources));
+
+	mainloop->sources = sources;
+	mainloop->max_sources = max;
+
+	return 0;
+}
+
+int mainloop_add_events(struct mainloop *mainloop, int fd, unsigned int events,
+			mainloop_callback_t cb, void *data)
+{
+	struct epoll_event ev = { .events = events };
 	struct mainloop_data *md;
 
-	md = malloc(sizeof(*md));
-	if (!md)
+	if (fd < 0 || !cb)
+		return -1;
+
+	if (fd >= mainloop->max_sources && mainloop_sources_grow(mainloop, fd))
+		return -1;
+
+	md = &mainloop->sources[fd];
+	if (md->cb)
+		return -1;
+
+	ev.data.u64 = mainloop_event_data(fd, mainloop->generation + 1);
+
+	if (epoll_ctl(mainloop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
 		return -1;
 
 	md->data = data;
 	md->cb = cb;
-	md->fd = fd;
+	md->events = events;
+	md->generation = ++mainloop->generation;
+	md->dispatched = 0;
 
-	ev.data.ptr = md;
+	mainloop->nr_sources++;
 
-	if (epoll_ctl(mainloop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
-		free(md);
+	return 0;
+}
+
+int mainloop_add(struct mainloop *mainloop, int fd,
+		 mainloop_callback_t cb, void *data)
+{
+	return mainloop_add_events(mainloop, fd, EPOLLIN, cb, data);
+}
+
+int mainloop_mod(struct mainloop *mainloop, int fd, unsigned int events)
+{
+	struct epoll_event ev = { .events = events };
+
+	if (fd < 0 || fd >= mainloop->max_sources || !mainloop->sources[fd].cb)
 		return -1;
-	}
 
-	pair_add(&mainloop->events, fd, md);
-	
+	ev.data.u64 = mainloop_event_data(fd, mainloop->sources[fd].generation);
+
+	if (epoll_ctl(mainloop->epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+		return -1;
+
+	mainloop->sources[fd].events = events;
+
 	return 0;
 }
 
 int mainloop_del(struct mainloop *mainloop, int fd)
 {
-	if (epoll_ctl(mainloop->epfd, EPOLL_CTL_DEL, fd, NULL) < 0)
+	if (fd < 0 || fd >= mainloop->max_sources || !mainloop->sources[fd].cb)
 		return -1;
 
-	free(pair_find(&mainloop->events, fd));
-	
+	/*
+	 * The fd may already be closed, it is then removed from the
+	 * epoll set by the kernel
+	 */
+	if (epoll_ctl(mainloop->epfd, EPOLL_CTL_DEL, fd, NULL) < 0 && errno != EBADF)
+		return -1;
+
+	memset(&mainloop->sources[fd], 0, sizeof(mainloop->sources[fd]));
+
+	mainloop->nr_sources--;
+
 	return 0;
 }
 
+int mainloop_dispatched(struct mainloop *mainloop, int fd, unsigned long *dispatched)
+{
+	if (fd < 0 || fd >= mainloop->max_sources || !mainloop->sources[fd].cb)
+		return -1;
+
+	*dispatched = mainloop->sources[fd].dispatched;
+
+	return 0;
+}
+
+unsigned long mainloop_wakeups(struct mainloop *mainloop)
+{
+	return mainloop->wakeups;
+}
+
+int mainloop_for_each_source(struct mainloop *mainloop,
+			     int (*cb)(int fd, unsigned int events,
+				       unsigned long dispatched, void *arg),
+			     void *arg)
+{
+	struct mainloop_data *md;
+	int fd, ret = 0;
+
+	for (fd = 0; fd < mainloop->max_sources; fd++) {
+
+		md = &mainloop->sources[fd];
+		if (!md->cb)
+			continue;
+
+		ret |= cb(fd, md->events, md->dispatched, arg);
+	}
+
+	return ret;
+}
+
+static long long mainloop_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void mainloop_timer_swap(struct mainloop_timer **heap, int a, int b)
+{
+	struct mainloop_timer *timer = heap[a];
+
+	heap[a] = heap[b];
+	heap[b] = timer;
+}
+
+static void mainloop_timer_sift_up(struct mainloop_timers *timers, int i)
+{
+	struct mainloop_timer **heap = timers->heap;
+
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+
+		if (heap[parent]->deadline <= heap[i]->deadline)
+			break;
+
+		mainloop_timer_swap(heap, parent, i);
+		i = parent;
+	}
+}
+
+static void mainloop_timer_sift_down(struct mainloop_timers *timers, int i)
+{
+	struct mainloop_timer **heap = timers->heap;
+	int nr = timers->nr_timers;
+
+	for (;;) {
+		int left = 2 * i + 1, right = left + 1, min = i;
+
+		if (left < nr && heap[left]->deadline < heap[min]->deadline)
+			min = left;
+
+		if (right < nr && heap[right]->deadline < heap[min]->deadline)
+			min = right;
+
+		if (min == i)
+			break;
+
+		mainloop_timer_swap(heap, min, i);
+		i = min;
+	}
+}
+
+static int mainloop_timer_push(struct mainloop_timers *timers, struct mainloop_timer *timer)
+{
+	struct mainloop_timer **heap;
+	int max;
+
+	if (timers->nr_timers == timers->max_timers) {
+
+		max = timers->max_timers ? timers->max_timers * 2 : 8;
+
+		heap = realloc(timers->heap, sizeof(*heap) * max);
+		if (!heap)
+			return -1;
+
+		timers->heap = heap;
+		timers->max_timers = max;
+	}
+
+	timers->heap[timers->nr_timers++] = timer;
+
+	mainloop_timer_sift_up(timers, timers->nr_timers - 1);
+
+	return 0;
+}
+
+static struct mainloop_timer *mainloop_timer_pop(struct mainloop_timers *timers)
+{
+	struct mainloop_timer *timer = timers->heap[0];
+
+	timers->heap[0] = timers->heap[--timers->nr_timers];
+
+	mainloop_timer_sift_down(timers, 0);
+
+	return timer;
+}
+
+/*
+ * Release the cancelled timers and rebuild the heap with the others
+ */
+static void mainloop_timer_purge(struct mainloop_timers *timers)
+{
+	int i, nr = 0;
+
+	for (i = 0; i < timers->nr_timers; i++) {
+
+		if (timers->heap[i]->cancelled) {
+			free(timers->heap[i]);
+			continue;
+		}
+
+		timers->heap[nr++] = timers->heap[i];
+	}
+
+	timers->nr_timers = nr;
+	timers->nr_cancelled = 0;
+
+	for (i = nr / 2 - 1; i >= 0; i--)
+		mainloop_timer_sift_down(timers, i);
+}
+
+static int mainloop_timer_arm(struct mainloop_timers *timers)
+{
+	struct itimerspec its = { 0 };
+	struct mainloop_timer *timer;
+
+	/*
+	 * Drop the cancelled timers at the top so the timerfd is not
+	 * armed for nothing
+	 */
+	while (timers->nr_timers && timers->heap[0]->cancelled) {
+		free(mainloop_timer_pop(timers));
+		timers->nr_cancelled--;
+	}
+
+	/*
+	 * A zero value disarms the timer when the heap is empty
+	 */
+	if (timers->nr_timers) {
+		timer = timers->heap[0];
+		its.it_value.tv_sec = timer->deadline / 1000;
+		its.it_value.tv_nsec = (timer->deadline % 1000) * 1000000;
+
+		/*
+		 * An absolute time of zero disarms the timer, make sure
+		 * an already expired deadline fires
+		 */
+		if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+			its.it_value.tv_nsec = 1;
+	}
+
+	return timerfd_settime(timers->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void mainloop_timer_set(struct mainloop_timer *timer, long long expire)
+{
+	timer->expire = expire;
+	timer->deadline = expire + timer->slack;
+}
+
+static int mainloop_timer_handler(int fd, void *data)
+{
+	struct mainloop_timers *timers = data;
+	struct mainloop_timer *timer;
+	unsigned long long expirations;
+	long long now;
+	int ret = 0;
+
+	if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+		return -1;
+
+	now = mainloop_now();
+
+	while (timers->nr_timers) {
+
+		timer = timers->heap[0];
+
+		if (timer->cancelled) {
+			free(mainloop_timer_pop(timers));
+			timers->nr_cancelled--;
+			continue;
+		}
+
+		if (timer->expire > now)
+			break;
+
+		mainloop_timer_pop(timers);
+
+		timers->running = timer;
+
+		if (timer->cb(timer, timer->data) > 0)
+			ret = 1;
+
+		timers->running = NULL;
+
+		/*
+		 * The callback may have deleted its own timer
+		 */
+		if (!timer->period || timer->cancelled) {
+			free(timer);
+			continue;
+		}
+
+		/*
+		 * Missed periods are skipped rather than run in a burst
+		 */
+		mainloop_timer_set(timer, timer->expire + timer->period);
+		if (timer->expire <= now)
+			mainloop_timer_set(timer, now + timer->period);
+
+		if (mainloop_timer_push(timers, timer))
+			free(timer);
+	}
+
+	if (mainloop_timer_arm(timers))
+		return -1;
+
+	return ret;
+}
+
+struct mainloop_timer *mainloop_timer_add(struct mainloop *mainloop,
+					  unsigned int expire,
+					  unsigned int period,
+					  unsigned int slack,
+					  mainloop_timer_callback_t cb,
+					  void *data)
+{
+	struct mainloop_timers *timers = &mainloop->timers;
+	struct mainloop_timer *timer;
+
+	if (!cb)
+		return NULL;
+
+	if (timers->fd < 0) {
+
+		timers->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (timers->fd < 0)
+			return NULL;
+
+		if (mainloop_add(mainloop, timers->fd, mainloop_timer_handler, timers)) {
+			close(timers->fd);
+			timers->fd = -1;
+			return NULL;
+		}
+	}
+
+	timer = malloc(sizeof(*timer));
+	if (!timer)
+		return NULL;
+
+	timer->period = period;
+	timer->slack = slack;
+	timer->cancelled = 0;
+	timer->cb = cb;
+	timer->data = data;
+
+	mainloop_timer_set(timer, mainloop_now() + expire);
+
+	if (mainloop_timer_push(timers, timer)) {
+		free(timer);
+		return NULL;
+	}
+
+	/*
+	 * The timerfd is only reprogrammed when the new timer is the
+	 * next one to expire
+	 */
+	if (timers->heap[0] == timer && mainloop_timer_arm(timers)) {
+		timer->cancelled = 1;
+		timers->nr_cancelled++;
+		return NULL;
+	}
+
+	return timer;
+}
+
+void mainloop_timer_del(struct mainloop *mainloop, struct mainloop_timer *timer)
+{
+	struct mainloop_timers *timers = &mainloop->timers;
+
+	if (!timer || timer->cancelled)
+		return;
+
+	/*
+	 * The running timer is out of the heap, it is released when
+	 * its callback returns
+	 */
+	if (timer == timers->running) {
+		timer->cancelled = 1;
+		return;
+	}
+
+	timer->cancelled = 1;
+	timers->nr_cancelled++;
+
+	if (timers->nr_cancelled > timers->nr_timers / 2)
+		mainloop_timer_purge(timers);
+}
+
+int mainloop_flush_add(struct mainloop *mainloop, callback_t cb, void *data)
+{
+	return cb_chain_add(&mainloop->flush, cb, data);
+}
+
+void mainloop_flush_del(struct mainloop *mainloop, callback_t cb)
+{
+	cb_chain_remove(&mainloop->flush, cb);
+}
+
 struct mainloop *mainloop_init(void)
 {
 	struct mainloop *mainloop;
@@ -101,15 +605,31 @@ struct mainloop *mainloop_init(void)
 		return NULL;
 
 	mainloop->exit_mainloop = 0;
+	mainloop->sources = NULL;
+	mainloop->max_sources = 0;
+	mainloop->nr_sources = 0;
+	mainloop->timers.heap = NULL;
+	mainloop->timers.running = NULL;
+	mainloop->timers.nr_timers = 0;
+	mainloop->timers.max_timers = 0;
+	mainloop->timers.nr_cancelled = 0;
+	mainloop->timers.fd = -1;
+	cb_chain_init(&mainloop->flush);
 
-	mainloop->epfd = epoll_create(2);
+	mainloop->max_events = MIN_EVENTS;
+	mainloop->events = malloc(sizeof(*mainloop->events) * MIN_EVENTS);
+	if (!mainloop->events) {
+		free(mainloop);
+		return NULL;
+	}
+
+	mainloop->epfd = epoll_create1(EPOLL_CLOEXEC);
 	if (mainloop->epfd < 0) {
+		free(mainloop->events);
 		free(mainloop);
 		return NULL;
 	}
 
-	pair_init(&mainloop->events);
-	
 	return mainloop;
 }
 
@@ -120,6 +640,21 @@ void mainloop_exit(struct mainloop *mainloop)
 
 void mainloop_fini(struct mainloop *mainloop)
 {
+	int i;
+
+	for (i = 0; i < mainloop->timers.nr_timers; i++)
+		free(mainloop->timers.heap[i]);
+
+	free(mainloop->timers.heap);
+
+	if (mainloop->timers.fd >= 0) {
+		mainloop_del(mainloop, mainloop->timers.fd);
+		close(mainloop->timers.fd);
+	}
+
+	cb_chain_destroy(&mainloop->flush);
+	free(mainloop->sources);
+	free(mainloop->events);
 	close(mainloop->epfd);
 	free(mainloop);
 }
@@ -2,15 +2,68 @@
 #ifndef __THERMAL_ENGINE_MAINLOOP_H
 #define __THERMAL_ENGINE_MAINLOOP_H
 
+#include "cb_chain.h"
+
 typedef int (*mainloop_callback_t)(int fd, void *data);
 
 struct mainloop;
+struct mainloop_timer;
+
+typedef int (*mainloop_timer_callback_t)(struct mainloop_timer *timer, void *data);
 
 extern int mainloop(struct mainloop *mainloop, unsigned int timeout);
 extern int mainloop_add(struct mainloop *mainloop, int fd,
 			mainloop_callback_t cb, void *data);
 extern int mainloop_del(struct mainloop *mainloop, int fd);
+
+/*
+ * Register a source with an epoll events mask, for instance
+ * EPOLLPRI | EPOLLERR for a sysfs attribute or EPOLLIN | EPOLLET for an
+ * edge triggered source. mainloop_add() uses EPOLLIN.
+ */
+extern int mainloop_add_events(struct mainloop *mainloop, int fd, unsigned int events,
+			       mainloop_callback_t cb, void *data);
+extern int mainloop_mod(struct mainloop *mainloop, int fd, unsigned int events);
+
+/*
+ * Number of times the callback of a source was called
+ */
+extern int mainloop_dispatched(struct mainloop *mainloop, int fd,
+			       unsigned long *dispatched);
+extern int mainloop_for_each_source(struct mainloop *mainloop,
+				    int (*cb)(int fd, unsigned int events,
+					      unsigned long dispatched, void *arg),
+				    void *arg);
 extern void mainloop_exit(struct mainloop *mainloop);
+
+/*
+ * Number of times epoll_wait() returned, with or without sources ready
+ */
+extern unsigned long mainloop_wakeups(struct mainloop *mainloop);
+
+/*
+ * Flush callbacks are called once per mainloop iteration, after the
+ * callbacks of all the sources ready in the iteration, with the
+ * number of these sources as id. They process the work accumulated
+ * by the callbacks of the iteration at once.
+ */
+extern int mainloop_flush_add(struct mainloop *mainloop, callback_t cb, void *data);
+extern void mainloop_flush_del(struct mainloop *mainloop, callback_t cb);
+
+/*
+ * Timers: 'expire' is the delay in ms before the first expiration,
+ * 'period' the interval in ms of a periodic timer or zero for a one
+ * shot timer. The callback can be delayed by up to 'slack' ms to run
+ * with other timers in the same wakeup. A one shot timer is released
+ * after its callback returns, it must not be deleted afterwards.
+ */
+extern struct mainloop_timer *mainloop_timer_add(struct mainloop *mainloop,
+						 unsigned int expire,
+						 unsigned int period,
+						 unsigned int slack,
+						 mainloop_timer_callback_t cb,
+						 void *data);
+extern void mainloop_timer_del(struct mainloop *mainloop, struct mainloop_timer *timer);
 extern void mainloop_fini(struct mainloop *mainloop);
 extern struct mainloop *mainloop_init(void);
 
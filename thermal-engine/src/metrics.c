@@ -0,0 +1,459 @@
+// Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <thermal.h>
+
+#include "thermal-engine.h"
+#include "options.h"
+#include "mainloop.h"
+#include "threshold.h"
+#include "plugin.h"
+#include "metrics.h"
+#include "trace.h"
+#include "log.h"
+
+/*
+ * The metrics are served on a unix socket: a snapshot is written to
+ * each client when it connects and the connection is closed, eg.
+ * 'socat - UNIX-CONNECT:<path>'
+ *
+ * The snapshot not fitting in the socket buffer is kept with the
+ * client, the rest is sent when the socket is writable again.
+ */
+struct metrics {
+	int fd;
+	const char *path;
+	struct mainloop *ml;
+	struct list clients;
+};
+
+struct metrics_client {
+	int fd;
+	char *buffer;
+	size_t len;
+	size_t sent;
+	struct metrics *metrics;
+	struct list list;
+};
+
+__thread struct metrics_counters *__metrics_counters;
+
+/*
+ * The list only grows at its head, the reader can walk it while a
+ * thread adds its counters
+ */
+static struct metrics_counters *metrics_counters;
+
+struct metrics_counters *metrics_counters_alloc(void)
+{
+	struct metrics_counters *mc;
+
+	mc = aligned_alloc(__alignof__(*mc), sizeof(*mc));
+	if (!mc)
+		return NULL;
+
+	memset(mc, 0, sizeof(*mc));
+
+	mc->next = __atomic_load_n(&metrics_counters, __ATOMIC_RELAXED);
+
+	while (!__atomic_compare_exchange_n(&metrics_counters, &mc->next, mc, 1,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	__metrics_counters = mc;
+
+	return mc;
+}
+
+unsigned long metrics_read(enum metrics_counter counter)
+{
+	struct metrics_counters *mc;
+	unsigned long value = 0;
+
+	for (mc = __atomic_load_n(&metrics_counters, __ATOMIC_ACQUIRE); mc; mc = mc->next)
+		value += __atomic_load_n(&mc->counter[counter], __ATOMIC_RELAXED);
+
+	return value;
+}
+
+static void metrics_header(FILE *f, const char *name, const char *type, const char *help)
+{
+	fprintf(f, "# HELP thermal_engine_%s %s\n", name, help);
+	fprintf(f, "# TYPE thermal_engine_%s %s\n", name, type);
+}
+
+static void metrics_counter(FILE *f, const char *name, const char *help,
+			    unsigned long value)
+{
+	metrics_header(f, name, "counter", help);
+	fprintf(f, "thermal_engine_%s %lu\n", name, value);
+}
+
+struct metrics_zone_data {
+	struct thermal_engine_data *ted;
+	FILE *f;
+};
+
+static int metrics_zone_show(int tz_id, unsigned long up, unsigned long down, void *data)
+{
+	struct metrics_zone_data *mzd = data;
+	struct thermal_zone *tz = thermal_zone_find_by_id(mzd->ted->tz, tz_id);
+	const char *name = tz ? tz->name : "";
+
+	fprintf(mzd->f, "thermal_engine_zone_crossings_total"
+		"{tz_id=\"%d\",zone=\"%s\",direction=\"up\"} %lu\n", tz_id, name, up);
+	fprintf(mzd->f, "thermal_engine_zone_crossings_total"
+		"{tz_id=\"%d\",zone=\"%s\",direction=\"down\"} %lu\n", tz_id, name, down);
+
+	return 0;
+}
+
+static void metrics_us(FILE *f, unsigned long long ns)
+{
+	fprintf(f, "%llu.%03llu\n", ns / 1000, ns % 1000);
+}
+
+static int metrics_trace_show(int tz_id, struct trace_histogram *stages, void *data)
+{
+	struct metrics_zone_data *mzd = data;
+	struct thermal_zone *tz = thermal_zone_find_by_id(mzd->ted->tz, tz_id);
+	const int quantiles[] = { 50, 90, 99 };
+	struct trace_histogram *h;
+	char labels[256];
+	int i, j;
+
+	for (i = 0; i < TRACE_STAGES; i++) {
+
+		h = &stages[i];
+
+		snprintf(labels, sizeof(labels), "tz_id=\"%d\",zone=\"%s\",stage=\"%s\"",
+			 tz_id, tz ? tz->name : "", trace_stage_name(i));
+
+		for (j = 0; j < (int)(sizeof(quantiles) / sizeof(quantiles[0])); j++) {
+			fprintf(mzd->f, "thermal_engine_trace_latency_us{%s,quantile=\"0.%d\"} ",
+				labels, quantiles[j]);
+			metrics_us(mzd->f, trace_percentile(h, quantiles[j]));
+		}
+
+		fprintf(mzd->f, "thermal_engine_trace_latency_us_sum{%s} ", labels);
+		metrics_us(mzd->f, h->sum);
+		fprintf(mzd->f, "thermal_engine_trace_latency_us_count{%s} %lu\n", labels, h->count);
+	}
+
+	return 0;
+}
+
+static void metrics_plugin_labels(struct plugin *plugin, char *labels, size_t size)
+{
+	snprintf(labels, size, "plugin=\"%s\",profile=\"%s\"",
+		 plugin->descriptor->compatibles[0], plugin->descriptor->profile);
+}
+
+static void metrics_plugin_actions_show(FILE *f, struct plugin *plugin)
+{
+	char labels[256];
+
+	metrics_plugin_labels(plugin, labels, sizeof(labels));
+
+	fprintf(f, "thermal_engine_plugin_actions_total{%s} %lu\n", labels,
+		__atomic_load_n(&plugin->latency.calls, __ATOMIC_RELAXED));
+}
+
+static void metrics_plugin_overruns_show(FILE *f, struct plugin *plugin)
+{
+	char labels[256];
+
+	metrics_plugin_labels(plugin, labels, sizeof(labels));
+
+	fprintf(f, "thermal_engine_plugin_overruns_total{%s} %lu\n", labels,
+		__atomic_load_n(&plugin->latency.overruns, __ATOMIC_RELAXED));
+}
+
+static void metrics_plugin_latency_show(FILE *f, struct plugin *plugin)
+{
+	struct plugin_latency *l = &plugin->latency;
+	unsigned long count = 0;
+	char labels[256];
+	int i;
+
+	metrics_plugin_labels(plugin, labels, sizeof(labels));
+
+	/*
+	 * The bucket 'n' counts the calls between 2^(n-1) and 2^n - 1
+	 * us, the last one counts the longer calls. The total is the
+	 * sum of the buckets, so it is consistent with them while the
+	 * plugin is running.
+	 */
+	for (i = 0; i < PLUGIN_LATENCY_BUCKETS - 1; i++) {
+		count += __atomic_load_n(&l->histogram[i], __ATOMIC_RELAXED);
+		fprintf(f, "thermal_engine_plugin_latency_us_bucket{%s,le=\"%llu\"} %lu\n",
+			labels, (1ULL << i) - 1, count);
+	}
+
+	count += __atomic_load_n(&l->histogram[i], __ATOMIC_RELAXED);
+
+	fprintf(f, "thermal_engine_plugin_latency_us_bucket{%s,le=\"+Inf\"} %lu\n",
+		labels, count);
+	fprintf(f, "thermal_engine_plugin_latency_us_sum{%s} %llu\n", labels,
+		__atomic_load_n(&l->total, __ATOMIC_RELAXED));
+	fprintf(f, "thermal_engine_plugin_latency_us_count{%s} %lu\n", labels, count);
+}
+
+/*
+ * Called from the mainloop thread, the counters of the mainloop, of
+ * the thresholds and of the netlink sockets are not changing. The
+ * latencies of a plugin are updated by the thread running its
+ * actions, they are read atomically.
+ */
+int metrics_show(struct thermal_engine_data *ted, FILE *f)
+{
+	struct metrics_zone_data mzd = { .ted = ted, .f = f };
+	unsigned long received = 0, overruns = 0;
+	struct list *l;
+
+	if (ted->ml)
+		metrics_counter(f, "mainloop_wakeups_total",
+				"Number of mainloop wakeups", mainloop_wakeups(ted->ml));
+
+	if (ted->th && !thermal_nl_stats(ted->th, &received, &overruns)) {
+		metrics_counter(f, "netlink_messages_received_total",
+				"Number of thermal netlink messages received", received);
+		metrics_counter(f, "netlink_overruns_total",
+				"Number of times thermal netlink messages were dropped",
+				overruns);
+	}
+
+	metrics_counter(f, "sysfs_writes_total", "Number of sysfs writes issued",
+			metrics_read(METRICS_SYSFS_WRITES));
+	metrics_counter(f, "sysfs_writes_elided_total",
+			"Number of sysfs writes skipped as the value did not change",
+			metrics_read(METRICS_SYSFS_ELIDED));
+
+	if (ted->thresholds) {
+		metrics_header(f, "zone_crossings_total", "counter",
+			       "Number of thresholds crossed");
+		threshold_for_each_zone(ted->thresholds, metrics_zone_show, &mzd);
+	}
+
+	metrics_header(f, "trace_latency_us", "summary",
+		       "Latency of the threshold crossing stages from the netlink event");
+	trace_for_each_zone(metrics_trace_show, &mzd);
+
+	if (!ted->plugins)
+		return 0;
+
+	/*
+	 * The samples of a metric family follow its header
+	 */
+	metrics_header(f, "plugin_actions_total", "counter",
+		       "Number of plugin callbacks called");
+	for (l = list_next(ted->plugins); l; l = list_next(l))
+		metrics_plugin_actions_show(f, container_of(l, struct plugin, list));
+
+	metrics_header(f, "plugin_overruns_total", "counter",
+		       "Number of plugin callbacks exceeding the latency budget");
+	for (l = list_next(ted->plugins); l; l = list_next(l))
+		metrics_plugin_overruns_show(f, container_of(l, struct plugin, list));
+
+	metrics_header(f, "plugin_latency_us", "histogram",
+		       "Latency of the plugin callbacks in microseconds");
+	for (l = list_next(ted->plugins); l; l = list_next(l))
+		metrics_plugin_latency_show(f, container_of(l, struct plugin, list));
+
+	return 0;
+}
+
+static void metrics_client_free(struct metrics_client *client)
+{
+	list_del(&client->metrics->clients, &client->list);
+	close(client->fd);
+	free(client->buffer);
+	free(client);
+}
+
+/*
+ * The mainloop must not block on a client which does not read, the
+ * snapshot is sent as long as the socket accepts it. Returns 1 when
+ * there is more to send.
+ */
+static int metrics_send(struct metrics_client *client)
+{
+	ssize_t ret;
+
+	while (client->sent < client->len) {
+
+		ret = send(client->fd, client->buffer + client->sent,
+			   client->len - client->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 1;
+			return -1;
+		}
+
+		client->sent += ret;
+	}
+
+	return 0;
+}
+
+static int metrics_client_handler(int fd, void *data)
+{
+	struct metrics_client *client = data;
+	int ret;
+
+	ret = metrics_send(client);
+	if (ret > 0)
+		return 0;
+
+	if (ret < 0)
+		WARN("Failed to send the metrics: %s\n", strerror(errno));
+
+	mainloop_del(client->metrics->ml, fd);
+	metrics_client_free(client);
+
+	return 0;
+}
+
+static int metrics_handler(int fd, void *data)
+{
+	struct thermal_engine_data *ted = data;
+	struct metrics_client *client;
+	FILE *f;
+	int ret;
+
+	fd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	client = calloc(1, sizeof(*client));
+	if (!client) {
+		close(fd);
+		return 0;
+	}
+
+	client->fd = fd;
+	client->metrics = ted->metrics;
+	list_add_tail(&client->metrics->clients, &client->list);
+
+	f = open_memstream(&client->buffer, &client->len);
+	if (!f)
+		goto out_free;
+
+	metrics_show(ted, f);
+
+	fclose(f);
+
+	ret = metrics_send(client);
+	if (ret < 0)
+		WARN("Failed to send the metrics: %s\n", strerror(errno));
+
+	if (ret <= 0)
+		goto out_free;
+
+	if (mainloop_add_events(ted->ml, fd, EPOLLOUT, metrics_client_handler, client))
+		goto out_free;
+
+	return 0;
+
+out_free:
+	metrics_client_free(client);
+
+	return 0;
+}
+
+int thermal_engine_metrics_init(struct thermal_engine_data *ted)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct metrics *metrics;
+	const char *path = ted->options->metrics;
+
+	if (!path)
+		return 0;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		ERROR("Metrics socket path too long '%s'\n", path);
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	metrics = malloc(sizeof(*metrics));
+	if (!metrics)
+		return -1;
+
+	metrics->path = path;
+	metrics->ml = ted->ml;
+	list_init(&metrics->clients);
+
+	metrics->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (metrics->fd < 0)
+		goto out_free;
+
+	/*
+	 * A stale socket left by a previous instance
+	 */
+	unlink(path);
+
+	if (bind(metrics->fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		ERROR("Failed to bind the metrics socket '%s': %s\n", path,
+		      strerror(errno));
+		goto out_close;
+	}
+
+	if (listen(metrics->fd, SOMAXCONN))
+		goto out_unlink;
+
+	if (mainloop_add(ted->ml, metrics->fd, metrics_handler, ted))
+		goto out_unlink;
+
+	ted->metrics = metrics;
+
+	INFO("Metrics available on '%s'\n", path);
+
+	return 0;
+
+out_unlink:
+	unlink(path);
+out_close:
+	close(metrics->fd);
+out_free:
+	free(metrics);
+
+	return -1;
+}
+
+void thermal_engine_metrics_exit(struct thermal_engine_data *ted)
+{
+	struct metrics *metrics = ted->metrics;
+
+	if (!metrics)
+		return;
+
+	/*
+	 * The clients which did not read their snapshot yet
+	 */
+	while (list_next(&metrics->clients)) {
+		struct metrics_client *client = container_of(list_next(&metrics->clients),
+							     struct metrics_client, list);
+
+		mainloop_del(ted->ml, client->fd);
+		metrics_client_free(client);
+	}
+
+	mainloop_del(ted->ml, metrics->fd);
+	close(metrics->fd);
+	unlink(metrics->path);
+	free(metrics);
+
+	ted->metrics = NULL;
+}
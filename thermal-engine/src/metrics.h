@@ -0,0 +1,64 @@
+/* Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org> */
+#ifndef __THERMAL_ENGINE_METRICS_H
+#define __THERMAL_ENGINE_METRICS_H
+
+#include <stdio.h>
+
+struct thermal_engine_data;
+
+/*
+ * The counters of the events happening in any thread, the ones owned
+ * by the mainloop thread are kept by their module
+ */
+enum metrics_counter {
+	METRICS_SYSFS_WRITES,
+	METRICS_SYSFS_ELIDED,
+	METRICS_MAX,
+};
+
+/*
+ * Each thread has its own counters, allocated the first time the
+ * thread counts something and never freed: a thread only writes its
+ * counters, incrementing them does not take a lock nor share a cache
+ * line with the other threads, and the reader sums all of them
+ */
+struct metrics_counters {
+	unsigned long counter[METRICS_MAX];
+	struct metrics_counters *next;
+} __attribute__((aligned(64)));
+
+extern __thread struct metrics_counters *__metrics_counters;
+
+extern struct metrics_counters *metrics_counters_alloc(void);
+
+static inline void metrics_add(enum metrics_counter counter, unsigned long value)
+{
+	struct metrics_counters *mc = __metrics_counters;
+
+	if (!mc) {
+		mc = metrics_counters_alloc();
+		if (!mc)
+			return;
+	}
+
+	/*
+	 * Only this thread writes the counter, the atomic store is a
+	 * plain store which can not be torn for the reader
+	 */
+	__atomic_store_n(&mc->counter[counter], mc->counter[counter] + value,
+			 __ATOMIC_RELAXED);
+}
+
+static inline void metrics_inc(enum metrics_counter counter)
+{
+	metrics_add(counter, 1);
+}
+
+extern unsigned long metrics_read(enum metrics_counter counter);
+
+/*
+ * Write the metrics in the Prometheus text format
+ */
+extern int metrics_show(struct thermal_engine_data *ted, FILE *f);
+
+#endif
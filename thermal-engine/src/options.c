@@ -17,7 +17,13 @@ static void usage(const char *cmd)
 	printf("\t-l <level>, --loglevel <level>\tlog level: ");
 	printf("DEBUG, INFO, NOTICE, WARN, ERROR\n");
 	printf("\t-c <config_file>, --config <config_file\n");
+	printf("\t-k <cache_file>, --cache <cache_file>\tcompiled configuration, ");
+	printf("rebuilt when the configuration or the thermal zones change\n");
+	printf("\t-m <socket>, --metrics <socket>\tserve the metrics on a unix socket\n");
+	printf("\t-C <socket>, --control <socket>\tswitch the profile through a unix socket\n");
 	printf("\t-s, --syslog\t\toutput to syslog\n");
+	printf("\t-w <nr>, --workers <nr>\tnumber of threads running the plugin actions, ");
+	printf("0 runs them in the mainloop\n");
 	printf("\n");
 	exit(0);
 }
@@ -38,6 +44,10 @@ int thermal_engine_options_init(int argc, char *argv[], struct thermal_engine_da
 		{ "syslog",	no_argument, NULL, 's' },
 		{ "loglevel",	required_argument, NULL, 'l' },
 		{ "config",	required_argument, NULL, 'c' },
+		{ "cache",	required_argument, NULL, 'k' },
+		{ "metrics",	required_argument, NULL, 'm' },
+		{ "control",	required_argument, NULL, 'C' },
+		{ "workers",	required_argument, NULL, 'w' },
 		{ 0, 0, 0, 0 }
 	};
 
@@ -50,6 +60,7 @@ int thermal_engine_options_init(int argc, char *argv[], struct thermal_engine_da
 	options->config = CONFIG;
 	options->loglevel = LOG_INFO;
 	options->logopt = TO_STDOUT;
+	options->workers = -1;
 
 	ted->options = options;
 
@@ -57,7 +68,7 @@ int thermal_engine_options_init(int argc, char *argv[], struct thermal_engine_da
 
 		int optindex = 0;
 
-		opt = getopt_long(argc, argv, "c:l:dhs", long_options, &optindex);
+		opt = getopt_long(argc, argv, "c:k:l:m:C:w:dhs", long_options, &optindex);
 		if (opt == -1)
 			break;
 
@@ -65,12 +76,24 @@ int thermal_engine_options_init(int argc, char *argv[], struct thermal_engine_da
 		case 'c':
 			options->config = optarg;
 			break;
+		case 'k':
+			options->cache = optarg;
+			break;
+		case 'm':
+			options->metrics = optarg;
+			break;
+		case 'C':
+			options->control = optarg;
+			break;
 		case 'l':
 			options->loglevel = log_str2level(optarg);
 			break;
 		case 'd':
 			options->daemonize = 1;
 			break;
+		case 'w':
+			options->workers = atoi(optarg);
+			break;
 		case 's':
 			options->logopt = TO_SYSLOG;
 			break;
@@ -2,9 +2,13 @@
 #define __THERMAL_ENGINE_OPTIONS_H
 struct options {
 	const char *config;
+	const char *cache;
+	const char *metrics;
+	const char *control;
 	int loglevel;
 	int logopt;
 	int interactive;
 	int daemonize;
+	int workers;
 };
 #endif
@@ -1,112 +1,214 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #include "pair.h"
 
-static struct pair *pair_next(struct pair *pair)
-{
-	struct list *l;
+/*
+ * The index slots contain the position of the entry in the entries
+ * array, or one of these values
+ */
+#define PAIR_SLOT_EMPTY		-1
+#define PAIR_SLOT_REMOVED	-2
 
-	l = list_next(&pair->list);
-	if (!l)
-		return NULL;
+#define PAIR_MIN_BITS		3
 
-	return container_of(l, struct pair, list);
+static unsigned int pair_index_size(struct pair *pair)
+{
+	return 1U << pair->bits;
 }
 
-static struct pair *pair_prev(struct pair *pair)
+static unsigned int pair_hash(struct pair *pair, int key)
 {
-	struct list *l;
+	/*
+	 * Fibonacci hashing: the keys are often consecutive (fds,
+	 * states) or share the low bits (encoded thresholds), the
+	 * multiplication spreads them over the upper bits
+	 */
+	return ((unsigned int)key * 2654435769U) >> (32 - pair->bits);
+}
 
-	l = list_prev(&pair->list);
-	if (!l)
-		return NULL;
+/*
+ * Returns the slot of the key in the index or -1 if not found
+ */
+static int pair_lookup(struct pair *pair, int key)
+{
+	unsigned int mask, slot;
+	int pos;
 
-	return container_of(l, struct pair, list);
+	if (!pair || !pair->index)
+		return -1;
+
+	mask = pair_index_size(pair) - 1;
+
+	for (slot = pair_hash(pair, key); ; slot = (slot + 1) & mask) {
+
+		pos = pair->index[slot];
+
+		if (pos == PAIR_SLOT_EMPTY)
+			return -1;
+
+		if (pos >= 0 && pair->entries[pos].key == key)
+			return slot;
+	}
 }
 
-static struct pair *pair_tail(struct pair *pair)
+static void pair_index_insert(struct pair *pair, int key, int pos)
 {
-	struct list *l;
+	unsigned int mask = pair_index_size(pair) - 1;
+	unsigned int slot;
 
-	l = list_tail(&pair->list);
-	if (!l)
-		return NULL;
+	for (slot = pair_hash(pair, key); ; slot = (slot + 1) & mask) {
 
-	return container_of(l, struct pair, list);
+		if (pair->index[slot] < 0) {
+			pair->index[slot] = pos;
+			return;
+		}
+	}
 }
 
-static struct pair *__pair_find(struct pair *pair, int key)
+/*
+ * Rebuild the index with 'bits' size and compact the entries array,
+ * the removed slots are dropped in both
+ */
+static int pair_resize(struct pair *pair, unsigned int bits, unsigned int max_entries)
 {
-	if (!pair)
-		return NULL;
+	struct pair_entry *entries;
+	unsigned int i, nr = 0;
+	int *index;
+
+	entries = malloc(sizeof(*entries) * max_entries);
+	if (!entries)
+		return -ENOMEM;
 
-	pair = pair_next(pair);
+	index = malloc(sizeof(*index) << bits);
+	if (!index) {
+		free(entries);
+		return -ENOMEM;
+	}
 
-	while (pair) {
-		if (pair->key == key)
-			return pair;
+	memset(index, 0xff, sizeof(*index) << bits);
 
-		pair = pair_next(pair);
+	for (i = 0; i < pair->nr_entries; i++) {
+		if (pair->entries[i].data)
+			entries[nr++] = pair->entries[i];
 	}
 
-	return NULL;
+	free(pair->entries);
+	free(pair->index);
+
+	pair->entries = entries;
+	pair->index = index;
+	pair->nr_entries = nr;
+	pair->nr_removed = 0;
+	pair->max_entries = max_entries;
+	pair->bits = bits;
+
+	for (i = 0; i < nr; i++)
+		pair_index_insert(pair, entries[i].key, i);
+
+	return 0;
+}
+
+static int pair_grow(struct pair *pair)
+{
+	unsigned int used = pair->nr_entries - pair->nr_removed;
+	unsigned int bits = PAIR_MIN_BITS;
+
+	/*
+	 * The load factor, including the removed entries still
+	 * referenced by the index, is kept below 3/4
+	 */
+	while ((used + 1) * 4 > (3U << bits))
+		bits++;
+
+	return pair_resize(pair, bits, (3U << bits) / 4);
 }
 
 void *pair_find(struct pair *pair, int key)
 {
-	pair = __pair_find(pair, key);
-	if (!pair)
+	int slot;
+
+	slot = pair_lookup(pair, key);
+	if (slot < 0)
 		return NULL;
 
-	return pair->data;
+	return pair->entries[pair->index[slot]].data;
 }
 
 int pair_add(struct pair *pair, int key, void *data)
 {
-	struct pair *p;
+	int ret;
 
 	if (!pair)
 		return -EINVAL;
 
-	p = __pair_find(pair, key);
-	if (p)
+	if (pair_lookup(pair, key) >= 0)
 		return -EEXIST;
 
 	if (!data)
 		return -EINVAL;
 
-	p = malloc(sizeof(*p));
-	if (!p)
-		return -ENOMEM;
+	if (pair->nr_entries == pair->max_entries) {
+		ret = pair_grow(pair);
+		if (ret)
+			return ret;
+	}
 
-	p->key = key;
-	p->data = data;
+	pair->entries[pair->nr_entries].key = key;
+	pair->entries[pair->nr_entries].data = data;
+
+	pair_index_insert(pair, key, pair->nr_entries);
+
+	pair->nr_entries++;
 
-	list_add_tail(&pair->list, &p->list);
-	
 	return 0;
 }
 
 void pair_remove(struct pair *pair, int key)
 {
-	struct pair *p;
+	int slot;
 
-	p = __pair_find(pair, key);
-	if (!p)
+	slot = pair_lookup(pair, key);
+	if (slot < 0)
 		return;
 
-	list_remove(&p->list);
-	
-	free(p);
+	/*
+	 * The entry stays in the array with a NULL data, so an
+	 * iteration in progress is not disturbed
+	 */
+	pair->entries[pair->index[slot]].data = NULL;
+	pair->index[slot] = PAIR_SLOT_REMOVED;
+	pair->nr_removed++;
+}
+
+int pair_for_each(struct pair *pair, int (*cb)(int key, void *data, void *arg), void *arg)
+{
+	unsigned int i;
+	int ret;
+
+	if (!pair)
+		return -EINVAL;
+
+	for (i = 0; i < pair->nr_entries; i++) {
+
+		if (!pair->entries[i].data)
+			continue;
+
+		ret = cb(pair->entries[i].key, pair->entries[i].data, arg);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
 }
 
 void pair_init(struct pair *pair)
 {
 	if (pair)
-		list_init(&pair->list);
+		memset(pair, 0, sizeof(*pair));
 }
 
 void pair_destroy(struct pair *pair)
@@ -114,12 +216,8 @@ void pair_destroy(struct pair *pair)
 	if (!pair)
 		return;
 
-	pair = pair_tail(pair);
+	free(pair->entries);
+	free(pair->index);
 
-	while (pair && pair_prev(pair)) {
-		struct pair *p = pair;
-		list_remove(&pair->list);
-		pair = pair_prev(pair);
-		free(p);
-	};
+	pair_init(pair);
 }
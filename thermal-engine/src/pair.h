@@ -1,17 +1,32 @@
 #ifndef __PAIR_H__
 #define __PAIR_H__
 
-#include "list.h"
-
-struct pair {
+/*
+ * Associative container of pointers indexed by an integer key.
+ *
+ * The entries are stored contiguously in insertion order and indexed
+ * by an open addressing hash table, the lookups are O(1) on average
+ * and the iteration follows the insertion order. A removed entry
+ * leaves a hole in the array until the next resize compacts it.
+ */
+struct pair_entry {
 	int key;
 	void *data;
-	struct list list;
+};
+
+struct pair {
+	struct pair_entry *entries;
+	int *index;
+	unsigned int nr_entries;
+	unsigned int nr_removed;
+	unsigned int max_entries;
+	unsigned int bits;
 };
 
 void *pair_find(struct pair *pair, int key);
 int pair_add(struct pair *pair, int key, void *data);
 void pair_remove(struct pair *pair, int key);
+int pair_for_each(struct pair *pair, int (*cb)(int key, void *data, void *arg), void *arg);
 void pair_init(struct pair *pair);
 void pair_destroy(struct pair *pair);
 #endif /* __PAIR_H__ */
@@ -1,17 +1,27 @@
 #define _GNU_SOURCE
-#include <dirent.h>
 #include <dlfcn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
-#include <regex.h>
+
+#include <thermal.h>
+#include <probe.h>
 
 #include "log.h"
 #include "thermal-engine.h"
 #include "pair.h"
 #include "plugin.h"
 #include "config.h"
+#include "capability.h"
+#include "executor.h"
+#include "plugin_index.h"
+#include "metrics.h"
+#include "trace.h"
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(__array) (sizeof(__array)/sizeof(__array[0]))
@@ -31,6 +41,55 @@ struct plugin_power {
 	struct list devices;
 };
 
+/*
+ * The latency budget of the plugin callbacks in us, zero means no
+ * budget
+ */
+struct plugin_budget {
+	unsigned int budget;
+	enum plugin_overrun overrun;
+	unsigned int quarantine;
+};
+
+static struct plugin_budget plugin_budget = {
+	.budget = 0,
+	.overrun = PLUGIN_OVERRUN_LOG,
+	.quarantine = PLUGIN_QUARANTINE_DEFAULT,
+};
+
+/*
+ * The index of the plugin directory, built at the first lookup
+ */
+static struct plugin_index *plugin_index;
+
+/*
+ * The engine data gives the plugins access to the actuators handled
+ * by the libraries without having to deal with sysfs themselves
+ */
+static struct thermal_engine_data *__ted;
+
+/*
+ * The plugins built into the engine, the table is empty when the
+ * engine is built without them
+ */
+extern const struct plugin_builtin __start_te_plugins[] __attribute__((weak));
+extern const struct plugin_builtin __stop_te_plugins[] __attribute__((weak));
+
+static void plugin_setup(struct plugin *plugin)
+{
+	if (plugin->ops_v2 && plugin->ops_v2->version < PLUGIN_OPS_VERSION) {
+		WARN("Unsupported plugin ops version %u\n", plugin->ops_v2->version);
+		plugin->ops_v2 = NULL;
+	}
+
+	memset(&plugin->latency, 0, sizeof(plugin->latency));
+	plugin->overruns = 0;
+	plugin->quarantined = 0;
+	plugin->key = (unsigned long)plugin;
+
+	plugin->private = plugin->ops->init();
+}
+
 static int plugin_init(struct plugin *plugin, void *handle)
 {
 	plugin->handle = handle;
@@ -41,7 +100,9 @@ static int plugin_init(struct plugin *plugin, void *handle)
 		return -1;
 	}
 
-	plugin->private = plugin->ops->init();
+	plugin->ops_v2 = (typeof(plugin->ops_v2))dlsym(handle, "plugin_ops_v2");
+
+	plugin_setup(plugin);
 
 	return 0;
 }
@@ -123,6 +184,8 @@ static struct plugin *plugin_load(const char *lib, const char *compatible,
 		goto out_free_plugin;
 	}
 
+	plugin->lib = strdup(lib);
+
 	INFO("Loaded plugin compatible='%s', profile='%s', version='%s'\n",
 	     compatible, profile, version);
 	
@@ -153,6 +216,21 @@ struct plugin_power *plugin_power_alloc(unsigned int power)
 
 void plugin_power_free(struct plugin_power *pwr)
 {
+	struct plugin_device *dev;
+	struct list *l;
+
+	if (!pwr)
+		return;
+
+	for (l = list_next(&pwr->devices); l; ) {
+
+		dev = container_of(l, struct plugin_device, list);
+		l = list_next(l);
+
+		free((char *)dev->device);
+		free(dev);
+	}
+
 	free(pwr);
 }
 
@@ -183,51 +261,184 @@ int plugin_power_limit(struct plugin_power *pwr)
 	return pwr->power;
 }
 
+int plugin_power_nr_devices(struct plugin_power *pwr)
+{
+	struct list *l;
+	int nr = 0;
+
+	for (l = list_next(&pwr->devices); l; l = list_next(l))
+		nr++;
+
+	return nr;
+}
+
+int plugin_power_for_each_device(struct plugin_power *pwr,
+				 int (*cb)(const char *device, void *data), void *data)
+{
+	struct list *l;
+	int ret = 0;
+
+	for (l = list_next(&pwr->devices); l; l = list_next(l))
+		ret |= cb(container_of(l, struct plugin_device, list)->device, data);
+
+	return ret;
+}
+
+int plugin_cdev_get_id(const char *name)
+{
+	struct thermal_cdev *cdev;
+
+	if (!__ted)
+		return -1;
+
+	cdev = thermal_cdev_find_by_name(__ted->cdev, name);
+	if (!cdev)
+		return -1;
+
+	return cdev->id;
+}
+
+int plugin_cdev_set_state(int cdev_id, int state)
+{
+	struct thermal_cdev_request req = { .id = cdev_id, .state = state };
+
+	return plugin_cdev_set_states(&req, 1) < 0 ? -1 : 0;
+}
+
+/*
+ * The library does not write the state of a cooling device already in
+ * the requested state
+ */
+int plugin_cdev_set_states(struct thermal_cdev_request *req, int nr)
+{
+	int ret;
+
+	if (!__ted)
+		return -1;
+
+	ret = thermal_cdev_set_states(__ted->th, req, nr);
+	if (ret < 0)
+		return ret;
+
+	metrics_add(METRICS_SYSFS_WRITES, ret);
+	metrics_add(METRICS_SYSFS_ELIDED, nr - ret);
+
+	if (ret)
+		trace_actuator();
+
+	return ret;
+}
+
+int plugin_cpu_best(void)
+{
+	if (!__ted)
+		return -1;
+
+	return capability_best(__ted->capabilities);
+}
+
+int plugin_cpu_capability(int cpu, int *performance, int *efficiency)
+{
+	struct thermal_cpu_capability cap;
+
+	if (!__ted)
+		return -1;
+
+	if (capability_get(__ted->capabilities, cpu, &cap))
+		return -1;
+
+	*performance = cap.performance;
+	*efficiency = cap.efficiency;
+
+	return 0;
+}
+
+struct plugin_open_data {
+	const char *compatible;
+	const char *profile;
+	const char *version;
+	struct plugin *plugin;
+};
+
+static int __plugin_open(const char *lib, void *data)
+{
+	struct plugin_open_data *pod = data;
+
+	pod->plugin = plugin_load(lib, pod->compatible, pod->profile, pod->version);
+
+	return pod->plugin ? 1 : 0;
+}
+
+static struct plugin *plugin_builtin_open(const char *compatible, const char *profile,
+					  const char *version)
+{
+	const struct plugin_builtin *builtin;
+	struct plugin *plugin;
+
+	for (builtin = __start_te_plugins; builtin < __stop_te_plugins; builtin++) {
+
+		if (plugin_match(builtin->descriptor, compatible, profile, version))
+			continue;
+
+		plugin = malloc(sizeof(*plugin));
+		if (!plugin)
+			return NULL;
+
+		plugin->handle = NULL;
+		plugin->lib = NULL;
+		plugin->descriptor = builtin->descriptor;
+		plugin->ops = builtin->ops;
+		plugin->ops_v2 = builtin->ops_v2;
+
+		plugin_setup(plugin);
+
+		INFO("Loaded built-in plugin compatible='%s', profile='%s', version='%s'\n",
+		     compatible, profile, version);
+
+		return plugin;
+	}
+
+	return NULL;
+}
+
+/*
+ * The built-in plugins are looked up first, then only the shared
+ * objects whose indexed descriptor matches are loaded
+ */
 struct plugin *plugin_open(const char *path, const char *compatible,
 			   const char *profile, const char *version)
 {
-	struct plugin *plugin = NULL;
-	struct dirent *dirent;
-	regex_t regex;
-	DIR *dir;
+	struct plugin_open_data pod = {
+		.compatible = compatible,
+		.profile = profile,
+		.version = version,
+		.plugin = NULL,
+	};
 
 	if (!compatible) {
 		ERROR("Plugin 'compatible' is missing\n");
 		return NULL;
 	}
-	
-	dir = opendir(path);
-	if (!dir) {
-		ERROR("Failed to open plugin directory '%s'\n", path);
-		return NULL;
-	}
-
-	if (regcomp(&regex, ".*\\.so$", REG_NOSUB))
-		return NULL;
-	
-	while ((dirent = readdir(dir))) {
-
-		char *abspath;
-		
-		if (regexec(&regex, dirent->d_name, 0, NULL, 0) == REG_NOMATCH)
-			continue;
-
-		if (asprintf(&abspath, "%s/%s", path, dirent->d_name) == -1)
-			break;
 
-		plugin = plugin_load(abspath, compatible, profile, version);
+	pod.plugin = plugin_builtin_open(compatible, profile, version);
+	if (pod.plugin)
+		return pod.plugin;
 
-		free(abspath);
-		
-		if (plugin)
-			break;
+	if (plugin_index && strcmp(plugin_index_path(plugin_index), path)) {
+		plugin_index_free(plugin_index);
+		plugin_index = NULL;
 	}
 
-	regfree(&regex);
+	if (!plugin_index) {
+		plugin_index = plugin_index_build(path);
+		if (!plugin_index)
+			return NULL;
+	}
 
-	closedir(dir);
+	plugin_index_for_each_match(plugin_index, compatible, profile, version,
+				    __plugin_open, &pod);
 
-	return plugin;
+	return pod.plugin;
 }
 
 void plugin_close(struct plugin *plugin)
@@ -236,51 +447,374 @@ void plugin_close(struct plugin *plugin)
 		return;
 
 	plugin->ops->exit(plugin->private);
-	dlclose(plugin->handle);
+
+	/*
+	 * The messages of the plugin refer to its string literals
+	 */
+	log_flush();
+
+	if (plugin->handle)
+		dlclose(plugin->handle);
+	free(plugin->lib);
 	free(plugin);
 }
 
+struct plugin_retire {
+	struct executor_job job;
+	struct plugin *plugin;
+};
+
+static int plugin_retire_run(__maybe_unused struct executor_job *job)
+{
+	return 0;
+}
+
+static void plugin_retire_done(struct executor_job *job, __maybe_unused int ret)
+{
+	struct plugin_retire *pr = container_of(job, struct plugin_retire, job);
+
+	DEBUG("Closing plugin '%s'\n", pr->plugin->descriptor->compatibles[0]);
+
+	plugin_close(pr->plugin);
+	free(pr);
+}
+
+/*
+ * The plugin can still have actions queued in the executor, they are
+ * serialized per plugin key, so a job queued behind them closes the
+ * plugin when they are done, before the actions of a reloaded instance
+ */
+void plugin_retire(struct executor *executor, struct plugin *plugin)
+{
+	struct plugin_retire *pr;
+
+	pr = malloc(sizeof(*pr));
+	if (!pr) {
+		WARN("Failed to close plugin '%s'\n", plugin->descriptor->compatibles[0]);
+		return;
+	}
+
+	pr->plugin = plugin;
+
+	if (!executor) {
+		plugin_retire_done(&pr->job, 0);
+		return;
+	}
+
+	executor_submit(executor, plugin->key, &pr->job,
+			plugin_retire_run, plugin_retire_done);
+}
+
+/*
+ * The plugin loaded for a configuration descriptor
+ */
+struct plugin *plugin_find(struct list *plugins, const char *compatible,
+			   const char *profile, const char *version)
+{
+	struct plugin *plugin;
+	struct list *l;
+
+	for (l = list_next(plugins); l; l = list_next(l)) {
+
+		plugin = container_of(l, struct plugin, list);
+
+		if (!plugin_match(plugin->descriptor, compatible, profile, version))
+			return plugin;
+	}
+
+	return NULL;
+}
+
+/*
+ * The dynamic loader returns the already loaded object when the path
+ * or the inode is the same, the new version is loaded from an
+ * anonymous copy instead
+ */
+static int plugin_copy(const char *lib)
+{
+	char buffer[BUFSIZ];
+	ssize_t len;
+	int fd, memfd;
+
+	fd = open(lib, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	memfd = memfd_create(basename(lib), MFD_CLOEXEC);
+	if (memfd < 0)
+		goto out;
+
+	while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+
+		if (write(memfd, buffer, len) != len) {
+			len = -1;
+			break;
+		}
+	}
+
+	if (len < 0) {
+		close(memfd);
+		memfd = -1;
+	}
+out:
+	close(fd);
+
+	return memfd;
+}
+
+void plugin_rescan(void)
+{
+	plugin_index_free(plugin_index);
+	plugin_index = NULL;
+}
+
+struct plugin *plugin_reload(struct plugin *plugin)
+{
+	struct plugin *new;
+	char *lib;
+	int fd;
+
+	if (!plugin->lib)
+		return NULL;
+
+	/*
+	 * The index describes the previous version of the object
+	 */
+	plugin_rescan();
+
+	fd = plugin_copy(plugin->lib);
+	if (fd < 0) {
+		ERROR("Failed to copy plugin '%s'\n", plugin->lib);
+		return NULL;
+	}
+
+	if (asprintf(&lib, "/proc/self/fd/%d", fd) == -1) {
+		close(fd);
+		return NULL;
+	}
+
+	new = plugin_load(lib, plugin->descriptor->compatibles[0],
+			  plugin->descriptor->profile, NULL);
+
+	free(lib);
+	close(fd);
+
+	if (!new)
+		return NULL;
+
+	free(new->lib);
+	new->lib = strdup(plugin->lib);
+	if (!new->lib) {
+		plugin_close(new);
+		return NULL;
+	}
+
+	/*
+	 * The actions of the new instance run after the ones still
+	 * queued for the old instance and after its retirement
+	 */
+	new->key = plugin->key;
+
+	return new;
+}
+
+/*
+ * The operation is reported by the plugin_dispatch and plugin_done
+ * probes, the thermal zone and the temperature are zero for a batch
+ */
 typedef enum {
 	TRIP_LOW,
 	TRIP_HIGH,
 	RESET,
+	TRIP_BATCH,
 } plugin_ops_t;
 
+int plugin_budget_set(unsigned int budget, const char *overrun, unsigned int quarantine)
+{
+	const char *overruns[] = {
+		[PLUGIN_OVERRUN_LOG] = "log",
+		[PLUGIN_OVERRUN_COUNT] = "count",
+		[PLUGIN_OVERRUN_QUARANTINE] = "quarantine",
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(overruns); i++) {
+
+		if (overrun && strcmp(overrun, overruns[i]))
+			continue;
+
+		plugin_budget.budget = budget;
+		plugin_budget.overrun = overrun ? i : PLUGIN_OVERRUN_LOG;
+		plugin_budget.quarantine = quarantine ? quarantine : PLUGIN_QUARANTINE_DEFAULT;
+
+		return 0;
+	}
+
+	ERROR("Unknown plugin overrun policy '%s'\n", overrun);
+
+	return -1;
+}
+
+static unsigned long long plugin_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int plugin_latency_bucket(unsigned long long latency)
+{
+	int bucket;
+
+	if (!latency)
+		return 0;
+
+	bucket = 64 - __builtin_clzll(latency);
+
+	return bucket < PLUGIN_LATENCY_BUCKETS ? bucket : PLUGIN_LATENCY_BUCKETS - 1;
+}
+
+/*
+ * Returns the upper bound in us of the bucket containing the
+ * percentile, the resolution is a power of two
+ */
+unsigned long long plugin_latency_percentile(struct plugin_latency *latency, int percent)
+{
+	unsigned long long target, count = 0;
+	int i;
+
+	if (!latency->calls)
+		return 0;
+
+	target = ((unsigned long long)latency->calls * percent + 99) / 100;
+
+	for (i = 0; i < PLUGIN_LATENCY_BUCKETS - 1; i++) {
+
+		count += latency->histogram[i];
+		if (count >= target)
+			return (1ULL << i) - 1;
+	}
+
+	return latency->max;
+}
+
+static void plugin_latency_account(struct plugin *plugin, unsigned long long latency)
+{
+	struct plugin_latency *l = &plugin->latency;
+	const char *name = plugin->descriptor->compatibles[0];
+
+	/*
+	 * The actions of the plugin are serialized, but the latencies
+	 * are read by the metrics from the mainloop
+	 */
+	__atomic_fetch_add(&l->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&l->total, latency, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&l->histogram[plugin_latency_bucket(latency)], 1, __ATOMIC_RELAXED);
+
+	if (latency > l->max)
+		__atomic_store_n(&l->max, latency, __ATOMIC_RELAXED);
+
+	if (!plugin_budget.budget || latency <= plugin_budget.budget) {
+		plugin->overruns = 0;
+		return;
+	}
+
+	__atomic_fetch_add(&l->overruns, 1, __ATOMIC_RELAXED);
+	plugin->overruns++;
+
+	switch (plugin_budget.overrun) {
+	case PLUGIN_OVERRUN_COUNT:
+		break;
+	case PLUGIN_OVERRUN_LOG:
+		WARN("Plugin '%s' took %llu us, budget is %u us\n",
+		     name, latency, plugin_budget.budget);
+		break;
+	case PLUGIN_OVERRUN_QUARANTINE:
+		WARN("Plugin '%s' took %llu us, budget is %u us\n",
+		     name, latency, plugin_budget.budget);
+
+		if (plugin->overruns < plugin_budget.quarantine)
+			break;
+
+		ERROR("Plugin '%s' overran its budget %u times in a row, "
+		      "quarantined\n", name, plugin->overruns);
+		plugin->quarantined = 1;
+		break;
+	}
+}
+
+/*
+ * The actions of a plugin are serialized by the executor, the latency
+ * statistics are only updated by one thread at a time
+ */
 static int plugin_ops(struct plugin *plugin, int tz_id, int temperature,
-		      void *data, plugin_ops_t ops_t)
+		      struct plugin_batch *batch, void *data, plugin_ops_t ops_t)
 {
 	struct plugin_ops *ops;
+	unsigned long long start;
+	int ret = -1;
 
-	if (!plugin)
+	if (!plugin || plugin->quarantined)
 		return -1;
 
 	ops = plugin->ops;
 
+	PROBE4(thermal_engine, plugin_dispatch, plugin->descriptor->compatibles[0],
+	       ops_t, tz_id, temperature);
+
+	start = plugin_now();
+
 	switch (ops_t) {
 	case TRIP_LOW:
-		return ops->trip_low(tz_id, temperature, data);
+		if (ops->trip_low)
+			ret = ops->trip_low(tz_id, temperature, data);
+		break;
 	case TRIP_HIGH:
-		return ops->trip_high(tz_id, temperature, data);
+		if (ops->trip_high)
+			ret = ops->trip_high(tz_id, temperature, data);
+		break;
 	case RESET:
-		return ops->reset(tz_id, temperature, data);
+		if (ops->reset)
+			ret = ops->reset(tz_id, temperature, data);
+		break;
+	case TRIP_BATCH:
+		if (plugin_batched(plugin))
+			ret = plugin->ops_v2->trip_batch(batch, data);
+		break;
 	}
 
-	return -1;
+	plugin_latency_account(plugin, plugin_now() - start);
+
+	PROBE3(thermal_engine, plugin_done, plugin->descriptor->compatibles[0], ops_t, ret);
+
+	return ret;
 }
 
 int plugin_trip_low(struct plugin *plugin, int tz_id, int temperature, void *data)
 {
-	return plugin_ops(plugin, tz_id, temperature, data, TRIP_LOW);
+	return plugin_ops(plugin, tz_id, temperature, NULL, data, TRIP_LOW);
 }
 
 int plugin_trip_high(struct plugin *plugin, int tz_id, int temperature, void *data)
 {
-	return plugin_ops(plugin, tz_id, temperature, data, TRIP_HIGH);
+	return plugin_ops(plugin, tz_id, temperature, NULL, data, TRIP_HIGH);
 }
 
 int plugin_reset(struct plugin *plugin, int tz_id, int temperature, void *data)
 {
-	return plugin_ops(plugin, tz_id, temperature, data, RESET);
+	return plugin_ops(plugin, tz_id, temperature, NULL, data, RESET);
+}
+
+int plugin_trip_batch(struct plugin *plugin, struct plugin_batch *batch, void *data)
+{
+	return plugin_ops(plugin, 0, 0, batch, data, TRIP_BATCH);
+}
+
+int plugin_batched(struct plugin *plugin)
+{
+	return plugin->ops_v2 && plugin->ops_v2->trip_batch;
 }
 
 static int plugin_add(struct list *plugins,
@@ -341,9 +875,31 @@ int plugin_profile_for_each(struct list *plugins, const char *profile,
 	return 0;
 }
 
+static int plugin_latency_show(struct plugin *plugin, __maybe_unused void *data)
+{
+	struct plugin_latency *l = &plugin->latency;
+
+	if (!l->calls)
+		return 0;
+
+	INFO("Plugin '%s': %lu calls, avg=%llu us, p50<=%llu us, p99<=%llu us, "
+	     "max=%llu us, %lu overruns%s\n", plugin->descriptor->compatibles[0],
+	     l->calls, l->total / l->calls, plugin_latency_percentile(l, 50),
+	     plugin_latency_percentile(l, 99), l->max, l->overruns,
+	     plugin->quarantined ? ", quarantined" : "");
+
+	return 0;
+}
+
 void thermal_engine_plugins_exit(struct thermal_engine_data *ted)
 {
+	plugin_for_each(ted->plugins, plugin_latency_show, NULL);
+
+	plugin_index_free(plugin_index);
+	plugin_index = NULL;
+
 	free(ted->plugins);
+	__ted = NULL;
 }
 	
 int thermal_engine_plugins_init(struct thermal_engine_data *ted)
@@ -353,7 +909,9 @@ int thermal_engine_plugins_init(struct thermal_engine_data *ted)
 		return -1;
 
 	list_init(ted->plugins);
-	
+
+	__ted = ted;
+
 	if (config_plugins(ted, plugin_add))
 		return -1;
 
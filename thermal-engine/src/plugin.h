@@ -4,7 +4,9 @@
 #include "list.h"
 
 struct thermal_engine_data;
+struct thermal_cdev_request;
 struct plugin_power;
+struct executor;
 
 struct plugin_descriptor {
 	const char *version;
@@ -12,6 +14,69 @@ struct plugin_descriptor {
 	const char *compatibles[];
 };
 
+/*
+ * Defines the plugin descriptor and a copy of its strings in the
+ * PLUGIN_INDEX_SECTION section, the engine reads it from the file to
+ * find the matching plugins without loading all of them:
+ *
+ * PLUGIN_DESCRIPTOR("0.0.1", "game", "te-plugin-compat1", "te-plugin-compat2");
+ *
+ * The plugin ops are declared with PLUGIN_EXPORT and the plugin ends
+ * with PLUGIN_REGISTER(&plugin_ops) or, with the second version of
+ * the ops, PLUGIN_REGISTER(&plugin_ops, &plugin_ops_v2).
+ *
+ * When the plugins are built into the engine, PLUGIN_BUILTIN is
+ * defined: the symbols are local to the plugin and PLUGIN_REGISTER()
+ * adds the plugin to the PLUGIN_BUILTIN_SECTION table, looked up
+ * before the plugin directory.
+ */
+#define PLUGIN_INDEX_SECTION ".te_plugin_index"
+#define PLUGIN_BUILTIN_SECTION te_plugins
+
+#define __plugin_str(...) #__VA_ARGS__
+#define __plugin_xstr(...) __plugin_str(__VA_ARGS__)
+
+struct plugin_ops_v2;
+
+struct plugin_builtin {
+	struct plugin_descriptor *descriptor;
+	struct plugin_ops *ops;
+	struct plugin_ops_v2 *ops_v2;
+};
+
+#ifdef PLUGIN_BUILTIN
+#define PLUGIN_EXPORT static
+
+#define PLUGIN_DESCRIPTOR(__version, __profile, ...)			\
+	static struct plugin_descriptor plugin_descriptor = {		\
+		.version	= __version,				\
+		.profile	= __profile,				\
+		.compatibles	= { __VA_ARGS__, NULL },		\
+	}
+
+#define PLUGIN_REGISTER(...)						\
+	static const struct plugin_builtin __plugin_builtin		\
+	__attribute__((section(__plugin_xstr(PLUGIN_BUILTIN_SECTION)),	\
+		       used, aligned(sizeof(void *)))) = {		\
+		.descriptor = &plugin_descriptor, .ops = __VA_ARGS__	\
+	}
+#else
+#define PLUGIN_EXPORT
+
+#define PLUGIN_DESCRIPTOR(__version, __profile, ...)			\
+	static const char __plugin_index[]				\
+	__attribute__((section(PLUGIN_INDEX_SECTION), used)) =		\
+		__plugin_xstr(__version, __profile, __VA_ARGS__);	\
+	struct plugin_descriptor plugin_descriptor = {			\
+		.version	= __version,				\
+		.profile	= __profile,				\
+		.compatibles	= { __VA_ARGS__, NULL },		\
+	}
+
+#define PLUGIN_REGISTER(...)						\
+	extern struct plugin_builtin __plugin_builtin
+#endif
+
 struct plugin_ops {
 	void *(*init)();
 	void (*exit)(void *);
@@ -20,11 +85,85 @@ struct plugin_ops {
 	int (*reset)(int tz_id, int temperature, void *data);
 };
 
+/*
+ * A threshold crossed on a thermal zone, in the order they were
+ * reported
+ */
+struct plugin_event {
+	int tz_id;
+	int temperature;
+	int way_up;
+};
+
+/*
+ * The state of a thermal zone when the batch is built: 'level' is the
+ * number of thresholds below the temperature and 'temperature' is the
+ * last threshold crossed, THRESHOLD_TEMP_INVALID if none
+ */
+struct plugin_level {
+	int tz_id;
+	int level;
+	int temperature;
+};
+
+struct plugin_batch {
+	struct plugin_event *events;
+	int nr_events;
+	struct plugin_level *levels;
+	int nr_levels;
+};
+
+/*
+ * Optional second version of the ops, exported by the plugin with
+ * the 'plugin_ops_v2' symbol in addition to 'plugin_ops'. When
+ * 'trip_batch' is set, the plugin receives all the thresholds crossed
+ * during a mainloop iteration in a single call instead of the
+ * 'trip_high' and 'trip_low' callbacks.
+ */
+#define PLUGIN_OPS_VERSION 2
+
+struct plugin_ops_v2 {
+	unsigned int version;
+	int (*trip_batch)(struct plugin_batch *batch, void *data);
+};
+
+/*
+ * Latency of the plugin callbacks in us, the histogram bucket 'n'
+ * counts the calls which took between 2^(n-1) and 2^n - 1 us, the
+ * last bucket counts the longer calls
+ */
+#define PLUGIN_LATENCY_BUCKETS 24
+
+struct plugin_latency {
+	unsigned long calls;
+	unsigned long overruns;
+	unsigned long long total;
+	unsigned long long max;
+	unsigned long histogram[PLUGIN_LATENCY_BUCKETS];
+};
+
+/*
+ * What to do when a callback exceeds the latency budget: log it, only
+ * count it, or stop calling the plugin after too many consecutive
+ * overruns
+ */
+enum plugin_overrun {
+	PLUGIN_OVERRUN_LOG,
+	PLUGIN_OVERRUN_COUNT,
+	PLUGIN_OVERRUN_QUARANTINE,
+};
+
 struct plugin {
 	void *handle;
+	char *lib; /* shared object path, NULL for a built-in plugin */
 	void *private; /* pointer returned from the init function */
 	struct plugin_descriptor *descriptor;
 	struct plugin_ops *ops;
+	struct plugin_ops_v2 *ops_v2;
+	struct plugin_latency latency;
+	unsigned int overruns; /* consecutive overruns */
+	int quarantined;
+	unsigned long key; /* executor key, kept across a reload */
 	struct list list;
 };
 
@@ -32,14 +171,80 @@ struct plugin *plugin_open(const char *path, const char *compatible,
 			   const char *profile, const char *version);
 
 void plugin_close(struct plugin *plugin);
+
+/*
+ * Close the plugin once the actions already submitted to the executor
+ * are done, the plugin must not be referenced anymore
+ */
+void plugin_retire(struct executor *executor, struct plugin *plugin);
+
+struct plugin *plugin_find(struct list *plugins, const char *compatible,
+			   const char *profile, const char *version);
+
+/*
+ * Load a new instance of the shared object of a plugin, even if the
+ * file was modified in place. The returned plugin is initialized, the
+ * caller replaces the old one and closes it.
+ */
+struct plugin *plugin_reload(struct plugin *plugin);
+
+/*
+ * The plugin directory is indexed again at the next plugin_open()
+ */
+void plugin_rescan(void);
 int plugin_trip_high(struct plugin *plugin, int tz_id, int temperature, void *data);
 int plugin_trip_low(struct plugin *plugin, int tz_id, int temperature, void *data);
 int plugin_reset(struct plugin *plugin, int tz_id, int temperature, void *data);
+int plugin_trip_batch(struct plugin *plugin, struct plugin_batch *batch, void *data);
+int plugin_batched(struct plugin *plugin);
 
+/*
+ * Number of consecutive overruns quarantining a plugin when the
+ * quarantine is not configured
+ */
+#define PLUGIN_QUARANTINE_DEFAULT	3
+
+/*
+ * A zero budget disables the overrun detection, the latencies are
+ * always measured. A zero quarantine selects the default.
+ */
+int plugin_budget_set(unsigned int budget, const char *overrun, unsigned int quarantine);
+unsigned long long plugin_latency_percentile(struct plugin_latency *latency, int percent);
+
+/*
+ * The plugin callbacks run on the executor workers: the callbacks of a
+ * plugin are serialized but different plugins run concurrently. The
+ * cooling device and cpu capability helpers below can be called from
+ * the callbacks, they are thread safe.
+ *
+ * The power descriptions are built when the configuration is read and
+ * only used by the engine from the mainloop, they must not be used
+ * from a plugin callback.
+ */
 struct plugin_power *plugin_power_alloc(unsigned int power);
 void plugin_power_free(struct plugin_power *pwr);
 
 int plugin_power_add_device(struct plugin_power *pwr, const char *device);
+int plugin_power_limit(struct plugin_power *pwr);
+int plugin_power_nr_devices(struct plugin_power *pwr);
+int plugin_power_for_each_device(struct plugin_power *pwr,
+				 int (*cb)(const char *device, void *data), void *data);
+
+/*
+ * Cooling device control for the plugins, the cooling devices are
+ * the ones discovered by the thermal library
+ */
+int plugin_cdev_get_id(const char *name);
+int plugin_cdev_set_state(int cdev_id, int state);
+int plugin_cdev_set_states(struct thermal_cdev_request *req, int nr);
+
+/*
+ * CPU capabilities reported by the hardware feedback interface: the
+ * best cpu is the one with the highest performance capability, -1
+ * until the kernel reported the capabilities.
+ */
+int plugin_cpu_best(void);
+int plugin_cpu_capability(int cpu, int *performance, int *efficiency);
 
 int plugin_profile_for_each(struct list *plugins, const char *profile,
 			    int (*cb)(struct plugin *, void *data), void *data);
@@ -0,0 +1,386 @@
+// Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "plugin.h"
+#include "plugin_index.h"
+
+/*
+ * The strings of an entry are stored in the 'strings' buffer:
+ * version, profile then the compatibles
+ */
+struct plugin_index_entry {
+	char *lib;
+	char *strings;
+	const char **compatibles;
+	const char *version;
+	const char *profile;
+};
+
+struct plugin_index {
+	char *path;
+	struct plugin_index_entry *entries;
+	int nr_entries;
+};
+
+/*
+ * The index section is the stringified arguments of the
+ * PLUGIN_DESCRIPTOR() macro: a comma separated list of string
+ * literals. The content of the literals is copied to 'strings' with
+ * a nul terminator and the number of strings is returned.
+ */
+static int plugin_index_parse(const char *section, size_t len, char *strings)
+{
+	const char *end = section + len;
+	int nr = 0;
+
+	while (section < end && *section) {
+
+		if (*section++ != '"')
+			continue;
+
+		while (section < end && *section && *section != '"')
+			*strings++ = *section++;
+
+		if (section == end || *section != '"')
+			return -1;
+
+		*strings++ = '\0';
+		section++;
+		nr++;
+	}
+
+	return nr;
+}
+
+/*
+ * Read the index section of a shared object of the same ELF class as
+ * the engine, returns NULL if there is none
+ */
+static char *plugin_index_section(const char *lib, size_t *len)
+{
+	ElfW(Ehdr) ehdr;
+	ElfW(Shdr) *shdr = NULL;
+	char *shstrtab = NULL;
+	char *section = NULL;
+	size_t size;
+	int i, fd;
+
+	fd = open(lib, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr))
+		goto out;
+
+	if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) ||
+	    ehdr.e_ident[EI_CLASS] != (sizeof(void *) == 8 ? ELFCLASS64 : ELFCLASS32) ||
+	    ehdr.e_shentsize != sizeof(*shdr) ||
+	    ehdr.e_shstrndx == SHN_UNDEF || ehdr.e_shstrndx >= ehdr.e_shnum)
+		goto out;
+
+	size = sizeof(*shdr) * ehdr.e_shnum;
+
+	shdr = malloc(size);
+	if (!shdr)
+		goto out;
+
+	if (pread(fd, shdr, size, ehdr.e_shoff) != (ssize_t)size)
+		goto out;
+
+	size = shdr[ehdr.e_shstrndx].sh_size;
+
+	shstrtab = malloc(size + 1);
+	if (!shstrtab)
+		goto out;
+
+	if (pread(fd, shstrtab, size, shdr[ehdr.e_shstrndx].sh_offset) != (ssize_t)size)
+		goto out;
+
+	shstrtab[size] = '\0';
+
+	for (i = 0; i < ehdr.e_shnum; i++) {
+
+		if (shdr[i].sh_name >= size)
+			continue;
+
+		if (strcmp(&shstrtab[shdr[i].sh_name], PLUGIN_INDEX_SECTION))
+			continue;
+
+		section = malloc(shdr[i].sh_size + 1);
+		if (!section)
+			break;
+
+		if (pread(fd, section, shdr[i].sh_size, shdr[i].sh_offset) !=
+		    (ssize_t)shdr[i].sh_size) {
+			free(section);
+			section = NULL;
+			break;
+		}
+
+		section[shdr[i].sh_size] = '\0';
+		*len = shdr[i].sh_size;
+		break;
+	}
+out:
+	free(shstrtab);
+	free(shdr);
+	close(fd);
+
+	return section;
+}
+
+static int plugin_index_entry_strings(struct plugin_index_entry *entry, int nr)
+{
+	char *s = entry->strings;
+	int i;
+
+	if (nr < 3)
+		return -1;
+
+	entry->compatibles = calloc(nr - 1, sizeof(*entry->compatibles));
+	if (!entry->compatibles)
+		return -1;
+
+	entry->version = s;
+	s += strlen(s) + 1;
+	entry->profile = s;
+	s += strlen(s) + 1;
+
+	for (i = 0; i < nr - 2; i++) {
+		entry->compatibles[i] = s;
+		s += strlen(s) + 1;
+	}
+
+	return 0;
+}
+
+static int plugin_index_entry_elf(struct plugin_index_entry *entry)
+{
+	char *section;
+	size_t len;
+	int nr;
+
+	section = plugin_index_section(entry->lib, &len);
+	if (!section)
+		return -1;
+
+	entry->strings = malloc(len + 1);
+	if (!entry->strings)
+		goto out_free;
+
+	nr = plugin_index_parse(section, len, entry->strings);
+	if (plugin_index_entry_strings(entry, nr))
+		goto out_free_strings;
+
+	free(section);
+
+	return 0;
+
+out_free_strings:
+	free(entry->strings);
+	entry->strings = NULL;
+out_free:
+	free(section);
+
+	return -1;
+}
+
+/*
+ * Plugins built without the index section, the descriptor is read
+ * from the loaded object
+ */
+static int plugin_index_entry_dlopen(struct plugin_index_entry *entry)
+{
+	struct plugin_descriptor *pd;
+	size_t len = 0;
+	void *handle;
+	char *s;
+	int i, ret = -1;
+
+	handle = dlopen(entry->lib, RTLD_NOW);
+	if (!handle) {
+		ERROR("Failed to dlopen: %s\n", dlerror());
+		return -1;
+	}
+
+	pd = dlsym(handle, "plugin_descriptor");
+	if (!pd)
+		goto out;
+
+	len += strlen(pd->version ? pd->version : "") + 1;
+	len += strlen(pd->profile ? pd->profile : "") + 1;
+	for (i = 0; pd->compatibles[i]; i++)
+		len += strlen(pd->compatibles[i]) + 1;
+
+	entry->strings = s = malloc(len);
+	if (!s)
+		goto out;
+
+	s = stpcpy(s, pd->version ? pd->version : "") + 1;
+	s = stpcpy(s, pd->profile ? pd->profile : "") + 1;
+	for (i = 0; pd->compatibles[i]; i++)
+		s = stpcpy(s, pd->compatibles[i]) + 1;
+
+	ret = plugin_index_entry_strings(entry, i + 2);
+	if (ret) {
+		free(entry->strings);
+		entry->strings = NULL;
+	}
+out:
+	dlclose(handle);
+
+	return ret;
+}
+
+static int plugin_index_add(struct plugin_index *index, const char *name)
+{
+	struct plugin_index_entry *entries, *entry;
+
+	entries = realloc(index->entries, sizeof(*entries) * (index->nr_entries + 1));
+	if (!entries)
+		return -1;
+
+	index->entries = entries;
+
+	entry = &entries[index->nr_entries];
+	memset(entry, 0, sizeof(*entry));
+
+	if (asprintf(&entry->lib, "%s/%s", index->path, name) == -1)
+		return -1;
+
+	if (!plugin_index_entry_elf(entry)) {
+		DEBUG("Plugin '%s' indexed from its ELF section\n", entry->lib);
+		goto out;
+	}
+
+	if (!plugin_index_entry_dlopen(entry)) {
+		DEBUG("Plugin '%s' indexed from its descriptor\n", entry->lib);
+		goto out;
+	}
+
+	WARN("Failed to index plugin '%s'\n", entry->lib);
+	free(entry->lib);
+
+	return 0;
+out:
+	index->nr_entries++;
+
+	return 0;
+}
+
+struct plugin_index *plugin_index_build(const char *path)
+{
+	struct plugin_index *index;
+	struct dirent *dirent;
+	size_t len;
+	DIR *dir;
+
+	dir = opendir(path);
+	if (!dir) {
+		ERROR("Failed to open plugin directory '%s'\n", path);
+		return NULL;
+	}
+
+	index = calloc(1, sizeof(*index));
+	if (!index)
+		goto out_closedir;
+
+	index->path = strdup(path);
+	if (!index->path)
+		goto out_free;
+
+	while ((dirent = readdir(dir))) {
+
+		len = strlen(dirent->d_name);
+		if (len < 3 || strcmp(&dirent->d_name[len - 3], ".so"))
+			continue;
+
+		if (plugin_index_add(index, dirent->d_name))
+			goto out_free;
+	}
+
+	closedir(dir);
+
+	DEBUG("Indexed %d plugins in '%s'\n", index->nr_entries, path);
+
+	return index;
+
+out_free:
+	plugin_index_free(index);
+out_closedir:
+	closedir(dir);
+
+	return NULL;
+}
+
+void plugin_index_free(struct plugin_index *index)
+{
+	int i;
+
+	if (!index)
+		return;
+
+	for (i = 0; i < index->nr_entries; i++) {
+		free(index->entries[i].lib);
+		free(index->entries[i].strings);
+		free(index->entries[i].compatibles);
+	}
+
+	free(index->entries);
+	free(index->path);
+	free(index);
+}
+
+const char *plugin_index_path(struct plugin_index *index)
+{
+	return index->path;
+}
+
+static int plugin_index_match(struct plugin_index_entry *entry, const char *compatible,
+			      const char *profile, const char *version)
+{
+	int i;
+
+	if (profile && strcmp(entry->profile, profile))
+		return -1;
+
+	if (version && strcmp(entry->version, version))
+		return -1;
+
+	for (i = 0; entry->compatibles[i]; i++)
+		if (!strcmp(entry->compatibles[i], compatible))
+			return 0;
+
+	return -1;
+}
+
+int plugin_index_for_each_match(struct plugin_index *index,
+				const char *compatible, const char *profile,
+				const char *version,
+				int (*cb)(const char *lib, void *data),
+				void *data)
+{
+	int i, ret;
+
+	for (i = 0; i < index->nr_entries; i++) {
+
+		if (plugin_index_match(&index->entries[i], compatible, profile, version))
+			continue;
+
+		ret = cb(index->entries[i].lib, data);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
@@ -0,0 +1,27 @@
+/* Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org> */
+#ifndef __THERMAL_ENGINE_PLUGIN_INDEX_H
+#define __THERMAL_ENGINE_PLUGIN_INDEX_H
+
+struct plugin_index;
+
+/*
+ * The descriptors of the plugins found in a directory. They are read
+ * from the PLUGIN_INDEX_SECTION section of the shared objects without
+ * loading them, the plugins without this section are loaded once to
+ * read their descriptor.
+ */
+extern struct plugin_index *plugin_index_build(const char *path);
+extern void plugin_index_free(struct plugin_index *index);
+extern const char *plugin_index_path(struct plugin_index *index);
+
+/*
+ * Call 'cb' with the path of the shared objects whose descriptor
+ * matches, stops when the callback returns non-zero and returns this
+ * value
+ */
+extern int plugin_index_for_each_match(struct plugin_index *index,
+				       const char *compatible, const char *profile,
+				       const char *version,
+				       int (*cb)(const char *lib, void *data),
+				       void *data);
+#endif
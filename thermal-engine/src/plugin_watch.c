@@ -0,0 +1,205 @@
+// Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/inotify.h>
+
+#include "thermal-engine.h"
+#include "mainloop.h"
+#include "pair.h"
+#include "plugin.h"
+#include "threshold.h"
+#include "log.h"
+
+/*
+ * The directories of the loaded plugins are watched, the directory
+ * paths are indexed by their watch descriptor
+ */
+struct plugin_watch {
+	int fd;
+	struct pair dirs;
+};
+
+static void plugin_watch_reload(struct thermal_engine_data *ted, const char *lib)
+{
+	struct plugin *old, *new;
+	struct list *l;
+
+	for (l = list_next(ted->plugins); l; ) {
+
+		old = container_of(l, struct plugin, list);
+		l = list_next(l);
+
+		if (!old->lib || strcmp(old->lib, lib))
+			continue;
+
+		new = plugin_reload(old);
+		if (!new) {
+			WARN("Failed to reload plugin '%s', keeping the running one\n", lib);
+			continue;
+		}
+
+		/*
+		 * The mainloop does not process any event until the
+		 * swap is complete
+		 */
+		threshold_plugin_replace(ted->thresholds, old, new);
+
+		list_replace(ted->plugins, &old->list, &new->list);
+
+		plugin_retire(ted->executor, old);
+
+		INFO("Reloaded plugin '%s', compatible='%s', profile='%s'\n", lib,
+		     new->descriptor->compatibles[0], new->descriptor->profile);
+	}
+}
+
+static int plugin_watch_handler(int fd, void *data)
+{
+	struct thermal_engine_data *ted = data;
+	struct plugin_watch *watch = ted->watch;
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *event;
+	const char *dir;
+	char *lib;
+	ssize_t len;
+	size_t name_len;
+	char *p;
+
+	len = read(fd, buffer, sizeof(buffer));
+	if (len < 0)
+		return errno == EAGAIN ? 0 : -1;
+
+	for (p = buffer; p < buffer + len; p += sizeof(*event) + event->len) {
+
+		event = (struct inotify_event *)p;
+
+		if (!event->len)
+			continue;
+
+		name_len = strlen(event->name);
+		if (name_len < 3 || strcmp(&event->name[name_len - 3], ".so"))
+			continue;
+
+		dir = pair_find(&watch->dirs, event->wd);
+		if (!dir)
+			continue;
+
+		if (asprintf(&lib, "%s/%s", dir, event->name) == -1)
+			continue;
+
+		DEBUG("Plugin '%s' changed\n", lib);
+
+		plugin_watch_reload(ted, lib);
+
+		free(lib);
+	}
+
+	return 0;
+}
+
+static int plugin_watch_add(struct plugin_watch *watch, const char *lib)
+{
+	char *dir, *slash;
+	int wd;
+
+	dir = strdup(lib);
+	if (!dir)
+		return -1;
+
+	slash = strrchr(dir, '/');
+	if (!slash) {
+		free(dir);
+		return 0;
+	}
+
+	*slash = '\0';
+
+	/*
+	 * Modified in place or replaced by a rename
+	 */
+	wd = inotify_add_watch(watch->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (wd < 0) {
+		WARN("Failed to watch the plugin directory '%s'\n", dir);
+		free(dir);
+		return 0;
+	}
+
+	if (pair_find(&watch->dirs, wd) || pair_add(&watch->dirs, wd, dir)) {
+		free(dir);
+		return 0;
+	}
+
+	INFO("Watching the plugin directory '%s'\n", dir);
+
+	return 0;
+}
+
+static int __plugin_watch_free(__maybe_unused int key, void *data,
+			       __maybe_unused void *arg)
+{
+	free(data);
+
+	return 0;
+}
+
+int thermal_engine_plugin_watch_init(struct thermal_engine_data *ted)
+{
+	struct plugin_watch *watch;
+	struct list *l;
+
+	watch = malloc(sizeof(*watch));
+	if (!watch)
+		return -1;
+
+	pair_init(&watch->dirs);
+
+	watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch->fd < 0)
+		goto out_free;
+
+	for (l = list_next(ted->plugins); l; l = list_next(l)) {
+
+		struct plugin *plugin = container_of(l, struct plugin, list);
+
+		if (plugin->lib && plugin_watch_add(watch, plugin->lib))
+			goto out_close;
+	}
+
+	if (mainloop_add(ted->ml, watch->fd, plugin_watch_handler, ted))
+		goto out_close;
+
+	ted->watch = watch;
+
+	return 0;
+
+out_close:
+	close(watch->fd);
+out_free:
+	pair_for_each(&watch->dirs, __plugin_watch_free, NULL);
+	pair_destroy(&watch->dirs);
+	free(watch);
+
+	return -1;
+}
+
+void thermal_engine_plugin_watch_exit(struct thermal_engine_data *ted)
+{
+	struct plugin_watch *watch = ted->watch;
+
+	if (!watch)
+		return;
+
+	mainloop_del(ted->ml, watch->fd);
+	close(watch->fd);
+
+	pair_for_each(&watch->dirs, __plugin_watch_free, NULL);
+	pair_destroy(&watch->dirs);
+	free(watch);
+
+	ted->watch = NULL;
+}
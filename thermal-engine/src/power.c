@@ -22,7 +22,23 @@ int thermal_engine_power_init(struct thermal_engine_data *ted)
 	return 0;
 }
 
+static int restore_dtpm(const char *name, void *data)
+{
+	struct power_handler *pw = data;
+
+	if (power_limit_reset(pw, name, 0) < 0)
+		WARN("Failed to restore the power limit of '%s'\n", name);
+
+	return 0;
+}
+
 void thermal_engine_power_exit(struct thermal_engine_data *ted)
 {
+	/*
+	 * Do not leave the power budgets set without the engine, the
+	 * limits which did not change are not written
+	 */
+	power_for_each(ted->pw, restore_dtpm, ted->pw);
+
 	power_destroy(ted->pw);
 }
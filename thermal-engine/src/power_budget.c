@@ -0,0 +1,127 @@
+// Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thermal-engine.h"
+#include "plugin.h"
+#include "power_budget.h"
+#include "metrics.h"
+#include "trace.h"
+#include "log.h"
+
+struct power_budget_data {
+	struct power_handler *pw;
+	struct power_budget *budget;
+	int *max;
+};
+
+static int power_budget_device(const char *device, void *data)
+{
+	struct power_budget_data *pbd = data;
+	struct power_budget *budget = pbd->budget;
+	int id;
+
+	id = power_dtpm_id(pbd->pw, device);
+	if (id < 0) {
+		WARN("No dtpm device '%s', ignored in the power budget\n", device);
+		return 0;
+	}
+
+	budget->req[budget->nr].id = id;
+	pbd->max[budget->nr] = power_dtpm_max(pbd->pw, id);
+	budget->nr++;
+
+	return 0;
+}
+
+void power_budget_split(struct power_budget *budget, unsigned int power,
+			const int *max)
+{
+	unsigned long long total = 0;
+	int i;
+
+	for (i = 0; i < budget->nr; i++) {
+
+		if (max[i] <= 0) {
+			total = 0;
+			break;
+		}
+
+		total += max[i];
+	}
+
+	for (i = 0; i < budget->nr; i++) {
+
+		if (total)
+			budget->req[i].power_mw = power * (unsigned long long)max[i] / total;
+		else
+			budget->req[i].power_mw = power / budget->nr;
+
+		/*
+		 * A zero power restores the initial limit, the kernel
+		 * clamps the limit to the minimum power instead
+		 */
+		if (!budget->req[i].power_mw)
+			budget->req[i].power_mw = 1;
+	}
+}
+
+struct power_budget *power_budget_alloc(struct power_handler *pw,
+					struct plugin_power *pwr)
+{
+	struct power_budget_data pbd = { .pw = pw };
+	int nr = plugin_power_nr_devices(pwr);
+
+	pbd.budget = malloc(sizeof(*pbd.budget) + sizeof(*pbd.budget->req) * nr);
+	if (!pbd.budget)
+		return NULL;
+
+	pbd.max = malloc(sizeof(*pbd.max) * nr);
+	if (!pbd.max) {
+		free(pbd.budget);
+		return NULL;
+	}
+
+	pbd.budget->nr = 0;
+
+	plugin_power_for_each_device(pwr, power_budget_device, &pbd);
+
+	power_budget_split(pbd.budget, plugin_power_limit(pwr), pbd.max);
+
+	free(pbd.max);
+
+	return pbd.budget;
+}
+
+void power_budget_free(struct power_budget *budget)
+{
+	free(budget);
+}
+
+unsigned int power_budget_find(struct power_budget *budget, int id)
+{
+	int i;
+
+	for (i = 0; i < budget->nr; i++)
+		if (budget->req[i].id == id)
+			return budget->req[i].power_mw;
+
+	return 0;
+}
+
+int power_budget_apply(struct power_handler *pw, struct power_limit_request *req, int nr)
+{
+	int ret;
+
+	ret = power_limits_set(pw, req, nr);
+	if (ret < 0)
+		return ret;
+
+	metrics_add(METRICS_SYSFS_WRITES, ret);
+	metrics_add(METRICS_SYSFS_ELIDED, nr - ret);
+
+	if (ret)
+		trace_actuator();
+
+	return ret;
+}
@@ -0,0 +1,39 @@
+/* Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org> */
+#ifndef __THERMAL_ENGINE_POWER_BUDGET_H
+#define __THERMAL_ENGINE_POWER_BUDGET_H
+
+#include <power.h>
+
+struct plugin_power;
+
+/*
+ * The power budget of a threshold action with the devices resolved
+ * to their dtpm id, built when the thresholds are configured. The
+ * budget is split across the devices in proportion to their max
+ * power, evenly if one of them is unknown.
+ */
+struct power_budget {
+	int nr;
+	struct power_limit_request req[];
+};
+
+extern struct power_budget *power_budget_alloc(struct power_handler *pw,
+					       struct plugin_power *pwr);
+extern void power_budget_free(struct power_budget *budget);
+
+extern void power_budget_split(struct power_budget *budget, unsigned int power,
+			       const int *max);
+
+/*
+ * The power of the device in the budget, zero if the budget does not
+ * cover it
+ */
+extern unsigned int power_budget_find(struct power_budget *budget, int id);
+
+/*
+ * Set the limits in one batch, the limits which did not change are
+ * not written. Returns the number of writes or -1.
+ */
+extern int power_budget_apply(struct power_handler *pw,
+			      struct power_limit_request *req, int nr);
+#endif
@@ -7,6 +7,7 @@
 #include "config.h"
 #include "log.h"
 #include "profile.h"
+#include "threshold.h"
 
 #ifndef DEFAULT_PROFILE
 #define DEFAULT_PROFILE "default"
@@ -43,6 +44,31 @@ int profile_set_name(struct profile *profile, const char *name)
 	return 0;
 }
 
+/*
+ * The name is allocated before switching, the name and the active
+ * profile of the thresholds can not diverge
+ */
+int profile_switch(struct thermal_engine_data *ted, const char *name)
+{
+	struct profile *profile = ted->profile;
+	char *n;
+
+	n = strdup(name);
+	if (!n)
+		return -1;
+
+	if (threshold_profile_switch(ted->thresholds, name)) {
+		free(n);
+		return -1;
+	}
+
+	free(profile->name);
+
+	profile->name = n;
+
+	return 0;
+}
+
 int thermal_engine_profile_init(struct thermal_engine_data *ted)
 {
 	struct profile *profile;
@@ -5,4 +5,10 @@ const char *profile_get_name(struct profile *profile);
 
 int profile_set_name(struct profile *profile, const char *name);
 
+/*
+ * Switch the thresholds to the actions of the profile, the running
+ * profile is kept if the profile is unknown
+ */
+int profile_switch(struct thermal_engine_data *ted, const char *name);
+
 #endif /* __PROFILE_H__ */
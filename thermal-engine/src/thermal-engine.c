@@ -17,6 +17,7 @@
 #include <sys/signalfd.h>
 
 #include "thermal-engine.h"
+#include "config_cache.h"
 #include "log.h"
 #include "options.h"
 #include "mainloop.h"
@@ -54,13 +55,20 @@ static void thermal_engine_exit(void)
 
 	INFO("Thermal engine exiting.\n");
 
+	thermal_engine_executor_exit(ted);
+	thermal_engine_control_exit(ted);
+	thermal_engine_metrics_exit(ted);
+	thermal_engine_trace_exit(ted);
+	thermal_engine_plugin_watch_exit(ted);
 	thermal_engine_options_exit(ted);
 	thermal_engine_config_exit(ted);
 	thermal_engine_threshold_exit(ted);
+	thermal_engine_window_exit(ted);
 	thermal_engine_plugins_exit(ted);
 	thermal_engine_profile_exit(ted);
 	thermal_engine_power_exit(ted);
 	thermal_engine_thermal_exit(ted);
+	thermal_engine_capability_exit(ted);
 	thermal_engine_performance_exit(ted);
 	mainloop_fini(ted->ml);
 	log_exit();
@@ -80,6 +88,13 @@ static int thermal_engine_signal_handler(int fd, void *data)
 		mainloop_exit(ted->ml);
 	}
 
+	/*
+	 * A failed reload keeps the engine running with the previous
+	 * or the partially applied configuration
+	 */
+	if (si.ssi_signo == SIGHUP && thermal_engine_config_reload(ted))
+		WARN("Failed to reload the configuration\n");
+
 	return 0;
 }
 
@@ -91,6 +106,8 @@ static int thermal_engine_signal_init(struct thermal_engine_data *ted)
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGQUIT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGHUP);
 
 	if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
 		return -1;
@@ -153,11 +170,21 @@ int main(int argc, char *argv[])
 		return THERMAL_ENGINE_MAINLOOP_ERROR;
 	}
 
+	if (thermal_engine_executor_init(ted)) {
+		ERROR("Failed to initialize the executor\n");
+		return THERMAL_ENGINE_SYSTEM_ERROR;
+	}
+
 	if (thermal_engine_power_init(ted)) {
 		ERROR("Failed to initialize the power library");
 		return THERMAL_ENGINE_THERMAL_ERROR;
 	}
 
+	if (thermal_engine_capability_init(ted)) {
+		ERROR("Failed to initialize the cpu capabilities\n");
+		return THERMAL_ENGINE_THERMAL_ERROR;
+	}
+
 	if (thermal_engine_thermal_init(ted)) {
 		ERROR("Failed to initialize the thermal library\n");
 		return THERMAL_ENGINE_THERMAL_ERROR;
@@ -183,11 +210,39 @@ int main(int argc, char *argv[])
 		return THERMAL_ENGINE_PLUGINS_ERROR;
 	}
 
+	if (thermal_engine_window_init(ted)) {
+		ERROR("Failed to initialize the windows\n");
+		return THERMAL_ENGINE_THRESHOLD_ERROR;
+	}
+
 	if (thermal_engine_threshold_init(ted)) {
 		ERROR("Failed to initialize the thresholds\n");
 		return THERMAL_ENGINE_THRESHOLD_ERROR;
 	}
 
+	if (thermal_engine_plugin_watch_init(ted)) {
+		ERROR("Failed to watch the plugins\n");
+		return THERMAL_ENGINE_PLUGINS_ERROR;
+	}
+
+	if (thermal_engine_metrics_init(ted)) {
+		ERROR("Failed to initialize the metrics\n");
+		return THERMAL_ENGINE_SYSTEM_ERROR;
+	}
+
+	if (thermal_engine_control_init(ted)) {
+		ERROR("Failed to initialize the control\n");
+		return THERMAL_ENGINE_SYSTEM_ERROR;
+	}
+
+	/*
+	 * Compiled once everything is configured, the next start does
+	 * not parse the configuration
+	 */
+	if (ted->options->cache && !ted->cache && config_cache_save(ted))
+		WARN("Failed to write the configuration cache '%s'\n",
+		     ted->options->cache);
+
 	if (thermal_engine_signal_init(ted)) {
 		ERROR("Failed to configure signal handlers: %p\n");
 		return THERMAL_ENGINE_SYSTEM_ERROR;
@@ -10,9 +10,17 @@ struct options;
 struct config_t;
 struct list;
 struct thresholds;
+struct windows;
+struct capabilities;
+struct executor;
+struct plugin_watch;
+struct config_cache;
+struct metrics;
+struct control;
 
 struct thermal_engine_data {
 	struct config_t *config;
+	struct config_cache *cache;
 	struct mainloop *ml;
 	struct options *options;
 	struct profile *profile;
@@ -23,6 +31,12 @@ struct thermal_engine_data {
 	struct performance_handler *ph;
 	struct list *plugins;
 	struct thresholds *thresholds;
+	struct windows *windows;
+	struct capabilities *capabilities;
+	struct executor *executor;
+	struct plugin_watch *watch;
+	struct metrics *metrics;
+	struct control *control;
 };
 
 int thermal_engine_options_init(int argc, char *argv[], struct thermal_engine_data *ted);
@@ -30,22 +44,43 @@ void thermal_engine_options_exit(struct thermal_engine_data *ted);
 	
 int thermal_engine_config_init(struct thermal_engine_data *ted);
 void thermal_engine_config_exit(struct thermal_engine_data *ted);
+int thermal_engine_config_reload(struct thermal_engine_data *ted);
 
 int thermal_engine_threshold_init(struct thermal_engine_data *ted);
 void thermal_engine_threshold_exit(struct thermal_engine_data *ted);
 
+int thermal_engine_window_init(struct thermal_engine_data *ted);
+void thermal_engine_window_exit(struct thermal_engine_data *ted);
+
 int thermal_engine_power_init(struct thermal_engine_data *ted);
 void thermal_engine_power_exit(struct thermal_engine_data *ted);
 
 int thermal_engine_thermal_init(struct thermal_engine_data *ted);
 void thermal_engine_thermal_exit(struct thermal_engine_data *ted);
 
+int thermal_engine_capability_init(struct thermal_engine_data *ted);
+void thermal_engine_capability_exit(struct thermal_engine_data *ted);
+
 int thermal_engine_performance_init(struct thermal_engine_data *ted);
 void thermal_engine_performance_exit(struct thermal_engine_data *ted);
 
+int thermal_engine_executor_init(struct thermal_engine_data *ted);
+void thermal_engine_executor_exit(struct thermal_engine_data *ted);
+
 int thermal_engine_plugins_init(struct thermal_engine_data *ted);
 void thermal_engine_plugins_exit(struct thermal_engine_data *ted);
 
+int thermal_engine_plugin_watch_init(struct thermal_engine_data *ted);
+void thermal_engine_plugin_watch_exit(struct thermal_engine_data *ted);
+
 int thermal_engine_profile_init(struct thermal_engine_data *ted);
 void thermal_engine_profile_exit(struct thermal_engine_data *ted);
+
+int thermal_engine_metrics_init(struct thermal_engine_data *ted);
+void thermal_engine_metrics_exit(struct thermal_engine_data *ted);
+
+int thermal_engine_control_init(struct thermal_engine_data *ted);
+void thermal_engine_control_exit(struct thermal_engine_data *ted);
+
+void thermal_engine_trace_exit(struct thermal_engine_data *ted);
 #endif
@@ -9,8 +9,12 @@
 #include "thermal-engine.h"
 #include "mainloop.h"
 #include "threshold.h"
+#include "window.h"
+#include "capability.h"
 #include "log.h"
 #include "profile.h"
+#include "timestamp.h"
+#include "trace.h"
 
 static int show_trip(struct thermal_trip *tt, __maybe_unused void *arg)
 {
@@ -60,6 +64,52 @@ static int show_cdev(struct thermal_cdev *cdev, void *arg)
 	return 0;
 }
 
+static int show_cdev_stats(struct thermal_cdev *cdev, void *arg)
+{
+	struct thermal_handler *th = (typeof(th))arg;
+	struct thermal_cdev_stats stats;
+	struct thermal_cdev_stats sysfs;
+	int i;
+
+	if (cdev->max_state < 0)
+		return 0;
+
+	stats.max_state = cdev->max_state;
+	stats.time_in_state = calloc(cdev->max_state + 1, sizeof(*stats.time_in_state));
+	if (!stats.time_in_state)
+		return 0;
+
+	if (thermal_cdev_stats_get(th, cdev->id, &stats))
+		goto out_free;
+
+	INFO("Cooling device '%s', id=%d: %lu transitions\n",
+	     cdev->name, cdev->id, stats.total_trans);
+
+	sysfs.max_state = stats.max_state;
+	sysfs.time_in_state = calloc(stats.max_state + 1, sizeof(*sysfs.time_in_state));
+	if (sysfs.time_in_state && thermal_cdev_stats_sysfs(cdev->id, &sysfs)) {
+		free(sysfs.time_in_state);
+		sysfs.time_in_state = NULL;
+	}
+
+	for (i = 0; i <= stats.max_state; i++) {
+
+		if (!sysfs.time_in_state) {
+			INFO("  state %d: %llu ms\n", i, stats.time_in_state[i]);
+			continue;
+		}
+
+		INFO("  state %d: %llu ms (kernel: %llu ms)\n", i,
+		     stats.time_in_state[i], sysfs.time_in_state[i]);
+	}
+
+	free(sysfs.time_in_state);
+out_free:
+	free(stats.time_in_state);
+
+	return 0;
+}
+
 static int show_tz(struct thermal_zone *tz, void *arg)
 {
 	DEBUG("Thermal zone '%s', id=%d, governor='%s'\n",
@@ -104,15 +154,52 @@ static int tz_enable(int tz_id, void *arg)
 	return 0;
 }
 
+static int tz_temp(int tz_id, int temp, void *arg)
+{
+	struct thermal_engine_data *ted = arg;
+	struct thermal_zone *tz = thermal_zone_find_by_id(ted->tz, tz_id);
+	struct thermal_trip *trip;
+	int delay;
+
+	if (!tz)
+		return 0;
+
+	tz->temp = temp;
+
+	thermal_trend_update(&tz->trend, temp, timestamp());
+
+	delay = thermal_zone_time_to_trip(tz, &trip);
+	if (delay < 0)
+		return 0;
+
+	DEBUG("Thermal zone %d ('%s'): temperature=%d m°C, slope=%d m°C/s, "
+	      "trip point %d (%d m°C) expected in %d ms\n", tz_id, tz->name,
+	      temp, tz->trend.slope, trip->id, trip->temp, delay);
+
+	return 0;
+}
+
 static int trip_high(int tz_id, int trip_id, int temp, void *arg)
 {
 	struct thermal_engine_data *ted = arg;
 	struct thermal_zone *tz = thermal_zone_find_by_id(ted->tz, tz_id);
 	struct thermal_trip *trip;
+	struct window *window;
 
 	DEBUG("Thermal zone %d ('%s'): trip point %d crossed way up with %d m°C\n",
 	     tz_id, tz->name, trip_id, temp);
 
+	/*
+	 * The kernel thresholds are the only source of crossing events
+	 * for the thermal zone
+	 */
+	if (threshold_kernel(ted->thresholds, tz_id))
+		return 0;
+
+	window = window_find(ted->windows, tz_id, trip_id);
+	if (window)
+		return window_crossed_up(ted, window, temp);
+
 	if (find_trip(tz, trip_id, &trip)) {
 		WARN("No trip point found for id=%d\n", trip_id);
 		return 0;
@@ -126,10 +213,22 @@ static int trip_low(int tz_id, int trip_id, int temp, void *arg)
 	struct thermal_engine_data *ted = arg;
 	struct thermal_zone *tz = thermal_zone_find_by_id(ted->tz, tz_id);
 	struct thermal_trip *trip;
+	struct window *window;
 
 	DEBUG("Thermal zone %d ('%s'): trip point %d crossed way down with %d m°C\n",
 	     tz_id, tz->name, trip_id, temp);
 
+	/*
+	 * The kernel thresholds are the only source of crossing events
+	 * for the thermal zone
+	 */
+	if (threshold_kernel(ted->thresholds, tz_id))
+		return 0;
+
+	window = window_find(ted->windows, tz_id, trip_id);
+	if (window)
+		return window_crossed_down(ted, window, temp);
+
 	if (find_trip(tz, trip_id, &trip)) {
 		WARN("No trip point found for id=%d\n", trip_id);
 		return 0;
@@ -138,20 +237,86 @@ static int trip_low(int tz_id, int trip_id, int temp, void *arg)
 	return threshold_crossed_down(ted->thresholds, tz_id, trip->temp);
 }
 
-static int trip_add(int tz_id, int trip_id, int type, int temp, int hyst,
-		    __maybe_unused void *arg)
+static int threshold_up(int tz_id, int temp, int prev_temp, void *arg)
+{
+	struct thermal_engine_data *ted = arg;
+
+	DEBUG("Thermal zone %d: threshold crossed way up %d -> %d m°C\n",
+	      tz_id, prev_temp, temp);
+
+	return threshold_crossed_range_up(ted->thresholds, tz_id, prev_temp, temp);
+}
+
+static int threshold_down(int tz_id, int temp, int prev_temp, void *arg)
+{
+	struct thermal_engine_data *ted = arg;
+
+	DEBUG("Thermal zone %d: threshold crossed way down %d -> %d m°C\n",
+	      tz_id, prev_temp, temp);
+
+	return threshold_crossed_range_down(ted->thresholds, tz_id, prev_temp, temp);
+}
+
+static int cpu_capability_change(struct thermal_cpu_capability *cap, int nr, void *arg)
+{
+	struct thermal_engine_data *ted = arg;
+
+	DEBUG("Capability changed for %d cpu(s)\n", nr);
+
+	return capability_update(ted->capabilities, cap, nr);
+}
+
+static int trip_refresh_done(thermal_error_t error, void *data, void *arg)
+{
+	struct thermal_zone *tz = data;
+
+	if (error) {
+		WARN("Failed to refresh the trip points of thermal zone '%s'\n",
+		     tz->name);
+		return -1;
+	}
+
+	DEBUG("Thermal zone '%s' trip points refreshed\n", tz->name);
+
+	for_each_thermal_trip(tz->trip, show_trip, arg);
+
+	return 0;
+}
+
+static int trip_refresh(struct thermal_engine_data *ted, int tz_id)
+{
+	struct thermal_zone *tz = thermal_zone_find_by_id(ted->tz, tz_id);
+
+	if (!tz)
+		return 0;
+
+	/*
+	 * The trip point table changed, ask for the new one without
+	 * blocking the mainloop, the reply will be processed when the
+	 * command socket is readable
+	 */
+	if (thermal_cmd_async_get_trip(ted->th, tz, trip_refresh_done, ted->th)) {
+		ERROR("Failed to request the trip points of thermal zone '%s'\n",
+		      tz->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int trip_add(int tz_id, int trip_id, int type, int temp, int hyst, void *arg)
 {
 	DEBUG("Trip point added %d: id=%d, type=%d, temp=%d, hyst=%d\n",
 	     tz_id, trip_id, type, temp, hyst);
 
-	return 0;
+	return trip_refresh(arg, tz_id);
 }
 
-static int trip_delete(int tz_id, int trip_id, __maybe_unused void *arg)
+static int trip_delete(int tz_id, int trip_id, void *arg)
 {
 	DEBUG("Trip point deleted %d: id=%d\n", tz_id, trip_id);
 
-	return 0;
+	return trip_refresh(arg, tz_id);
 }
 
 static int trip_change(int tz_id, int trip_id, int type, int temp,
@@ -159,15 +324,35 @@ static int trip_change(int tz_id, int trip_id, int type, int temp,
 {
 	struct thermal_engine_data *ted = arg;
 	struct thermal_zone *tz = thermal_zone_find_by_id(ted->tz, tz_id);
+	int i;
 
 	DEBUG("Trip point changed %d: id=%d, type=%d, temp=%d, hyst=%d\n",
 	     tz_id, trip_id, type, temp, hyst);
 
-	tz->trip[trip_id].type = type;
-	tz->trip[trip_id].temp = temp;
-	tz->trip[trip_id].hyst = hyst;
+	if (!tz)
+		return 0;
 
-	return 0;
+	/*
+	 * The table is indexed by position, not by trip id, and it is
+	 * replaced when a trip point is added or deleted
+	 */
+	for (i = 0; tz->trip && tz->trip[i].id != -1; i++) {
+
+		if (tz->trip[i].id != trip_id)
+			continue;
+
+		tz->trip[i].type = type;
+		tz->trip[i].temp = temp;
+		tz->trip[i].hyst = hyst;
+
+		return 0;
+	}
+
+	/*
+	 * Not in the table yet, a refresh is pending or the addition
+	 * was missed
+	 */
+	return trip_refresh(ted, tz_id);
 }
 
 static int cdev_add(const char *name, int cdev_id, int max_state, __maybe_unused void *arg)
@@ -184,10 +369,16 @@ static int cdev_delete(int cdev_id, __maybe_unused void *arg)
 	return 0;
 }
 
-static int cdev_update(int cdev_id, int cur_state, __maybe_unused void *arg)
+static int cdev_update(int cdev_id, int cur_state, void *arg)
 {
+	struct thermal_engine_data *ted = arg;
+	struct thermal_cdev *cdev = thermal_cdev_find_by_id(ted->cdev, cdev_id);
+
 	DEBUG("cdev:%d state:%d\n", cdev_id, cur_state);
 
+	if (cdev)
+		cdev->cur_state = cur_state;
+
 	return 0;
 }
 
@@ -196,14 +387,18 @@ static int gov_change(int tz_id, const char *name, __maybe_unused void *arg)
 	struct thermal_engine_data *ted = arg;
 	struct thermal_zone *tz = thermal_zone_find_by_id(ted->tz, tz_id);
 
+	if (!tz)
+		return 0;
+
 	DEBUG("%s: governor changed %s -> %s\n", tz->name, tz->governor, name);
 
-	strcpy(tz->governor, name);
+	snprintf(tz->governor, sizeof(tz->governor), "%s", name);
 
 	return 0;
 }
 
 static struct thermal_ops ops = {
+	.sampling.tz_temp	= tz_temp,
 	.events.tz_create	= tz_create,
 	.events.tz_delete	= tz_delete,
 	.events.tz_disable	= tz_disable,
@@ -216,19 +411,51 @@ static struct thermal_ops ops = {
 	.events.cdev_add	= cdev_add,
 	.events.cdev_delete	= cdev_delete,
 	.events.cdev_update	= cdev_update,
-	.events.gov_change	= gov_change
+	.events.gov_change	= gov_change,
+	.events.threshold_up	= threshold_up,
+	.events.threshold_down	= threshold_down,
+	.events.cpu_capability_change = cpu_capability_change,
 };
 
 static int thermal_event(__maybe_unused int fd, __maybe_unused void *arg)
+{
+	struct thermal_engine_data *ted = arg;
+	int ret;
+
+	/*
+	 * The latencies of the thresholds crossed by these events are
+	 * measured from here
+	 */
+	trace_receive();
+
+	ret = thermal_events_handle(ted->th, ted);
+
+	trace_receive_done();
+
+	return ret;
+}
+
+static int thermal_sampling(__maybe_unused int fd, void *arg)
 {
 	struct thermal_engine_data *ted = arg;
 
-	return thermal_events_handle(ted->th, ted);
+	return thermal_sampling_handle(ted->th, ted);
+}
+
+static int thermal_cmd_event(__maybe_unused int fd, void *arg)
+{
+	struct thermal_engine_data *ted = arg;
+
+	return thermal_cmd_async_handle(ted->th);
 }
 
 void thermal_engine_thermal_exit(struct thermal_engine_data *ted)
 {
 	mainloop_del(ted->ml, thermal_events_fd(ted->th));
+	mainloop_del(ted->ml, thermal_cmd_async_fd(ted->th));
+	mainloop_del(ted->ml, thermal_sampling_fd(ted->th));
+
+	for_each_thermal_cdev(ted->cdev, show_cdev_stats, ted->th);
 
 	/* 
 	 * FIXME: seems like genl unsubscribe is broken
@@ -257,11 +484,26 @@ int thermal_engine_thermal_init(struct thermal_engine_data *ted)
 		return -1;
 	}
 
+	if (thermal_cdev_stats_init(ted->th, ted->cdev)) {
+		ERROR("Failed to initialize the cooling device statistics\n");
+		return -1;
+	}
+
 	if (mainloop_add(ted->ml, thermal_events_fd(ted->th), thermal_event, ted)) {
 		ERROR("Failed to setup the mainloop\n");
 		return -1;
 	}
 
+	if (mainloop_add(ted->ml, thermal_cmd_async_fd(ted->th), thermal_cmd_event, ted)) {
+		ERROR("Failed to setup the mainloop for the commands\n");
+		return -1;
+	}
+
+	if (mainloop_add(ted->ml, thermal_sampling_fd(ted->th), thermal_sampling, ted)) {
+		ERROR("Failed to setup the mainloop for the sampling\n");
+		return -1;
+	}
+
 	for_each_thermal_zone(ted->tz, show_tz, ted->th);
 
 	for_each_thermal_cdev(ted->cdev, show_cdev, ted->th);
@@ -1,12 +1,20 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
+#include <thermal.h>
+#include <probe.h>
 
 #include "thermal-engine.h"
 #include "threshold.h"
 #include "config.h"
 #include "pair.h"
 #include "plugin.h"
+#include "profile.h"
+#include "power_budget.h"
+#include "executor.h"
+#include "mainloop.h"
+#include "trace.h"
 #include "log.h"
 
 struct plugin_list {
@@ -14,211 +22,1575 @@ struct plugin_list {
 	struct plugin *plugin;
 };
 
-struct threshold {
+/*
+ * The actions of a threshold for a profile, 'budget' is the power
+ * budget resolved to the dtpm devices
+ */
+struct threshold_actions {
 	struct plugin_power *power;
+	struct power_budget *budget;
 	struct list plugins;
+};
+
+/*
+ * The actions are indexed by the profile id, a profile without
+ * action on the threshold is beyond 'nr_actions' or has an empty list
+ */
+struct threshold {
+	struct threshold_actions *actions;
+	int nr_actions;
 	int temperature;
+	int hysteresis;
 	int tz_id;
 };
 
+/*
+ * The thresholds of a thermal zone sorted by temperature, 'level' is
+ * the number of thresholds below the temperature and 'temperature'
+ * the last threshold crossed. The crossings are counted since the
+ * start, they are kept when the thresholds are reset.
+ */
+struct threshold_zone {
+	struct threshold **threshold;
+	int nr_thresholds;
+	int level;
+	int temperature;
+	unsigned long crossed_up;
+	unsigned long crossed_down;
+};
+
+/*
+ * The thresholds crossed during a mainloop iteration for a plugin
+ * using the batched ops, they are delivered when the mainloop flushes
+ */
+struct threshold_batch {
+	struct plugin *plugin;
+	struct plugin_event *events;
+	struct trace_event *traces;
+	int nr_events;
+	int max_events;
+};
+
+/*
+ * The profiles having actions on the thresholds, they are resolved
+ * when the thresholds are configured and kept until the thresholds
+ * are freed, the id is the index of their actions on the thresholds
+ */
+struct threshold_profile {
+	char *name;
+	int id;
+};
+
+/*
+ * The thermal zones are indexed by their id, the table grows when a
+ * threshold is added to a thermal zone with a higher id. Switching
+ * the profile changes the 'active' pointer, nothing else.
+ */
 struct thresholds {
 	int crossed;
-	struct pair threshold;
+	struct power_handler *pw;
+	struct threshold_profile *active;
+	struct threshold_profile **profiles;
+	int nr_profiles;
+	struct executor *executor;
+	struct threshold_zone *zones;
+	int nr_zones;
+	struct threshold_batch *batches;
+	int nr_batches;
+	int pending;
+	struct pair kernel;
 };
 
-static int threshold_id_encode(int tz_id, int temperature)
+static struct threshold_zone *threshold_zone_find(struct thresholds *thresholds, int tz_id)
 {
-	/*
-	 * Assumption is there won't be more than 512 thermal zones so
-	 * we can encode the id on 9 bits for the thermal zone id and
-	 * 23 bits for the trip point temperature.
-	 * That allows:
-	 *  9 bits : 512 thermal zones
-	 * 23 bits : 8388°C max temperature
-	 */
-	return tz_id << 23 | temperature;
-}	
+	if (tz_id < 0 || tz_id >= thresholds->nr_zones)
+		return NULL;
+
+	return &thresholds->zones[tz_id];
+}
+
+/*
+ * Returns the position of the first threshold with a temperature
+ * greater than or equal to 'temperature', nr_thresholds if none
+ */
+static int threshold_lower_bound(struct threshold_zone *zone, int temperature)
+{
+	int low = 0, high = zone->nr_thresholds;
+
+	while (low < high) {
+		int mid = low + (high - low) / 2;
+
+		if (zone->threshold[mid]->temperature < temperature)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
 
 static struct threshold *threshold_find(struct thresholds *thresholds,
 					int tz_id, int temperature)
 {
-	int id = threshold_id_encode(tz_id, temperature);
+	struct threshold_zone *zone;
+	int pos;
+
+	zone = threshold_zone_find(thresholds, tz_id);
+	if (!zone)
+		return NULL;
+
+	pos = threshold_lower_bound(zone, temperature);
+	if (pos == zone->nr_thresholds ||
+	    zone->threshold[pos]->temperature != temperature) {
+		PROBE3(thermal_engine, threshold_lookup, tz_id, temperature, 0);
+		return NULL;
+	}
+
+	PROBE3(thermal_engine, threshold_lookup, tz_id, temperature, 1);
+
+	return zone->threshold[pos];
+}
+
+static struct threshold_profile *threshold_profile_find(struct thresholds *thresholds,
+							const char *name)
+{
+	int i;
+
+	for (i = 0; i < thresholds->nr_profiles; i++)
+		if (!strcmp(thresholds->profiles[i]->name, name))
+			return thresholds->profiles[i];
+
+	return NULL;
+}
+
+static struct threshold_profile *threshold_profile_get(struct thresholds *thresholds,
+						       const char *name)
+{
+	struct threshold_profile **profiles;
+	struct threshold_profile *profile;
+
+	profile = threshold_profile_find(thresholds, name);
+	if (profile)
+		return profile;
+
+	profiles = realloc(thresholds->profiles,
+			   sizeof(*profiles) * (thresholds->nr_profiles + 1));
+	if (!profiles)
+		return NULL;
+
+	thresholds->profiles = profiles;
+
+	profile = malloc(sizeof(*profile));
+	if (!profile)
+		return NULL;
+
+	profile->name = strdup(name);
+	if (!profile->name) {
+		free(profile);
+		return NULL;
+	}
+
+	profile->id = thresholds->nr_profiles;
+	profiles[thresholds->nr_profiles++] = profile;
+
+	DEBUG("Added profile name='%s', id=%d\n", name, profile->id);
+
+	return profile;
+}
+
+static struct threshold_actions *threshold_actions_find(struct threshold *threshold,
+							struct threshold_profile *profile)
+{
+	if (!profile || profile->id >= threshold->nr_actions)
+		return NULL;
 
-	return pair_find(&thresholds->threshold, id);
+	return &threshold->actions[profile->id];
+}
+
+static struct threshold_actions *threshold_actions_get(struct threshold *threshold,
+						       struct threshold_profile *profile)
+{
+	struct threshold_actions *actions;
+	int nr = threshold->nr_actions;
+
+	if (profile->id < nr)
+		return &threshold->actions[profile->id];
+
+	actions = realloc(threshold->actions, sizeof(*actions) * (profile->id + 1));
+	if (!actions)
+		return NULL;
+
+	for (; nr <= profile->id; nr++) {
+		list_init(&actions[nr].plugins);
+		actions[nr].power = NULL;
+		actions[nr].budget = NULL;
+	}
+
+	threshold->actions = actions;
+	threshold->nr_actions = nr;
+
+	return &actions[profile->id];
 }
 
 int threshold_for_each_plugin(struct threshold *threshold,
 			      int (*cb)(struct plugin *plugin, struct threshold *threshold))
 {
 	struct list *l;
-	int ret = 0;
+	int i, ret = 0;
+
+	for (i = 0; i < threshold->nr_actions; i++) {
+
+		l = list_next(&threshold->actions[i].plugins);
+		while (l) {
+			struct plugin_list *pl;
+			struct plugin *p;
 
-	l = list_next(&threshold->plugins);
-	while (l) {
-		struct plugin_list *pl;
-		struct plugin *p;
+			pl = container_of(l, struct plugin_list, list);
+			p = pl->plugin;
 
-		pl = container_of(l, struct plugin_list, list);
-		p = pl->plugin;
+			ret |= cb(p, threshold);
 
-		ret |= cb(p, threshold);
-		
-		l = list_next(l);
+			l = list_next(l);
+		}
 	}
 
 	return ret;
 }
 
-static int threshold_crossed(struct thresholds *thresholds, int tz_id, int temperature,
-			     int (*cb)(struct plugin *plugin, struct threshold *threshold))
+enum threshold_op {
+	THRESHOLD_TRIP_LOW,
+	THRESHOLD_TRIP_HIGH,
+	THRESHOLD_RESET,
+};
+
+/*
+ * A plugin action, the job is released when the action completes
+ */
+struct threshold_job {
+	struct executor_job job;
+	struct plugin *plugin;
+	struct trace_event trace;
+	int tz_id;
+	int temperature;
+	enum threshold_op op;
+};
+
+static int threshold_job_run(struct executor_job *job)
 {
-	struct threshold *threshold;
+	struct threshold_job *tj = container_of(job, struct threshold_job, job);
+	int ret = 0;
 
-	threshold = threshold_find(thresholds, tz_id, temperature);
-	if (!threshold)
-		return 0;
-	
-	return threshold_for_each_plugin(threshold, cb);
+	trace_dispatch(&tj->trace, 1);
+
+	switch (tj->op) {
+	case THRESHOLD_TRIP_LOW:
+		ret = plugin_trip_low(tj->plugin, tj->tz_id, tj->temperature, NULL);
+		break;
+	case THRESHOLD_TRIP_HIGH:
+		ret = plugin_trip_high(tj->plugin, tj->tz_id, tj->temperature, NULL);
+		break;
+	case THRESHOLD_RESET:
+		ret = plugin_reset(tj->plugin, tj->tz_id, tj->temperature, NULL);
+		break;
+	}
+
+	trace_dispatch_done();
+
+	return ret;
 }
 
-static int __threshold_crossed_up(struct plugin *plugin, struct threshold *threshold)
+static void threshold_job_done(struct executor_job *job, int ret)
 {
-	DEBUG("Doing plugin action %s with profile=%s\n",
-	      plugin->descriptor->compatibles[0], plugin->descriptor->profile);
+	struct threshold_job *tj = container_of(job, struct threshold_job, job);
 
-	if (plugin_trip_high(plugin, threshold->tz_id, threshold->temperature, NULL))
+	if (ret)
 		WARN("Plugin callback failed\n");
 
-	return 0;
+	free(tj);
 }
 
-static int __threshold_crossed_down(struct plugin *plugin, struct threshold *threshold)
+/*
+ * The actions of a plugin are serialized, the plugins do not have to
+ * deal with concurrency, but different plugins act in parallel
+ */
+static int threshold_action(struct thresholds *thresholds, struct plugin *plugin,
+			    int tz_id, int temperature, enum threshold_op op,
+			    struct trace_event *trace)
 {
+	struct threshold_job *tj;
+
 	DEBUG("Doing plugin action %s with profile=%s\n",
 	      plugin->descriptor->compatibles[0], plugin->descriptor->profile);
 
-	if (plugin_trip_low(plugin, threshold->tz_id, threshold->temperature, NULL))
-		WARN("Plugin callback failed\n");
-		
+	tj = malloc(sizeof(*tj));
+	if (!tj)
+		return -1;
+
+	tj->plugin = plugin;
+	tj->trace = *trace;
+	tj->tz_id = tz_id;
+	tj->temperature = temperature;
+	tj->op = op;
+
+	if (!thresholds->executor) {
+		threshold_job_done(&tj->job, threshold_job_run(&tj->job));
+		return 0;
+	}
+
+	executor_submit(thresholds->executor, plugin->key, &tj->job,
+			threshold_job_run, threshold_job_done);
+
 	return 0;
 }
 
-int threshold_crossed_up(struct thresholds *thresholds, int tz_id, int temperature)
+/*
+ * The power limits set by a threshold crossing or a profile switch,
+ * the job owns a copy of the requests
+ */
+struct threshold_power_job {
+	struct executor_job job;
+	struct power_handler *pw;
+	struct trace_event trace;
+	int nr;
+	struct power_limit_request req[];
+};
+
+static int threshold_power_job_run(struct executor_job *job)
 {
-	DEBUG("Detected threshold crossed the way up event, "
-	     "tz_id=%d, temperature=%d\n", tz_id, temperature);
+	struct threshold_power_job *tpj = container_of(job, struct threshold_power_job, job);
+	int ret;
 
-	thresholds->crossed++;
+	trace_dispatch(&tpj->trace, 1);
+
+	ret = power_budget_apply(tpj->pw, tpj->req, tpj->nr);
 
-	return threshold_crossed(thresholds, tz_id, temperature, __threshold_crossed_up);
+	trace_dispatch_done();
+
+	return ret < 0 ? -1 : 0;
 }
 
-int threshold_crossed_down(struct thresholds *thresholds, int tz_id, int temperature)
+static void threshold_power_job_done(struct executor_job *job, int ret)
 {
-	DEBUG("Detected threshold crossed the way down event, "
-	      "tz_id=%d, temperature=%d\n", tz_id, temperature);
+	struct threshold_power_job *tpj = container_of(job, struct threshold_power_job, job);
 
-	thresholds->crossed--;
-	
-	return threshold_crossed(thresholds, tz_id, temperature, __threshold_crossed_down);
+	if (ret)
+		WARN("Failed to set the power limits\n");
+
+	free(tpj);
 }
 
-static int __threshold_add_action(struct plugin *plugin, void *data)
+/*
+ * The limit of a device on a thermal zone is the one of the highest
+ * threshold crossed with a budget covering it
+ */
+static unsigned int threshold_zone_power(struct threshold_zone *zone,
+					 struct threshold_profile *profile, int id)
 {
-	struct threshold *threshold = data;
-	struct plugin_list *pl;
+	struct threshold_actions *actions;
+	unsigned int power;
+	int i;
 
-	DEBUG("Added action on tz_id=%d with plugin='%s' on profile='%s'\n",
-	      threshold->tz_id, plugin->descriptor->compatibles[0],
-	      plugin->descriptor->profile);
+	for (i = zone->level - 1; i >= 0; i--) {
 
-	pl = malloc(sizeof(*pl));
-	if (!pl)
+		actions = threshold_actions_find(zone->threshold[i], profile);
+		if (!actions || !actions->budget)
+			continue;
+
+		power = power_budget_find(actions->budget, id);
+		if (power)
+			return power;
+	}
+
+	return 0;
+}
+
+/*
+ * Several thermal zones can budget the same device, it gets the lowest
+ * of their limits. Zero restores the initial limit.
+ */
+static unsigned int threshold_device_power(struct thresholds *thresholds,
+					   struct threshold_profile *profile, int id)
+{
+	unsigned int power, min = 0;
+	int i;
+
+	for (i = 0; i < thresholds->nr_zones; i++) {
+
+		if (!thresholds->zones[i].level)
+			continue;
+
+		power = threshold_zone_power(&thresholds->zones[i], profile, id);
+		if (power && (!min || power < min))
+			min = power;
+	}
+
+	return min;
+}
+
+/*
+ * The devices of the budgets get their limits in a single batch, the
+ * power updates are serialized
+ */
+static int threshold_power(struct thresholds *thresholds, struct threshold_profile *profile,
+			   struct power_budget **budgets, int nr_budgets,
+			   struct trace_event *trace)
+{
+	struct threshold_power_job *tpj;
+	int i, j, nr = 0;
+
+	for (i = 0; i < nr_budgets; i++)
+		nr += budgets[i]->nr;
+
+	if (!nr)
+		return 0;
+
+	tpj = malloc(sizeof(*tpj) + sizeof(*tpj->req) * nr);
+	if (!tpj)
 		return -1;
 
-	list_init(&pl->list);
-	pl->plugin = plugin;
+	tpj->pw = thresholds->pw;
+	tpj->trace = *trace;
+	tpj->nr = nr;
+
+	for (i = 0, nr = 0; i < nr_budgets; i++) {
+
+		for (j = 0; j < budgets[i]->nr; j++, nr++) {
+			tpj->req[nr].id = budgets[i]->req[j].id;
+			tpj->req[nr].power_mw = threshold_device_power(thresholds, profile,
+								       tpj->req[nr].id);
+		}
+	}
+
+	if (!thresholds->executor) {
+		threshold_power_job_done(&tpj->job, threshold_power_job_run(&tpj->job));
+		return 0;
+	}
 
-	list_add_tail(&threshold->plugins, &pl->list);
+	executor_submit(thresholds->executor, (unsigned long)thresholds->pw, &tpj->job,
+			threshold_power_job_run, threshold_power_job_done);
 
 	return 0;
 }
 
-int threshold_add_action(struct thresholds *thresholds, struct list *plugins,
-			 struct plugin_power *power, const char *profile,
-			 int tz_id, int temperature)
+/*
+ * The budgets of the thresholds crossed on a thermal zone for a
+ * profile, the array is allocated by the caller with room for the
+ * level of the zone
+ */
+static int threshold_zone_budgets(struct threshold_zone *zone,
+				  struct threshold_profile *profile,
+				  struct power_budget **budgets)
 {
-	struct threshold *threshold;
+	struct threshold_actions *actions;
+	int i, nr = 0;
 
-	DEBUG("Adding all actions for profile='%s' on temperature=%d for thermal"
-	      " zone id=%d\n", profile, temperature, tz_id);
+	for (i = 0; i < zone->level; i++) {
 
-	threshold = threshold_find(thresholds, tz_id, temperature);
-	if (!threshold) {
-		ERROR("Failed to add action, threshold not found tz_id=%d, "
-		      "temperature=%d\n", tz_id, temperature);
-		return 0;
+		actions = threshold_actions_find(zone->threshold[i], profile);
+		if (actions && actions->budget)
+			budgets[nr++] = actions->budget;
 	}
 
-	threshold->power = power;
+	return nr;
+}
+
+static struct threshold_batch *threshold_batch_find(struct thresholds *thresholds,
+						    struct plugin *plugin)
+{
+	struct threshold_batch *batches;
+	int i;
+
+	for (i = 0; i < thresholds->nr_batches; i++)
+		if (thresholds->batches[i].plugin == plugin)
+			return &thresholds->batches[i];
 
-	return plugin_profile_for_each(plugins, profile,
-				       __threshold_add_action, threshold);
+	batches = realloc(thresholds->batches, sizeof(*batches) * (i + 1));
+	if (!batches)
+		return NULL;
+
+	memset(&batches[i], 0, sizeof(*batches));
+	batches[i].plugin = plugin;
+
+	thresholds->batches = batches;
+	thresholds->nr_batches++;
+
+	return &batches[i];
 }
 
-int threshold_add(struct thresholds *thresholds, int tz_id, int temperature)
+static int threshold_batch_add(struct thresholds *thresholds, struct plugin *plugin,
+			       struct threshold *threshold, int way_up,
+			       struct trace_event *trace)
 {
-	int id = threshold_id_encode(tz_id, temperature);
-	struct threshold *threshold;
+	struct threshold_batch *batch;
+	struct plugin_event *events;
+	struct trace_event *traces;
 
-	if (!thresholds) {
-		ERROR("Thresholds not initialized\n");
+	batch = threshold_batch_find(thresholds, plugin);
+	if (!batch)
 		return -1;
+
+	if (batch->nr_events == batch->max_events) {
+
+		int max = batch->max_events ? batch->max_events * 2 : 8;
+
+		events = realloc(batch->events, sizeof(*events) * max);
+		if (!events)
+			return -1;
+
+		batch->events = events;
+
+		traces = realloc(batch->traces, sizeof(*traces) * max);
+		if (!traces)
+			return -1;
+
+		batch->traces = traces;
+		batch->max_events = max;
 	}
 
-	threshold = malloc(sizeof(*threshold));
+	batch->traces[batch->nr_events] = *trace;
+
+	events = &batch->events[batch->nr_events++];
+	events->tz_id = threshold->tz_id;
+	events->temperature = threshold->temperature;
+	events->way_up = way_up;
+
+	thresholds->pending++;
+
+	return 0;
+}
+
+static int threshold_crossed(struct thresholds *thresholds, int tz_id, int temperature,
+			     int way_up)
+{
+	struct threshold_profile *profile;
+	struct threshold_actions *actions;
+	struct threshold_zone *zone;
+	struct threshold *threshold;
+	struct trace_event trace;
+	struct list *l;
+	int ret = 0;
+
+	threshold = threshold_find(thresholds, tz_id, temperature);
 	if (!threshold)
-		return -1;
+		return 0;
 
-	list_init(&threshold->plugins);
-	threshold->temperature = temperature;
-	threshold->tz_id = tz_id;
+	PROBE3(thermal_engine, threshold_crossed, tz_id, temperature, way_up);
 
-	if (pair_add(&thresholds->threshold, id, threshold)) {
-		ERROR("Failed to add threshold\n");
-		return -1;
+	trace_crossed(tz_id, &trace);
+
+	zone = threshold_zone_find(thresholds, tz_id);
+	zone->level = threshold_lower_bound(zone, temperature) + (way_up ? 1 : 0);
+	zone->temperature = temperature;
+
+	if (way_up)
+		zone->crossed_up++;
+	else
+		zone->crossed_down++;
+
+	/*
+	 * The active profile is read once, a switch applies to the
+	 * thresholds crossed after it
+	 */
+	profile = __atomic_load_n(&thresholds->active, __ATOMIC_ACQUIRE);
+
+	actions = threshold_actions_find(threshold, profile);
+	if (!actions)
+		return 0;
+
+	for (l = list_next(&actions->plugins); l; l = list_next(l)) {
+		struct plugin_list *pl = container_of(l, struct plugin_list, list);
+
+		if (plugin_batched(pl->plugin))
+			ret |= threshold_batch_add(thresholds, pl->plugin, threshold,
+						   way_up, &trace);
+		else
+			ret |= threshold_action(thresholds, pl->plugin, tz_id, temperature,
+						way_up ? THRESHOLD_TRIP_HIGH :
+						THRESHOLD_TRIP_LOW, &trace);
 	}
 
-	DEBUG("Added threshold id=%d\n", id);
+	/*
+	 * The way up the budget applies, the way down its devices get
+	 * back the lowest limit of the thresholds still crossed
+	 */
+	if (actions->budget)
+		ret |= threshold_power(thresholds, profile, &actions->budget, 1, &trace);
 
-	return 0;
+	return ret;
 }
 
-int thermal_engine_threshold_init(struct thermal_engine_data *ted)
+/*
+ * The batch job owns a copy of the events, of their traces and of the
+ * levels, they follow the structure in the same allocation
+ */
+struct threshold_batch_job {
+	struct executor_job job;
+	struct plugin *plugin;
+	struct trace_event *traces;
+	struct plugin_batch batch;
+};
+
+static int threshold_batch_job_run(struct executor_job *job)
 {
-	struct thresholds *thresholds;
+	struct threshold_batch_job *tbj = container_of(job, struct threshold_batch_job, job);
+	int ret;
 
-	if (!ted)
-		return -1;
-	
-	thresholds = malloc(sizeof(*thresholds));
-	if (!thresholds)
-		return -1;
+	trace_dispatch(tbj->traces, tbj->batch.nr_events);
 
-	pair_init(&thresholds->threshold);
-	thresholds->crossed = 0;
+	ret = plugin_trip_batch(tbj->plugin, &tbj->batch, NULL);
 
-	ted->thresholds = thresholds;
+	trace_dispatch_done();
 
-	if (config_thermal_zone(ted)) {
-		ERROR("Failed to configure the thermal zones");
+	return ret;
+}
+
+static void threshold_batch_job_done(struct executor_job *job, int ret)
+{
+	struct threshold_batch_job *tbj = container_of(job, struct threshold_batch_job, job);
+
+	if (ret)
+		WARN("Plugin batch callback failed\n");
+
+	free(tbj);
+}
+
+static int threshold_levels(struct thresholds *thresholds, struct plugin_level *levels)
+{
+	int i, nr = 0;
+
+	for (i = 0; i < thresholds->nr_zones; i++) {
+
+		if (!thresholds->zones[i].nr_thresholds)
+			continue;
+
+		if (levels) {
+			levels[nr].tz_id = i;
+			levels[nr].level = thresholds->zones[i].level;
+			levels[nr].temperature = thresholds->zones[i].temperature;
+		}
+
+		nr++;
+	}
+
+	return nr;
+}
+
+static int threshold_batch_submit(struct thresholds *thresholds,
+				  struct threshold_batch *batch, int nr_levels)
+{
+	struct threshold_batch_job *tbj;
+	size_t events_size = sizeof(*batch->events) * batch->nr_events;
+	size_t traces_size = sizeof(*batch->traces) * batch->nr_events;
+
+	tbj = malloc(sizeof(*tbj) + traces_size + events_size +
+		     sizeof(struct plugin_level) * nr_levels);
+	if (!tbj)
 		return -1;
+
+	tbj->plugin = batch->plugin;
+	tbj->traces = (struct trace_event *)(tbj + 1);
+	tbj->batch.events = (struct plugin_event *)(tbj->traces + batch->nr_events);
+	tbj->batch.nr_events = batch->nr_events;
+	tbj->batch.levels = (struct plugin_level *)(tbj->batch.events + batch->nr_events);
+	tbj->batch.nr_levels = threshold_levels(thresholds, tbj->batch.levels);
+
+	memcpy(tbj->traces, batch->traces, traces_size);
+	memcpy(tbj->batch.events, batch->events, events_size);
+
+	if (!thresholds->executor) {
+		threshold_batch_job_done(&tbj->job, threshold_batch_job_run(&tbj->job));
+		return 0;
 	}
-	
+
+	executor_submit(thresholds->executor, batch->plugin->key, &tbj->job,
+			threshold_batch_job_run, threshold_batch_job_done);
+
 	return 0;
 }
 
-void thermal_engine_threshold_exit(struct thermal_engine_data *ted)
+/*
+ * Deliver the thresholds crossed since the last flush to the plugins
+ * using the batched ops, one call per plugin
+ */
+int threshold_flush(struct thresholds *thresholds)
+{
+	int i, nr_levels, ret = 0;
+
+	if (!thresholds->pending)
+		return 0;
+
+	nr_levels = threshold_levels(thresholds, NULL);
+
+	for (i = 0; i < thresholds->nr_batches; i++) {
+
+		struct threshold_batch *batch = &thresholds->batches[i];
+
+		if (!batch->nr_events)
+			continue;
+
+		DEBUG("Delivering %d events to plugin %s\n", batch->nr_events,
+		      batch->plugin->descriptor->compatibles[0]);
+
+		ret |= threshold_batch_submit(thresholds, batch, nr_levels);
+
+		batch->nr_events = 0;
+	}
+
+	thresholds->pending = 0;
+
+	return ret;
+}
+
+static void threshold_mainloop_flush(__maybe_unused int nfds, void *data)
 {
-	free(ted->thresholds);
+	if (threshold_flush(data))
+		WARN("Failed to deliver the batched thresholds\n");
+}
+
+int threshold_crossed_up(struct thresholds *thresholds, int tz_id, int temperature)
+{
+	DEBUG("Detected threshold crossed the way up event, "
+	     "tz_id=%d, temperature=%d\n", tz_id, temperature);
+
+	thresholds->crossed++;
+
+	return threshold_crossed(thresholds, tz_id, temperature, 1);
+}
+
+int threshold_crossed_down(struct thresholds *thresholds, int tz_id, int temperature)
+{
+	DEBUG("Detected threshold crossed the way down event, "
+	      "tz_id=%d, temperature=%d\n", tz_id, temperature);
+
+	thresholds->crossed--;
+	
+	return threshold_crossed(thresholds, tz_id, temperature, 0);
+}
+
+/*
+ * Called from the mainloop, the events processed after the swap go
+ * to the new plugin, the actions already submitted are run by the old
+ * one
+ */
+void threshold_plugin_replace(struct thresholds *thresholds, struct plugin *old,
+			      struct plugin *new)
+{
+	struct list *l;
+	int i, j, k;
+
+	for (i = 0; i < thresholds->nr_zones; i++) {
+
+		for (j = 0; j < thresholds->zones[i].nr_thresholds; j++) {
+
+			struct threshold *threshold = thresholds->zones[i].threshold[j];
+
+			for (k = 0; k < threshold->nr_actions; k++) {
+
+				struct threshold_actions *actions = &threshold->actions[k];
+
+				for (l = list_next(&actions->plugins); l; l = list_next(l)) {
+					struct plugin_list *pl = container_of(l, struct plugin_list, list);
+
+					if (pl->plugin == old)
+						pl->plugin = new;
+				}
+			}
+		}
+	}
+
+	/*
+	 * The events not flushed yet are delivered to the new plugin
+	 */
+	for (i = 0; i < thresholds->nr_batches; i++)
+		if (thresholds->batches[i].plugin == old)
+			thresholds->batches[i].plugin = new;
+}
+
+/*
+ * The plugin is removed from the configuration, the events pending
+ * for it are delivered before it is detached from the thresholds
+ */
+void threshold_plugin_remove(struct thresholds *thresholds, struct plugin *plugin)
+{
+	struct list *l;
+	int i, j, k;
+
+	if (threshold_flush(thresholds))
+		WARN("Failed to deliver the batched thresholds\n");
+
+	for (i = 0; i < thresholds->nr_zones; i++) {
+
+		for (j = 0; j < thresholds->zones[i].nr_thresholds; j++) {
+
+			struct threshold *threshold = thresholds->zones[i].threshold[j];
+
+			for (k = 0; k < threshold->nr_actions; k++) {
+
+				struct threshold_actions *actions = &threshold->actions[k];
+
+				for (l = list_next(&actions->plugins); l; ) {
+					struct plugin_list *pl = container_of(l, struct plugin_list, list);
+
+					l = list_next(l);
+
+					if (pl->plugin != plugin)
+						continue;
+
+					list_del(&actions->plugins, &pl->list);
+					free(pl);
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < thresholds->nr_batches; i++) {
+
+		if (thresholds->batches[i].plugin != plugin)
+			continue;
+
+		free(thresholds->batches[i].events);
+		free(thresholds->batches[i].traces);
+
+		memmove(&thresholds->batches[i], &thresholds->batches[i + 1],
+			sizeof(*thresholds->batches) * (thresholds->nr_batches - i - 1));
+
+		thresholds->nr_batches--;
+		break;
+	}
+}
+
+static int __threshold_add_action(struct plugin *plugin, void *data)
+{
+	struct threshold_actions *actions = data;
+	struct plugin_list *pl;
+
+	DEBUG("Added action with plugin='%s' on profile='%s'\n",
+	      plugin->descriptor->compatibles[0], plugin->descriptor->profile);
+
+	pl = malloc(sizeof(*pl));
+	if (!pl)
+		return -1;
+
+	list_init(&pl->list);
+	pl->plugin = plugin;
+
+	list_add_tail(&actions->plugins, &pl->list);
+
+	return 0;
+}
+
+/*
+ * The actions of all the profiles are added, only the ones of the
+ * active profile are done when the threshold is crossed
+ */
+int threshold_add_action(struct thresholds *thresholds, struct list *plugins,
+			 struct plugin_power *power, const char *profile,
+			 int tz_id, int temperature)
+{
+	struct threshold_profile *tp;
+	struct threshold_actions *actions;
+	struct threshold *threshold;
+
+	DEBUG("Adding all actions for profile='%s' on temperature=%d for thermal"
+	      " zone id=%d\n", profile, temperature, tz_id);
+
+	threshold = threshold_find(thresholds, tz_id, temperature);
+	if (!threshold) {
+		ERROR("Failed to add action, threshold not found tz_id=%d, "
+		      "temperature=%d\n", tz_id, temperature);
+		return 0;
+	}
+
+	tp = threshold_profile_get(thresholds, profile);
+	if (!tp)
+		return -1;
+
+	actions = threshold_actions_get(threshold, tp);
+	if (!actions)
+		return -1;
+
+	plugin_power_free(actions->power);
+	power_budget_free(actions->budget);
+
+	actions->power = power;
+	actions->budget = NULL;
+
+	/*
+	 * The devices are resolved once, the crossings only use the
+	 * dtpm ids
+	 */
+	if (power && thresholds->pw) {
+		actions->budget = power_budget_alloc(thresholds->pw, power);
+		if (!actions->budget)
+			return -1;
+	}
+
+	return plugin_profile_for_each(plugins, profile,
+				       __threshold_add_action, actions);
+}
+
+/*
+ * Attach a plugin loaded after the thresholds were configured to the
+ * action of a threshold
+ */
+int threshold_add_plugin(struct thresholds *thresholds, struct plugin *plugin,
+			 int tz_id, int temperature)
+{
+	struct threshold_profile *profile;
+	struct threshold_actions *actions;
+	struct threshold *threshold;
+
+	threshold = threshold_find(thresholds, tz_id, temperature);
+	if (!threshold) {
+		ERROR("Failed to add plugin, threshold not found tz_id=%d, "
+		      "temperature=%d\n", tz_id, temperature);
+		return -1;
+	}
+
+	profile = threshold_profile_get(thresholds, plugin->descriptor->profile);
+	if (!profile)
+		return -1;
+
+	actions = threshold_actions_get(threshold, profile);
+	if (!actions)
+		return -1;
+
+	return __threshold_add_action(plugin, actions);
+}
+
+static int threshold_actions_uses(struct threshold_actions *actions, struct plugin *plugin)
+{
+	struct list *l;
+
+	for (l = list_next(&actions->plugins); l; l = list_next(l))
+		if (container_of(l, struct plugin_list, list)->plugin == plugin)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Whether the plugin has an action for the profile on one of the 'nr'
+ * first thresholds of the thermal zone
+ */
+static int threshold_zone_uses(struct threshold_zone *zone, int nr,
+			       struct threshold_profile *profile, struct plugin *plugin)
+{
+	struct threshold_actions *actions;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+
+		actions = threshold_actions_find(zone->threshold[i], profile);
+		if (actions && threshold_actions_uses(actions, plugin))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int threshold_profile_uses(struct thresholds *thresholds,
+				  struct threshold_profile *profile, struct plugin *plugin)
+{
+	struct threshold_zone *zone;
+	int i;
+
+	for (i = 0; i < thresholds->nr_zones; i++) {
+
+		zone = &thresholds->zones[i];
+
+		if (threshold_zone_uses(zone, zone->nr_thresholds, profile, plugin))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * The plugins of the previous profile not used by the new one are
+ * reset once on each thermal zone having crossed a threshold. The
+ * reset is queued after the actions of the plugin already submitted.
+ */
+static int threshold_profile_reset(struct thresholds *thresholds,
+				   struct threshold_profile *old,
+				   struct threshold_profile *new)
+{
+	struct trace_event trace = { 0 };
+	struct threshold_actions *actions;
+	struct threshold_zone *zone;
+	struct list *l;
+	int i, j, ret = 0;
+
+	for (i = 0; i < thresholds->nr_zones; i++) {
+
+		zone = &thresholds->zones[i];
+		if (zone->temperature == THRESHOLD_TEMP_INVALID)
+			continue;
+
+		for (j = 0; j < zone->nr_thresholds; j++) {
+
+			actions = threshold_actions_find(zone->threshold[j], old);
+			if (!actions)
+				continue;
+
+			for (l = list_next(&actions->plugins); l; l = list_next(l)) {
+				struct plugin *plugin = container_of(l, struct plugin_list, list)->plugin;
+
+				if (threshold_zone_uses(zone, j, old, plugin) ||
+				    threshold_profile_uses(thresholds, new, plugin))
+					continue;
+
+				DEBUG("Resetting plugin '%s' on tz_id=%d\n",
+				      plugin->descriptor->compatibles[0], i);
+
+				ret |= threshold_action(thresholds, plugin, i, zone->temperature,
+							THRESHOLD_RESET, &trace);
+			}
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * The devices of the budgets of both profiles on the thresholds
+ * crossed get the limits of the new profile
+ */
+static int threshold_profile_power(struct thresholds *thresholds,
+				   struct threshold_profile *old,
+				   struct threshold_profile *new)
+{
+	struct trace_event trace = { 0 };
+	struct threshold_zone *zone;
+	struct power_budget **budgets;
+	int i, nr = 0, max = 0, ret;
+
+	for (i = 0; i < thresholds->nr_zones; i++)
+		max += thresholds->zones[i].level * 2;
+
+	if (!max)
+		return 0;
+
+	budgets = malloc(sizeof(*budgets) * max);
+	if (!budgets)
+		return -1;
+
+	/*
+	 * The devices budgeted by the previous profile are restored or
+	 * get the limits of the new one, all in one batch
+	 */
+	for (i = 0; i < thresholds->nr_zones; i++) {
+
+		zone = &thresholds->zones[i];
+
+		nr += threshold_zone_budgets(zone, old, &budgets[nr]);
+		nr += threshold_zone_budgets(zone, new, &budgets[nr]);
+	}
+
+	ret = threshold_power(thresholds, new, budgets, nr, &trace);
+
+	free(budgets);
+
+	return ret;
+}
+
+void threshold_power_handler(struct thresholds *thresholds, struct power_handler *pw)
+{
+	thresholds->pw = pw;
+}
+
+/*
+ * Register a profile the thresholds may have no action for, it can
+ * be switched to like the others
+ */
+int threshold_profile_add(struct thresholds *thresholds, const char *name)
+{
+	if (threshold_profile_find(thresholds, name))
+		return 0;
+
+	WARN("No action on the thresholds for profile '%s'\n", name);
+
+	return threshold_profile_get(thresholds, name) ? 0 : -1;
+}
+
+/*
+ * The actions of all the profiles are built when the thresholds are
+ * configured, the switch only changes the active profile. Called from
+ * the mainloop, it fails only when the profile is unknown: the profile
+ * is active even if some of its actions failed.
+ */
+int threshold_profile_switch(struct thresholds *thresholds, const char *name)
+{
+	struct threshold_profile *profile, *old;
+
+	profile = threshold_profile_find(thresholds, name);
+	if (!profile) {
+		ERROR("Unknown profile '%s'\n", name);
+		return -1;
+	}
+
+	old = thresholds->active;
+	if (old == profile)
+		return 0;
+
+	/*
+	 * The batched events were crossed with the previous profile,
+	 * they are delivered before its plugins are reset
+	 */
+	if (threshold_flush(thresholds))
+		WARN("Failed to deliver the batched thresholds\n");
+
+	__atomic_store_n(&thresholds->active, profile, __ATOMIC_RELEASE);
+
+	INFO("Switched to profile '%s'\n", name);
+
+	if (!old)
+		return 0;
+
+	if (threshold_profile_reset(thresholds, old, profile) |
+	    threshold_profile_power(thresholds, old, profile))
+		WARN("Failed to apply the actions of profile '%s'\n", name);
+
+	return 0;
+}
+
+int threshold_window(struct thresholds *thresholds, int tz_id, int temperature,
+		     struct threshold_window *window)
+{
+	struct threshold_zone *zone;
+	struct threshold *threshold;
+	int pos;
+
+	window->low = window->high = THRESHOLD_TEMP_INVALID;
+	window->low_hyst = window->high_hyst = 0;
+
+	zone = threshold_zone_find(thresholds, tz_id);
+	if (!zone)
+		return 0;
+
+	/*
+	 * The first threshold above the temperature is the high one,
+	 * the one before is the low one
+	 */
+	pos = threshold_lower_bound(zone, temperature);
+	if (pos < zone->nr_thresholds &&
+	    zone->threshold[pos]->temperature == temperature)
+		pos++;
+
+	if (pos < zone->nr_thresholds) {
+		threshold = zone->threshold[pos];
+		window->high = threshold->temperature;
+		window->high_hyst = threshold->hysteresis;
+	}
+
+	if (pos > 0) {
+		threshold = zone->threshold[pos - 1];
+		window->low = threshold->temperature;
+		window->low_hyst = threshold->hysteresis;
+	}
+
+	return 0;
+}
+
+static struct threshold_zone *threshold_zone_alloc(struct thresholds *thresholds, int tz_id)
+{
+	struct threshold_zone *zones;
+	int nr = thresholds->nr_zones;
+
+	if (tz_id < nr)
+		return &thresholds->zones[tz_id];
+
+	zones = realloc(thresholds->zones, sizeof(*zones) * (tz_id + 1));
+	if (!zones)
+		return NULL;
+
+	memset(&zones[nr], 0, sizeof(*zones) * (tz_id + 1 - nr));
+
+	for (; nr <= tz_id; nr++)
+		zones[nr].temperature = THRESHOLD_TEMP_INVALID;
+
+	thresholds->zones = zones;
+	thresholds->nr_zones = tz_id + 1;
+
+	return &zones[tz_id];
+}
+
+int threshold_add(struct thresholds *thresholds, int tz_id, int temperature, int hysteresis)
+{
+	struct threshold_zone *zone;
+	struct threshold **array;
+	struct threshold *threshold;
+	int pos;
+
+	if (!thresholds) {
+		ERROR("Thresholds not initialized\n");
+		return -1;
+	}
+
+	if (tz_id < 0) {
+		ERROR("Invalid thermal zone id=%d\n", tz_id);
+		return -1;
+	}
+
+	zone = threshold_zone_alloc(thresholds, tz_id);
+	if (!zone)
+		return -1;
+
+	pos = threshold_lower_bound(zone, temperature);
+	if (pos < zone->nr_thresholds &&
+	    zone->threshold[pos]->temperature == temperature) {
+		ERROR("Failed to add threshold, temperature=%d already exists on "
+		      "thermal zone id=%d\n", temperature, tz_id);
+		return -1;
+	}
+
+	array = realloc(zone->threshold, sizeof(*array) * (zone->nr_thresholds + 1));
+	if (!array)
+		return -1;
+
+	zone->threshold = array;
+
+	threshold = malloc(sizeof(*threshold));
+	if (!threshold)
+		return -1;
+
+	threshold->actions = NULL;
+	threshold->nr_actions = 0;
+	threshold->temperature = temperature;
+	threshold->hysteresis = hysteresis;
+	threshold->tz_id = tz_id;
+
+	/*
+	 * The thresholds are added at init time, the insertion cost
+	 * does not matter but the lookups on the events do
+	 */
+	memmove(&array[pos + 1], &array[pos],
+		sizeof(*array) * (zone->nr_thresholds - pos));
+
+	array[pos] = threshold;
+	zone->nr_thresholds++;
+
+	DEBUG("Added threshold tz_id=%d, temperature=%d\n", tz_id, temperature);
+
+	return 0;
+}
+
+static void threshold_free_one(struct threshold *threshold)
+{
+	struct list *l;
+	int i;
+
+	for (i = 0; i < threshold->nr_actions; i++) {
+
+		l = list_next(&threshold->actions[i].plugins);
+		while (l) {
+			struct plugin_list *pl = container_of(l, struct plugin_list, list);
+
+			l = list_next(l);
+			free(pl);
+		}
+
+		plugin_power_free(threshold->actions[i].power);
+		power_budget_free(threshold->actions[i].budget);
+	}
+
+	free(threshold->actions);
+	free(threshold);
+}
+
+int threshold_for_each_zone(struct thresholds *thresholds,
+			    int (*cb)(int tz_id, unsigned long up,
+				      unsigned long down, void *data),
+			    void *data)
+{
+	struct threshold_zone *zone;
+	int i, ret = 0;
+
+	for (i = 0; i < thresholds->nr_zones; i++) {
+
+		zone = &thresholds->zones[i];
+		if (!zone->nr_thresholds && !zone->crossed_up && !zone->crossed_down)
+			continue;
+
+		ret |= cb(i, zone->crossed_up, zone->crossed_down, data);
+	}
+
+	return ret;
+}
+
+/*
+ * Remove all the thresholds of a thermal zone, the zone restarts from
+ * its initial state when the new thresholds are added
+ */
+void threshold_zone_reset(struct thresholds *thresholds, int tz_id)
+{
+	struct threshold_profile *profile;
+	struct trace_event trace = { 0 };
+	struct threshold_zone *zone;
+	struct power_budget **budgets;
+	int i, nr;
+
+	zone = threshold_zone_find(thresholds, tz_id);
+	if (!zone)
+		return;
+
+	/*
+	 * The limits set by the crossed thresholds of the zone are
+	 * computed again without them before their budgets are freed
+	 */
+	profile = thresholds->active;
+
+	if (zone->level && profile) {
+
+		budgets = malloc(sizeof(*budgets) * zone->level);
+		if (budgets) {
+			nr = threshold_zone_budgets(zone, profile, budgets);
+
+			zone->level = 0;
+
+			if (threshold_power(thresholds, profile, budgets, nr, &trace))
+				WARN("Failed to restore the power limits of thermal "
+				     "zone id=%d\n", tz_id);
+
+			free(budgets);
+		}
+	}
+
+	for (i = 0; i < zone->nr_thresholds; i++)
+		threshold_free_one(zone->threshold[i]);
+
+	free(zone->threshold);
+
+	zone->threshold = NULL;
+	zone->nr_thresholds = 0;
+	zone->level = 0;
+	zone->temperature = THRESHOLD_TEMP_INVALID;
+
+	DEBUG("Removed the thresholds of thermal zone id=%d\n", tz_id);
+}
+
+/*
+ * The kernel gives the previous and the current temperatures, all the
+ * thresholds in between were crossed
+ */
+int threshold_crossed_range_up(struct thresholds *thresholds, int tz_id,
+			       int prev_temp, int temp)
+{
+	struct threshold_window tw;
+	int ret = 0;
+
+	if (threshold_window(thresholds, tz_id, prev_temp, &tw))
+		return -1;
+
+	while (tw.high != THRESHOLD_TEMP_INVALID && tw.high <= temp) {
+
+		ret |= threshold_crossed_up(thresholds, tz_id, tw.high);
+
+		if (threshold_window(thresholds, tz_id, tw.high, &tw))
+			return -1;
+	}
+
+	return ret;
+}
+
+int threshold_crossed_range_down(struct thresholds *thresholds, int tz_id,
+				 int prev_temp, int temp)
+{
+	struct threshold_window tw;
+	int ret = 0;
+
+	if (threshold_window(thresholds, tz_id, prev_temp, &tw))
+		return -1;
+
+	while (tw.low != THRESHOLD_TEMP_INVALID && tw.low > temp) {
+
+		ret |= threshold_crossed_down(thresholds, tz_id, tw.low);
+
+		if (threshold_window(thresholds, tz_id, tw.low - 1, &tw))
+			return -1;
+	}
+
+	return ret;
+}
+
+/*
+ * Register the thresholds of a thermal zone in the kernel, only these
+ * temperatures will generate an event for the thermal zone. Returns
+ * -1 if the kernel does not support the userspace thresholds or the
+ * engine is not allowed to set them, the trip points are used instead.
+ */
+int threshold_kernel_register(struct thermal_engine_data *ted, int tz_id)
+{
+	struct thresholds *thresholds = ted->thresholds;
+	struct threshold_zone *zone;
+	struct thermal_zone *tz;
+	int i;
+
+	zone = threshold_zone_find(thresholds, tz_id);
+	tz = thermal_zone_find_by_id(ted->tz, tz_id);
+	if (!zone || !tz)
+		return -1;
+
+	if (thermal_cmd_threshold_get(ted->th, tz)) {
+		DEBUG("No kernel thresholds for thermal zone '%s'\n", tz->name);
+		return -1;
+	}
+
+	/*
+	 * Remove the thresholds left by a previous instance
+	 */
+	if (tz->thresholds && thermal_cmd_threshold_flush(ted->th, tz))
+		return -1;
+
+	for (i = 0; i < zone->nr_thresholds; i++) {
+
+		if (!thermal_cmd_threshold_add(ted->th, tz, zone->threshold[i]->temperature,
+					       THERMAL_THRESHOLD_WAY_UP |
+					       THERMAL_THRESHOLD_WAY_DOWN))
+			continue;
+
+		WARN("Failed to add the kernel thresholds for thermal zone '%s'\n",
+		     tz->name);
+		thermal_cmd_threshold_flush(ted->th, tz);
+		return -1;
+	}
+
+	if (pair_add(&thresholds->kernel, tz_id, tz)) {
+		thermal_cmd_threshold_flush(ted->th, tz);
+		return -1;
+	}
+
+	INFO("Thermal zone '%s' uses the kernel thresholds\n", tz->name);
+
+	return 0;
+}
+
+int threshold_kernel(struct thresholds *thresholds, int tz_id)
+{
+	return pair_find(&thresholds->kernel, tz_id) != NULL;
+}
+
+static int __threshold_kernel_unregister(__maybe_unused int key, void *data, void *arg)
+{
+	struct thermal_engine_data *ted = arg;
+	struct thermal_zone *tz = data;
+
+	if (thermal_cmd_threshold_flush(ted->th, tz))
+		WARN("Failed to flush the kernel thresholds of thermal zone '%s'\n",
+		     tz->name);
+
+	return 0;
+}
+
+void threshold_kernel_unregister(struct thermal_engine_data *ted, int tz_id)
+{
+	struct thermal_zone *tz;
+
+	tz = pair_find(&ted->thresholds->kernel, tz_id);
+	if (!tz)
+		return;
+
+	__threshold_kernel_unregister(tz_id, tz, ted);
+
+	pair_remove(&ted->thresholds->kernel, tz_id);
+}
+
+struct thresholds *threshold_alloc(void)
+{
+	struct thresholds *thresholds;
+
+	thresholds = malloc(sizeof(*thresholds));
+	if (!thresholds)
+		return NULL;
+
+	thresholds->zones = NULL;
+	thresholds->nr_zones = 0;
+	thresholds->crossed = 0;
+	thresholds->pw = NULL;
+	thresholds->active = NULL;
+	thresholds->profiles = NULL;
+	thresholds->nr_profiles = 0;
+	thresholds->executor = NULL;
+	thresholds->batches = NULL;
+	thresholds->nr_batches = 0;
+	thresholds->pending = 0;
+	pair_init(&thresholds->kernel);
+
+	return thresholds;
+}
+
+void threshold_free(struct thresholds *thresholds)
+{
+	int i, j;
+
+	if (!thresholds)
+		return;
+
+	for (i = 0; i < thresholds->nr_zones; i++) {
+
+		for (j = 0; j < thresholds->zones[i].nr_thresholds; j++)
+			threshold_free_one(thresholds->zones[i].threshold[j]);
+
+		free(thresholds->zones[i].threshold);
+	}
+
+	for (i = 0; i < thresholds->nr_batches; i++) {
+		free(thresholds->batches[i].events);
+		free(thresholds->batches[i].traces);
+	}
+
+	for (i = 0; i < thresholds->nr_profiles; i++) {
+		free(thresholds->profiles[i]->name);
+		free(thresholds->profiles[i]);
+	}
+
+	pair_destroy(&thresholds->kernel);
+	free(thresholds->profiles);
+	free(thresholds->batches);
+	free(thresholds->zones);
+	free(thresholds);
+}
+
+int thermal_engine_threshold_init(struct thermal_engine_data *ted)
+{
+	const char *profile;
+
+	if (!ted)
+		return -1;
+
+	ted->thresholds = threshold_alloc();
+	if (!ted->thresholds)
+		return -1;
+
+	ted->thresholds->executor = ted->executor;
+	threshold_power_handler(ted->thresholds, ted->pw);
+
+	if (mainloop_flush_add(ted->ml, threshold_mainloop_flush, ted->thresholds))
+		return -1;
+
+	if (config_thermal_zone(ted)) {
+		ERROR("Failed to configure the thermal zones");
+		return -1;
+	}
+
+	profile = profile_get_name(ted->profile);
+
+	if (threshold_profile_add(ted->thresholds, profile) ||
+	    threshold_profile_switch(ted->thresholds, profile))
+		return -1;
+
+	return 0;
+}
+
+void thermal_engine_threshold_exit(struct thermal_engine_data *ted)
+{
+	/*
+	 * Do not leave thresholds nobody listens to in the kernel
+	 */
+	pair_for_each(&ted->thresholds->kernel, __threshold_kernel_unregister, ted);
+
+	mainloop_flush_del(ted->ml, threshold_mainloop_flush);
+
+	threshold_free(ted->thresholds);
+	ted->thresholds = NULL;
 }
@@ -3,13 +3,75 @@
 
 #define THRESHOLD_DEFAULT_TEMP 21000
 
+/*
+ * Same value as THERMAL_TEMP_INVALID in the kernel, writing it to a
+ * trip point disables it
+ */
+#define THRESHOLD_TEMP_INVALID -274000
+
+struct thermal_engine_data;
 struct thresholds;
 struct plugin_power;
+struct power_handler;
 struct list;
+struct plugin;
+
+/*
+ * The thresholds surrounding a temperature: 'low' is the highest
+ * threshold below or equal to the temperature and 'high' is the lowest
+ * threshold above it. THRESHOLD_TEMP_INVALID is used when there is none.
+ */
+struct threshold_window {
+	int low;
+	int low_hyst;
+	int high;
+	int high_hyst;
+};
 
 int threshold_crossed_up(struct thresholds *thresholds, int tz_id, int temperature);
 int threshold_crossed_down(struct thresholds *thresholds, int tz_id, int temperature);
-int threshold_add(struct thresholds *thresholds, int tz_id, int temperature);
+int threshold_crossed_range_up(struct thresholds *thresholds, int tz_id,
+			       int prev_temp, int temp);
+int threshold_crossed_range_down(struct thresholds *thresholds, int tz_id,
+				 int prev_temp, int temp);
+int threshold_flush(struct thresholds *thresholds);
+void threshold_plugin_replace(struct thresholds *thresholds, struct plugin *old,
+			      struct plugin *new);
+void threshold_plugin_remove(struct thresholds *thresholds, struct plugin *plugin);
+int threshold_add_plugin(struct thresholds *thresholds, struct plugin *plugin,
+			 int tz_id, int temperature);
+void threshold_zone_reset(struct thresholds *thresholds, int tz_id);
+
+/*
+ * The thresholds crossed after the switch run the actions of the
+ * profile, the plugins of the previous profile it does not use are
+ * reset. The profile must have been added or have actions.
+ */
+int threshold_profile_add(struct thresholds *thresholds, const char *name);
+int threshold_profile_switch(struct thresholds *thresholds, const char *name);
+
+/*
+ * The power budgets of the actions added afterwards are resolved and
+ * applied with the handler, they are ignored without it
+ */
+void threshold_power_handler(struct thresholds *thresholds, struct power_handler *pw);
+
+/*
+ * Number of thresholds crossed the way up and the way down on the
+ * thermal zones having thresholds
+ */
+int threshold_for_each_zone(struct thresholds *thresholds,
+			    int (*cb)(int tz_id, unsigned long up,
+				      unsigned long down, void *data),
+			    void *data);
+int threshold_kernel_register(struct thermal_engine_data *ted, int tz_id);
+void threshold_kernel_unregister(struct thermal_engine_data *ted, int tz_id);
+int threshold_kernel(struct thresholds *thresholds, int tz_id);
+struct thresholds *threshold_alloc(void);
+void threshold_free(struct thresholds *thresholds);
+int threshold_add(struct thresholds *thresholds, int tz_id, int temperature, int hysteresis);
+int threshold_window(struct thresholds *thresholds, int tz_id, int temperature,
+		     struct threshold_window *window);
 int threshold_add_action(struct thresholds *thresholds, struct list *plugins,
 			 struct plugin_power *pwr, const char *profile,
 			 int tz_id, int temperature);
@@ -0,0 +1,268 @@
+// Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <thermal.h>
+
+#include "thermal-engine.h"
+#include "trace.h"
+#include "log.h"
+
+struct trace_zone {
+	struct trace_histogram stages[TRACE_STAGES];
+};
+
+/*
+ * The table is indexed by the thermal zone id and only used by the
+ * mainloop thread. The other threads record in the zones through the
+ * events, the zones are not freed before the threads are stopped.
+ */
+static struct trace_zone **trace_zones;
+static int nr_trace_zones;
+
+/*
+ * Reception time of the netlink events being processed by the
+ * mainloop, zero outside of the processing
+ */
+static unsigned long long trace_received;
+
+static __thread struct trace_event *trace_events;
+static __thread int trace_nr_events;
+
+static const char *const trace_stages[] = {
+	[TRACE_CROSSED]		= "crossed",
+	[TRACE_DISPATCH]	= "dispatch",
+	[TRACE_ACTUATOR]	= "actuator",
+};
+
+static unsigned long long trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int trace_bucket(unsigned long long value)
+{
+	int msb;
+
+	if (value < TRACE_SUB_BUCKETS)
+		return value;
+
+	msb = 63 - __builtin_clzll(value);
+	if (msb >= TRACE_MAX_BITS)
+		return TRACE_BUCKETS - 1;
+
+	return (msb - TRACE_SUB_BITS + 1) * TRACE_SUB_BUCKETS +
+		((value >> (msb - TRACE_SUB_BITS)) & (TRACE_SUB_BUCKETS - 1));
+}
+
+/*
+ * The highest value going to the bucket
+ */
+static unsigned long long trace_bucket_max(int bucket)
+{
+	int group = bucket / TRACE_SUB_BUCKETS;
+	int sub = bucket % TRACE_SUB_BUCKETS;
+
+	if (!group)
+		return sub;
+
+	return ((unsigned long long)(TRACE_SUB_BUCKETS + sub + 1) << (group - 1)) - 1;
+}
+
+/*
+ * The stages of a zone can be recorded by several threads at the same
+ * time, the counters are updated atomically without lock
+ */
+static void trace_record(struct trace_histogram *h, unsigned long long value)
+{
+	unsigned long long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&h->buckets[trace_bucket(value)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
+	while (value > max &&
+	       !__atomic_compare_exchange_n(&h->max, &max, value, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+unsigned long long trace_percentile(struct trace_histogram *h, int percent)
+{
+	unsigned long long target, count = 0;
+	int i;
+
+	if (!h->count)
+		return 0;
+
+	target = ((unsigned long long)h->count * percent + 99) / 100;
+
+	for (i = 0; i < TRACE_BUCKETS; i++) {
+		count += h->buckets[i];
+		if (count >= target)
+			break;
+	}
+
+	if (i == TRACE_BUCKETS || trace_bucket_max(i) > h->max)
+		return h->max;
+
+	return trace_bucket_max(i);
+}
+
+const char *trace_stage_name(enum trace_stage stage)
+{
+	return trace_stages[stage];
+}
+
+static struct trace_zone *trace_zone_get(int tz_id)
+{
+	struct trace_zone **zones;
+
+	if (tz_id < 0)
+		return NULL;
+
+	if (tz_id >= nr_trace_zones) {
+
+		zones = realloc(trace_zones, sizeof(*zones) * (tz_id + 1));
+		if (!zones)
+			return NULL;
+
+		memset(&zones[nr_trace_zones], 0,
+		       sizeof(*zones) * (tz_id + 1 - nr_trace_zones));
+
+		trace_zones = zones;
+		nr_trace_zones = tz_id + 1;
+	}
+
+	if (!trace_zones[tz_id])
+		trace_zones[tz_id] = calloc(1, sizeof(struct trace_zone));
+
+	return trace_zones[tz_id];
+}
+
+void trace_receive(void)
+{
+	trace_received = trace_now();
+}
+
+void trace_receive_done(void)
+{
+	trace_received = 0;
+}
+
+void trace_crossed(int tz_id, struct trace_event *event)
+{
+	event->received = trace_received;
+	event->zone = NULL;
+
+	if (!event->received)
+		return;
+
+	event->zone = trace_zone_get(tz_id);
+	if (!event->zone)
+		return;
+
+	trace_record(&event->zone->stages[TRACE_CROSSED], trace_now() - event->received);
+}
+
+void trace_dispatch(struct trace_event *events, int nr)
+{
+	unsigned long long now = trace_now();
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (events[i].zone)
+			trace_record(&events[i].zone->stages[TRACE_DISPATCH],
+				     now - events[i].received);
+	}
+
+	trace_events = events;
+	trace_nr_events = nr;
+}
+
+void trace_dispatch_done(void)
+{
+	trace_events = NULL;
+	trace_nr_events = 0;
+}
+
+/*
+ * The action of the plugin is effective with the first write, the
+ * following ones are not accounted
+ */
+void trace_actuator(void)
+{
+	unsigned long long now;
+	int i;
+
+	if (!trace_events)
+		return;
+
+	now = trace_now();
+
+	for (i = 0; i < trace_nr_events; i++) {
+		if (trace_events[i].zone)
+			trace_record(&trace_events[i].zone->stages[TRACE_ACTUATOR],
+				     now - trace_events[i].received);
+	}
+
+	trace_dispatch_done();
+}
+
+int trace_for_each_zone(int (*cb)(int tz_id, struct trace_histogram *stages, void *data),
+			void *data)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < nr_trace_zones; i++) {
+		if (trace_zones[i])
+			ret |= cb(i, trace_zones[i]->stages, data);
+	}
+
+	return ret;
+}
+
+static int trace_show(int tz_id, struct trace_histogram *stages, void *data)
+{
+	struct thermal_engine_data *ted = data;
+	struct thermal_zone *tz = thermal_zone_find_by_id(ted->tz, tz_id);
+	struct trace_histogram *h;
+	int i;
+
+	for (i = 0; i < TRACE_STAGES; i++) {
+
+		h = &stages[i];
+		if (!h->count)
+			continue;
+
+		INFO("Thermal zone %d ('%s'): %s: %lu events, avg=%llu us, p50<=%llu us, "
+		     "p99<=%llu us, max=%llu us\n", tz_id, tz ? tz->name : "",
+		     trace_stages[i], h->count, h->sum / h->count / 1000,
+		     trace_percentile(h, 50) / 1000, trace_percentile(h, 99) / 1000,
+		     h->max / 1000);
+	}
+
+	return 0;
+}
+
+/*
+ * Called once the threads running the plugin actions are stopped
+ */
+void thermal_engine_trace_exit(struct thermal_engine_data *ted)
+{
+	int i;
+
+	trace_for_each_zone(trace_show, ted);
+
+	for (i = 0; i < nr_trace_zones; i++)
+		free(trace_zones[i]);
+
+	free(trace_zones);
+	trace_zones = NULL;
+	nr_trace_zones = 0;
+}
@@ -0,0 +1,73 @@
+/* Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org> */
+#ifndef __THERMAL_ENGINE_TRACE_H
+#define __THERMAL_ENGINE_TRACE_H
+
+/*
+ * Latency of the stages of a threshold crossing, measured from the
+ * reception of the netlink event by the mainloop
+ */
+enum trace_stage {
+	TRACE_CROSSED,		/* threshold crossed */
+	TRACE_DISPATCH,		/* plugin callback called */
+	TRACE_ACTUATOR,		/* first actuator write done by the callback */
+	TRACE_STAGES,
+};
+
+/*
+ * The histograms are log-linear: each power of two is divided in
+ * TRACE_SUB_BUCKETS buckets, the values are in ns and the error is
+ * below 1/TRACE_SUB_BUCKETS. The values above 2^TRACE_MAX_BITS ns go
+ * to the last bucket.
+ */
+#define TRACE_SUB_BITS		4
+#define TRACE_SUB_BUCKETS	(1 << TRACE_SUB_BITS)
+#define TRACE_MAX_BITS		36
+#define TRACE_BUCKETS		((TRACE_MAX_BITS - TRACE_SUB_BITS + 1) * TRACE_SUB_BUCKETS)
+
+struct trace_histogram {
+	unsigned long count;
+	unsigned long long sum;
+	unsigned long long max;
+	unsigned long buckets[TRACE_BUCKETS];
+};
+
+/*
+ * The event being processed, it follows the plugin action to the
+ * thread running it. 'received' is zero when the crossing does not
+ * come from a netlink event.
+ */
+struct trace_zone;
+
+struct trace_event {
+	unsigned long long received;
+	struct trace_zone *zone;
+};
+
+/*
+ * Called by the mainloop thread around the processing of the netlink
+ * events
+ */
+extern void trace_receive(void);
+extern void trace_receive_done(void);
+
+extern void trace_crossed(int tz_id, struct trace_event *event);
+
+/*
+ * Called by the thread running the plugin callback for the events it
+ * processes, the actuator writes done by the callback are accounted
+ * to these events
+ */
+extern void trace_dispatch(struct trace_event *events, int nr);
+extern void trace_dispatch_done(void);
+extern void trace_actuator(void);
+
+extern unsigned long long trace_percentile(struct trace_histogram *histogram, int percent);
+extern const char *trace_stage_name(enum trace_stage stage);
+
+/*
+ * The histograms of the stages of the thermal zones having crossed a
+ * threshold, called from the mainloop thread
+ */
+extern int trace_for_each_zone(int (*cb)(int tz_id, struct trace_histogram *stages,
+					 void *data), void *data);
+#endif
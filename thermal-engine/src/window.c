@@ -0,0 +1,270 @@
+// Copyright (C) 2024, Linaro Ltd - Daniel Lezcano <daniel.lezcano@linaro.org>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <thermal.h>
+
+#include "thermal-engine.h"
+#include "threshold.h"
+#include "window.h"
+#include "pair.h"
+#include "metrics.h"
+#include "log.h"
+
+/*
+ * A window uses two writable trip points of a thermal zone to bracket
+ * the current temperature with the surrounding thresholds. When one
+ * of them is crossed, the trip points are moved to the next
+ * thresholds. The kernel only sends an event when a threshold is
+ * actually crossed instead of one event per trip point or a
+ * temperature sample at each polling interval.
+ */
+struct window {
+	struct threshold_window programmed;
+	int trip_low;
+	int trip_high;
+	int tz_id;
+};
+
+struct windows {
+	struct pair window;
+};
+
+struct window *window_find(struct windows *windows, int tz_id, int trip_id)
+{
+	struct window *window;
+
+	if (!windows)
+		return NULL;
+
+	window = pair_find(&windows->window, tz_id);
+	if (!window)
+		return NULL;
+
+	if (window->trip_low != trip_id && window->trip_high != trip_id)
+		return NULL;
+
+	return window;
+}
+
+static int window_trip_set(struct thermal_engine_data *ted, struct thermal_zone *tz,
+			   int trip_id, int temp, int hyst)
+{
+	int i;
+
+	/*
+	 * The trip point is already where the window wants it
+	 */
+	for (i = 0; tz->trip && tz->trip[i].id != -1; i++) {
+		if (tz->trip[i].id == trip_id && tz->trip[i].temp == temp &&
+		    tz->trip[i].hyst == hyst) {
+			metrics_add(METRICS_SYSFS_ELIDED, 2);
+			return 0;
+		}
+	}
+
+	if (thermal_trip_set_hyst(ted->th, tz->id, trip_id, hyst) ||
+	    thermal_trip_set_temp(ted->th, tz->id, trip_id, temp)) {
+		ERROR("Failed to set trip point %d of thermal zone '%s' to %d m°C\n",
+		      trip_id, tz->name, temp);
+		return -1;
+	}
+
+	metrics_add(METRICS_SYSFS_WRITES, 2);
+
+	/*
+	 * Update the trip point right away, a crossing event can come
+	 * before the trip change event
+	 */
+	for (i = 0; tz->trip && tz->trip[i].id != -1; i++) {
+		if (tz->trip[i].id != trip_id)
+			continue;
+
+		tz->trip[i].temp = temp;
+		tz->trip[i].hyst = hyst;
+	}
+
+	return 0;
+}
+
+static int window_program(struct thermal_engine_data *ted, struct window *window,
+			  struct threshold_window *tw)
+{
+	struct thermal_zone *tz = thermal_zone_find_by_id(ted->tz, window->tz_id);
+	int ret = 0;
+
+	if (!tz)
+		return -1;
+
+	DEBUG("Thermal zone '%s': window [%d, %d] m°C\n", tz->name, tw->low, tw->high);
+
+	/*
+	 * Only the trip point which moved is written, when sliding by
+	 * one threshold the other one is already at the right place
+	 */
+	if (tw->high != window->programmed.high)
+		ret |= window_trip_set(ted, tz, window->trip_high, tw->high, tw->high_hyst);
+
+	if (tw->low != window->programmed.low)
+		ret |= window_trip_set(ted, tz, window->trip_low, tw->low, tw->low_hyst);
+
+	if (!ret)
+		window->programmed = *tw;
+
+	return ret;
+}
+
+int window_crossed_up(struct thermal_engine_data *ted, struct window *window, int temperature)
+{
+	struct threshold_window tw = window->programmed;
+	int ret = 0;
+
+	/*
+	 * The temperature may have jumped over several thresholds
+	 * before the event is processed, all of them are crossed
+	 */
+	while (tw.high != THRESHOLD_TEMP_INVALID && tw.high <= temperature) {
+
+		ret |= threshold_crossed_up(ted->thresholds, window->tz_id, tw.high);
+
+		if (threshold_window(ted->thresholds, window->tz_id, tw.high, &tw))
+			return -1;
+	}
+
+	return ret | window_program(ted, window, &tw);
+}
+
+int window_crossed_down(struct thermal_engine_data *ted, struct window *window, int temperature)
+{
+	struct threshold_window tw = window->programmed;
+	int ret = 0;
+
+	while (tw.low != THRESHOLD_TEMP_INVALID && temperature < tw.low - tw.low_hyst) {
+
+		ret |= threshold_crossed_down(ted->thresholds, window->tz_id, tw.low);
+
+		if (threshold_window(ted->thresholds, window->tz_id, tw.low - 1, &tw))
+			return -1;
+	}
+
+	return ret | window_program(ted, window, &tw);
+}
+
+int window_add(struct thermal_engine_data *ted, int tz_id, int trip_low, int trip_high)
+{
+	struct threshold_window tw;
+	struct thermal_zone *tz;
+	struct window *window;
+
+	if (!ted->windows) {
+		ERROR("Windows not initialized\n");
+		return -1;
+	}
+
+	if (trip_low == trip_high) {
+		ERROR("The window needs two different trip points\n");
+		return -1;
+	}
+
+	tz = thermal_zone_find_by_id(ted->tz, tz_id);
+	if (!tz) {
+		ERROR("No thermal zone id=%d for the window\n", tz_id);
+		return -1;
+	}
+
+	window = malloc(sizeof(*window));
+	if (!window)
+		return -1;
+
+	window->tz_id = tz_id;
+	window->trip_low = trip_low;
+	window->trip_high = trip_high;
+
+	/*
+	 * Nothing is programmed yet, make sure both trip points are
+	 * written the first time
+	 */
+	window->programmed.low = window->programmed.high = INT_MIN;
+	window->programmed.low_hyst = window->programmed.high_hyst = 0;
+
+	if (pair_add(&ted->windows->window, tz_id, window)) {
+		ERROR("Failed to add window for thermal zone id=%d\n", tz_id);
+		goto out_free;
+	}
+
+	if (thermal_cmd_get_temp(ted->th, tz)) {
+		ERROR("Failed to get the temperature of thermal zone id=%d\n", tz_id);
+		goto out_remove;
+	}
+
+	if (threshold_window(ted->thresholds, tz_id, tz->temp, &tw))
+		goto out_remove;
+
+	if (window_program(ted, window, &tw))
+		goto out_remove;
+
+	DEBUG("Added window on thermal zone id=%d with trip points %d and %d\n",
+	      tz_id, trip_low, trip_high);
+
+	return 0;
+
+out_remove:
+	pair_remove(&ted->windows->window, tz_id);
+out_free:
+	free(window);
+
+	return -1;
+}
+
+/*
+ * The trip points keep the last programmed temperatures
+ */
+void window_del(struct thermal_engine_data *ted, int tz_id)
+{
+	struct window *window;
+
+	if (!ted->windows)
+		return;
+
+	window = pair_find(&ted->windows->window, tz_id);
+	if (!window)
+		return;
+
+	pair_remove(&ted->windows->window, tz_id);
+	free(window);
+
+	DEBUG("Removed window on thermal zone id=%d\n", tz_id);
+}
+
+int thermal_engine_window_init(struct thermal_engine_data *ted)
+{
+	struct windows *windows;
+
+	windows = malloc(sizeof(*windows));
+	if (!windows)
+		return -1;
+
+	pair_init(&windows->window);
+
+	ted->windows = windows;
+
+	return 0;
+}
+
+static int __window_free(__maybe_unused int key, void *data, __maybe_unused void *arg)
+{
+	free(data);
+
+	return 0;
+}
+
+void thermal_engine_window_exit(struct thermal_engine_data *ted)
+{
+	if (!ted->windows)
+		return;
+
+	pair_for_each(&ted->windows->window, __window_free, NULL);
+	pair_destroy(&ted->windows->window);
+	free(ted->windows);
+}
@@ -0,0 +1,13 @@
+#ifndef __WINDOW_H__
+#define __WINDOW_H__
+
+struct thermal_engine_data;
+struct windows;
+struct window;
+
+struct window *window_find(struct windows *windows, int tz_id, int trip_id);
+int window_add(struct thermal_engine_data *ted, int tz_id, int trip_low, int trip_high);
+void window_del(struct thermal_engine_data *ted, int tz_id);
+int window_crossed_up(struct thermal_engine_data *ted, struct window *window, int temperature);
+int window_crossed_down(struct thermal_engine_data *ted, struct window *window, int temperature);
+#endif
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <libconfig.h>
+#include <thermal.h>
+
+#include "thermal-engine.h"
+#include "config_cache.h"
+#include "options.h"
+
+/*
+ * Compare the startup cost of the configuration file parsing with
+ * the opening of the configuration cache compiled from it. Both are
+ * checked against the same thermal zones, the replay of the thresholds
+ * is common to both paths and not timed.
+ */
+#define NR_ZONES	32
+#define NR_THRESHOLDS	8
+#define NR_LOOPS	1000
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int bench_config_write(const char *path)
+{
+	FILE *f;
+	int i, j;
+
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+
+	fprintf(f, "profile = { name=\"bench\"; };\n\nthermal-zones = (\n");
+
+	for (i = 0; i < NR_ZONES; i++) {
+
+		fprintf(f, "  {\n\tname = \"tz%d\";\n\ttype = \"cpu\";\n\tthresholds = (", i);
+
+		for (j = 0; j < NR_THRESHOLDS; j++)
+			fprintf(f, "%s ( %d, 500 )", j ? "," : "", 50000 + j * 2000);
+
+		fprintf(f, " )\n  }%s\n", i < NR_ZONES - 1 ? "," : "");
+	}
+
+	fprintf(f, ");\n");
+
+	return fclose(f);
+}
+
+static struct thermal_zone *bench_zones(void)
+{
+	struct thermal_zone *tz;
+	int i;
+
+	tz = calloc(NR_ZONES + 1, sizeof(*tz));
+	if (!tz)
+		return NULL;
+
+	for (i = 0; i < NR_ZONES; i++) {
+		tz[i].id = i;
+		snprintf(tz[i].name, sizeof(tz[i].name), "tz%d", i);
+	}
+
+	tz[NR_ZONES].id = -1;
+
+	return tz;
+}
+
+static int bench(struct thermal_engine_data *ted)
+{
+	struct config_cache *cache;
+	struct config_t config;
+	long long start, config_ns, cache_ns;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < NR_LOOPS; i++) {
+
+		config_init(&config);
+
+		if (!config_read_file(&config, ted->options->config)) {
+			config_destroy(&config);
+			return -1;
+		}
+
+		config_destroy(&config);
+	}
+	config_ns = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < NR_LOOPS; i++) {
+
+		cache = config_cache_open(ted);
+		if (!cache)
+			return -1;
+
+		config_cache_close(cache);
+	}
+	cache_ns = now_ns() - start;
+
+	printf("%d zones x %d thresholds: config %8.1f us, cache %8.1f us\n",
+	       NR_ZONES, NR_THRESHOLDS, (double)config_ns / NR_LOOPS / 1000,
+	       (double)cache_ns / NR_LOOPS / 1000);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char config_path[] = "/tmp/bench_config_cache.conf";
+	char cache_path[] = "/tmp/bench_config_cache.cache";
+	struct options options = {
+		.config = config_path,
+		.cache = cache_path,
+	};
+	struct thermal_engine_data ted = {
+		.options = &options,
+	};
+	struct config_t config;
+	int ret = 1;
+
+	printf("\n");
+
+	ted.tz = bench_zones();
+	if (!ted.tz)
+		return 1;
+
+	if (bench_config_write(config_path))
+		goto out_free;
+
+	config_init(&config);
+
+	if (!config_read_file(&config, config_path))
+		goto out_destroy;
+
+	ted.config = &config;
+
+	if (config_cache_save(&ted))
+		goto out_destroy;
+
+	ret = bench(&ted) ? 1 : 0;
+
+	unlink(cache_path);
+out_destroy:
+	config_destroy(&config);
+	unlink(config_path);
+out_free:
+	free(ted.tz);
+
+	return ret;
+}
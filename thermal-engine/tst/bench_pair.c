@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include "list.h"
+#include "pair.h"
+
+/*
+ * Compare the pair container with the linked list implementation it
+ * replaced. Only the lookups are timed, the list version is filled
+ * without the duplicate check to keep the setup reasonable with 100k
+ * keys.
+ */
+#define NR_LOOKUPS 100000
+
+struct list_pair {
+	int key;
+	void *data;
+	struct list list;
+};
+
+static void *list_pair_find(struct list_pair *pair, int key)
+{
+	struct list *l;
+
+	for (l = list_next(&pair->list); l; l = list_next(l)) {
+
+		struct list_pair *p = container_of(l, struct list_pair, list);
+
+		if (p->key == key)
+			return p->data;
+	}
+
+	return NULL;
+}
+
+static int list_pair_add(struct list_pair *pair, int key, void *data)
+{
+	struct list_pair *p;
+
+	p = malloc(sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+
+	p->key = key;
+	p->data = data;
+
+	list_add_tail(&pair->list, &p->list);
+
+	return 0;
+}
+
+static void list_pair_destroy(struct list_pair *pair)
+{
+	struct list *l = list_next(&pair->list);
+
+	while (l) {
+		struct list_pair *p = container_of(l, struct list_pair, list);
+
+		l = list_next(l);
+		free(p);
+	}
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * The keys look like the encoded thresholds: the thermal zone id in
+ * the upper bits and the temperature in the lower bits
+ */
+static int bench_key(int i)
+{
+	return (i % 512) << 23 | (i / 512) * 500;
+}
+
+static int bench(int nr_keys)
+{
+	struct list_pair list_pair;
+	struct pair pair;
+	long long start, list_ns, pair_ns;
+	unsigned int seed = 1;
+	int i, lookups = NR_LOOKUPS;
+	void *data;
+
+	/*
+	 * Keep the list benchmark below a few seconds
+	 */
+	if ((long long)lookups * nr_keys > 2000000000LL)
+		lookups = 2000000000LL / nr_keys;
+
+	list_init(&list_pair.list);
+	pair_init(&pair);
+
+	for (i = 0; i < nr_keys; i++) {
+		if (list_pair_add(&list_pair, bench_key(i), (void *)(long)(i + 1)))
+			return -1;
+		if (pair_add(&pair, bench_key(i), (void *)(long)(i + 1)))
+			return -1;
+	}
+
+	start = now_ns();
+	for (i = 0; i < lookups; i++) {
+		int k = rand_r(&seed) % nr_keys;
+
+		data = list_pair_find(&list_pair, bench_key(k));
+		if (data != (void *)(long)(k + 1))
+			return -1;
+	}
+	list_ns = now_ns() - start;
+
+	seed = 1;
+
+	start = now_ns();
+	for (i = 0; i < lookups; i++) {
+		int k = rand_r(&seed) % nr_keys;
+
+		data = pair_find(&pair, bench_key(k));
+		if (data != (void *)(long)(k + 1))
+			return -1;
+	}
+	pair_ns = now_ns() - start;
+
+	printf("%7d keys: list %10.1f ns/lookup, pair %6.1f ns/lookup (%d lookups)\n",
+	       nr_keys, (double)list_ns / lookups, (double)pair_ns / lookups, lookups);
+
+	list_pair_destroy(&list_pair);
+	pair_destroy(&pair);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int sizes[] = { 10, 1000, 100000 };
+	unsigned int i;
+
+	printf("\n");
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (bench(sizes[i]))
+			return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <thermal.h>
+
+#include "capability.h"
+
+static int capability_test(void)
+{
+	struct thermal_cpu_capability cap[] = {
+		{ .cpu = 0, .performance = 512, .efficiency = 1023 },
+		{ .cpu = 1, .performance = 1023, .efficiency = 256 },
+		{ .cpu = 2, .performance = 1023, .efficiency = 512 },
+	};
+	struct thermal_cpu_capability throttled = {
+		.cpu = 2, .performance = 128, .efficiency = 512
+	};
+	struct thermal_cpu_capability unknown = { .cpu = 4 };
+	struct thermal_cpu_capability c;
+	struct capabilities *caps;
+	int ret = -1;
+
+	caps = capability_alloc(4);
+	if (!caps)
+		return -1;
+
+	if (capability_best(caps) != -1)
+		goto out;
+
+	if (!capability_get(caps, 0, &c))
+		goto out;
+
+	if (capability_update(caps, cap, 3))
+		goto out;
+
+	/* Same performance, the most efficient wins */
+	if (capability_best(caps) != 2)
+		goto out;
+
+	if (capability_update(caps, &throttled, 1))
+		goto out;
+
+	if (capability_best(caps) != 1)
+		goto out;
+
+	if (capability_get(caps, 2, &c) || c.performance != 128)
+		goto out;
+
+	/* Out of range cpu is ignored */
+	if (capability_update(caps, &unknown, 1))
+		goto out;
+
+	if (!capability_get(caps, 3, &c) || !capability_get(caps, 4, &c))
+		goto out;
+
+	ret = 0;
+out:
+	capability_free(caps);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	if (capability_test())
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mainloop.h"
+#include "executor.h"
+
+#define NR_KEYS		8
+#define NR_JOBS		1024
+
+struct tst_job {
+	struct executor_job job;
+	int key;
+	int seq;
+};
+
+static atomic_int running[NR_KEYS];
+static int next[NR_KEYS];
+static int completed;
+static int failed;
+
+static int tst_job_run(struct executor_job *job)
+{
+	struct tst_job *tj = (struct tst_job *)job;
+	int ret = 0;
+
+	/* Jobs with the same key never run concurrently */
+	if (atomic_fetch_add(&running[tj->key], 1))
+		ret = -1;
+
+	usleep(100);
+
+	atomic_fetch_sub(&running[tj->key], 1);
+
+	return ret;
+}
+
+static void tst_job_done(struct executor_job *job, int ret)
+{
+	struct tst_job *tj = (struct tst_job *)job;
+
+	/* Jobs with the same key complete in the submission order */
+	if (ret || tj->seq != next[tj->key]++)
+		failed++;
+
+	completed++;
+
+	free(tj);
+}
+
+static int executor_test(int nr_workers)
+{
+	struct mainloop *ml;
+	struct executor *executor;
+	int i, ret = -1;
+
+	completed = failed = 0;
+
+	for (i = 0; i < NR_KEYS; i++)
+		next[i] = 0;
+
+	ml = mainloop_init();
+	if (!ml)
+		return -1;
+
+	executor = executor_init(ml, nr_workers);
+	if (!executor)
+		goto out_mainloop;
+
+	for (i = 0; i < NR_JOBS; i++) {
+
+		struct tst_job *tj = malloc(sizeof(*tj));
+		if (!tj)
+			goto out;
+
+		tj->key = i % NR_KEYS;
+		tj->seq = i / NR_KEYS;
+
+		executor_submit(executor, tj->key, &tj->job, tst_job_run, tst_job_done);
+	}
+
+	/* The completions are reported by the mainloop */
+	while (executor_pending(executor))
+		if (mainloop(ml, 100))
+			goto out;
+
+	if (completed != NR_JOBS || failed)
+		goto out;
+
+	ret = 0;
+out:
+	executor_fini(executor);
+out_mainloop:
+	mainloop_fini(ml);
+
+	return ret;
+}
+
+static atomic_int unblocked;
+
+static int tst_blocked_run(struct executor_job *job)
+{
+	int i;
+
+	/* Wait for the jobs of all the other keys, one second at most */
+	for (i = 0; i < 10000; i++) {
+		if (atomic_load(&unblocked) == NR_KEYS - 1)
+			return 0;
+		usleep(100);
+	}
+
+	return -1;
+}
+
+static int tst_unblock_run(struct executor_job *job)
+{
+	atomic_fetch_add(&unblocked, 1);
+
+	return 0;
+}
+
+static void tst_blocked_done(struct executor_job *job, int ret)
+{
+	if (ret)
+		failed++;
+
+	completed++;
+}
+
+/*
+ * A job running for a key does not delay the jobs of the other keys
+ */
+static int executor_blocked_test(int nr_workers)
+{
+	struct executor_job jobs[NR_KEYS];
+	struct mainloop *ml;
+	struct executor *executor;
+	int i, ret = -1;
+
+	completed = failed = 0;
+	atomic_store(&unblocked, 0);
+
+	ml = mainloop_init();
+	if (!ml)
+		return -1;
+
+	executor = executor_init(ml, nr_workers);
+	if (!executor)
+		goto out_mainloop;
+
+	executor_submit(executor, 0, &jobs[0], tst_blocked_run, tst_blocked_done);
+
+	for (i = 1; i < NR_KEYS; i++)
+		executor_submit(executor, i, &jobs[i], tst_unblock_run, tst_blocked_done);
+
+	while (executor_pending(executor))
+		if (mainloop(ml, 100))
+			goto out;
+
+	if (completed != NR_KEYS || failed)
+		goto out;
+
+	ret = 0;
+out:
+	executor_fini(executor);
+out_mainloop:
+	mainloop_fini(ml);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	/* Synchronous */
+	if (executor_test(0))
+		return 1;
+
+	if (executor_test(1))
+		return 1;
+
+	if (executor_test(4))
+		return 1;
+
+	if (executor_blocked_test(2))
+		return 1;
+
+	return 0;
+}
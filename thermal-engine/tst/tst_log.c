@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* The DEBUG messages are removed at compile time */
+#define LOG_BUILD_LEVEL LOG_INFO
+#include "log.h"
+
+#define NR_THREADS	4
+#define NR_MESSAGES	10
+#define NR_STORM	1000
+
+static char path[] = "/tmp/tst_log.XXXXXX";
+
+static char *log_read(void)
+{
+	static char buffer[65536];
+	size_t len;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return NULL;
+
+	len = fread(buffer, 1, sizeof(buffer) - 1, f);
+	buffer[len] = '\0';
+
+	fclose(f);
+
+	return buffer;
+}
+
+static int log_count(const char *log, const char *what)
+{
+	int nr = 0;
+
+	while ((log = strstr(log, what))) {
+		log += strlen(what);
+		nr++;
+	}
+
+	return nr;
+}
+
+static void *log_thread(void *arg)
+{
+	long id = (long)arg;
+	int i;
+
+	for (i = 0; i < NR_MESSAGES; i++)
+		INFO("thread %ld message %d\n", id, i);
+
+	return NULL;
+}
+
+static int log_test(void)
+{
+	pthread_t threads[NR_THREADS];
+	char expected[64], string[256];
+	const char *log, *p;
+	long i;
+	int j;
+
+	memset(string, 'x', sizeof(string) - 1);
+	string[sizeof(string) - 1] = '\0';
+
+	INFO("int=%d long=%ld str=%s prec=%.*s float=%.2f pct=%% hex=%#x\n",
+	     -3, 1234567890123L, "abc", 2, "xyz", 3.14159, 255);
+
+	INFO("a=%d", 1);
+	INFO(", b=%s\n", "two");
+
+	DEBUG("elided\n");
+
+	/* The string does not fit in the record */
+	INFO("long=%s end\n", string);
+
+	/* Too many arguments */
+	INFO("args=%d %d %d %d %d %d %d %d %d\n", 1, 2, 3, 4, 5, 6, 7, 8, 9);
+
+	for (i = 0; i < NR_THREADS; i++)
+		if (pthread_create(&threads[i], NULL, log_thread, (void *)i))
+			return -1;
+
+	for (i = 0; i < NR_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	/* Written when log_flush() returns */
+	log_flush();
+
+	log = log_read();
+	if (!log)
+		return -1;
+
+	if (!strstr(log, "(INFO): int=-3 long=1234567890123 str=abc prec=xy "
+		    "float=3.14 pct=% hex=0xff\n"))
+		return -1;
+
+	if (!strstr(log, "(INFO): a=1, b=two\n"))
+		return -1;
+
+	if (strstr(log, "elided"))
+		return -1;
+
+	p = strstr(log, "(INFO): long=");
+	if (!p || strspn(p + strlen("(INFO): long="), "x") != 127 ||
+	    strncmp(p + strlen("(INFO): long=") + 127, " end...\n", 8))
+		return -1;
+
+	if (!strstr(log, "(INFO): args=1 2 3 4 5 6 7 8 ...\n"))
+		return -1;
+
+	/* The messages of a thread are in order */
+	for (i = 0; i < NR_THREADS; i++) {
+
+		p = log;
+
+		for (j = 0; j < NR_MESSAGES; j++) {
+			snprintf(expected, sizeof(expected), "thread %ld message %d\n", i, j);
+			p = strstr(p, expected);
+			if (!p)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void log_storm(void)
+{
+	int i;
+
+	/* All the messages come from the same call site */
+	for (i = 0; i < NR_STORM; i++)
+		WARN("storm %d\n", i);
+
+	log_flush();
+}
+
+static int log_ratelimit_test(void)
+{
+	const char *log;
+
+	log_storm();
+
+	log = log_read();
+	if (!log || log_count(log, "storm") != LOG_RATELIMIT_BURST)
+		return -1;
+
+	/* The next interval reports the suppressed messages */
+	usleep((LOG_RATELIMIT_INTERVAL + 100) * 1000);
+
+	log_storm();
+
+	log = log_read();
+	if (!log || log_count(log, "storm") != 2 * LOG_RATELIMIT_BURST)
+		return -1;
+
+	if (!strstr(log, "950 messages suppressed\n"))
+		return -1;
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int fd, ret = 1;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+
+	close(fd);
+
+	if (!freopen(path, "w", stdout))
+		goto out;
+
+	if (log_init(LOG_DEBUG, "tst_log", TO_STDOUT))
+		goto out;
+
+	if (log_test())
+		goto out_exit;
+
+	if (log_ratelimit_test())
+		goto out_exit;
+
+	ret = 0;
+out_exit:
+	log_exit();
+out:
+	unlink(path);
+
+	return ret;
+}
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "mainloop.h"
+
+struct timer_test {
+	struct mainloop *ml;
+	struct mainloop_timer *periodic;
+	long long start;
+	long long oneshot_time;
+	long long coalesced_time;
+	int periodic_count;
+	int cancelled_count;
+	int oneshot_count;
+};
+
+static long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int timer_periodic(struct mainloop_timer *timer, void *data)
+{
+	struct timer_test *tt = data;
+
+	if (++tt->periodic_count == 5) {
+		mainloop_timer_del(tt->ml, timer);
+		mainloop_exit(tt->ml);
+	}
+
+	return 0;
+}
+
+static int timer_cancelled(struct mainloop_timer *timer, void *data)
+{
+	struct timer_test *tt = data;
+
+	tt->cancelled_count++;
+
+	return 0;
+}
+
+static int timer_oneshot(struct mainloop_timer *timer, void *data)
+{
+	struct timer_test *tt = data;
+
+	tt->oneshot_count++;
+	tt->oneshot_time = now() - tt->start;
+
+	return 0;
+}
+
+static int timer_coalesced(struct mainloop_timer *timer, void *data)
+{
+	struct timer_test *tt = data;
+
+	tt->coalesced_time = now() - tt->start;
+
+	return 0;
+}
+
+static int mainloop_timer_test(void)
+{
+	struct timer_test tt = { 0 };
+	struct mainloop_timer *timer;
+	int ret = -1;
+
+	tt.ml = mainloop_init();
+	if (!tt.ml)
+		return -1;
+
+	tt.start = now();
+
+	if (!mainloop_timer_add(tt.ml, 10, 10, 0, timer_periodic, &tt))
+		goto out;
+
+	timer = mainloop_timer_add(tt.ml, 5, 0, 0, timer_cancelled, &tt);
+	if (!timer)
+		goto out;
+
+	mainloop_timer_del(tt.ml, timer);
+
+	if (!mainloop_timer_add(tt.ml, 20, 0, 0, timer_oneshot, &tt))
+		goto out;
+
+	/*
+	 * Expires before the one shot timer but has enough slack to be
+	 * run with it
+	 */
+	if (!mainloop_timer_add(tt.ml, 15, 0, 10, timer_coalesced, &tt))
+		goto out;
+
+	if (mainloop(tt.ml, -1))
+		goto out;
+
+	if (tt.periodic_count != 5 || tt.cancelled_count || tt.oneshot_count != 1)
+		goto out;
+
+	if (tt.oneshot_time < 20 || tt.coalesced_time < 20)
+		goto out;
+
+	ret = 0;
+out:
+	mainloop_fini(tt.ml);
+
+	return ret;
+}
+
+#define NR_PIPES 256
+
+static int pipes[NR_PIPES][2];
+static int spare[2];
+
+static int source_stale(int fd, void *data)
+{
+	return -1;
+}
+
+static int source_read(int fd, void *data)
+{
+	struct mainloop *ml = data;
+	char c;
+
+	if (read(fd, &c, 1) != 1)
+		return -1;
+
+	/*
+	 * Remove the next source, it must not be dispatched even if it
+	 * is in the same batch. Its fd is reused by a new source without
+	 * data, which must not get the pending event of the old one.
+	 */
+	if (fd == pipes[0][0]) {
+		mainloop_del(ml, pipes[1][0]);
+
+		if (dup2(spare[0], pipes[1][0]) < 0)
+			return -1;
+
+		if (mainloop_add(ml, pipes[1][0], source_stale, ml))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int mainloop_source_test(void)
+{
+	struct mainloop *ml;
+	unsigned long dispatched;
+	int i, ret = -1;
+
+	ml = mainloop_init();
+	if (!ml)
+		return -1;
+
+	if (pipe(spare))
+		goto out_fini;
+
+	for (i = 0; i < NR_PIPES; i++) {
+
+		if (pipe(pipes[i]))
+			goto out;
+
+		if (mainloop_add_events(ml, pipes[i][0], EPOLLIN, source_read, ml))
+			goto out;
+
+		if (write(pipes[i][1], "x", 1) != 1)
+			goto out;
+	}
+
+	/* Already registered */
+	if (!mainloop_add(ml, pipes[0][0], source_read, ml))
+		goto out;
+
+	if (mainloop(ml, 0))
+		goto out;
+
+	if (mainloop_dispatched(ml, pipes[1][0], &dispatched) || dispatched)
+		goto out;
+
+	for (i = 0; i < NR_PIPES; i++) {
+
+		if (i == 1)
+			continue;
+
+		if (mainloop_dispatched(ml, pipes[i][0], &dispatched) || dispatched != 1)
+			goto out;
+	}
+
+	ret = 0;
+out:
+	for (i = 0; i < NR_PIPES; i++) {
+		close(pipes[i][0]);
+		close(pipes[i][1]);
+	}
+
+	close(spare[0]);
+	close(spare[1]);
+out_fini:
+	mainloop_fini(ml);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	if (mainloop_timer_test())
+		return 1;
+
+	if (mainloop_source_test())
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,287 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "thermal-engine.h"
+#include "options.h"
+#include "mainloop.h"
+#include "threshold.h"
+#include "metrics.h"
+#include "plugin.h"
+#include "list.h"
+
+#define NR_THREADS	4
+#define NR_WRITES	1000
+
+/*
+ * Enough zones for the snapshot to not fit in the socket buffer
+ */
+#define NR_ZONES	4096
+
+static void *metrics_thread(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NR_WRITES; i++)
+		metrics_inc(METRICS_SYSFS_WRITES);
+
+	metrics_add(METRICS_SYSFS_ELIDED, 2);
+
+	return NULL;
+}
+
+static int metrics_counters_test(void)
+{
+	pthread_t threads[NR_THREADS];
+	int i;
+
+	for (i = 0; i < NR_THREADS; i++)
+		if (pthread_create(&threads[i], NULL, metrics_thread, NULL))
+			return -1;
+
+	for (i = 0; i < NR_THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	if (metrics_read(METRICS_SYSFS_WRITES) != NR_THREADS * NR_WRITES)
+		return -1;
+
+	if (metrics_read(METRICS_SYSFS_ELIDED) != NR_THREADS * 2)
+		return -1;
+
+	return 0;
+}
+
+static int metrics_connect(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return -1;
+
+	strcpy(addr.sun_path, path);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * The rest of the snapshot is sent by the mainloop when the client
+ * read the beginning
+ */
+static ssize_t metrics_receive(struct mainloop *ml, int fd, char *buffer, size_t size)
+{
+	ssize_t len = 0, ret;
+
+	for (;;) {
+
+		if (mainloop(ml, 100))
+			return -1;
+
+		while ((ret = read(fd, buffer + len, size - len - 1)) > 0)
+			len += ret;
+
+		if (!ret)
+			break;
+
+		if (errno != EAGAIN)
+			return -1;
+	}
+
+	buffer[len] = '\0';
+
+	return len;
+}
+
+static int metrics_socket_test(void)
+{
+	struct thermal_engine_data ted = { 0 };
+	struct options options = { 0 };
+	char path[64] = "/tmp/tst_metrics.XXXXXX";
+	static char buffer[1 << 20];
+	char last[128];
+	int i, fd, err = -1;
+
+	if (!mkdtemp(path))
+		return -1;
+
+	strcat(path, "/sock");
+
+	options.metrics = path;
+	ted.options = &options;
+
+	ted.ml = mainloop_init();
+	if (!ted.ml)
+		goto out_rmdir;
+
+	ted.thresholds = threshold_alloc();
+	if (!ted.thresholds)
+		goto out_fini;
+
+	if (threshold_add(ted.thresholds, 3, 50000, 500) ||
+	    threshold_add(ted.thresholds, 3, 75000, 500))
+		goto out_free;
+
+	for (i = 4; i < NR_ZONES; i++)
+		if (threshold_add(ted.thresholds, i, 50000, 500))
+			goto out_free;
+
+	threshold_crossed_up(ted.thresholds, 3, 50000);
+	threshold_crossed_up(ted.thresholds, 3, 75000);
+	threshold_crossed_down(ted.thresholds, 3, 75000);
+
+	/* Not a threshold */
+	threshold_crossed_up(ted.thresholds, 3, 60000);
+
+	if (thermal_engine_metrics_init(&ted))
+		goto out_free;
+
+	fd = metrics_connect(path);
+	if (fd < 0)
+		goto out_exit;
+
+	/*
+	 * The snapshot is sent when the mainloop accepts the connection,
+	 * the mainloop returns after being idle
+	 */
+	if (metrics_receive(ted.ml, fd, buffer, sizeof(buffer)) < 0)
+		goto out_close;
+
+	if (!strstr(buffer, "# TYPE thermal_engine_mainloop_wakeups_total counter\n"))
+		goto out_close;
+
+	if (!strstr(buffer, "thermal_engine_sysfs_writes_total 4000\n") ||
+	    !strstr(buffer, "thermal_engine_sysfs_writes_elided_total 8\n"))
+		goto out_close;
+
+	if (!strstr(buffer, "thermal_engine_zone_crossings_total"
+		    "{tz_id=\"3\",zone=\"\",direction=\"up\"} 2\n") ||
+	    !strstr(buffer, "thermal_engine_zone_crossings_total"
+		    "{tz_id=\"3\",zone=\"\",direction=\"down\"} 1\n"))
+		goto out_close;
+
+	/* The whole snapshot was received */
+	snprintf(last, sizeof(last), "thermal_engine_zone_crossings_total"
+		 "{tz_id=\"%d\",zone=\"\",direction=\"down\"} 0\n", NR_ZONES - 1);
+	if (!strstr(buffer, last))
+		goto out_close;
+
+	err = 0;
+out_close:
+	close(fd);
+out_exit:
+	thermal_engine_metrics_exit(&ted);
+
+	/* The socket is removed */
+	if (!access(path, F_OK))
+		err = -1;
+out_free:
+	threshold_free(ted.thresholds);
+out_fini:
+	mainloop_fini(ted.ml);
+out_rmdir:
+	rmdir(dirname(path));
+
+	return err;
+}
+
+static struct plugin_descriptor tst_descriptor_a = {
+	.profile	= "game",
+	.compatibles	= { "te-plugin-a", NULL },
+};
+
+static struct plugin_descriptor tst_descriptor_b = {
+	.profile	= "game",
+	.compatibles	= { "te-plugin-b", NULL },
+};
+
+/*
+ * The samples of the plugin metric families are grouped after their
+ * header, not interleaved per plugin
+ */
+static int metrics_plugins_test(void)
+{
+	const char *families[] = {
+		"thermal_engine_plugin_actions_total",
+		"thermal_engine_plugin_overruns_total",
+		"thermal_engine_plugin_latency_us",
+	};
+	struct plugin plugins[2] = {
+		{ .descriptor = &tst_descriptor_a },
+		{ .descriptor = &tst_descriptor_b },
+	};
+	struct thermal_engine_data ted = { 0 };
+	struct list list;
+	char header[128], sample[128];
+	char *buffer = NULL, *next;
+	size_t size;
+	FILE *f;
+	int i, err = -1;
+
+	list_init(&list);
+	list_add_tail(&list, &plugins[0].list);
+	list_add_tail(&list, &plugins[1].list);
+	ted.plugins = &list;
+
+	f = open_memstream(&buffer, &size);
+	if (!f)
+		return -1;
+
+	metrics_show(&ted, f);
+	fclose(f);
+
+	for (i = 0; i < 3; i++) {
+
+		snprintf(header, sizeof(header), "# TYPE %s ", families[i]);
+		snprintf(sample, sizeof(sample), "\n%s", families[i]);
+
+		next = strstr(buffer, header);
+		if (!next)
+			goto out;
+
+		/* Both plugins after the header */
+		if (!strstr(next, "plugin=\"te-plugin-a\"") ||
+		    !strstr(next, "plugin=\"te-plugin-b\""))
+			goto out;
+
+		/* No sample of the family after the next header */
+		if (i < 2) {
+			snprintf(header, sizeof(header), "# HELP %s ", families[i + 1]);
+			next = strstr(next, header);
+			if (!next || strstr(next, sample))
+				goto out;
+		}
+	}
+
+	err = 0;
+out:
+	free(buffer);
+
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	if (metrics_counters_test())
+		return 1;
+
+	if (metrics_socket_test())
+		return 1;
+
+	if (metrics_plugins_test())
+		return 1;
+
+	return 0;
+}
@@ -6,11 +6,21 @@
 
 #include "pair.h"
 
+static int pair_sum(int key, __attribute__((unused)) void *data, void *arg)
+{
+	int *sum = arg;
+
+	*sum += key;
+
+	return 0;
+}
+
 static int pair_test(void)
 {
 	struct pair transitions;
 	struct pair *pair;
 	void *data;
+	int sum = 0;
 
 	pair_init(&transitions);
 	pair_add(&transitions, 123, (void *)0x123);
@@ -39,6 +49,68 @@ static int pair_test(void)
 	if (data)
 		return -1;
 
+	if (pair_for_each(&transitions, pair_sum, &sum))
+		return -1;
+
+	if (sum != 123 + 789)
+		return -1;
+
+	pair_destroy(&transitions);
+
+	return 0;
+}
+
+static int pair_order(int key, void *data, void *arg)
+{
+	int *prev = arg;
+
+	if (key <= *prev || (long)data != key)
+		return -1;
+
+	*prev = key;
+
+	return 0;
+}
+
+static int pair_test_many(void)
+{
+	struct pair transitions;
+	int i, prev = 0;
+
+	pair_init(&transitions);
+
+	for (i = 1; i <= 10000; i++) {
+		if (pair_add(&transitions, i, (void *)(long)i))
+			return -1;
+	}
+
+	if (pair_add(&transitions, 5000, (void *)5000L) != -EEXIST)
+		return -1;
+
+	for (i = 2; i <= 10000; i += 2)
+		pair_remove(&transitions, i);
+
+	/* Re-adding the removed keys must not corrupt the index */
+	for (i = 10002; i <= 20000; i += 2) {
+		if (pair_add(&transitions, i, (void *)(long)i))
+			return -1;
+	}
+
+	for (i = 1; i <= 20000; i++) {
+		void *data = pair_find(&transitions, i);
+
+		if ((i <= 10000 && (i % 2)) || (i > 10000 && !(i % 2))) {
+			if (data != (void *)(long)i)
+				return -1;
+		} else if (data) {
+			return -1;
+		}
+	}
+
+	/* The iteration follows the insertion order */
+	if (pair_for_each(&transitions, pair_order, &prev))
+		return -1;
+
 	pair_destroy(&transitions);
 
 	return 0;
@@ -49,5 +121,8 @@ int main(int argc, char *argv[])
 	if (pair_test())
 		return 1;
 
+	if (pair_test_many())
+		return 1;
+
 	return 0;
 }
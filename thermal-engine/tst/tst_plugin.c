@@ -3,8 +3,11 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "plugin.h"
+#include "plugin_index.h"
 
 #ifndef PLUGIN_PATH
 #define PLUGIN_PATH "../plugins"
@@ -80,10 +83,166 @@ int tst_plugin(const char *plugin_path)
 	return 0;
 }
 
+static int tst_count(const char *lib, void *data)
+{
+	(*(int *)data)++;
+
+	return 0;
+}
+
+int tst_plugin_index(const char *plugin_path)
+{
+	struct plugin_index *index;
+	int nr, ret = -1;
+
+	index = plugin_index_build(plugin_path);
+	if (!index)
+		return -1;
+
+	/*
+	 * The compatibles are declared by the game and browsing plugins
+	 */
+	nr = 0;
+	plugin_index_for_each_match(index, "te-plugin-compat2", NULL, NULL, tst_count, &nr);
+	if (nr != 2)
+		goto out;
+
+	nr = 0;
+	plugin_index_for_each_match(index, "te-plugin-compat2", "game", "0.0.1", tst_count, &nr);
+	if (nr != 1)
+		goto out;
+
+	nr = 0;
+	plugin_index_for_each_match(index, "te-plugin-compat", NULL, NULL, tst_count, &nr);
+	if (nr)
+		goto out;
+
+	ret = 0;
+out:
+	plugin_index_free(index);
+
+	return ret;
+}
+
+int tst_plugin_reload(const char *plugin_path)
+{
+	struct plugin *plugin, *new;
+	int ret = -1;
+
+	plugin = plugin_open(plugin_path, "te-plugin-compat1", "game", NULL);
+	if (!plugin || !plugin->lib)
+		return -1;
+
+	/*
+	 * Same file, a new instance must be loaded
+	 */
+	new = plugin_reload(plugin);
+	if (!new)
+		goto out;
+
+	/*
+	 * The new instance is serialized with the old one in the executor
+	 */
+	if (new->handle == plugin->handle || strcmp(new->lib, plugin->lib) ||
+	    strcmp(new->descriptor->profile, "game") || new->key != plugin->key)
+		goto out_close;
+
+	ret = 0;
+out_close:
+	plugin_close(new);
+out:
+	plugin_close(plugin);
+
+	return ret;
+}
+
+static int slow;
+
+static int tst_trip(int tz_id, int temperature, void *data)
+{
+	if (slow)
+		usleep(2000);
+
+	return 0;
+}
+
+static struct plugin_descriptor tst_descriptor = {
+	.version	= "0.0.1",
+	.profile	= "test",
+	.compatibles	= { "te-plugin-test", NULL },
+};
+
+static struct plugin_ops tst_ops = {
+	.trip_low	= tst_trip,
+	.trip_high	= tst_trip,
+	.reset		= tst_trip,
+};
+
+int tst_plugin_budget(void)
+{
+	struct plugin plugin = {
+		.descriptor = &tst_descriptor,
+		.ops = &tst_ops,
+	};
+	int ret = -1;
+
+	if (!plugin_budget_set(1000, "unknown", 0))
+		return -1;
+
+	if (plugin_budget_set(1000, "quarantine", 2))
+		return -1;
+
+	/*
+	 * Within the budget, the consecutive overruns are reset
+	 */
+	slow = 1;
+	if (plugin_trip_high(&plugin, 0, 0, NULL))
+		goto out;
+
+	slow = 0;
+	if (plugin_trip_low(&plugin, 0, 0, NULL) || plugin.quarantined)
+		goto out;
+
+	if (plugin.latency.calls != 2 || plugin.latency.overruns != 1)
+		goto out;
+
+	if (plugin.latency.max < 2000 ||
+	    plugin_latency_percentile(&plugin.latency, 99) < 2000)
+		goto out;
+
+	/*
+	 * Two overruns in a row, the plugin is no longer called
+	 */
+	slow = 1;
+	plugin_trip_high(&plugin, 0, 0, NULL);
+	plugin_trip_high(&plugin, 0, 0, NULL);
+
+	if (!plugin.quarantined)
+		goto out;
+
+	if (!plugin_reset(&plugin, 0, 0, NULL) || plugin.latency.calls != 4)
+		goto out;
+
+	ret = 0;
+out:
+	plugin_budget_set(0, NULL, 0);
+
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	if (tst_plugin(argc < 2 ? PLUGIN_PATH : argv[1]))
 		return 1;
 
+	if (tst_plugin_index(argc < 2 ? PLUGIN_PATH : argv[1]))
+		return 1;
+
+	if (tst_plugin_reload(argc < 2 ? PLUGIN_PATH : argv[1]))
+		return 1;
+
+	if (tst_plugin_budget())
+		return 1;
+
 	return 0;
 }
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "power_budget.h"
+
+#define NR_DEVICES 3
+
+static int power_budget_check(int *max, unsigned int power, const unsigned int *expected)
+{
+	struct power_budget *budget;
+	int i, ret = 0;
+
+	budget = malloc(sizeof(*budget) + sizeof(*budget->req) * NR_DEVICES);
+	if (!budget)
+		return -1;
+
+	budget->nr = NR_DEVICES;
+
+	for (i = 0; i < NR_DEVICES; i++)
+		budget->req[i].id = i * 2;
+
+	power_budget_split(budget, power, max);
+
+	for (i = 0; i < NR_DEVICES; i++) {
+
+		if (budget->req[i].power_mw != expected[i])
+			ret = -1;
+
+		if (power_budget_find(budget, i * 2) != expected[i])
+			ret = -1;
+	}
+
+	/* Not in the budget */
+	if (power_budget_find(budget, 1))
+		ret = -1;
+
+	free(budget);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	/* In proportion to the max power */
+	if (power_budget_check((int []){ 1000, 3000, 6000 }, 5000,
+			       (unsigned int []){ 500, 1500, 3000 }))
+		return 1;
+
+	/* One max power unknown, split evenly */
+	if (power_budget_check((int []){ 1000, -1, 6000 }, 3000,
+			       (unsigned int []){ 1000, 1000, 1000 }))
+		return 1;
+
+	/* A zero power would restore the initial limit */
+	if (power_budget_check((int []){ 1, 1, 100000 }, 1000,
+			       (unsigned int []){ 1, 1, 999 }))
+		return 1;
+
+	return 0;
+}
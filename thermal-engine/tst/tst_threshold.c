@@ -0,0 +1,608 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "threshold.h"
+#include "plugin.h"
+#include "power_budget.h"
+
+#define NR_ZONES 1024
+
+static int threshold_check(struct thresholds *thresholds, int tz_id, int temperature,
+			   int low, int high)
+{
+	struct threshold_window tw;
+
+	if (threshold_window(thresholds, tz_id, temperature, &tw))
+		return -1;
+
+	if (tw.low != low || tw.high != high)
+		return -1;
+
+	return 0;
+}
+
+static int threshold_test(void)
+{
+	struct thresholds *thresholds;
+	int i, ret = -1;
+
+	thresholds = threshold_alloc();
+	if (!thresholds)
+		return -1;
+
+	/*
+	 * More than 512 thermal zones and temperatures above 8388°C
+	 * used to alias in the encoded key
+	 */
+	for (i = 0; i < NR_ZONES; i++) {
+
+		if (threshold_add(thresholds, i, 75000, 750) ||
+		    threshold_add(thresholds, i, 50000, 500) ||
+		    threshold_add(thresholds, i, 9000000, 0) ||
+		    threshold_add(thresholds, i, -20000 - i, 1000))
+			goto out;
+	}
+
+	if (!threshold_add(thresholds, 0, 50000, 500))
+		goto out;
+
+	if (!threshold_add(thresholds, -1, 50000, 500))
+		goto out;
+
+	for (i = 0; i < NR_ZONES; i++) {
+
+		if (threshold_check(thresholds, i, -30000, THRESHOLD_TEMP_INVALID, -20000 - i))
+			goto out;
+
+		if (threshold_check(thresholds, i, -20000 - i, -20000 - i, 50000))
+			goto out;
+
+		if (threshold_check(thresholds, i, 0, -20000 - i, 50000))
+			goto out;
+
+		if (threshold_check(thresholds, i, 50000, 50000, 75000))
+			goto out;
+
+		if (threshold_check(thresholds, i, 74999, 50000, 75000))
+			goto out;
+
+		if (threshold_check(thresholds, i, 100000, 75000, 9000000))
+			goto out;
+
+		if (threshold_check(thresholds, i, 9000000, 9000000, THRESHOLD_TEMP_INVALID))
+			goto out;
+	}
+
+	/* Unknown thermal zone */
+	if (threshold_check(thresholds, NR_ZONES, 50000,
+			    THRESHOLD_TEMP_INVALID, THRESHOLD_TEMP_INVALID))
+		goto out;
+
+	/* No plugin attached, nothing to do */
+	if (threshold_crossed_up(thresholds, 700, 75000) ||
+	    threshold_crossed_down(thresholds, 700, 75000))
+		goto out;
+
+	ret = 0;
+out:
+	threshold_free(thresholds);
+
+	return ret;
+}
+
+static int nr_batches;
+static struct plugin_event events[8];
+static int nr_events;
+static struct plugin_level levels[8];
+static int nr_levels;
+
+static int tst_trip_batch(struct plugin_batch *batch, void *data)
+{
+	nr_batches++;
+
+	nr_events = batch->nr_events;
+	if (nr_events > 8)
+		return -1;
+
+	nr_levels = batch->nr_levels;
+	if (nr_levels > 8)
+		return -1;
+
+	memcpy(events, batch->events, sizeof(*events) * nr_events);
+	memcpy(levels, batch->levels, sizeof(*levels) * nr_levels);
+
+	return 0;
+}
+
+static struct plugin_descriptor tst_descriptor = {
+	.version	= "0.0.1",
+	.profile	= "test",
+	.compatibles	= { "te-plugin-test", NULL },
+};
+
+static struct plugin_ops tst_ops;
+
+static struct plugin_ops_v2 tst_ops_v2 = {
+	.version	= PLUGIN_OPS_VERSION,
+	.trip_batch	= tst_trip_batch,
+};
+
+static int threshold_batch_test(void)
+{
+	struct plugin plugin = {
+		.descriptor = &tst_descriptor,
+		.ops = &tst_ops,
+		.ops_v2 = &tst_ops_v2,
+	};
+	struct thresholds *thresholds;
+	struct list plugins;
+	int tz_id, ret = -1;
+
+	list_init(&plugins);
+	list_init(&plugin.list);
+	list_add_tail(&plugins, &plugin.list);
+
+	thresholds = threshold_alloc();
+	if (!thresholds)
+		return -1;
+
+	for (tz_id = 0; tz_id < 3; tz_id++) {
+
+		if (threshold_add(thresholds, tz_id, 50000, 0) ||
+		    threshold_add(thresholds, tz_id, 60000, 0))
+			goto out;
+
+		if (threshold_add_action(thresholds, &plugins, NULL, "test", tz_id, 50000) ||
+		    threshold_add_action(thresholds, &plugins, NULL, "test", tz_id, 60000))
+			goto out;
+	}
+
+	if (threshold_profile_switch(thresholds, "test"))
+		goto out;
+
+	/* Nothing crossed, nothing delivered */
+	if (threshold_flush(thresholds) || nr_batches)
+		goto out;
+
+	threshold_crossed_up(thresholds, 0, 50000);
+	threshold_crossed_up(thresholds, 2, 50000);
+	threshold_crossed_up(thresholds, 2, 60000);
+	threshold_crossed_down(thresholds, 0, 50000);
+
+	if (threshold_flush(thresholds) || nr_batches != 1)
+		goto out;
+
+	if (nr_events != 4 || nr_levels != 3)
+		goto out;
+
+	/* Delivered in the order they were crossed */
+	if (events[0].tz_id != 0 || events[0].temperature != 50000 || !events[0].way_up ||
+	    events[2].tz_id != 2 || events[2].temperature != 60000 || !events[2].way_up ||
+	    events[3].tz_id != 0 || events[3].temperature != 50000 || events[3].way_up)
+		goto out;
+
+	if (levels[0].level != 0 || levels[0].temperature != 50000 ||
+	    levels[1].level != 0 || levels[1].temperature != THRESHOLD_TEMP_INVALID ||
+	    levels[2].level != 2 || levels[2].temperature != 60000)
+		goto out;
+
+	/* Already delivered */
+	if (threshold_flush(thresholds) || nr_batches != 1)
+		goto out;
+
+	ret = 0;
+out:
+	threshold_free(thresholds);
+
+	return ret;
+}
+
+static int threshold_reload_test(void)
+{
+	struct plugin plugin = {
+		.descriptor = &tst_descriptor,
+		.ops = &tst_ops,
+		.ops_v2 = &tst_ops_v2,
+	};
+	struct thresholds *thresholds;
+	struct list plugins;
+	int tz_id, ret = -1;
+
+	nr_batches = 0;
+
+	list_init(&plugins);
+	list_init(&plugin.list);
+	list_add_tail(&plugins, &plugin.list);
+
+	thresholds = threshold_alloc();
+	if (!thresholds)
+		return -1;
+
+	for (tz_id = 0; tz_id < 2; tz_id++) {
+
+		if (threshold_add(thresholds, tz_id, 50000, 0) ||
+		    threshold_add(thresholds, tz_id, 60000, 0))
+			goto out;
+
+		if (threshold_add_action(thresholds, &plugins, NULL, "test", tz_id, 50000))
+			goto out;
+	}
+
+	if (threshold_profile_switch(thresholds, "test"))
+		goto out;
+
+	/* The pending events are delivered before the plugin is removed */
+	threshold_crossed_up(thresholds, 0, 50000);
+	threshold_plugin_remove(thresholds, &plugin);
+
+	if (nr_batches != 1 || nr_events != 1)
+		goto out;
+
+	threshold_crossed_down(thresholds, 0, 50000);
+	threshold_crossed_up(thresholds, 1, 50000);
+
+	if (threshold_flush(thresholds) || nr_batches != 1)
+		goto out;
+
+	/* Attached again to one threshold only */
+	if (threshold_add_plugin(thresholds, &plugin, 1, 50000))
+		goto out;
+
+	if (!threshold_add_plugin(thresholds, &plugin, 1, 55000))
+		goto out;
+
+	threshold_crossed_up(thresholds, 0, 50000);
+	threshold_crossed_down(thresholds, 1, 50000);
+
+	if (threshold_flush(thresholds) || nr_batches != 2 || nr_events != 1 ||
+	    events[0].tz_id != 1 || events[0].way_up)
+		goto out;
+
+	/* The other thermal zones are not touched by a reset */
+	threshold_zone_reset(thresholds, 0);
+
+	if (threshold_check(thresholds, 0, 55000, THRESHOLD_TEMP_INVALID,
+			    THRESHOLD_TEMP_INVALID))
+		goto out;
+
+	if (threshold_check(thresholds, 1, 55000, 50000, 60000))
+		goto out;
+
+	if (threshold_add(thresholds, 0, 70000, 0) ||
+	    threshold_check(thresholds, 0, 55000, THRESHOLD_TEMP_INVALID, 70000))
+		goto out;
+
+	ret = 0;
+out:
+	threshold_free(thresholds);
+
+	return ret;
+}
+
+static int nr_trips[2];
+static int nr_resets[2];
+static int reset_tz_id, reset_temperature;
+
+static int tst_trip_high(int tz_id, int temperature, void *data)
+{
+	nr_trips[0]++;
+
+	return 0;
+}
+
+static int tst_game_trip_high(int tz_id, int temperature, void *data)
+{
+	nr_trips[1]++;
+
+	return 0;
+}
+
+static int tst_reset(int tz_id, int temperature, void *data)
+{
+	nr_resets[0]++;
+	reset_tz_id = tz_id;
+	reset_temperature = temperature;
+
+	return 0;
+}
+
+static int tst_game_reset(int tz_id, int temperature, void *data)
+{
+	nr_resets[1]++;
+
+	return 0;
+}
+
+static struct plugin_descriptor tst_game_descriptor = {
+	.version	= "0.0.1",
+	.profile	= "game",
+	.compatibles	= { "te-plugin-test-game", NULL },
+};
+
+static struct plugin_ops tst_profile_ops = {
+	.trip_high	= tst_trip_high,
+	.reset		= tst_reset,
+};
+
+static struct plugin_ops tst_game_ops = {
+	.trip_high	= tst_game_trip_high,
+	.reset		= tst_game_reset,
+};
+
+static int threshold_profile_test(void)
+{
+	struct plugin plugin = {
+		.descriptor = &tst_descriptor,
+		.ops = &tst_profile_ops,
+	};
+	struct plugin game = {
+		.descriptor = &tst_game_descriptor,
+		.ops = &tst_game_ops,
+	};
+	struct thresholds *thresholds;
+	struct list plugins;
+	int ret = -1;
+
+	list_init(&plugins);
+	list_init(&plugin.list);
+	list_init(&game.list);
+	list_add_tail(&plugins, &plugin.list);
+	list_add_tail(&plugins, &game.list);
+
+	thresholds = threshold_alloc();
+	if (!thresholds)
+		return -1;
+
+	if (threshold_add(thresholds, 1, 50000, 0) ||
+	    threshold_add(thresholds, 1, 60000, 0) ||
+	    threshold_add(thresholds, 2, 50000, 0))
+		goto out;
+
+	/* Both profiles have actions on the same thresholds */
+	if (threshold_add_action(thresholds, &plugins, NULL, "test", 1, 50000) ||
+	    threshold_add_action(thresholds, &plugins, NULL, "test", 1, 60000) ||
+	    threshold_add_action(thresholds, &plugins, NULL, "test", 2, 50000) ||
+	    threshold_add_action(thresholds, &plugins, NULL, "game", 1, 50000))
+		goto out;
+
+	/* No active profile, the crossings do nothing */
+	threshold_crossed_up(thresholds, 1, 50000);
+	if (nr_trips[0] || nr_trips[1])
+		goto out;
+
+	if (!threshold_profile_switch(thresholds, "unknown") ||
+	    threshold_profile_switch(thresholds, "test"))
+		goto out;
+
+	threshold_crossed_up(thresholds, 1, 60000);
+	if (nr_trips[0] != 1 || nr_trips[1])
+		goto out;
+
+	/*
+	 * The plugin leaves the active set, it is reset once on the
+	 * thermal zone having crossed thresholds only
+	 */
+	if (threshold_profile_switch(thresholds, "game"))
+		goto out;
+
+	if (nr_resets[0] != 1 || nr_resets[1] ||
+	    reset_tz_id != 1 || reset_temperature != 60000)
+		goto out;
+
+	threshold_crossed_down(thresholds, 1, 60000);
+	threshold_crossed_down(thresholds, 1, 50000);
+	threshold_crossed_up(thresholds, 1, 50000);
+	threshold_crossed_up(thresholds, 2, 50000);
+	if (nr_trips[0] != 1 || nr_trips[1] != 1)
+		goto out;
+
+	/* Unknown profile, the active one is kept */
+	if (!threshold_profile_switch(thresholds, "unknown"))
+		goto out;
+
+	threshold_crossed_down(thresholds, 1, 50000);
+	threshold_crossed_up(thresholds, 1, 50000);
+	if (nr_trips[1] != 2)
+		goto out;
+
+	/* Same profile, nothing to reset */
+	if (threshold_profile_switch(thresholds, "game") || nr_resets[1])
+		goto out;
+
+	/* A profile without action */
+	if (threshold_profile_add(thresholds, "quiet") ||
+	    threshold_profile_switch(thresholds, "quiet"))
+		goto out;
+
+	if (nr_resets[0] != 1 || nr_resets[1] != 1)
+		goto out;
+
+	threshold_crossed_down(thresholds, 1, 50000);
+	threshold_crossed_up(thresholds, 1, 50000);
+	if (nr_trips[0] != 1 || nr_trips[1] != 2)
+		goto out;
+
+	ret = 0;
+out:
+	threshold_free(thresholds);
+
+	return ret;
+}
+
+/*
+ * The power library is replaced by a table of dtpm devices with the
+ * same max power, the budgets are split evenly. The limits requested
+ * are recorded, zero is the initial limit.
+ */
+#define NR_DTPM 3
+
+static const char * const dtpm_names[NR_DTPM] = { "dev0", "dev1", "dev2" };
+static unsigned int dtpm_limits[NR_DTPM];
+static int nr_limits_set, nr_requests, nr_writes;
+
+int power_dtpm_id(struct power_handler *handler, const char *name)
+{
+	int i;
+
+	for (i = 0; i < NR_DTPM; i++)
+		if (!strcmp(name, dtpm_names[i]))
+			return i;
+
+	return -1;
+}
+
+int power_dtpm_max(struct power_handler *handler, int id)
+{
+	return 1000;
+}
+
+int power_limits_set(struct power_handler *handler,
+		     struct power_limit_request *req, int nr)
+{
+	int i, writes = 0;
+
+	nr_limits_set++;
+	nr_requests = nr;
+
+	for (i = 0; i < nr; i++) {
+
+		if (dtpm_limits[req[i].id] == req[i].power_mw)
+			continue;
+
+		dtpm_limits[req[i].id] = req[i].power_mw;
+		writes++;
+	}
+
+	nr_writes = writes;
+
+	return writes;
+}
+
+static int threshold_budget(struct thresholds *thresholds, struct list *plugins,
+			    const char *profile, int tz_id, int temperature,
+			    unsigned int power, const char *dev1, const char *dev2)
+{
+	struct plugin_power *pwr;
+
+	pwr = plugin_power_alloc(power);
+	if (!pwr)
+		return -1;
+
+	if (plugin_power_add_device(pwr, dev1) ||
+	    (dev2 && plugin_power_add_device(pwr, dev2))) {
+		plugin_power_free(pwr);
+		return -1;
+	}
+
+	return threshold_add_action(thresholds, plugins, pwr, profile, tz_id, temperature);
+}
+
+static int threshold_limits(unsigned int dev0, unsigned int dev1, unsigned int dev2)
+{
+	return dtpm_limits[0] != dev0 || dtpm_limits[1] != dev1 || dtpm_limits[2] != dev2;
+}
+
+static int threshold_power_test(void)
+{
+	struct thresholds *thresholds;
+	struct list plugins;
+	int ret = -1;
+
+	list_init(&plugins);
+
+	thresholds = threshold_alloc();
+	if (!thresholds)
+		return -1;
+
+	/* The handler is not used by the replaced power library */
+	threshold_power_handler(thresholds, (struct power_handler *)thresholds);
+
+	if (threshold_add(thresholds, 1, 50000, 0) ||
+	    threshold_add(thresholds, 1, 60000, 0) ||
+	    threshold_add(thresholds, 2, 50000, 0))
+		goto out;
+
+	/* Two thermal zones budget dev0 */
+	if (threshold_budget(thresholds, &plugins, "test", 1, 50000, 2000, "dev0", "dev1") ||
+	    threshold_budget(thresholds, &plugins, "test", 1, 60000, 1000, "dev0", "dev1") ||
+	    threshold_budget(thresholds, &plugins, "test", 2, 50000, 800, "dev0", NULL) ||
+	    threshold_budget(thresholds, &plugins, "game", 1, 50000, 600, "dev2", NULL))
+		goto out;
+
+	/* Nothing crossed, nothing to apply */
+	if (threshold_profile_switch(thresholds, "test") || nr_limits_set)
+		goto out;
+
+	/* The way up, the devices of a budget are set in one batch */
+	threshold_crossed_up(thresholds, 1, 50000);
+	if (nr_limits_set != 1 || nr_requests != 2 || threshold_limits(1000, 1000, 0))
+		goto out;
+
+	threshold_crossed_up(thresholds, 1, 60000);
+	if (nr_limits_set != 2 || threshold_limits(500, 500, 0))
+		goto out;
+
+	/* The limit of the other zone is higher, nothing is written */
+	threshold_crossed_up(thresholds, 2, 50000);
+	if (nr_limits_set != 3 || nr_writes || threshold_limits(500, 500, 0))
+		goto out;
+
+	/* The way down, the lowest limit of the crossed thresholds */
+	threshold_crossed_down(thresholds, 1, 60000);
+	if (threshold_limits(800, 1000, 0))
+		goto out;
+
+	/* dev0 is still capped by the other zone, dev1 is restored */
+	threshold_crossed_down(thresholds, 1, 50000);
+	if (nr_writes != 1 || threshold_limits(800, 0, 0))
+		goto out;
+
+	threshold_crossed_up(thresholds, 1, 50000);
+	if (threshold_limits(800, 1000, 0))
+		goto out;
+
+	/*
+	 * The devices of the previous profile are restored and the new
+	 * budgets applied in a single batch
+	 */
+	if (threshold_profile_switch(thresholds, "game"))
+		goto out;
+
+	if (nr_limits_set != 7 || nr_requests != 4 || threshold_limits(0, 0, 600))
+		goto out;
+
+	/* Reloading the zone restores the limits it set */
+	threshold_zone_reset(thresholds, 1);
+	if (nr_limits_set != 8 || threshold_limits(0, 0, 0))
+		goto out;
+
+	ret = 0;
+out:
+	threshold_free(thresholds);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	if (threshold_test())
+		return 1;
+
+	if (threshold_batch_test())
+		return 1;
+
+	if (threshold_reload_test())
+		return 1;
+
+	if (threshold_profile_test())
+		return 1;
+
+	if (threshold_power_test())
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define TZ_ID		2
+#define DELAY_US	2000
+
+static struct trace_histogram *stages;
+
+static int trace_get(int tz_id, struct trace_histogram *s, void *data)
+{
+	if (tz_id != TZ_ID)
+		return -1;
+
+	stages = s;
+
+	return 0;
+}
+
+static int trace_check(struct trace_histogram *h, unsigned long count,
+		       unsigned long long min)
+{
+	if (h->count != count)
+		return -1;
+
+	if (h->max < min || h->sum < min)
+		return -1;
+
+	/* The percentiles are the value itself with a single sample */
+	if (count == 1 && trace_percentile(h, 50) != h->max)
+		return -1;
+
+	if (trace_percentile(h, 50) > trace_percentile(h, 99) ||
+	    trace_percentile(h, 99) > h->max)
+		return -1;
+
+	return 0;
+}
+
+static void *trace_thread(void *arg)
+{
+	struct trace_event *event = arg;
+
+	trace_dispatch(event, 1);
+
+	usleep(DELAY_US);
+
+	/* Only the first write is accounted */
+	trace_actuator();
+	trace_actuator();
+
+	trace_dispatch_done();
+
+	return NULL;
+}
+
+static int trace_test(void)
+{
+	struct trace_event event;
+	pthread_t thread;
+
+	/* Not coming from a netlink event */
+	trace_crossed(TZ_ID, &event);
+	if (event.zone || trace_for_each_zone(trace_get, NULL) || stages)
+		return -1;
+
+	trace_receive();
+	usleep(DELAY_US);
+	trace_crossed(TZ_ID, &event);
+	trace_receive_done();
+
+	if (!event.zone || trace_for_each_zone(trace_get, NULL) || !stages)
+		return -1;
+
+	if (trace_check(&stages[TRACE_CROSSED], 1, DELAY_US * 1000ULL))
+		return -1;
+
+	if (pthread_create(&thread, NULL, trace_thread, &event))
+		return -1;
+
+	pthread_join(thread, NULL);
+
+	if (trace_check(&stages[TRACE_DISPATCH], 1, DELAY_US * 1000ULL) ||
+	    trace_check(&stages[TRACE_ACTUATOR], 1, 2 * DELAY_US * 1000ULL))
+		return -1;
+
+	/* Outside of a plugin callback */
+	trace_actuator();
+
+	if (stages[TRACE_ACTUATOR].count != 1)
+		return -1;
+
+	return 0;
+}
+
+static int trace_percentile_test(void)
+{
+	struct trace_histogram h;
+	int i;
+
+	memset(&h, 0, sizeof(h));
+
+	if (trace_percentile(&h, 50))
+		return -1;
+
+	/*
+	 * 99 samples at 10 us and one at 1 s, the bucket resolution
+	 * is 1/16
+	 */
+	h.buckets[(13 - TRACE_SUB_BITS + 1) * TRACE_SUB_BUCKETS + 3] = 99;
+	h.buckets[TRACE_BUCKETS - 1] = 1;
+	h.count = 100;
+	h.max = 1000000000ULL;
+
+	for (i = 1; i <= 99; i++) {
+		if (trace_percentile(&h, i) < 10000 ||
+		    trace_percentile(&h, i) > 10000 + 10000 / TRACE_SUB_BUCKETS)
+			return -1;
+	}
+
+	if (trace_percentile(&h, 100) != h.max)
+		return -1;
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (trace_test())
+		return 1;
+
+	if (trace_percentile_test())
+		return 1;
+
+	return 0;
+}